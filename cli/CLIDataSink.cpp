@@ -55,11 +55,14 @@ void CLIDataSink::chunk_done(Plot3Chunk* job)
 	std::unique_lock<std::mutex> lock(_mux);
 	_chunks_done.insert(job);
 	_chunks_this_pass++;
+}
 
+void CLIDataSink::batch_done()
+{
 	if (quiet) return;
 	float workdone = (float)_chunks_this_pass / _plot->chunks_total();
 
-	// Must hold the lock, otherwise multiple threads bicker over the screen:
+	// Only the AsyncDataSink's consumer thread gets here, so no bickering over the screen.
 	ASSERT(workdone <= 1.0);
 	if (ncolumns > 10) {
 		int j, n=ncolumns * workdone;
@@ -71,7 +74,7 @@ void CLIDataSink::chunk_done(Plot3Chunk* job)
 	std::cerr << '\r';
 }
 
-void CLIDataSink::pass_complete(std::string& commentary, unsigned, unsigned, unsigned, unsigned)
+void CLIDataSink::pass_complete(std::string& commentary, unsigned, unsigned, unsigned, unsigned, std::shared_ptr<const Plot3::IterHistogram>)
 {
 	_chunks_this_pass=0;
 	if (quiet) return;
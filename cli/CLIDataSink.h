@@ -26,12 +26,15 @@ class CLIDataSink : public Plot3::IPlot3DataSink {
 	public:
 		// Constructor may take an explicit terminal width argument.
 		// Otherwise assumes something sensible.
+		// Progress is only drawn in batch_done(), so put this behind an
+		// AsyncDataSink.
 		CLIDataSink(int columns=0, bool silent=false);
 
 		void set_plot(Plot3::Plot3Plot* plot);
 
 		virtual void chunk_done(Plot3::Plot3Chunk* job);
-		virtual void pass_complete(std::string&, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels);
+		virtual void batch_done();
+		virtual void pass_complete(std::string&, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels, std::shared_ptr<const Plot3::IterHistogram> histogram);
 		virtual void plot_complete();
 
 		virtual ~CLIDataSink() {}
@@ -0,0 +1,40 @@
+/*
+    CLIOptions.cpp: command-line helpers shared by the brot2 CLI tools
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <set>
+#include <string>
+
+#include "CLIOptions.h"
+#include "libbrot2/palette.h"
+
+void list_palettes(void)
+{
+	std::set<std::string>::iterator it;
+
+	std::cout << "Palettes:" << std::endl;
+	std::cout << "  (key: [D] Discrete, [S] Smooth)" << std::endl;
+
+	std::set<std::string> names = DiscretePalette::all.names();
+	for (it = names.begin(); it != names.end(); it++)
+		std::cout << "   [D]\t" << *it << std::endl;
+	names = SmoothPalette::all.names();
+	for (it = names.begin(); it != names.end(); it++)
+		std::cout << "   [S]\t" << *it << std::endl;
+	std::cout << std::endl;
+}
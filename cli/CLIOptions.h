@@ -0,0 +1,33 @@
+/*
+    CLIOptions.h: command-line helpers shared by the brot2 CLI tools
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef CLIOPTIONS_H_
+#define CLIOPTIONS_H_
+
+// Adds an option to the Glib::OptionGroup called options (include glibmm first).
+#define OPTION(_SHRT, _LNG, _DESC, _VAR) do {	\
+	Glib::OptionEntry _t;						\
+	_t.set_short_name(_SHRT);					\
+	_t.set_long_name(_LNG);						\
+	_t.set_description(_DESC);					\
+	options.add_entry(_t, _VAR);				\
+} while(0)
+
+// Prints the names of all the palettes to stdout, for --list-palettes.
+void list_palettes(void);
+
+#endif /* CLIOPTIONS_H_ */
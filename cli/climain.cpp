@@ -16,8 +16,10 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <chrono>
 #include <memory>
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <stdio.h>
 #include <string.h>
@@ -33,17 +35,26 @@ BROT2_GLIBMM_AFTER
 #include "libbrot2/Plot3Plot.h"
 #include "libbrot2/ChunkDivider.h"
 #include "libbrot2/palette.h"
+#include "libbrot2/EqualisedPalette.h"
+#include "libbrot2/RawIterFile.h"
+#include "libbrot2/TiledPlot.h"
+#include "libbrot2/TilePyramid.h"
+#include "libbrot2/Checkpoint.h"
 #include "libfractal/Fractal.h"
 #include "CLIDataSink.h"
+#include "CLIOptions.h"
 #include "libbrot2/Render2.h"
 #include "libbrot2/Prefs.h"
 #include "libbrot2/PrefsRegistry.h"
 #include "libbrot2/BaseHUD.h"
+#include "libbrot2/CpuTopology.h"
+#include "libbrot2/AsyncDataSink.h"
 
 using namespace Plot3;
 using namespace BrotPrefs;
 
-static bool do_version, do_license, do_list_fractals, do_list_palettes, quiet, do_antialias, do_csv, do_info, do_hud, do_upscale;
+static bool do_version, do_license, do_list_fractals, do_list_palettes, quiet, do_antialias, do_csv, do_info, do_hud, do_upscale, do_equalise, do_raw, do_pyramid;
+static bool pin_threads, numa_partitions, physical_cores, exact_colours;
 static Glib::ustring c_re_x, c_im_y, length_x;
 static Glib::ustring entered_fractal = "Mandelbrot";
 static Glib::ustring entered_palette = "Linear rainbow";
@@ -51,14 +62,12 @@ static Glib::ustring filename;
 static int output_h=300, output_w=300, max_passes=0,
 		   init_maxiter=-1, min_escapee_pct=-1;
 static double live_threshold_fract=-1.0;
-
-#define OPTION(_SHRT, _LNG, _DESC, _VAR) do {	\
-	Glib::OptionEntry _t;						\
-	_t.set_short_name(_SHRT);					\
-	_t.set_long_name(_LNG);						\
-	_t.set_description(_DESC);					\
-	options.add_entry(_t, _VAR);				\
-} while(0)
+static int supersample=-1;
+static int memory_budget=-1;
+static int compression=-1, compression_threads=0;
+static int tile_size=0;
+static Glib::ustring checkpoint_file, resume_file;
+static int checkpoint_interval=300, target_maxiter=0;
 
 static void setup_options(Glib::OptionGroup& options)
 {
@@ -70,6 +79,7 @@ static void setup_options(Glib::OptionGroup& options)
 	OPTION(0, "list-fractals", "Lists all known fractals", do_list_fractals);
 	OPTION('p', "palette", "The palette to use", entered_palette);
 	OPTION(0, "list-palettes", "Lists all known palettes", do_list_palettes);
+	OPTION(0, "equalise", "Spreads the palette evenly over the plot, by histogram equalisation", do_equalise);
 
 	OPTION('h', "height", "Height of the output in pixels", output_h);
 	OPTION('w', "width", "Width of the output in pixels", output_w);
@@ -77,6 +87,12 @@ static void setup_options(Glib::OptionGroup& options)
 	OPTION('o', "output", "The filename to write to (or '-' for stdout)", filename);
 	OPTION('H', "hud", "Renders the HUD into the output PNG, using the current preferences", do_hud);
 
+	OPTION(0,   "tile-size", "Plots a tile this size (in output pixels) at a time, straight out to the PNG, so very big plots fit in memory (0 = off)", tile_size);
+	OPTION(0,   "pyramid", "Outputs a Deep Zoom tile pyramid (OUTPUT.dzi and OUTPUT_files/) with tiles of --tile-size, or 256; tiles already there are kept, so an interrupted run can be resumed", do_pyramid);
+	OPTION(0,   "checkpoint", "Saves the plot to this file between passes (at most every --checkpoint-interval), and when it's done, so it can be resumed", checkpoint_file);
+	OPTION(0,   "checkpoint-interval", "The least time between checkpoints, in seconds (0 = every pass)", checkpoint_interval);
+	OPTION(0,   "resume", "Carries on from a checkpoint, and keeps checkpointing there (unless --checkpoint says otherwise). The checkpoint says what to plot, so -X, -Y, -l, -f, -w and -h are ignored", resume_file);
+	OPTION(0,   "target-maxiter", "Keeps plotting until maxiter reaches at least this, whether or not the plot looks finished; say, to take a resumed plot further", target_maxiter);
 	OPTION('m', "max-passes", "Limits the number of passes of the plot", max_passes);
 	OPTION('I', "initial-maxiter",
 			PREFDESC(InitialMaxIter), init_maxiter);
@@ -84,11 +100,21 @@ static void setup_options(Glib::OptionGroup& options)
 			PREFDESC(MinEscapeePct), min_escapee_pct);
 	OPTION('T', "live-threshold-proportion",
 			PREFDESC(LiveThreshold), live_threshold_fract);
+	OPTION('S', "supersample", PREFDESC(SupersampleFactor), supersample);
+
+	OPTION(0, "pin-threads", PREFDESC(PinThreads), pin_threads);
+	OPTION(0, "numa", PREFDESC(NumaPartitions), numa_partitions);
+	OPTION(0, "physical-cores", PREFDESC(PhysicalCoresOnly), physical_cores);
+	OPTION(0, "exact-colours", PREFDESC(ExactColours), exact_colours);
+	OPTION(0, "memory-budget", PREFDESC(PlotMemoryBudget), memory_budget);
 
 	OPTION('q', "quiet", "Inhibits progress reporting", quiet);
 	OPTION('a', "antialias", "Enables linear antialiasing", do_antialias);
 	OPTION(0,   "csv", "Outputs as a CSV file", do_csv);
+	OPTION(0,   "raw", "Outputs the raw iteration counts, in brot2's binary format", do_raw);
 	OPTION(0,   "upscale", "Upscales the output by a factor of 2", do_upscale);
+	OPTION(0,   "compression", "PNG compression level, from 0 (none) to 9 (smallest); -1 for zlib's default", compression);
+	OPTION(0,   "compression-threads", "How many blocks of the PNG to compress at once (0 = one per thread)", compression_threads);
 
 	OPTION('i', "info", "Outputs the plot's info string on completion", do_info);
 	OPTION('v', "version", "Outputs this program's version number", do_version);
@@ -117,20 +143,92 @@ static void list_fractals(void)
 	std::cout << std::endl;
 }
 
-static void list_palettes(void)
+/* A failed checkpoint isn't worth losing the plot over. */
+static void save_checkpoint(const Plot3Plot& plot)
 {
-	std::set<std::string>::iterator it;
+	try {
+		Checkpoint::write(plot, checkpoint_file);
+	} catch (BrotException &e) {
+		std::cerr << std::endl << "Checkpoint failed: " << e.msg << std::endl;
+	}
+}
 
-	std::cout << "Palettes:" << std::endl;
-	std::cout << "  (key: [D] Discrete, [S] Smooth)" << std::endl;
+/* --tile-size and --pyramid: the plot goes out a tile at a time, and is
+ * never all there at once. Supersampling needs the whole plot, so doesn't
+ * happen. */
+static int plot_tiled(std::shared_ptr<ThreadPool> pool, std::shared_ptr<Prefs> prefs,
+		const Fractal::FractalImpl& fractal, const BasePalette& selected_palette,
+		Fractal::Point centre, Fractal::Point size, unsigned plot_w, unsigned plot_h,
+		bool do_stdout, const Render2::PNGCompression& comp)
+{
+	const unsigned antialias = do_antialias ? 2 : 1;
+	std::unique_ptr<TiledPlot> tiled;
+	try {
+		tiled.reset(new TiledPlot(pool, fractal, centre, size, plot_w, plot_h, tile_size * antialias, max_passes));
+	} catch (BrotException &e) {
+		std::cerr << "Plot failed to start: " << e.msg << std::endl;
+		return 4;
+	}
+	tiled->set_prefs(prefs);
+	if (!quiet) {
+		std::cerr << "Surveying..." << std::flush;
+		tiled->set_progress([] (unsigned done, unsigned total) {
+			std::cerr << "\rTile " << done << " of " << total << std::flush;
+		});
+	}
+	std::shared_ptr<const IterHistogram> histogram = tiled->survey().histogram();
+	if (!quiet)
+		std::cerr << "\r" << tiled->passes() << " passes each, to maxiter " << tiled->maxiter() << std::endl;
+
+	// The survey sees the whole view, so its histogram will do.
+	EqualisedPalette equalised(selected_palette);
+	equalised.set_histogram(histogram);
+	const BasePalette& palette = do_equalise ? equalised : selected_palette;
+
+	if (do_pyramid) {
+		try {
+			TilePyramid pyramid(*tiled, filename, palette, do_antialias, comp);
+			if (!quiet)
+				pyramid.set_progress([] (unsigned level) {
+					std::cerr << "\rLevel " << level << " done    " << std::flush;
+				});
+			pyramid.run();
+			if (!quiet)
+				std::cerr << std::endl << pyramid.tiles_written() << " tiles written, "
+					<< pyramid.tiles_skipped() << " already there" << std::endl;
+		} catch (BrotException &e) {
+			std::cerr << std::endl << e.msg << std::endl;
+			return 3;
+		}
+		if (do_info)
+			std::cout << tiled->view().info(true) << std::endl;
+		return 0;
+	}
 
-	std::set<std::string> names = DiscretePalette::all.names();
-	for (it = names.begin(); it != names.end(); it++)
-		std::cout << "   [D]\t" << *it << std::endl;
-	names = SmoothPalette::all.names();
-	for (it = names.begin(); it != names.end(); it++)
-		std::cout << "   [S]\t" << *it << std::endl;
-	std::cout << std::endl;
+	std::ofstream file;
+	if (!do_stdout) {
+		file.open(filename, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+		if (!file) {
+			std::cerr << "Could not open " << filename << " for writing" << std::endl;
+			return 3;
+		}
+	}
+	try {
+		Render2::PNGStream png(do_stdout ? std::cout : file, plot_w / antialias, plot_h / antialias,
+				palette, -1, do_antialias, false, comp);
+		if (do_hud)
+			BaseHUD::apply(png, prefs, &tiled->view(), false, false);
+		tiled->run(png, palette, do_antialias);
+		png.finish();
+	} catch (BrotException &e) {
+		std::cerr << std::endl << e.msg << std::endl;
+		return 3;
+	}
+	if (!quiet)
+		std::cerr << std::endl << "Complete!" << std::endl;
+	if (do_info)
+		std::cout << tiled->view().info(true) << std::endl;
+	return 0;
 }
 
 int main (int argc, char**argv)
@@ -177,37 +275,54 @@ int main (int argc, char**argv)
 	}
 	if (did_something) return EXIT_SUCCESS;
 
-	bool fail=false;
-	if (c_re_x.length()==0) {
-		std::cerr << "Error: Real centre (-X) is mandatory" << std::endl;
-		fail=true;
-	}
-	if (c_im_y.length()==0) {
-		std::cerr << "Error: Imaginary centre (-Y) is mandatory" << std::endl;
-		fail=true;
-	}
-	if (length_x.length()==0) {
-		std::cerr << "Error: Axis length (-l) is mandatory" << std::endl;
-		fail=true;
+	/* --resume: the checkpoint says what we're plotting */
+	const bool resuming = resume_file.length() > 0;
+	Checkpoint::Info resume_info;
+	if (resuming) {
+		try {
+			resume_info = Checkpoint::read_info(resume_file);
+		} catch (BrotException &e) {
+			std::cerr << e.msg << std::endl;
+			return 3;
+		}
+		entered_fractal = resume_info.fractal;
+		if (!checkpoint_file.length())
+			checkpoint_file = resume_file;
 	}
-	if (fail) return 4;
 
-	Fractal::Value CRe, CIm, XAxisLength;
-	if (!parse_fractal_value(c_re_x, CRe)) {
-		std::cerr << "cannot parse input real centre " << c_re_x << std::endl;
-		fail = true;
-	}
-	if (!parse_fractal_value(c_im_y, CIm)) {
-		std::cerr << "cannot parse input imaginary centre " << c_im_y << std::endl;
-		fail = true;
-	}
-	if (!parse_fractal_value(length_x, XAxisLength)) {
-		std::cerr << "cannot parse input axis length " << length_x << std::endl;
-		fail = true;
-	}
-	if (XAxisLength < Fractal::Maths::smallest_min_pixel_size()) {
-		std::cerr << "input axis length is smaller than the resolution limit" << std::endl;
-		fail = true;
+	bool fail=false;
+	Fractal::Value CRe=0, CIm=0, XAxisLength=0;
+	if (!resuming) {
+		if (c_re_x.length()==0) {
+			std::cerr << "Error: Real centre (-X) is mandatory" << std::endl;
+			fail=true;
+		}
+		if (c_im_y.length()==0) {
+			std::cerr << "Error: Imaginary centre (-Y) is mandatory" << std::endl;
+			fail=true;
+		}
+		if (length_x.length()==0) {
+			std::cerr << "Error: Axis length (-l) is mandatory" << std::endl;
+			fail=true;
+		}
+		if (fail) return 4;
+
+		if (!parse_fractal_value(c_re_x, CRe)) {
+			std::cerr << "cannot parse input real centre " << c_re_x << std::endl;
+			fail = true;
+		}
+		if (!parse_fractal_value(c_im_y, CIm)) {
+			std::cerr << "cannot parse input imaginary centre " << c_im_y << std::endl;
+			fail = true;
+		}
+		if (!parse_fractal_value(length_x, XAxisLength)) {
+			std::cerr << "cannot parse input axis length " << length_x << std::endl;
+			fail = true;
+		}
+		if (XAxisLength < Fractal::Maths::smallest_min_pixel_size()) {
+			std::cerr << "input axis length is smaller than the resolution limit" << std::endl;
+			fail = true;
+		}
 	}
 	if (filename.length()==0) {
 		std::cerr << "output filename is required (use '-' for stdout)" << std::endl;
@@ -221,6 +336,10 @@ int main (int argc, char**argv)
 		std::cerr << "ERROR: --antialias and --upscale are incompatible" << std::endl;
 		fail = true;
 	}
+	if (do_raw && (do_csv || do_antialias || do_upscale || do_hud)) {
+		std::cerr << "ERROR: --raw cannot be combined with --csv, --antialias, --upscale or --hud" << std::endl;
+		fail = true;
+	}
 	if (fail) return 4;
 
 	std::shared_ptr<const Prefs> mprefs = Prefs::getMaster();
@@ -251,6 +370,62 @@ int main (int argc, char**argv)
 			prefs->set(PREF(LiveThreshold), live_threshold_fract);
 		}
 	}
+	if (supersample!=-1) {
+		if ((supersample<PREF(SupersampleFactor)._min) || (supersample>PREF(SupersampleFactor)._max)) {
+			std::cerr << "Error: Supersampling factor (-S) must be from 0 to 8" << std::endl;
+			fail=true;
+		} else {
+			prefs->set(PREF(SupersampleFactor), supersample);
+		}
+	}
+	if (memory_budget!=-1) {
+		if (memory_budget < PREF(PlotMemoryBudget)._min) {
+			std::cerr << "Error: Memory budget cannot be negative" << std::endl;
+			fail=true;
+		} else {
+			prefs->set(PREF(PlotMemoryBudget), memory_budget);
+		}
+	}
+	if (compression < -1 || compression > 9) {
+		std::cerr << "Error: Compression level must be from -1 to 9" << std::endl;
+		fail=true;
+	}
+	if (compression_threads < 0) {
+		std::cerr << "Error: Compression threads cannot be negative" << std::endl;
+		fail=true;
+	}
+	if (tile_size < 0) {
+		std::cerr << "Error: Tile size cannot be negative" << std::endl;
+		fail=true;
+	}
+	if ((tile_size || do_pyramid) && (do_csv || do_raw || do_upscale)) {
+		std::cerr << "ERROR: --tile-size and --pyramid cannot be combined with --csv, --raw or --upscale" << std::endl;
+		fail=true;
+	}
+	if (do_pyramid && (do_hud || (filename.length()==1 && filename[0]=='-'))) {
+		std::cerr << "ERROR: --pyramid cannot be combined with --hud, or go to stdout" << std::endl;
+		fail=true;
+	}
+	if (do_pyramid && !tile_size)
+		tile_size = TilePyramid::DEFAULT_TILE;
+	if (checkpoint_file.length() && tile_size) {
+		std::cerr << "ERROR: --checkpoint and --resume cannot be combined with --tile-size or --pyramid" << std::endl;
+		fail=true;
+	}
+	if (checkpoint_interval < 0 || target_maxiter < 0) {
+		std::cerr << "Error: Checkpoint interval and target maxiter cannot be negative" << std::endl;
+		fail=true;
+	}
+	// These can only turn things on; the prefs decide otherwise.
+	if (pin_threads)
+		prefs->set(PREF(PinThreads), true);
+	if (numa_partitions)
+		prefs->set(PREF(NumaPartitions), true);
+	if (physical_cores)
+		prefs->set(PREF(PhysicalCoresOnly), true);
+	if (exact_colours)
+		prefs->set(PREF(ExactColours), true);
+	BasePalette::set_exact(prefs->get(PREF(ExactColours)));
 	if (fail) return 4;
 
 	Fractal::Point centre(CRe, CIm);
@@ -265,6 +440,23 @@ int main (int argc, char**argv)
 	Fractal::Value YAxisLength = XAxisLength / aspect;
 	Fractal::Point size(XAxisLength, YAxisLength);
 
+	if (resuming) {
+		centre = resume_info.centre;
+		size = resume_info.size;
+		plot_w = resume_info.width;
+		plot_h = resume_info.height;
+		if (plot_w % antialias || plot_h % antialias) {
+			std::cerr << "ERROR: cannot antialias this checkpoint, as it's an odd number of pixels across" << std::endl;
+			return 4;
+		}
+		output_w = plot_w / antialias;
+		output_h = plot_h / antialias;
+		if (do_upscale) {
+			output_w *= 2;
+			output_h *= 2;
+		}
+	}
+
 	// TODO allow pixel size / axes length to be specified in other ways
 
 	Fractal::FractalImpl *selected_fractal = Fractal::FractalCommon::registry.get(entered_fractal);
@@ -287,19 +479,93 @@ int main (int argc, char**argv)
 		do_stdout = true;
 	}
 
-	int nthreads = BrotPrefs::threadpool_size(prefs);
+	if (tile_size) {
+		std::shared_ptr<ThreadPool> pool(CpuTopology::make_threadpool(prefs));
+		return plot_tiled(pool, prefs, *selected_fractal, *selected_palette, centre, size, plot_w, plot_h,
+				do_stdout, Render2::PNGCompression(compression, pool.get(), compression_threads, QoS::EXPORT));
+	}
 
 	CLIDataSink sink(0, quiet);
-	std::shared_ptr<ThreadPool> pool(new ThreadPool(nthreads));
+	AsyncDataSink async_sink(&sink); // keeps terminal I/O off the workers
+	std::shared_ptr<ThreadPool> pool(CpuTopology::make_threadpool(prefs));
 	ChunkDivider::Horizontal10px divider;
-	Plot3Plot plot(pool, &sink, *selected_fractal, divider,
+	Plot3Plot plot(pool, &async_sink, *selected_fractal, divider,
 			centre, size, plot_w, plot_h, max_passes);
 
 	sink.set_plot(&plot);
 	plot.set_prefs(prefs);
+	if (!do_antialias && !do_upscale && !do_raw) // they don't look at supersamples
+		plot.set_supersample(prefs->get(PREF(SupersampleFactor)), prefs->get(PREF(SupersampleThreshold)));
+	if (target_maxiter)
+		plot.set_target_maxiter(target_maxiter);
+
+	std::chrono::steady_clock::time_point last_checkpoint = std::chrono::steady_clock::now();
+	if (checkpoint_file.length())
+		plot.set_checkpoint([&] {
+			const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (now - last_checkpoint < std::chrono::seconds(checkpoint_interval))
+				return;
+			save_checkpoint(plot);
+			last_checkpoint = now;
+		});
+
+	/* A PNG or CSV can go out row by row, as the plot finishes with the
+	 * chunks above, and the chunks be freed as we go; unless something
+	 * needs the whole plot at the end (a checkpoint needs every chunk).
+	 * A CSV has neither colours nor supersamples, so needs nothing else. */
+	const bool streaming = !do_raw && (do_csv || (!do_equalise && plot.supersample_factor() <= 1))
+		&& !checkpoint_file.length();
+	const Render2::PNGCompression png_comp(compression, &plot.pool(), compression_threads, plot.qos());
+	std::ofstream file;
+	std::ostream& out = do_stdout ? std::cout : file;
+	std::unique_ptr<Render2::PNGStream> png_stream;
+	std::unique_ptr<Render2::CSV> csv_stream;
+	std::string stream_error;
+	if (streaming) {
+		if (!do_stdout) {
+			file.open(filename, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+			if (!file) {
+				std::cerr << "Could not open " << filename << " for writing" << std::endl;
+				return 3;
+			}
+		}
+		try {
+			if (do_csv)
+				csv_stream.reset(new Render2::CSV(output_w, output_h, *selected_palette, -1, do_antialias));
+			else
+				png_stream.reset(new Render2::PNGStream(out,
+							output_w, output_h, *selected_palette, -1, do_antialias, do_upscale, png_comp));
+		} catch (BrotException &e) {
+			std::cerr << e.msg << std::endl;
+			return 3;
+		}
+		if (do_hud && png_stream)
+			BaseHUD::apply(*png_stream, prefs, &plot, false, false); // only needs the zoom
+		plot.set_retire([&] (const std::list<Plot3Chunk*>& chunks) {
+			if (stream_error.length())
+				return;
+			try {
+				if (csv_stream) {
+					// Formatted on the pool, as each lot is done
+					csv_stream->process(chunks, plot.pool(), plot.qos());
+					csv_stream->flush(out);
+				} else {
+					png_stream->process(chunks, plot.pool(), plot.qos());
+					png_stream->flush();
+				}
+			} catch (BrotException &e) {
+				stream_error = e.msg;
+				plot.stop();
+			}
+		});
+	}
 
 	try {
-		plot.start();
+		if (resuming) {
+			Checkpoint::restore(plot, resume_file);
+			plot.start(resume_info.arith);
+		} else
+			plot.start();
 	} catch (BrotException &e) {
 		// Usually means the pixels are too small for all known types.
 		std::cerr << "Plot failed to start: " << e.msg << std::endl;
@@ -307,19 +573,55 @@ int main (int argc, char**argv)
 	}
 	plot.wait();
 	ASSERT(sink.is_done());
+	if (checkpoint_file.length())
+		save_checkpoint(plot); // so it can be taken further
 	if (!quiet)
 		std::cerr << std::endl << "Complete!" << std::endl;
 
+	if (streaming) {
+		if (stream_error.length()) {
+			std::cerr << stream_error << std::endl;
+			return 3;
+		}
+		try {
+			if (csv_stream)
+				csv_stream->write(out);
+			else
+				png_stream->finish();
+		} catch (BrotException &e) {
+			std::cerr << e.msg << std::endl;
+			return 3;
+		}
+		if (do_info)
+			std::cout << plot.info(true) << std::endl;
+		return 0;
+	}
+
+	if (do_raw) {
+		// Straight from the chunks; no palette, no render.
+		if (do_stdout)
+			RawIterFile::write(plot, std::cout);
+		else
+			RawIterFile::write(plot, filename);
+		if (do_info)
+			std::cout << plot.info(true) << std::endl;
+		return 0;
+	}
+
 	Render2::Writable * render = 0;
+	EqualisedPalette equalised(*selected_palette);
+	equalised.set_histogram(plot.histogram());
+	const BasePalette& palette = do_equalise ? equalised : *selected_palette;
 
 	if (do_csv) {
-		render = new Render2::CSV(output_w, output_h, *selected_palette, -1, do_antialias);
+		render = new Render2::CSV(output_w, output_h, palette, -1, do_antialias);
 	} else {
-		render = new Render2::PNG(output_w, output_h, *selected_palette, -1, do_antialias, do_upscale);
+		Render2::PNG *png = new Render2::PNG(output_w, output_h, palette, -1, do_antialias, do_upscale);
+		png->set_compression(png_comp);
+		render = png;
 	}
 
-	for (auto it : sink.get_chunks_done())
-		render->process(*it);
+	render->process(plot.get_chunks__only_after_completion(), plot.pool(), plot.qos());
 	if (do_hud)
 		BaseHUD::apply(*render, prefs, &plot, false, false);
 	if (do_stdout)
@@ -0,0 +1,245 @@
+/*
+    recolour.cpp: Renders saved raw iteration data (brot2cli --raw) to PNG
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <memory>
+#include <iostream>
+#include <list>
+#include <string>
+#include <future>
+#include <algorithm>
+#include <stdlib.h>
+
+#include "misc.h"
+BROT2_GLIBMM_BEFORE
+#include <glibmm.h>
+BROT2_GLIBMM_AFTER
+
+#include "config.h"
+#include "license.h"
+#include "libbrot2/Plot3Plot.h"
+#include "libbrot2/ChunkDivider.h"
+#include "libbrot2/palette.h"
+#include "libbrot2/EqualisedPalette.h"
+#include "libbrot2/IterHistogram.h"
+#include "libbrot2/RawIterFile.h"
+#include "libfractal/Fractal.h"
+#include "libbrot2/Render2.h"
+#include "libbrot2/Prefs.h"
+#include "libbrot2/BaseHUD.h"
+#include "libbrot2/CpuTopology.h"
+#include "libbrot2/Exception.h"
+#include "CLIOptions.h"
+
+using namespace Plot3;
+using namespace BrotPrefs;
+
+static bool do_version, do_license, do_list_palettes, do_antialias, do_upscale, do_hud, do_equalise, do_info;
+static bool pin_threads, numa_partitions, physical_cores, exact_colours;
+static Glib::ustring entered_palette = "Linear rainbow";
+static Glib::ustring input, filename;
+static int compression=-1, compression_threads=0;
+
+static void setup_options(Glib::OptionGroup& options)
+{
+	OPTION('i', "input", "The raw iteration file to read, as written by brot2cli --raw", input);
+	OPTION('o', "output", "The PNG filename to write to (or '-' for stdout)", filename);
+
+	OPTION('p', "palette", "The palette to use", entered_palette);
+	OPTION(0, "list-palettes", "Lists all known palettes", do_list_palettes);
+	OPTION(0, "equalise", "Spreads the palette evenly over the plot, by histogram equalisation", do_equalise);
+
+	OPTION('a', "antialias", "Enables linear antialiasing (the output is half the size of the plot)", do_antialias);
+	OPTION(0,   "upscale", "Upscales the output by a factor of 2", do_upscale);
+	OPTION(0,   "compression", "PNG compression level, from 0 (none) to 9 (smallest); -1 for zlib's default", compression);
+	OPTION(0,   "compression-threads", "How many blocks of the PNG to compress at once (0 = one per thread)", compression_threads);
+	OPTION('H', "hud", "Renders the HUD into the output PNG, using the current preferences", do_hud);
+
+	OPTION(0, "pin-threads", PREFDESC(PinThreads), pin_threads);
+	OPTION(0, "numa", PREFDESC(NumaPartitions), numa_partitions);
+	OPTION(0, "physical-cores", PREFDESC(PhysicalCoresOnly), physical_cores);
+	OPTION(0, "exact-colours", PREFDESC(ExactColours), exact_colours);
+
+	OPTION(0,   "info", "Outputs what the input file says about its plot", do_info);
+	OPTION('v', "version", "Outputs this program's version number", do_version);
+	OPTION(0,   "license", "Outputs this program's license information", do_license);
+}
+
+/* The histogram the plot would have had, built from its iterf plane in
+ * bands across the pool. */
+static std::shared_ptr<IterHistogram> make_histogram(const RawIterFile& raw, ThreadPool& pool)
+{
+	const unsigned BAND = 64;
+	std::list<std::future<std::shared_ptr<IterHistogram>>> bands;
+	for (unsigned y0=0; y0<raw.height(); y0+=BAND) {
+		const unsigned y1 = std::min(raw.height(), y0 + BAND);
+		bands.push_back(pool.enqueue<std::shared_ptr<IterHistogram>>([&raw, y0, y1] {
+			std::shared_ptr<IterHistogram> h(new IterHistogram());
+			for (unsigned y=y0; y<y1; y++) {
+				const float *row = raw.iterf_row(y);
+				for (unsigned x=0; x<raw.width(); x++)
+					if (row[x] >= 0)
+						h->add(row[x]);
+			}
+			return h;
+		}, QoS::EXPORT));
+	}
+	std::shared_ptr<IterHistogram> rv(new IterHistogram());
+	for (auto& f : bands)
+		rv->merge(*f.get());
+	return rv;
+}
+
+int main (int argc, char**argv)
+{
+	Glib::thread_init();
+
+	Glib::OptionContext octx;
+	Glib::OptionGroup options("brot2recolour", "brot2recolour options", "Options relating to brot2recolour");
+	setup_options(options);
+
+	octx.set_help_enabled(true);
+	octx.set_ignore_unknown_options(false);
+	octx.set_main_group(options);
+
+	try {
+		if (!octx.parse(argc,argv))
+			return EXIT_FAILURE;
+	} catch(Glib::Exception& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	Fractal::FractalCommon::load_base();
+	DiscretePalette::register_base();
+	SmoothPalette::register_base();
+
+	bool did_something=false;
+	if (do_license) {
+		std::cout << brot2_license_text << std::endl;
+		did_something=true;
+	}
+	if (do_version && !do_license) {
+		std::cout << PACKAGE_STRING << " " << brot2_copyright_string << std::endl;
+		std::cout << "To see the license for this software, run " << argv[0] << " --license" << std::endl;
+		did_something=true;
+	}
+	if (do_list_palettes) {
+		list_palettes();
+		did_something=true;
+	}
+	if (did_something) return EXIT_SUCCESS;
+
+	bool fail=false;
+	if (input.length()==0) {
+		std::cerr << "Error: Input file (-i) is mandatory" << std::endl;
+		fail=true;
+	}
+	if (filename.length()==0 && !do_info) {
+		std::cerr << "output filename is required (use '-' for stdout)" << std::endl;
+		fail = true;
+	}
+	if (do_antialias && do_upscale) {
+		std::cerr << "ERROR: --antialias and --upscale are incompatible" << std::endl;
+		fail = true;
+	}
+	if (compression < -1 || compression > 9) {
+		std::cerr << "Error: Compression level must be from -1 to 9" << std::endl;
+		fail = true;
+	}
+	if (compression_threads < 0) {
+		std::cerr << "Error: Compression threads cannot be negative" << std::endl;
+		fail = true;
+	}
+	if (fail) return 4;
+
+	std::unique_ptr<RawIterFile> raw;
+	try {
+		raw.reset(new RawIterFile(input));
+	} catch (BrotException &e) {
+		std::cerr << e.msg << std::endl;
+		return 3;
+	}
+
+	Fractal::FractalImpl *fract = Fractal::FractalCommon::registry.get(raw->fractal());
+	if (!fract && do_hud) {
+		std::cerr << "Fractal " << raw->fractal() << " not found" << std::endl;
+		return 5;
+	}
+	if (do_info) {
+		std::cout << raw->fractal() << "@(" << real(raw->centre()) << ", " << imag(raw->centre()) << ")"
+			<< ", maxiter=" << raw->maxiter() << " / axis length=" << raw->size()
+			<< " / " << raw->width() << "x" << raw->height() << std::endl;
+		if (filename.length()==0)
+			return 0;
+	}
+
+	unsigned output_w = raw->width(), output_h = raw->height();
+	if (do_antialias) {
+		if (output_w % 2 || output_h % 2) {
+			std::cerr << "ERROR: --antialias needs a plot of even width and height" << std::endl;
+			return 4;
+		}
+		output_w /= 2;
+		output_h /= 2;
+	} else if (do_upscale) {
+		output_w *= 2;
+		output_h *= 2;
+	}
+
+	BasePalette *selected_palette = DiscretePalette::all.get(entered_palette);
+	if (!selected_palette)
+		selected_palette = SmoothPalette::all.get(entered_palette);
+	if (!selected_palette) {
+		std::cerr << "Palette " << entered_palette << " not found" << std::endl;
+		return 5;
+	}
+
+	std::shared_ptr<const Prefs> mprefs = Prefs::getMaster();
+	std::shared_ptr<Prefs> prefs = mprefs->getWorkingCopy();
+	// These can only turn things on; the prefs decide otherwise.
+	if (pin_threads)
+		prefs->set(PREF(PinThreads), true);
+	if (numa_partitions)
+		prefs->set(PREF(NumaPartitions), true);
+	if (physical_cores)
+		prefs->set(PREF(PhysicalCoresOnly), true);
+	if (exact_colours)
+		prefs->set(PREF(ExactColours), true);
+	BasePalette::set_exact(prefs->get(PREF(ExactColours)));
+	std::shared_ptr<ThreadPool> pool(CpuTopology::make_threadpool(prefs));
+
+	EqualisedPalette equalised(*selected_palette);
+	if (do_equalise)
+		equalised.set_histogram(make_histogram(*raw, *pool));
+	const BasePalette& palette = do_equalise ? equalised : *selected_palette;
+
+	Render2::PNG render(output_w, output_h, palette, -1, do_antialias, do_upscale);
+	render.set_compression(Render2::PNGCompression(compression, pool.get(), compression_threads, QoS::EXPORT));
+	render.process(*raw, *pool, QoS::EXPORT);
+	if (do_hud) {
+		// The plot is never run; it's there to tell the HUD about the view.
+		ChunkDivider::OneChunk divider;
+		Plot3Plot plot(pool, 0, *fract, divider, raw->centre(), raw->size(), raw->width(), raw->height());
+		BaseHUD::apply(render, prefs, &plot, false, false);
+	}
+	if (filename.length()==1 && filename[0]=='-')
+		render.write(std::cout);
+	else
+		render.write(filename);
+	return 0;
+}
@@ -55,6 +55,7 @@ Fractal::Point Canvas::pixel_to_set_tlo(int x, int y) const
 
 bool Canvas::on_button_press_event(GdkEventButton *evt) {
 	if (!surface) return false;
+	main->stop_refining(); // The user has work for us
 
 	MouseActions ma = Prefs::getMaster()->mouseActions();
 	if (evt->button <= (unsigned)ma.MAX) {
@@ -97,6 +98,7 @@ bool Canvas::on_button_release_event(GdkEventButton *evt) {
 
 bool Canvas::on_scroll_event(GdkEventScroll *evt) {
 	if (!surface) return false;
+	main->stop_refining();
 	ScrollActions sa = Prefs::getMaster()->scrollActions();
 	Fractal::Point clickpos = pixel_to_set_tlo(evt->x, evt->y);
 
@@ -154,13 +156,19 @@ bool Canvas::end_dragrect(gdouble x, gdouble y) {
 
 bool Canvas::on_motion_notify_event(GdkEventMotion * UNUSED(evt)) {
 	if (!surface) return false;
-	if (!main->dragrect.is_active()) return false;
 	int x, y;
 	get_pointer(x,y);
+	main->pointer_moved(x,y);
+	if (!main->dragrect.is_active()) return false;
 	main->dragrect.draw(x,y);
 	return true;
 }
 
+bool Canvas::on_leave_notify_event(GdkEventCrossing * UNUSED(evt)) {
+	main->pointer_left();
+	return false;
+}
+
 
 static bool seen_first_expose_event = false;
 
@@ -47,6 +47,7 @@ public:
     virtual bool on_button_press_event(GdkEventButton * evt);
     virtual bool on_button_release_event(GdkEventButton * evt);
     virtual bool on_motion_notify_event(GdkEventMotion * evt);
+    virtual bool on_leave_notify_event(GdkEventCrossing * evt);
     virtual bool on_expose_event(GdkEventExpose * evt);
     virtual bool on_configure_event(GdkEventConfigure * evt);
     virtual bool on_scroll_event(GdkEventScroll * evt);
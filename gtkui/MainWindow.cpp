@@ -23,6 +23,7 @@
 #include "HUD.h"
 #include "libbrot2/Render2.h"
 #include "libbrot2/Plot3Plot.h"
+#include "libbrot2/CpuTopology.h"
 #include "gtkutil.h"
 #include "config.h"
 #include "ControlsWindow.h"
@@ -62,13 +63,15 @@ MainWindow::MainWindow() : Gtk::Window(),
 			movieWin(*this, prefs()),
 			imgbuf(0), plot(0), plot_prev(0), renderer(0),
 			rwidth(0), rheight(0),
-			draw_hud(true), antialias(false),
+			draw_hud(true), antialias(false), equalise(false),
 			initializing(true),
-			aspectfix(false), at_max_zoom(false), at_min_zoom(false), recolour_when_done(false),
+			aspectfix(false), at_max_zoom(false), at_min_zoom(false),
 			divider(new Plot3::ChunkDivider::SuperpixelVariable(prefs())),
+			ordering_type(-1),
             _chunks_this_pass(0),
+			_async_sink(this),
 			dragrect(*this),
-			_threadpool(new ThreadPool(BrotPrefs::threadpool_size(prefs())))
+			_threadpool(CpuTopology::make_threadpool(prefs()))
 {
 	set_title(PACKAGE_NAME); // Renderer will update this
 	vbox = Gtk::manage(new Gtk::VBox());
@@ -109,6 +112,7 @@ MainWindow::MainWindow() : Gtk::Window(),
 
 	// _main_ctx.pal initial setting by setup_colour_menu().
 	// render_ctx.fractal set by setup_fractal_menu().
+	BasePalette::set_exact(prefs()->get(PREF(ExactColours)));
 
 	initializing = false;
 	menubar->optionsMenu->set_controls_status( prefs()->get(PREF(ShowControls)) );
@@ -123,6 +127,7 @@ MainWindow::~MainWindow() {
 		plot->stop();
 		plot->wait();
 	}
+	refiner.reset();
 	movieWindow().stop();
 	movieWindow().wait();
 	delete plot;
@@ -196,6 +201,7 @@ void MainWindow::do_zoom(enum Zoom type, const Fractal::Point& newcentre) {
 }
 
 bool MainWindow::on_key_release_event(GdkEventKey *event) {
+	stop_refining();
 	switch(event->keyval) {
 	case GDK_KP_Add:
 		do_zoom(ZOOM_IN);
@@ -230,7 +236,7 @@ void MainWindow::render_prep(int local_inf) {
 		renderer = 0;
 	}
 	if (!renderer)
-		renderer = new Render2::MemoryBuffer(imgbuf, rowstride, rwidth, rheight, antialias, local_inf, FORMAT, *pal, false /*no upscale*/);
+		renderer = new Render2::MemoryBuffer(imgbuf, rowstride, rwidth, rheight, antialias, local_inf, FORMAT, colour_palette(), false /*no upscale*/);
 	else
 		renderer->fresh_local_inf(local_inf);
 
@@ -264,8 +270,7 @@ void MainWindow::render(int local_inf, bool do_reprocess, bool may_do_hud, Plot3
 
 	if (do_reprocess) {
 		renderer->fresh_local_inf(local_inf);
-		renderer->fresh_palette(*pal);
-		renderer->process(plot->get_chunks__only_after_completion());
+		plane.recolour(*renderer, &colour_palette(), plot->pool(), plot->qos());
 	}
 
 	if (may_do_hud && draw_hud)
@@ -355,7 +360,19 @@ void MainWindow::do_plot(bool is_same_plot)
 		pwidth *= 2;
 		pheight *= 2;
 	}
-	plot = new Plot3::Plot3Plot(get_threadpool(), this, *fractal, *divider, centre, size, pwidth, pheight);
+	plot = new Plot3::Plot3Plot(get_threadpool(), &_async_sink, *fractal, *divider, centre, size, pwidth, pheight);
+	plane.reset(pwidth, pheight);
+
+	int order_pref = prefs()->get(PREF(TileOrder));
+	if (order_pref != ordering_type) {
+		ordering.reset(Plot3::ChunkOrdering::Base::create(order_pref));
+		if (!ordering)
+			ordering.reset(new Plot3::ChunkOrdering::AsDivided());
+		ordering_type = order_pref;
+	}
+	plot->set_ordering(ordering);
+	if (!antialias) // the antialiasing renderer doesn't look at supersamples
+		plot->set_supersample(prefs()->get(PREF(SupersampleFactor)), prefs()->get(PREF(SupersampleThreshold)));
 
 	render_prep(-1);
 	if (draw_hud)
@@ -369,6 +386,20 @@ void MainWindow::do_plot(bool is_same_plot)
 	// TODO try/catch (and in do_resume) - report failure. Is gtkmm exception-safe?
 }
 
+void MainWindow::pointer_moved(int x, int y) {
+	auto pf = std::dynamic_pointer_cast<Plot3::ChunkOrdering::PointerFirst>(ordering);
+	if (!pf) return;
+	// Canvas is top-left origin, plots are bottom-left.
+	int aa = antialias ? 2 : 1;
+	pf->set_focus(x * aa, (rheight - y) * aa);
+}
+
+void MainWindow::pointer_left() {
+	auto pf = std::dynamic_pointer_cast<Plot3::ChunkOrdering::PointerFirst>(ordering);
+	if (pf)
+		pf->clear_focus();
+}
+
 void MainWindow::safe_stop_plot() {
 	// As it stands this function must only ever be called from the main thread.
 	// If this assumption later fails to hold, need to vary it to not
@@ -379,29 +410,78 @@ void MainWindow::safe_stop_plot() {
 		plot->wait();
 		gdk_threads_enter();
 	}
+	stop_refining();
+}
+
+void MainWindow::stop_refining() {
+	if (!refiner) return;
+	// Its callback takes the gdk lock, so we mustn't hold that while we wait.
+	// Once it's out of the member, the callback knows not to bother.
+	std::unique_ptr<Plot3::ProgressiveRefiner> tmp(std::move(refiner));
+	tmp->stop();
+	gdk_threads_leave();
+	tmp.reset();
+	gdk_threads_enter();
+}
+
+void MainWindow::start_refining() {
+	stop_refining();
+	unsigned samples = prefs()->get(PREF(IdleRefineSamples));
+	// Only for a plot that finished by itself. The antialiased plot has
+	// no need, and anyway isn't the size of the renderer.
+	if (samples < 2 || antialias || !plot || !renderer
+			|| plot->is_running() || plot->get_stop_latency() >= 0)
+		return;
+	refiner.reset(new Plot3::ProgressiveRefiner(*plot, colour_palette(),
+			[this](unsigned n) { refined(n); }, samples));
+	refiner->start();
+}
+
+void MainWindow::refined(unsigned samples) {
+	// On the refiner's thread
+	gdk_threads_enter();
+	if (refiner && renderer) {
+		refiner->render(*renderer);
+		render(-1, false, false); // the HUD is unchanged
+		std::ostringstream info;
+		info << "Refined: " << samples << " samples per pixel";
+		progbar->set_text(info.str().c_str());
+	}
+	gdk_threads_leave();
 }
 
 void MainWindow::chunk_done(Plot3Chunk* job)
 {
+	// We're behind _async_sink, so this is its consumer thread, not a worker.
 	_chunks_this_pass++;
-	if (renderer)
-		renderer->process(*job);
+	plane.update(*job, renderer);
+}
 
+void MainWindow::batch_done()
+{
 	float workdone = (float) _chunks_this_pass / plot->chunks_total();
     ASSERT(workdone >= 0.0);
 	ASSERT(workdone <= 1.0);
 	gdk_threads_enter();
 	progbar->set_fraction(workdone);
 	if (renderer)
-		render_buffer_updated(job);
+		render_buffer_updated(0); // one redraw for the whole batch
 	gdk_threads_leave();
 }
 
-void MainWindow::pass_complete(std::string& commentary, unsigned, unsigned, unsigned, unsigned)
+void MainWindow::pass_complete(std::string& commentary, unsigned, unsigned, unsigned, unsigned,
+		std::shared_ptr<const Plot3::IterHistogram> new_histogram)
 {
 	_chunks_this_pass=0;
+	{
+		std::unique_lock<std::mutex> lock(equalised_lock);
+		histogram = new_histogram;
+	}
 
-	render_buffer_tidyup(); // applies the HUD
+	if (equalise)
+		render(-1, true, true); // recolour everything by the new ranks, and apply the HUD
+	else
+		render_buffer_tidyup(); // applies the HUD
 	gdk_threads_enter();
 	progbar->set_text(commentary.c_str());
 	gdk_threads_leave();
@@ -432,6 +512,8 @@ void MainWindow::real_plot_complete()
 	info.precision(4);
 	info << timetaken << "s; ";
 	info << plot->get_passes() <<" passes; maxiter=" << plot->get_maxiter() << ".";
+	if (plot->get_stop_latency() >= 0)
+		info << " Stopped in " << plot->get_stop_latency() << "ms.";
 	if (aspectfix)
 		info << " Aspect ratio autofixed.";
 	if (at_max_zoom)
@@ -442,8 +524,7 @@ void MainWindow::real_plot_complete()
 	progbar->set_fraction(1.0);
 	progbar->set_text(info.str().c_str());
 
-	if (recolour_when_done) // If the palette was changed during the computation.
-		render(-1, true, true);
+	start_refining();
 
 	queue_draw();
 	gdk_flush();
@@ -452,12 +533,11 @@ void MainWindow::real_plot_complete()
 void MainWindow::recolour()
 {
 	if (initializing) return;
-	if (plot->is_running()) {
-		renderer->fresh_palette(*pal);
-		recolour_when_done = true;
-	}
-	else
-		render(-1, true, true);
+	// The plane is kept up to date as chunks come in, so we needn't wait
+	// for a running plot. Any refinement is in the old colours; start again.
+	stop_refining();
+	render(-1, true, true);
+	start_refining();
 }
 
 void MainWindow::do_undo()
@@ -472,6 +552,13 @@ void MainWindow::do_undo()
 	Plot3Plot *tmp = plot;
 	plot = plot_prev;
 	plot_prev = tmp;
+	plane.reset(plot->width, plot->height);
+	plane.update(plot->get_chunks__only_after_completion());
+	std::shared_ptr<const Plot3::IterHistogram> undone = plot->histogram();
+	if (undone) {
+		std::unique_lock<std::mutex> lock(equalised_lock);
+		histogram = undone;
+	}
 
 	centre = plot->centre;
 	size = plot->size;
@@ -489,7 +576,7 @@ void MainWindow::do_undo()
 
 void MainWindow::do_stop()
 {
-	progbar->set_text("Stopping at end of this pass...");
+	progbar->set_text("Stopping...");
 	//safe_stop_plot(); // Blocking!
 	if (plot) plot->stop(); // Safe enough - other actions will call safe_stop_plot before proceeding.
 }
@@ -504,6 +591,7 @@ void MainWindow::do_more_iters()
 		progbar->set_text("Plot already running");
 		return;
 	}
+	stop_refining(); // it's looking at the chunks we're about to change
 	gettimeofday(&plot_tv_start,0);
 	plot->start();
 }
@@ -588,6 +676,26 @@ void MainWindow::toggle_antialias()
 	do_plot(false);
 }
 
+void MainWindow::toggle_equalise()
+{
+	if (initializing) return;
+	equalise = !equalise;
+	recolour();
+}
+
+const BasePalette& MainWindow::colour_palette()
+{
+	if (!equalise)
+		return *pal;
+	std::unique_lock<std::mutex> lock(equalised_lock);
+	std::unique_ptr<EqualisedPalette>& eq = equalised[pal];
+	if (!eq)
+		eq.reset(new EqualisedPalette(*pal));
+	if (eq->histogram() != histogram)
+		eq->set_histogram(histogram);
+	return *eq;
+}
+
 void MainWindow::toggle_fullscreen()
 {
 	fullscreen_requested = !fullscreen_requested;
@@ -634,9 +742,9 @@ std::shared_ptr<ThreadPool> MainWindow::get_threadpool()
 	return _threadpool;
 }
 
-void MainWindow::resize_threadpool(unsigned max_threads)
+void MainWindow::resize_threadpool(std::shared_ptr<const BrotPrefs::Prefs> newprefs)
 {
-	_threadpool.reset(new ThreadPool(max_threads));
+	_threadpool = CpuTopology::make_threadpool(newprefs);
 }
 
 unsigned MainWindow::get_menubar_height() {
@@ -22,8 +22,11 @@
 #include "Canvas.h"
 #include "Plot3Plot.h"
 #include "ChunkDivider.h"
+#include "ChunkOrdering.h"
 #include "IPlot3DataSink.h"
+#include "AsyncDataSink.h"
 #include "palette.h"
+#include "EqualisedPalette.h"
 #include "Fractal.h"
 #include "DragRectangle.h"
 #include "HUD.h"
@@ -32,11 +35,15 @@
 #include "Prefs.h"
 #include "Menus.h"
 #include "Render2.h"
+#include "IterPlane.h"
+#include "ProgressiveRefiner.h"
 #include "libbrot2/ThreadPool.h"
 #include "SaveAsPNG.h"
 
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 BROT2_GTKMM_BEFORE
 #include <gtkmm/window.h>
@@ -66,18 +73,31 @@ class MainWindow : public Gtk::Window, Plot3::IPlot3DataSink {
 	Plot3::Plot3Plot * plot;
 	Plot3::Plot3Plot * plot_prev;
 	Render2::MemoryBuffer * renderer;
+	Render2::IterPlane plane; // What we know of the current plot, for recolouring
+	std::unique_ptr<Plot3::ProgressiveRefiner> refiner; // Antialiases the finished plot while we're idle
 
 	Fractal::Point centre, size;
 	unsigned rwidth, rheight; // Rendering dimensions; plot dims will be larger if antialiased
-	bool draw_hud, antialias, fullscreen_requested;
+	bool draw_hud, antialias, fullscreen_requested, equalise;
 	bool initializing; // Disables certain event actions when set.
 
-	bool aspectfix, at_max_zoom, at_min_zoom, recolour_when_done; // Details about the current render
+	bool aspectfix, at_max_zoom, at_min_zoom; // Details about the current render
 
 	struct timeval plot_tv_start;
 
 	Plot3::ChunkDivider::Base* divider;
+	std::shared_ptr<Plot3::ChunkOrdering::Base> ordering;
+	int ordering_type; // The TileOrder pref that ordering was created for
 	std::atomic<int> _chunks_this_pass; // Reset to 0 on pass completion.
+	Plot3::AsyncDataSink _async_sink; // Our plots report to this, and it to us.
+
+	/* Equalised versions of the palettes, made as they're wanted and kept,
+	 * as a renderer may be using one. They all colour by the latest
+	 * histogram we've had; a new plot keeps the last one's until its first
+	 * pass is done, so colours don't jump about as we zoom. */
+	std::map<const BasePalette*, std::unique_ptr<EqualisedPalette>> equalised; // PROTECT by equalised_lock
+	std::shared_ptr<const Plot3::IterHistogram> histogram; // PROTECT by equalised_lock
+	std::mutex equalised_lock;
 
 public:
 	BasePalette * pal;
@@ -111,6 +131,8 @@ public:
     void do_resize(unsigned width, unsigned height);
     void do_plot(bool is_same_plot = false);
     void safe_stop_plot();
+    // Stops any idle refinement (e.g. because the user is doing something). Call with the gdk lock held.
+    void stop_refining();
 
 	const Fractal::Point& get_centre() const { return centre; }
 	const Fractal::Point& get_size() const { return size; }
@@ -124,6 +146,10 @@ public:
     void do_zoom(enum Zoom z);
     void do_zoom(enum Zoom z, const Fractal::Point& newcentre);
 
+    // Tells the tile ordering where the mouse is (canvas co-ordinates), or that it's gone.
+    void pointer_moved(int x, int y);
+    void pointer_left();
+
     // Prepare to render. Sets up everything needed to start passing chunks in.
     void render_prep(int local_inf);
 
@@ -133,7 +159,7 @@ public:
     // Call after a plot is finished, will redraw the HUD if approprate
     void render_buffer_tidyup();
 
-    // Pushes the render buffer out to the display. Optionally reprocesses all chunks (only use after the plot is complete, e.g. to change the palette). If a job is provided, only marks the relevant part of the window as dirty.
+    // Pushes the render buffer out to the display. Optionally recolours everything from the plane (e.g. to change the palette; fine while the plot is running). If a job is provided, only marks the relevant part of the window as dirty.
     void render(int local_inf, bool do_reprocess, bool may_do_hud, Plot3::Plot3Chunk *job = NULL);
 
     void recolour();
@@ -147,6 +173,10 @@ public:
 	}
 	void toggle_hud();
 	void toggle_antialias();
+	void toggle_equalise();
+	bool is_equalised() const { return equalise; }
+	// What to colour with: pal, or its equalised version.
+	const BasePalette& colour_palette();
 	void toggle_fullscreen();
 	bool is_antialias() const { return antialias; }
 	unsigned get_menubar_height();
@@ -175,7 +205,8 @@ public:
 
 	// IPlot3DataSink:
 	virtual void chunk_done(Plot3::Plot3Chunk* job);
-	virtual void pass_complete(std::string& commentary, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels);
+	virtual void batch_done();
+	virtual void pass_complete(std::string& commentary, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels, std::shared_ptr<const Plot3::IterHistogram> histogram);
 	virtual void plot_complete();
 
 	static const unsigned DEFAULT_INITIAL_SIZE = 300;
@@ -186,11 +217,13 @@ private:
 	void png_save_completion();
 	void destroy_image();
 	void real_plot_complete();
+	void start_refining();
+	void refined(unsigned samples); // ProgressiveRefiner callback
 
 	std::shared_ptr<ThreadPool> _threadpool;
 public:
 	std::shared_ptr<ThreadPool> get_threadpool(); // singleton-like accessor
-	void resize_threadpool(unsigned max_threads); // Called when Prefs updated
+	void resize_threadpool(std::shared_ptr<const BrotPrefs::Prefs> newprefs); // Called when Prefs updated
 };
 
 #endif /* MAINWINDOW_H_ */
@@ -361,8 +361,9 @@ public:
 class ColourMenu : public Gtk::Menu {
 	MainWindow* _parent;
 	std::list<Gtk::RadioMenuItem*> all; // for prev/next handling
+	Gtk::CheckMenuItem equalise;
 public:
-	ColourMenu(MainWindow& parent, std::string& initial) {
+	ColourMenu(MainWindow& parent, std::string& initial) : equalise("_Equalise", true) {
 		Glib::RefPtr<Gtk::AccelGroup> ag = Gtk::AccelGroup::create();
 		set_accel_group(ag);
 		parent.add_accel_group(ag);
@@ -382,6 +383,10 @@ public:
 		i1->signal_activate().connect(sigc::mem_fun(*this, &ColourMenu::do_next));
 		i1->add_accelerator("activate", ag, GDK_2, Gdk::ModifierType::CONTROL_MASK, Gtk::ACCEL_VISIBLE);
 
+		append(equalise);
+		equalise.signal_toggled().connect(sigc::mem_fun(*this, &ColourMenu::toggle_equalise));
+		equalise.add_accelerator("activate", ag, GDK_E, Gdk::ModifierType::CONTROL_MASK, Gtk::ACCEL_VISIBLE);
+
 		i1 = new Gtk::SeparatorMenuItem();
 		append(*manage(i1));
 		i1 = new Gtk::MenuItem("Discrete");
@@ -433,6 +438,9 @@ public:
 			THROW(BrotFatalException,"Initial palette selection " + initial + " not found. Link error?");
 		selection1(initial);
 	}
+	void toggle_equalise() {
+		_parent->toggle_equalise();
+	}
 	void selection(Gtk::RadioMenuItem *item) {
 		selection1(item->get_label());
 	}
@@ -89,7 +89,7 @@ void Movie::Progress::chunk_done_gdklocked(Plot3::Plot3Chunk* job) {
 	else
 		++chunks_done;
 }
-void Movie::Progress::pass_complete(std::string& msg, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels) {
+void Movie::Progress::pass_complete(std::string& msg, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels, std::shared_ptr<const Plot3::IterHistogram>) {
 	gdk_threads_enter();
 	pass_complete_gdklocked(msg, passes_plotted, maxiter, pixels_still_live, total_pixels);
 	gdk_threads_leave();
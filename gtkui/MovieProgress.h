@@ -63,7 +63,7 @@ namespace Movie {
 
 			// These 3 functions, from IPlot3DataSink, all lock the GDK lock.
 			virtual void chunk_done(Plot3::Plot3Chunk* job);
-			virtual void pass_complete(std::string& msg, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels);
+			virtual void pass_complete(std::string& msg, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels, std::shared_ptr<const Plot3::IterHistogram> histogram);
 			virtual void plot_complete();
 
 			virtual void frames_traversed(int n); // Locks the gdk lock, then calls frames_traversed_gdklocked
@@ -43,14 +43,12 @@ extern "C" {
 #include "libavutil/opt.h"
 #include "libavformat/avformat.h"
 #include "libswresample/swresample.h"
-#include "libswscale/swscale.h"
 }
 
 using namespace std;
 
 // ------------------------------------------------------------------------------
 
-#define SCALE_FLAGS SWS_BICUBIC
 #define LIBAV_LINE_SIZE 1024 // Source: https://www.ffmpeg.org/doxygen/2.7/log_8c_source.html
 
 SUBCLASS_BROTEXCEPTION(AVException);
@@ -274,23 +272,21 @@ class LibAV : public Movie::Renderer {
 		int64_t next_pts;
 
 		AVFrame *frame;
-		AVFrame *tmp_frame;
 
 		bool finished_cleanly;
 
-		struct SwsContext *sws_ctx;
 		struct SwrContext *swr_ctx;
 
 		Plot3::Plot3Plot *plot;
 		Plot3::ChunkDivider::Horizontal10px divider;
-		Render2::MemoryBuffer *render;
+		Render2::YUV420P *render; // Straight into frame, no conversion needed
 		std::shared_ptr<const BrotPrefs::Prefs> prefs;
 
 		unsigned actual_fps;
 
 		Private(Movie::RenderJob& _job) :
 			RenderInstancePrivate(_job),
-			fmt(0), oc(0), st(0), next_pts(0), frame(0), tmp_frame(0), finished_cleanly(false), sws_ctx(0), swr_ctx(0),
+			fmt(0), oc(0), st(0), next_pts(0), frame(0), finished_cleanly(false), swr_ctx(0),
 			plot(0), render(0), prefs(BrotPrefs::Prefs::getMaster())
 		{
 			ConsoleOutputWindow::activate(_job._reporter, prefs);
@@ -301,9 +297,6 @@ class LibAV : public Movie::Renderer {
 		}
 		virtual ~Private() {
 			av_frame_free(&frame);
-			av_frame_free(&tmp_frame);
-			sws_freeContext(sws_ctx);
-			sws_ctx = 0;
 			if (oc) {
 				avio_close(oc->pb); // may return error
 				avformat_free_context(oc);
@@ -410,11 +403,6 @@ class LibAV : public Movie::Renderer {
 			mypriv->frame = alloc_picture(AV_PIX_FMT_YUV420P, cp->width, cp->height);
 			if (!mypriv->frame)
 				THROW(AVException,"Could not alloc picture");
-			{
-				mypriv->tmp_frame = alloc_picture(AV_PIX_FMT_RGB24, cp->width, cp->height);
-				if (!mypriv->tmp_frame)
-					THROW(AVException,"Could not alloc 2nd picture");
-			}
 
 			av_dump_format(mypriv->oc, 0, url.c_str(), 1);
 			if (avio_open(&mypriv->oc->pb, url.c_str(), AVIO_FLAG_WRITE) < 0)
@@ -422,13 +410,12 @@ class LibAV : public Movie::Renderer {
 			if (avformat_write_header(mypriv->oc, 0))
 				THROW(AVException,"Could not write header");
 
-			AVFrame * ren_frame = mypriv->tmp_frame ? mypriv->tmp_frame : mypriv->frame;
-			mypriv->render = new Render2::MemoryBuffer(
-					ren_frame->data[0],
-					ren_frame->linesize[0],
+			mypriv->render = new Render2::YUV420P(
+					mypriv->frame->data,
+					mypriv->frame->linesize,
 					cp->width, cp->height,
 					job._movie.antialias, -1/*local_inf*/,
-					Render2::pixpack_format::PACKED_RGB_24, *job._movie.palette, job._movie.preview/*upscale*/);
+					*job._movie.palette, job._movie.preview/*upscale*/);
 			// Update local_inf later with mypriv->render->fresh_local_inf() if needed.
 		}
 
@@ -441,38 +428,20 @@ class LibAV : public Movie::Renderer {
 					fr.centre, fr.size,
 					mypriv->job._rwidth / upfactor, mypriv->job._rheight / upfactor);
 			// LATER: Why not apply the upfactor to _rwidth in MovieRender?
+			mypriv->plot->set_qos(QoS::BATCH);
 			mypriv->plot->start();
 			mypriv->job._reporter->set_chunks_count(mypriv->plot->chunks_total());
 			mypriv->plot->wait();
 
-			int ret=0;
-			if (mypriv->tmp_frame)
-				ret = av_frame_make_writable(mypriv->tmp_frame);
-			else
-				ret = av_frame_make_writable(mypriv->frame);
+			int ret = av_frame_make_writable(mypriv->frame);
 			if (ret < 0) THROW(AVException, "Could not make frame writeable");
+			// That may have given the frame new buffers, if the encoder was hanging on to the old.
+			mypriv->render->set_planes(mypriv->frame->data, mypriv->frame->linesize);
 
-			mypriv->render->process(mypriv->plot->get_chunks__only_after_completion());
+			mypriv->render->process(mypriv->plot->get_chunks__only_after_completion(), mypriv->plot->pool(), mypriv->plot->qos());
 			if (mypriv->job._movie.draw_hud)
 				BaseHUD::apply(*mypriv->render, mypriv->prefs, mypriv->plot, false, false);
 
-			// Prepare the video frame
-			AVCodecParameters *cp = mypriv->st->codecpar;
-			// We generate in RGB24 but libav wants YUV420P, so convert
-			{
-				if (!mypriv->sws_ctx) {
-					mypriv->sws_ctx = sws_getContext(cp->width, cp->height,
-							AV_PIX_FMT_RGB24,
-							cp->width, cp->height,
-							AV_PIX_FMT_YUV420P,
-							SCALE_FLAGS, 0, 0, 0);
-					if (!mypriv->sws_ctx)
-						THROW(AVException, "Cannot allocate conversion context");
-				}
-				sws_scale(mypriv->sws_ctx, mypriv->tmp_frame->data, mypriv->tmp_frame->linesize,
-						0, cp->height, mypriv->frame->data, mypriv->frame->linesize);
-			}
-
 			// Write the video frame
 			for (unsigned i=0; i<n_frames; i++) {
 				mypriv->frame->pts = mypriv->next_pts++;
@@ -24,6 +24,7 @@
 #include "Exception.h"
 #include "ColourPanel.h"
 #include "BaseHUD.h"
+#include "ChunkOrdering.h"
 
 #include <gtkmm/dialog.h>
 #include <gtkmm/table.h>
@@ -31,6 +32,7 @@
 #include <gtkmm/box.h>
 #include <gtkmm/stock.h>
 #include <gtkmm/combobox.h>
+#include <gtkmm/comboboxtext.h>
 #include <gtkmm/liststore.h>
 #include <gtkmm/enums.h>
 #include <gtkmm/scale.h>
@@ -197,15 +199,39 @@ namespace PrefsDialogBits {
 		// Editable fields:
 		Util::HandyEntry<int> *f_max_threads;
 		Util::HandyEntry<int> *f_tile_size;
+		Gtk::ComboBoxText *f_tile_order;
+		Util::HandyEntry<int> *f_ss_factor;
+		Util::HandyEntry<double> *f_ss_threshold;
+		Util::HandyEntry<int> *f_idle_refine;
+		Gtk::CheckButton *f_physical, *f_pin, *f_numa, *f_exact;
 
 		MiscFrame() : Gtk::Frame("Miscellaneous") {
 			f_max_threads = Gtk::manage(new Util::HandyEntry<int>());
 			f_max_threads->set_activates_default(true);
             f_tile_size = Gtk::manage(new Util::HandyEntry<int>());
 			f_tile_size->set_activates_default(true);
+			f_tile_order = Gtk::manage(new Gtk::ComboBoxText());
+			// Relies on the orderings being numbered from 0 without gaps.
+#define DO_APPEND(_num,_class,_str) f_tile_order->append(_str);
+			ALL_CHUNK_ORDERINGS(DO_APPEND);
+#undef DO_APPEND
+			f_ss_factor = Gtk::manage(new Util::HandyEntry<int>());
+			f_ss_factor->set_activates_default(true);
+			f_ss_threshold = Gtk::manage(new Util::HandyEntry<double>());
+			f_ss_threshold->set_activates_default(true);
+			f_idle_refine = Gtk::manage(new Util::HandyEntry<int>());
+			f_idle_refine->set_activates_default(true);
+			f_physical = Gtk::manage(new Gtk::CheckButton(PREFNAME(PhysicalCoresOnly)));
+			f_physical->set_tooltip_text(PREFDESC(PhysicalCoresOnly));
+			f_pin = Gtk::manage(new Gtk::CheckButton(PREFNAME(PinThreads)));
+			f_pin->set_tooltip_text(PREFDESC(PinThreads));
+			f_numa = Gtk::manage(new Gtk::CheckButton(PREFNAME(NumaPartitions)));
+			f_numa->set_tooltip_text(PREFDESC(NumaPartitions));
+			f_exact = Gtk::manage(new Gtk::CheckButton(PREFNAME(ExactColours)));
+			f_exact->set_tooltip_text(PREFDESC(ExactColours));
 
 			set_border_width(10);
-			Gtk::Table *tbl = Gtk::manage(new Gtk::Table(2/*r*/, 2/*c*/, false));
+			Gtk::Table *tbl = Gtk::manage(new Gtk::Table(10/*r*/, 2/*c*/, false));
 			Gtk::Label *lbl;
 
 			lbl = Gtk::manage(new Gtk::Label(PREFNAME(MaxPlotThreads)));
@@ -220,17 +246,62 @@ namespace PrefsDialogBits {
 			tbl->attach(*lbl, 0, 1, 1, 2);
 			tbl->attach(*f_tile_size, 1, 2, 1, 2);
 
+			lbl = Gtk::manage(new Gtk::Label(PREFNAME(TileOrder)));
+			lbl->set_tooltip_text(PREFDESC(TileOrder));
+			f_tile_order->set_tooltip_text(PREFDESC(TileOrder));
+			tbl->attach(*lbl, 0, 1, 2, 3);
+			tbl->attach(*f_tile_order, 1, 2, 2, 3);
+
+			lbl = Gtk::manage(new Gtk::Label(PREFNAME(SupersampleFactor)));
+			lbl->set_tooltip_text(PREFDESC(SupersampleFactor));
+			f_ss_factor->set_tooltip_text(PREFDESC(SupersampleFactor));
+			tbl->attach(*lbl, 0, 1, 3, 4);
+			tbl->attach(*f_ss_factor, 1, 2, 3, 4);
+
+			lbl = Gtk::manage(new Gtk::Label(PREFNAME(SupersampleThreshold)));
+			lbl->set_tooltip_text(PREFDESC(SupersampleThreshold));
+			f_ss_threshold->set_tooltip_text(PREFDESC(SupersampleThreshold));
+			tbl->attach(*lbl, 0, 1, 4, 5);
+			tbl->attach(*f_ss_threshold, 1, 2, 4, 5);
+
+			lbl = Gtk::manage(new Gtk::Label(PREFNAME(IdleRefineSamples)));
+			lbl->set_tooltip_text(PREFDESC(IdleRefineSamples));
+			f_idle_refine->set_tooltip_text(PREFDESC(IdleRefineSamples));
+			tbl->attach(*lbl, 0, 1, 5, 6);
+			tbl->attach(*f_idle_refine, 1, 2, 5, 6);
+
+			tbl->attach(*f_physical, 1, 2, 6, 7);
+			tbl->attach(*f_pin, 1, 2, 7, 8);
+			tbl->attach(*f_numa, 1, 2, 8, 9);
+			tbl->attach(*f_exact, 1, 2, 9, 10);
+
 			add(*tbl);
 		}
 
 		void prepare(const Prefs& prefs) {
 			f_max_threads->update(prefs.get(PREF(MaxPlotThreads)));
             f_tile_size->update(prefs.get(PREF(TileSize)));
+			f_tile_order->set_active(prefs.get(PREF(TileOrder)));
+			f_ss_factor->update(prefs.get(PREF(SupersampleFactor)));
+			f_ss_threshold->update(prefs.get(PREF(SupersampleThreshold)), 3);
+			f_idle_refine->update(prefs.get(PREF(IdleRefineSamples)));
+			f_physical->set_active(prefs.get(PREF(PhysicalCoresOnly)));
+			f_pin->set_active(prefs.get(PREF(PinThreads)));
+			f_numa->set_active(prefs.get(PREF(NumaPartitions)));
+			f_exact->set_active(prefs.get(PREF(ExactColours)));
 		}
 
 		void defaults() {
 			f_max_threads->update(PREF(MaxPlotThreads)._default);
 			f_tile_size->update(PREF(TileSize)._default);
+			f_tile_order->set_active(PREF(TileOrder)._default);
+			f_ss_factor->update(PREF(SupersampleFactor)._default);
+			f_ss_threshold->update(PREF(SupersampleThreshold)._default, 3);
+			f_idle_refine->update(PREF(IdleRefineSamples)._default);
+			f_physical->set_active(PREF(PhysicalCoresOnly)._default);
+			f_pin->set_active(PREF(PinThreads)._default);
+			f_numa->set_active(PREF(NumaPartitions)._default);
+			f_exact->set_active(PREF(ExactColours)._default);
 		}
 
 		void readout(Prefs& prefs) {
@@ -250,6 +321,35 @@ namespace PrefsDialogBits {
 				THROW(PrefsException,"Tile size must be at least 10");
 			tmpu = tmpi;
 			prefs.set(PREF(TileSize), tmpu);
+
+			tmpi = f_tile_order->get_active_row_number();
+			if ((tmpi < PREF(TileOrder)._min) || (tmpi > PREF(TileOrder)._max))
+				THROW(PrefsException,"Please choose a tile order");
+			prefs.set(PREF(TileOrder), tmpi);
+
+			if (!f_ss_factor->read(tmpi))
+				THROW(PrefsException,"Sorry, I don't understand your supersampling factor");
+			if ((tmpi < PREF(SupersampleFactor)._min) || (tmpi > PREF(SupersampleFactor)._max))
+				THROW(PrefsException,"Supersampling factor must be from 0 to 8");
+			prefs.set(PREF(SupersampleFactor), tmpi);
+
+			double tmpf=0.0;
+			if (!f_ss_threshold->read(tmpf))
+				THROW(PrefsException,"Sorry, I don't understand your supersampling threshold");
+			if ((tmpf < PREF(SupersampleThreshold)._min) || (tmpf > PREF(SupersampleThreshold)._max))
+				THROW(PrefsException,"Supersampling threshold must be between 0 and 10");
+			prefs.set(PREF(SupersampleThreshold), tmpf);
+
+			if (!f_idle_refine->read(tmpi))
+				THROW(PrefsException,"Sorry, I don't understand your idle refinement samples");
+			if ((tmpi < PREF(IdleRefineSamples)._min) || (tmpi > PREF(IdleRefineSamples)._max))
+				THROW(PrefsException,"Idle refinement samples must be from 0 to 1024");
+			prefs.set(PREF(IdleRefineSamples), tmpi);
+
+			prefs.set(PREF(PhysicalCoresOnly), f_physical->get_active());
+			prefs.set(PREF(PinThreads), f_pin->get_active());
+			prefs.set(PREF(NumaPartitions), f_numa->get_active());
+			prefs.set(PREF(ExactColours), f_exact->get_active());
 		}
 	};
 
@@ -472,12 +572,20 @@ int PrefsDialog::run() {
 			if (error) {
 				// Any other error cases?
 			} else {
-				// Do we need to change the size of the main worker ThreadPool?
-				if (BrotPrefs::threadpool_size(pp) != BrotPrefs::threadpool_size(p) )
-					mw->resize_threadpool(BrotPrefs::threadpool_size(pp));
-
+				// Do we need to change the size or placement of the main worker ThreadPool?
+				if (BrotPrefs::threadpool_size(pp) != BrotPrefs::threadpool_size(p)
+						|| pp->get(PREF(PinThreads)) != p->get(PREF(PinThreads))
+						|| pp->get(PREF(NumaPartitions)) != p->get(PREF(NumaPartitions))
+						|| pp->get(PREF(PhysicalCoresOnly)) != p->get(PREF(PhysicalCoresOnly)))
+					mw->resize_threadpool(pp);
+
+				const bool recolour = pp->get(PREF(ExactColours)) != p->get(PREF(ExactColours));
 				pp->commit();
 				// Poke anything that might want to know.
+				if (recolour) {
+					BasePalette::set_exact(pp->get(PREF(ExactColours)));
+					mw->recolour();
+				}
 			}
 		} else if (result == RESPONSE_DEFAULTS) {
 			threshold->defaults();
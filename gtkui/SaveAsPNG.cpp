@@ -56,7 +56,7 @@ void SavePNG::Base::to_png(Gtk::Window *parent, unsigned rwidth, unsigned rheigh
 	ofstream f(filename, ios::out | ios::trunc | ios::binary);
 	if (f.is_open()) {
 		Render2::PNG png(rwidth, rheight, *pal, -1, antialias, upscale);
-		png.process(plot->get_chunks__only_after_completion());
+		png.process(plot->get_chunks__only_after_completion(), plot->pool(), plot->qos());
 		if (show_hud) {
 			BaseHUD::apply(png, prefs, plot, false, false);
 		}
@@ -95,7 +95,7 @@ void SingleProgressWindow::chunk_done(Plot3Chunk*) {
 	gdk_threads_leave();
 }
 
-void SingleProgressWindow::pass_complete(std::string& commentary, unsigned, unsigned, unsigned, unsigned) {
+void SingleProgressWindow::pass_complete(std::string& commentary, unsigned, unsigned, unsigned, unsigned, std::shared_ptr<const Plot3::IterHistogram>) {
 	_chunks_this_pass=0;
 	gdk_threads_enter();
 	progbar->set_text(commentary);
@@ -240,7 +240,7 @@ void Single::do_save(MainWindow *mw)
 		// EASY CASE: Just save out of the current plot.
 		mw->get_progbar()->set_text("Saving...");
 		to_png(mw, mw->get_rwidth(), mw->get_rheight(), &mw->get_plot(),
-				mw->pal, mw->is_antialias(), false, filename);
+				&mw->colour_palette(), mw->is_antialias(), false, filename);
 		mw->get_progbar()->set_text("Save complete");
 	}
 }
@@ -252,17 +252,21 @@ SavePNG::Base::Base(std::shared_ptr<const Prefs> _prefs, std::shared_ptr<ThreadP
 		pal(&palette), filename(fname), _width(width), _height(height), _do_antialias(antialias), _do_hud(do_hud), _upscale(upscale)
 {
 	plot.set_prefs(_prefs);
+	if (!antialias && !upscale) // the renderer only looks at supersamples in plain mode
+		plot.set_supersample(_prefs->get(PREF(SupersampleFactor)), _prefs->get(PREF(SupersampleThreshold)));
 }
 
 Single::Single(MainWindow* mw, Fractal::Point centre, Fractal::Point size, unsigned width, unsigned height, bool antialias, bool do_hud, string& filename) :
-		Base(mw->prefs(), mw->get_threadpool(), *mw->fractal, *mw->pal, reporter, centre, size, width, height, antialias, do_hud, filename),
+		Base(mw->prefs(), mw->get_threadpool(), *mw->fractal, mw->colour_palette(), reporter, centre, size, width, height, antialias, do_hud, filename),
 		reporter(*mw, *this)
 {
+	plot.set_qos(QoS::EXPORT);
 }
 
 MovieFrame::MovieFrame(std::shared_ptr<const Prefs> prefs, std::shared_ptr<ThreadPool> threads, const Fractal::FractalImpl& fractal, const BasePalette& palette, Plot3::IPlot3DataSink& sink, Fractal::Point centre, Fractal::Point size, unsigned width, unsigned height, bool antialias, bool do_hud, string& filename, bool upscale) :
 		Base(prefs, threads, fractal, palette, sink, centre, size, width, height, antialias, do_hud, filename, upscale)
 {
+	plot.set_qos(QoS::BATCH);
 }
 
 
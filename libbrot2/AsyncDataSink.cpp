@@ -0,0 +1,224 @@
+/*
+    AsyncDataSink.cpp: Hands plot results to another sink on its own thread
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AsyncDataSink.h"
+#include "Exception.h"
+#include <iostream>
+#include <stdlib.h>
+
+namespace Plot3 {
+
+thread_local AsyncDataSink::EventCache AsyncDataSink::_cache;
+
+AsyncDataSink::EventCache::~EventCache()
+{
+	while (head) {
+		Event* next = head->next.load(std::memory_order_relaxed);
+		delete head;
+		head = next;
+	}
+}
+
+AsyncDataSink::AsyncDataSink(IPlot3DataSink* target) :
+		_target(target), _head(&_stub), _tail(&_stub), _stub(Event::QUIT),
+		_free(0), _sleeping(false)
+{
+	ASSERT(target);
+	_consumer = std::thread([this]{ this->consume(); });
+}
+
+AsyncDataSink::~AsyncDataSink()
+{
+	post(new Event(Event::QUIT));
+	_consumer.join();
+	Event* e = _free.load(std::memory_order_acquire);
+	while (e) {
+		Event* next = e->next.load(std::memory_order_relaxed);
+		delete e;
+		e = next;
+	}
+}
+
+void AsyncDataSink::push(Event* e)
+{
+	e->next.store(0, std::memory_order_relaxed);
+	Event* prev = _head.exchange(e, std::memory_order_acq_rel);
+	prev->next.store(e, std::memory_order_release);
+}
+
+AsyncDataSink::Event* AsyncDataSink::pop()
+{
+	Event* tail = _tail;
+	Event* next = tail->next.load(std::memory_order_acquire);
+	if (tail == &_stub) {
+		if (!next)
+			return 0;
+		_tail = next;
+		tail = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+	if (next) {
+		_tail = next;
+		return tail;
+	}
+	if (tail != _head.load(std::memory_order_acquire))
+		return 0; // A producer is half way through a push; try again shortly.
+	push(&_stub);
+	next = tail->next.load(std::memory_order_acquire);
+	if (next) {
+		_tail = next;
+		return tail;
+	}
+	return 0;
+}
+
+bool AsyncDataSink::maybe_empty() const
+{
+	return _tail == _head.load(std::memory_order_acquire)
+		&& !_tail->next.load(std::memory_order_acquire);
+}
+
+void AsyncDataSink::post(Event* e)
+{
+	push(e);
+	std::atomic_thread_fence(std::memory_order_seq_cst); // see _sleeping
+	if (_sleeping.exchange(false)) {
+		std::unique_lock<std::mutex> lock(_wake_lock);
+		_wake.notify_one();
+	}
+}
+
+AsyncDataSink::Event* AsyncDataSink::chunk_event(Plot3Chunk* chunk)
+{
+	Event* e = _cache.head;
+	if (!e)
+		e = _free.exchange(0, std::memory_order_acquire);
+	if (!e)
+		e = new Event(Event::CHUNK);
+	else
+		_cache.head = e->next.load(std::memory_order_relaxed);
+	e->chunk = chunk;
+	return e;
+}
+
+void AsyncDataSink::recycle(Event* e)
+{
+	Event* head = _free.load(std::memory_order_relaxed);
+	do {
+		e->next.store(head, std::memory_order_relaxed);
+	} while (!_free.compare_exchange_weak(head, e, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void AsyncDataSink::chunk_done(Plot3Chunk* job)
+{
+	post(chunk_event(job));
+}
+
+void AsyncDataSink::post_and_wait(Event* e)
+{
+	std::promise<void> delivered;
+	std::future<void> f = delivered.get_future();
+	e->delivered = &delivered;
+	post(e);
+	f.get();
+}
+
+void AsyncDataSink::pass_complete(std::string& commentary, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels,
+		std::shared_ptr<const IterHistogram> histogram)
+{
+	Event *e = new Event(Event::PASS);
+	e->commentary = commentary;
+	e->passes_plotted = passes_plotted;
+	e->maxiter = maxiter;
+	e->pixels_still_live = pixels_still_live;
+	e->total_pixels = total_pixels;
+	e->histogram = histogram;
+	post_and_wait(e);
+}
+
+void AsyncDataSink::plot_complete()
+{
+	post_and_wait(new Event(Event::PLOT));
+}
+
+bool AsyncDataSink::deliver(Event* e)
+{
+	switch(e->type) {
+	case Event::CHUNK:
+		_target->chunk_done(e->chunk);
+		break;
+	case Event::PASS:
+		_target->pass_complete(e->commentary, e->passes_plotted, e->maxiter, e->pixels_still_live, e->total_pixels, e->histogram);
+		break;
+	case Event::PLOT:
+		_target->plot_complete();
+		break;
+	case Event::QUIT:
+		return false;
+	}
+	return true;
+}
+
+void AsyncDataSink::consume()
+{
+	bool pending_batch = false;
+	while(true) {
+		Event *e = pop();
+		if (e) {
+			// Progress first, so the sink's view is up to date before a pass or plot ends.
+			if (pending_batch && e->type != Event::CHUNK) {
+				_target->batch_done();
+				pending_batch = false;
+			}
+			bool more;
+			try {
+				more = deliver(e);
+			} catch (std::exception& ex) {
+				std::cerr << "FATAL: Uncaught exception in data sink: " << ex.what() << std::endl;
+				exit(5);
+			}
+			if (e->type == Event::CHUNK)
+				pending_batch = true;
+			if (e->delivered)
+				e->delivered->set_value();
+			if (e->type == Event::CHUNK)
+				recycle(e);
+			else
+				delete e;
+			if (!more)
+				return;
+			continue;
+		}
+
+		// Ran dry.
+		if (pending_batch) {
+			_target->batch_done();
+			pending_batch = false;
+		}
+		std::unique_lock<std::mutex> lock(_wake_lock);
+		_sleeping = true;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (!maybe_empty()) {
+			_sleeping = false;
+			continue;
+		}
+		_wake.wait(lock, [this]{ return !_sleeping; });
+	}
+}
+
+} // namespace Plot3
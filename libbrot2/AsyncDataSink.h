@@ -0,0 +1,113 @@
+/*
+    AsyncDataSink.h: Hands plot results to another sink on its own thread
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASYNCDATASINK_H_
+#define ASYNCDATASINK_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "IPlot3DataSink.h"
+
+namespace Plot3 {
+
+/*
+ * Sits between a Plot3Plot and a real sink. The plot's worker threads
+ * drop their completed chunks into a lock-free queue and go straight back
+ * to work; a consumer thread of our own delivers them to the real sink,
+ * in order, and calls its batch_done() whenever it runs out of work.
+ * So a sink that takes the GDK lock or writes to the terminal no longer
+ * holds up the workers, and sees one progress update per batch instead
+ * of one per chunk.
+ *
+ * pass_complete() and plot_complete() are also delivered on the consumer
+ * thread, after every chunk before them, but the caller waits for them:
+ * the next pass mustn't start (and scribble on the chunks) until the real
+ * sink has finished with this one.
+ */
+class AsyncDataSink : public IPlot3DataSink {
+public:
+	AsyncDataSink(IPlot3DataSink* target);
+	virtual ~AsyncDataSink(); // Delivers anything outstanding first.
+
+	virtual void chunk_done(Plot3Chunk* job); // Never blocks.
+	virtual void pass_complete(std::string& commentary, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels,
+			std::shared_ptr<const IterHistogram> histogram);
+	virtual void plot_complete();
+
+private:
+	AsyncDataSink(const AsyncDataSink&) = delete;
+	const AsyncDataSink& operator= (const AsyncDataSink&) = delete;
+
+	struct Event {
+		enum Type { CHUNK, PASS, PLOT, QUIT } type;
+		Plot3Chunk *chunk;
+		std::string commentary;
+		unsigned passes_plotted, maxiter, pixels_still_live, total_pixels;
+		std::shared_ptr<const IterHistogram> histogram;
+		std::promise<void> *delivered; // If not null, the poster is waiting on it
+		std::atomic<Event*> next;
+		Event(Type t) : type(t), chunk(0), passes_plotted(0), maxiter(0),
+			pixels_still_live(0), total_pixels(0), delivered(0), next(0) {}
+	};
+
+	IPlot3DataSink* _target;
+
+	/* Intrusive MPSC queue, after Dmitry Vyukov. Producers swing _head;
+	 * only the consumer touches _tail. */
+	std::atomic<Event*> _head;
+	Event* _tail;
+	Event _stub;
+	void push(Event* e);
+	Event* pop(); // Consumer only. Returns null if there's nothing (yet).
+	bool maybe_empty() const; // Consumer only.
+	void post(Event* e); // push, and wake the consumer if need be
+	void post_and_wait(Event* e);
+
+	/* Chunk events are recycled, as there's one per chunk per pass. The
+	 * consumer pushes spent ones onto _free; a producer whose own cache is
+	 * empty takes the whole of _free at once, so there's no ABA problem. */
+	std::atomic<Event*> _free;
+	struct EventCache {
+		Event* head;
+		EventCache() : head(0) {}
+		~EventCache();
+	};
+	static thread_local EventCache _cache;
+	Event* chunk_event(Plot3Chunk* chunk); // Producers
+	void recycle(Event* e); // Consumer only
+
+	/* Wakeup. Producers only touch the lock when the consumer is asleep.
+	 * Each side stores, then loads what the other stores (the consumer
+	 * _sleeping then _head, a producer _head then _sleeping), with a full
+	 * fence between, so one of them always sees the other. */
+	std::atomic<bool> _sleeping;
+	std::mutex _wake_lock;
+	std::condition_variable _wake;
+
+	std::thread _consumer;
+	void consume();
+	bool deliver(Event* e); // Returns false on QUIT
+};
+
+} // namespace Plot3
+
+#endif /* ASYNCDATASINK_H_ */
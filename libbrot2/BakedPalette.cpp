@@ -0,0 +1,196 @@
+/*
+    BakedPalette.cpp: Tabulated versions of expensive palettes
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BakedPalette.h"
+#include "Exception.h"
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+const float BakedPalette::ITERF_LOG_MAX = 2147483648.0f; // 2^31, more than any maxiter
+
+static const unsigned LOG_SHIFT = 23 - BakedPalette::LOG_MANTISSA_BITS; // float has 23 mantissa bits
+
+static inline uint32_t float_bits(float f) {
+	uint32_t rv;
+	memcpy(&rv, &f, sizeof rv);
+	return rv;
+}
+
+static inline float bits_float(uint32_t u) {
+	float rv;
+	memcpy(&rv, &u, sizeof rv);
+	return rv;
+}
+
+std::atomic<bool> BasePalette::_exact(false);
+
+const BasePalette& BasePalette::baked() const {
+	if (_exact)
+		return *this;
+	std::call_once(_bake_once, [this]{
+		if (bake_axis().kind != BakeAxis::NONE)
+			_baked.reset(new BakedPalette(*this));
+	});
+	return _baked ? *_baked : *this;
+}
+
+rgb BakedPalette::entry(int iter, float iterf) const {
+	Fractal::PointData pt;
+	pt.iter = iter;
+	pt.iterf = iterf;
+	pt.nomore = true;
+	return _orig.get(pt);
+}
+
+BakedPalette::BakedPalette(const BasePalette& orig) :
+		BasePalette(orig.name), _orig(orig), _axis(orig.bake_axis()),
+		_log_base(0), _limit(0)
+{
+	switch (_axis.kind) {
+	case BakeAxis::NONE:
+		THROW(BrotFatalException, "Palette "+orig.name+" cannot be baked");
+
+	case BakeAxis::ITER_PERIODIC:
+	case BakeAxis::ITER_RANGE:
+		ASSERT(_axis.param >= 1 && _axis.param <= INT_MAX);
+		_table.resize((unsigned)_axis.param);
+		for (unsigned i=0; i<_table.size(); i++)
+			_table[i] = entry(i, i);
+		break;
+
+	case BakeAxis::ITERF_PERIODIC:
+		ASSERT(_axis.param > 0);
+		// One extra entry so lerp() can always look at i+1. It's the
+		// colour just before the wrap, which needn't be the same as entry 0.
+		_table.resize(PERIODIC_ENTRIES + 1);
+		for (unsigned i=0; i<PERIODIC_ENTRIES; i++)
+			_table[i] = entry(0, _axis.param * i / PERIODIC_ENTRIES);
+		_table[PERIODIC_ENTRIES] = entry(0, nextafterf(_axis.param, 0));
+		break;
+
+	case BakeAxis::ITERF_LOG:
+		{
+			/* The bit pattern of a positive float is a piecewise-linear
+			 * approximation of its log2, so we index by the top bits. The
+			 * first entry is at or just below the clamp. */
+			_log_base = float_bits(Fractal::PointData::ITERF_LOW_CLAMP) & ~((1u<<LOG_SHIFT)-1);
+			_limit = ITERF_LOG_MAX;
+			unsigned n = ((float_bits(_limit) - _log_base) >> LOG_SHIFT) + 2;
+			_table.resize(n);
+			for (unsigned i=0; i<n; i++) {
+				float f = bits_float(_log_base + (i << LOG_SHIFT));
+				_table[i] = entry(f < INT_MAX ? (int)f : INT_MAX, f);
+			}
+		}
+		break;
+
+	case BakeAxis::ITERF_SQRT:
+		{
+			ASSERT(_axis.param > 0);
+			_limit = _axis.param;
+			unsigned n = ceil(sqrt(_limit) * SQRT_STEPS) + 2;
+			_table.resize(n);
+			for (unsigned i=0; i<n; i++) {
+				float s = (float)i / SQRT_STEPS;
+				_table[i] = entry(s*s, s*s);
+			}
+		}
+		break;
+	}
+}
+
+inline rgb BakedPalette::lookup_iter_periodic(const Fractal::PointData& pt) const {
+	if (pt.iter >= 0)
+		return _table[pt.iter % _table.size()];
+	return _orig.get(pt);
+}
+
+inline rgb BakedPalette::lookup_iter_range(const Fractal::PointData& pt) const {
+	if (pt.iter >= 0 && (unsigned)pt.iter < _table.size())
+		return _table[pt.iter];
+	return _orig.get(pt);
+}
+
+inline rgb BakedPalette::lookup_periodic(const Fractal::PointData& pt) const {
+	// Same arithmetic as the palettes use, so we agree on where the wraps fall.
+	float tau = pt.iterf / _axis.param, tmp;
+	tau = modff(tau, &tmp);
+	if (!(tau >= 0))
+		return _orig.get(pt);
+	float pos = tau * PERIODIC_ENTRIES;
+	unsigned i = pos;
+	if (i >= PERIODIC_ENTRIES)
+		return _orig.get(pt); // paranoia
+	return lerp(i, (pos - i) * 256);
+}
+
+inline rgb BakedPalette::lookup_log(const Fractal::PointData& pt) const {
+	// (NaN fails the first test, so goes to the original too.)
+	if (pt.iterf >= Fractal::PointData::ITERF_LOW_CLAMP && pt.iterf < _limit) {
+		uint32_t u = float_bits(pt.iterf) - _log_base;
+		return lerp(u >> LOG_SHIFT, (u >> (LOG_SHIFT-8)) & 0xff);
+	}
+	return _orig.get(pt);
+}
+
+inline rgb BakedPalette::lookup_sqrt(const Fractal::PointData& pt) const {
+	if (pt.iterf >= Fractal::PointData::ITERF_LOW_CLAMP && pt.iterf < _limit) {
+		float pos = sqrtf(pt.iterf) * SQRT_STEPS;
+		unsigned i = pos;
+		return lerp(i, (pos - i) * 256);
+	}
+	return _orig.get(pt);
+}
+
+rgb BakedPalette::get(const Fractal::PointData &pt) const {
+	switch (_axis.kind) {
+	case BakeAxis::NONE: break;
+	case BakeAxis::ITER_PERIODIC: return lookup_iter_periodic(pt);
+	case BakeAxis::ITER_RANGE: return lookup_iter_range(pt);
+	case BakeAxis::ITERF_PERIODIC: return lookup_periodic(pt);
+	case BakeAxis::ITERF_LOG: return lookup_log(pt);
+	case BakeAxis::ITERF_SQRT: return lookup_sqrt(pt);
+	}
+	return _orig.get(pt);
+}
+
+/* The span loop, instantiated once per axis so there's no decision-making
+ * (or virtual call) per pixel beyond the range checks. */
+template<rgb (BakedPalette::*LOOKUP)(const Fractal::PointData&) const>
+void BakedPalette::span(const Fractal::PointData *pts, unsigned n, int local_inf, rgb *out) const {
+	for (unsigned i=0; i<n; i++) {
+		const Fractal::PointData& pt = pts[i];
+		if (pt.iter == local_inf || pt.iterf < 0)
+			out[i] = black;
+		else
+			out[i] = (this->*LOOKUP)(pt);
+	}
+}
+
+void BakedPalette::get_span(const Fractal::PointData *pts, unsigned n, int local_inf, rgb *out) const {
+	switch (_axis.kind) {
+	case BakeAxis::NONE: break;
+	case BakeAxis::ITER_PERIODIC: return span<&BakedPalette::lookup_iter_periodic>(pts, n, local_inf, out);
+	case BakeAxis::ITER_RANGE: return span<&BakedPalette::lookup_iter_range>(pts, n, local_inf, out);
+	case BakeAxis::ITERF_PERIODIC: return span<&BakedPalette::lookup_periodic>(pts, n, local_inf, out);
+	case BakeAxis::ITERF_LOG: return span<&BakedPalette::lookup_log>(pts, n, local_inf, out);
+	case BakeAxis::ITERF_SQRT: return span<&BakedPalette::lookup_sqrt>(pts, n, local_inf, out);
+	}
+	BasePalette::get_span(pts, n, local_inf, out);
+}
@@ -0,0 +1,86 @@
+/*
+    BakedPalette.h: Tabulated versions of expensive palettes
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BAKEDPALETTE_H_
+#define BAKEDPALETTE_H_
+
+#include <vector>
+#include <stdint.h>
+#include "palette.h"
+
+/*
+ * Most of the smooth palettes spend their time in log, sin, cos and an
+ * HSV to RGB conversion - for every pixel, every time we recolour. A
+ * BakedPalette evaluates the original once per table entry, up front,
+ * then answers get() by (interpolated) table lookup.
+ *
+ * How the table is indexed comes from the original's bake_axis(); see
+ * palette.h. Anything outside the table goes to the original, so we only
+ * ever differ from it by interpolation error, which is at most 1 in each
+ * channel.
+ *
+ * Don't construct these directly; use BasePalette::baked().
+ */
+class BakedPalette : public BasePalette {
+public:
+	// The original must outlive us.
+	BakedPalette(const BasePalette& orig);
+	virtual ~BakedPalette() {}
+
+	virtual rgb get(const Fractal::PointData &pt) const;
+	virtual void get_span(const Fractal::PointData *pts, unsigned n, int local_inf, rgb *out) const;
+
+	const BasePalette& original() const { return _orig; }
+	size_t table_size() const { return _table.size(); }
+
+	/* Table resolutions. */
+	static const unsigned PERIODIC_ENTRIES = 4096; // per period
+	static const unsigned LOG_MANTISSA_BITS = 11; // 2048 entries per octave
+	static const unsigned SQRT_STEPS = 16; // entries per unit of sqrt(iterf)
+	static const float ITERF_LOG_MAX; // Top of the log table
+
+private:
+	const BasePalette& _orig;
+	const BakeAxis _axis;
+	std::vector<rgb> _table;
+	uint32_t _log_base; // ITERF_LOG: bit pattern of the first entry's iterf
+	float _limit; // ITERF_LOG, ITERF_SQRT: largest iterf we tabulate
+
+	rgb entry(int iter, float iterf) const; // asks the original
+
+	/* One lookup per axis; each falls back to the original if the point
+	 * is off the table. */
+	inline rgb lookup_iter_periodic(const Fractal::PointData& pt) const;
+	inline rgb lookup_iter_range(const Fractal::PointData& pt) const;
+	inline rgb lookup_periodic(const Fractal::PointData& pt) const;
+	inline rgb lookup_log(const Fractal::PointData& pt) const;
+	inline rgb lookup_sqrt(const Fractal::PointData& pt) const;
+	template<rgb (BakedPalette::*LOOKUP)(const Fractal::PointData&) const>
+		void span(const Fractal::PointData *pts, unsigned n, int local_inf, rgb *out) const;
+	/* Interpolates between entries i and i+1; frac is 0..255. */
+	inline rgb lerp(unsigned i, unsigned frac) const {
+		const rgb& a = _table[i];
+		const rgb& b = _table[i+1];
+		const unsigned inv = 256 - frac;
+		return rgb((a.r*inv + b.r*frac + 128) >> 8,
+				(a.g*inv + b.g*frac + 128) >> 8,
+				(a.b*inv + b.b*frac + 128) >> 8);
+	}
+};
+
+#endif /* BAKEDPALETTE_H_ */
@@ -19,6 +19,9 @@
 #include "BaseHUD.h"
 #include "Prefs.h"
 #include "Exception.h"
+#include <algorithm>
+#include <mutex>
+#include <sstream>
 #include <pangomm/init.h>
 
 using namespace BrotPrefs;
@@ -35,53 +38,90 @@ struct rgb_double {
 
 const std::string BaseHUD::font_name = "sans-serif";
 
-void BaseHUD::draw(Cairo::RefPtr<Cairo::Surface> surface, std::shared_ptr<const BrotPrefs::Prefs> prefs, Plot3::Plot3Plot* plot, const int rwidth, const int rheight, bool is_max, bool is_min)
-{
-	if (!plot) return; // race condition trap
-
-	int xpos, ypos, xright, fontsize;
+/* Everything that decides what the HUD looks like, bar the text. */
+struct HUDStyle {
 	Gdk::Color fg_gdk, bg_gdk;
 	double alpha;
+	int xpos, ypos, xright, fontsize;
+	bool outline;
+	int rwidth, rheight;
+
+	HUDStyle(std::shared_ptr<const Prefs> prefs, int w, int h) : rwidth(w), rheight(h)
+	{
+		BaseHUD::retrieve_prefs(prefs,fg_gdk,bg_gdk,alpha,xpos,ypos,xright,fontsize);
+		outline = prefs->get(PREF(HUDOutlineText));
+	}
+
+	std::string key() const {
+		std::ostringstream os;
+		os << fg_gdk.get_red() << ' ' << fg_gdk.get_green() << ' ' << fg_gdk.get_blue() << ' '
+			<< bg_gdk.get_red() << ' ' << bg_gdk.get_green() << ' ' << bg_gdk.get_blue() << ' ' << alpha << ' '
+			<< xpos << ' ' << ypos << ' ' << xright << ' ' << fontsize << ' ' << outline << ' '
+			<< rwidth << 'x' << rheight;
+		return os.str();
+	}
+};
+
+/* ... and the text, which changes with every frame of a zoom. */
+struct HUDSettings : public HUDStyle {
+	std::string info;
 
-	std::string info = plot->info_zoom(prefs->get(PREF(HUDShowZoom)));
-	if (is_max)
-		info.append(" (max!)");
-	if (is_min)
-		info.append(" (min!)");
+	HUDSettings(std::shared_ptr<const Prefs> prefs, Plot3::Plot3Plot* plot, int w, int h, bool is_max, bool is_min) :
+		HUDStyle(prefs, w, h)
+	{
+		info = plot->info_zoom(prefs->get(PREF(HUDShowZoom)));
+		if (is_max)
+			info.append(" (max!)");
+		if (is_min)
+			info.append(" (min!)");
+	}
+};
 
-	BaseHUD::retrieve_prefs(prefs,fg_gdk,bg_gdk,alpha,xpos,ypos,xright,fontsize);
-	const rgb_double fg(fg_gdk), bg(bg_gdk);
-	const int hudwidthpct = MAX(xright - xpos, 1);
+/* A layout in the style's font and width, without any text yet. */
+static Glib::RefPtr<Pango::Layout> make_layout(Cairo::RefPtr<Cairo::Context> cr, const HUDStyle& s)
+{
+	static std::once_flag pango_once;
+	std::call_once(pango_once, []{ Pango::init(); });
 
-	const int XOFFSET = xpos * rwidth / 100;
-	const int WIDTH_PIXELS = hudwidthpct * rwidth / 100;
+	const int hudwidthpct = MAX(s.xright - s.xpos, 1);
+	const int WIDTH_PIXELS = hudwidthpct * s.rwidth / 100;
 
-	Pango::init();
 	Pango::FontDescription fontdesc(BaseHUD::font_name);
-	fontdesc.set_size(fontsize);
+	fontdesc.set_size(s.fontsize);
 	fontdesc.set_weight(Pango::Weight::WEIGHT_BOLD);
 
-	Cairo::RefPtr<Cairo::Context> cr = Cairo::Context::create(surface);
 	Glib::RefPtr<Pango::Layout> lyt = Pango::Layout::create(cr);
 	lyt->set_font_description(fontdesc);
-	lyt->set_markup(info);
 	lyt->set_width(Pango::SCALE * WIDTH_PIXELS);
 	lyt->set_wrap(Pango::WRAP_WORD_CHAR);
+	return lyt;
+}
 
+// Where the layout goes on the surface.
+static void layout_offsets(Glib::RefPtr<Pango::Layout> lyt, const HUDStyle& s, int& XOFFSET, int& YOFFSET)
+{
+	XOFFSET = s.xpos * s.rwidth / 100;
 	// Make sure we fit.
-	const int YOFFSET = ypos * (rheight - BaseHUD::compute_layout_height(lyt)) / 100;
+	YOFFSET = s.ypos * (s.rheight - BaseHUD::compute_layout_height(lyt)) / 100;
+}
+
+static void paint(Cairo::RefPtr<Cairo::Context> cr, Glib::RefPtr<Pango::Layout> lyt, const HUDStyle& s)
+{
+	const rgb_double fg(s.fg_gdk), bg(s.bg_gdk);
+	int XOFFSET, YOFFSET;
+	layout_offsets(lyt, s, XOFFSET, YOFFSET);
 
-	if (prefs->get(PREF(HUDOutlineText))) {
+	if (s.outline) {
 		// Outline text effect
 		cr->save();
 		cr->begin_new_path();
 		cr->move_to(XOFFSET,YOFFSET);
-		if (fontsize <= 13)
+		if (s.fontsize <= 13)
 			cr->set_line_width(1.0);
 		else
 			cr->set_line_width(2.0);
 		cr->set_operator(Cairo::Operator::OPERATOR_OVER);
-		cr->set_source_rgba(bg.r, bg.g, bg.b, alpha);
+		cr->set_source_rgba(bg.r, bg.g, bg.b, s.alpha);
 		lyt->update_from_cairo_context(cr);
 		lyt->add_to_cairo_context(cr);
 		cr->stroke_preserve();
@@ -100,7 +140,7 @@ void BaseHUD::draw(Cairo::RefPtr<Cairo::Surface> surface, std::shared_ptr<const
 					YOFFSET + log.get_y() / PANGO_SCALE,
 					log.get_width() / PANGO_SCALE, log.get_height() / PANGO_SCALE);
 			cr->clip();
-			cr->paint_with_alpha(alpha);
+			cr->paint_with_alpha(s.alpha);
 			cr->restore();
 		} while (iter.next_line());
 	}
@@ -108,10 +148,21 @@ void BaseHUD::draw(Cairo::RefPtr<Cairo::Surface> surface, std::shared_ptr<const
 	// Finally, draw the text itself.
 	cr->move_to(XOFFSET,YOFFSET);
 	cr->set_operator(Cairo::Operator::OPERATOR_OVER);
-	cr->set_source_rgba(fg.r, fg.g, fg.b, alpha);
+	cr->set_source_rgba(fg.r, fg.g, fg.b, s.alpha);
 	lyt->show_in_cairo_context(cr);
 }
 
+void BaseHUD::draw(Cairo::RefPtr<Cairo::Surface> surface, std::shared_ptr<const BrotPrefs::Prefs> prefs, Plot3::Plot3Plot* plot, const int rwidth, const int rheight, bool is_max, bool is_min)
+{
+	if (!plot) return; // race condition trap
+
+	const HUDSettings s(prefs, plot, rwidth, rheight, is_max, is_min);
+	Cairo::RefPtr<Cairo::Context> cr = Cairo::Context::create(surface);
+	Glib::RefPtr<Pango::Layout> lyt = make_layout(cr, s);
+	lyt->set_markup(s.info);
+	paint(cr, lyt, s);
+}
+
 void BaseHUD::retrieve_prefs(std::shared_ptr<const Prefs> prefs,
 		Gdk::Color& fgcol, Gdk::Color& bgcol, double& alpha,
 		int& xpos, int& ypos, int& xright, int& fontsize)
@@ -143,45 +194,102 @@ unsigned BaseHUD::compute_layout_height(Glib::RefPtr<Pango::Layout> lyt)
 	return ytotal;
 }
 
+/*
+ * The HUD as apply() last drew it: just the band of rows it covers, which
+ * is usually a small part of the picture.
+ */
+struct HUDRaster {
+	std::string info;
+	Cairo::RefPtr<Cairo::ImageSurface> surface; // null if nothing is visible
+	unsigned top, rows; // surface may have more rows than this
+};
+
+/*
+ * What apply() keeps from one call to the next. The layout, with its font
+ * and so cairo's cache of the glyphs drawn in it, lasts as long as the
+ * style does. Movie frames mostly differ only in the zoom, so then we just
+ * set the new text, and repaint the band we drew last time if nobody is
+ * still using it; the same text (or the same frame many times over) is
+ * the band as it was.
+ */
+struct HUDCache {
+	std::string style;
+	Cairo::RefPtr<Cairo::Context> scratch; // to measure the layout on
+	Glib::RefPtr<Pango::Layout> lyt;
+	std::shared_ptr<HUDRaster> raster;
+};
+
+static std::shared_ptr<const HUDRaster> rasterise(const HUDSettings& s)
+{
+	static std::mutex lock;
+	static HUDCache cache; // PROTECT by lock
+	std::unique_lock<std::mutex> guard(lock);
+
+	const std::string style = s.key();
+	if (!cache.lyt || cache.style != style) {
+		cache.style = style;
+		cache.scratch = Cairo::Context::create(Cairo::ImageSurface::create(Cairo::Format::FORMAT_ARGB32, 1, 1));
+		cache.lyt = make_layout(cache.scratch, s);
+		cache.raster.reset();
+	} else if (cache.raster && cache.raster->info == s.info)
+		return cache.raster;
+
+	// See where it falls.
+	Glib::RefPtr<Pango::Layout> lyt = cache.lyt;
+	lyt->update_from_cairo_context(cache.scratch);
+	lyt->set_markup(s.info);
+	int XOFFSET, YOFFSET;
+	layout_offsets(lyt, s, XOFFSET, YOFFSET);
+	Pango::Rectangle ink, logical;
+	lyt->get_pixel_extents(ink, logical);
+	const int MARGIN = 2; // for the outline's stroke, and luck
+	const int top = std::max(0, YOFFSET + std::min(ink.get_y(), logical.get_y()) - MARGIN);
+	const int bottom = std::min(s.rheight,
+			YOFFSET + std::max(ink.get_y() + ink.get_height(), logical.get_y() + logical.get_height()) + MARGIN);
+
+	// Draw over the last band if only the cache and rv have it: any other
+	// copy is a caller still blending it in. Copies are only handed out
+	// under the lock, so none can turn up meanwhile.
+	std::shared_ptr<HUDRaster> rv = cache.raster;
+	const bool reuse = rv && rv.use_count() == 2 && rv->surface
+			&& bottom > top && rv->surface->get_height() >= bottom - top;
+	if (!reuse) {
+		rv = std::make_shared<HUDRaster>();
+		cache.raster = rv;
+	}
+	rv->info = s.info;
+	rv->top = rv->rows = 0;
+	if (bottom > top) {
+		rv->top = top;
+		rv->rows = bottom - top;
+		// N.B. Cairo::ImageSurface docs say the new surface is initialised to (0,0,0,0).
+		if (!reuse)
+			rv->surface = Cairo::ImageSurface::create(Cairo::Format::FORMAT_ARGB32, s.rwidth, rv->rows);
+		Cairo::RefPtr<Cairo::Context> cr = Cairo::Context::create(rv->surface);
+		if (reuse) {
+			cr->set_operator(Cairo::Operator::OPERATOR_CLEAR);
+			cr->paint();
+			cr->set_operator(Cairo::Operator::OPERATOR_OVER);
+		}
+		cr->translate(0, -top);
+		lyt->update_from_cairo_context(cr);
+		paint(cr, lyt, s);
+		rv->surface->flush();
+		ASSERT(rv->surface->get_stride() > 0);
+	}
+	return rv;
+}
+
 void BaseHUD::apply(Render2::Base& target,
 		std::shared_ptr<const BrotPrefs::Prefs> prefs,
 		Plot3::Plot3Plot* plot,
 		bool is_max,
 		bool is_min)
 {
-	int rwidth = target.width(),
-		rheight = target.height();
-	// We'll use alpha in our surface because the HUD is partially transparent.
-	Cairo::RefPtr<Cairo::ImageSurface> surface = Cairo::ImageSurface::create(Cairo::Format::FORMAT_ARGB32, rwidth, rheight);
-	// N.B. Cairo::ImageSurface docs say the new surface is initialised to (0,0,0,0).
-
-	BaseHUD::draw(surface, prefs, plot, rwidth, rheight, is_max, is_min);
-
-	surface->flush();
-	unsigned char * image_data = surface->get_data();
-	ASSERT(surface->get_stride() > 0);
-	ASSERT(surface->get_height() == rheight);
-	ASSERT(surface->get_width() == rwidth);
-	unsigned char *rowptr = image_data;
-	for (int y = 0; y<rheight; y++) {
-		unsigned char *src = rowptr;
-		rgb current;
-		for (int x = 0; x<rwidth; x++) {
-			// This is hard-coded for FORMAT_ARGB32.
-			// Cairo stores bytes native-endian.
-			uint32_t* src32 = (uint32_t*)src;
-			unsigned char alpha = (*src32) >> 24;
-			if (alpha != 0) {
-				target.pixel_get(x, y, current);
-				unsigned char rr = ((*src32)>>16) & 0xff,
-							  gg = ((*src32)>>8 ) & 0xff,
-							  bb = ((*src32)    ) & 0xff;
-				rgba overpix(rr,gg,bb, alpha);
-				current.overlay(overpix);
-				target.pixel_done(x, y, current);
-			}
-			src+=4;
-		}
-		rowptr += surface->get_stride();
-	}
+	if (!plot) return; // race condition trap
+
+	const HUDSettings s(prefs, plot, target.width(), target.height(), is_max, is_min);
+	std::shared_ptr<const HUDRaster> hud = rasterise(s);
+	if (hud->surface)
+		target.overlay_argb32(hud->surface->get_data(), hud->surface->get_stride(), hud->top, hud->rows);
 }
@@ -0,0 +1,271 @@
+/*
+    Checkpoint.cpp: Saving a plot part way through, to carry on later
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Checkpoint.h"
+#include "Plot3Chunk.h"
+#include "IterHistogram.h"
+#include "Exception.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <locale>
+#include <sstream>
+#include <vector>
+
+namespace Plot3 {
+
+static const char MAGIC[8] = { 'b','r','o','t','2','c','k','p' };
+
+// Header field offsets; see Checkpoint.h.
+enum {
+	H_MAGIC = 0, H_VERSION = 8, H_WIDTH = 12, H_HEIGHT = 16, H_PASSES = 20,
+	H_MAXITER = 24, H_SCALE = 28, H_DELTA = 32, H_LIVE = 36, H_CHUNKS = 40,
+	H_VALUE = 44, H_FINISHED = 48, H_FRACTAL = 52,
+	H_ARITH = H_FRACTAL + Checkpoint::NAME_LEN,
+	H_CENTRE_RE = H_ARITH + Checkpoint::NAME_LEN,
+	H_CENTRE_IM = H_CENTRE_RE + Checkpoint::NAME_LEN,
+	H_SIZE_RE = H_CENTRE_IM + Checkpoint::NAME_LEN,
+	H_SIZE_IM = H_SIZE_RE + Checkpoint::NAME_LEN,
+	H_END = H_SIZE_IM + Checkpoint::NAME_LEN,
+};
+static_assert(H_END <= Checkpoint::HEADER, "Checkpoint header overflows");
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static const uint32_t VALUE_KIND = sizeof(Fractal::Value) | 0x100;
+#else
+static const uint32_t VALUE_KIND = sizeof(Fractal::Value);
+#endif
+
+static void put_le(unsigned char *p, uint32_t v) {
+	for (unsigned i=0; i<4; i++)
+		p[i] = v >> (8*i);
+}
+
+static uint32_t get_le(const unsigned char *p) {
+	uint32_t rv = 0;
+	for (unsigned i=0; i<4; i++)
+		rv |= (uint32_t)p[i] << (8*i);
+	return rv;
+}
+
+static void put_str(unsigned char *p, const std::string& s) {
+	memcpy(p, s.data(), std::min<size_t>(s.length(), Checkpoint::NAME_LEN-1));
+}
+
+static std::string get_str(const unsigned char *p) {
+	const char *s = (const char*)p;
+	return std::string(s, strnlen(s, Checkpoint::NAME_LEN-1));
+}
+
+// Enough digits to get the very same value back. Always in the "C"
+// locale, so that a file reads the same whatever locale opens it.
+static std::string value_str(Fractal::Value v) {
+	std::ostringstream os;
+	os.imbue(std::locale::classic());
+	os.precision(std::numeric_limits<Fractal::Value>::max_digits10);
+	os << v;
+	return os.str();
+}
+
+static Fractal::Value str_value(const unsigned char *p) {
+	std::istringstream is(get_str(p));
+	is.imbue(std::locale::classic());
+	Fractal::Value v = 0;
+	is >> v;
+	return v;
+}
+
+// What goes out for each pixel, bar the live ones' points
+static const unsigned PIXEL_BYTES = 9;
+
+void Checkpoint::write(const Plot3Plot& plot, const std::string& filename)
+{
+	ASSERT(!plot._chunks.empty());
+	unsigned char header[HEADER] = {0};
+	memcpy(header + H_MAGIC, MAGIC, sizeof MAGIC);
+	put_le(header + H_VERSION, VERSION);
+	put_le(header + H_WIDTH, plot.width);
+	put_le(header + H_HEIGHT, plot.height);
+	put_le(header + H_PASSES, plot.plotted_passes);
+	put_le(header + H_MAXITER, plot.plotted_maxiter);
+	put_le(header + H_SCALE, plot.maxiter_scale);
+	put_le(header + H_DELTA, plot.delta_threshold);
+	put_le(header + H_LIVE, plot.plotted_live);
+	put_le(header + H_CHUNKS, plot._chunks.size());
+	put_le(header + H_VALUE, VALUE_KIND);
+	put_le(header + H_FINISHED, plot.plotted_finished ? 1 : 0);
+	put_str(header + H_FRACTAL, plot.fract.name);
+	put_str(header + H_ARITH, Fractal::Maths::name(plot._chunks.front()->_valtype));
+	put_str(header + H_CENTRE_RE, value_str(real(plot.centre)));
+	put_str(header + H_CENTRE_IM, value_str(imag(plot.centre)));
+	put_str(header + H_SIZE_RE, value_str(real(plot.size)));
+	put_str(header + H_SIZE_IM, value_str(imag(plot.size)));
+
+	const std::string tmp = filename + ".tmp";
+	{
+		std::ofstream fs(tmp, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+		if (!fs)
+			THROW(BrotException, "Could not open "+tmp+" for writing");
+		fs.write((const char*)header, HEADER);
+
+		std::vector<unsigned char> buf;
+		for (auto chunk : plot._chunks) {
+			const Fractal::PointData *data = chunk->get_data();
+			if (!data)
+				THROW(BrotException, "Cannot checkpoint a plot whose chunks have been released");
+			buf.resize(16 + chunk->pixel_count() * PIXEL_BYTES + chunk->livecount() * 2 * sizeof(Fractal::Value));
+			unsigned char *p = &buf[0];
+			put_le(p, chunk->_offX);
+			put_le(p + 4, chunk->_offY);
+			put_le(p + 8, chunk->_width);
+			put_le(p + 12, chunk->_height);
+			p += 16;
+			for (unsigned i=0; i<chunk->pixel_count(); i++) {
+				const Fractal::PointData& pt = data[i];
+				uint32_t iterf;
+				memcpy(&iterf, &pt.iterf, sizeof iterf);
+				put_le(p, (uint32_t)pt.iter);
+				put_le(p + 4, iterf);
+				p[8] = pt.nomore;
+				p += PIXEL_BYTES;
+				if (!pt.nomore) {
+					ASSERT(p + 2 * sizeof(Fractal::Value) <= &buf[0] + buf.size());
+					const Fractal::Value re = real(pt.point), im = imag(pt.point);
+					memcpy(p, &re, sizeof re);
+					memcpy(p + sizeof re, &im, sizeof im);
+					p += 2 * sizeof(Fractal::Value);
+				}
+			}
+			ASSERT(p == &buf[0] + buf.size());
+			fs.write((const char*)&buf[0], buf.size());
+		}
+		fs.close();
+		if (!fs)
+			THROW(BrotException, "Failed writing "+tmp);
+	}
+	if (rename(tmp.c_str(), filename.c_str()) == -1)
+		THROW(BrotException, "Could not rename "+tmp+": "+strerror(errno));
+}
+
+static void read_header(std::istream& is, const std::string& filename, unsigned char *header)
+{
+	is.read((char*)header, Checkpoint::HEADER);
+	if (!is)
+		THROW(BrotException, filename+" is not a checkpoint (too short)");
+	if (memcmp(header + H_MAGIC, MAGIC, sizeof MAGIC))
+		THROW(BrotException, filename+" is not a checkpoint");
+	if (get_le(header + H_VERSION) != Checkpoint::VERSION)
+		THROW(BrotException, filename+" is a checkpoint of an unknown version");
+	if (get_le(header + H_VALUE) != VALUE_KIND)
+		THROW(BrotException, filename+" was made on a different kind of machine");
+}
+
+Checkpoint::Info Checkpoint::read_info(const std::string& filename)
+{
+	std::ifstream fs(filename, std::fstream::in | std::fstream::binary);
+	if (!fs)
+		THROW(BrotException, "Could not open "+filename);
+	unsigned char header[HEADER];
+	read_header(fs, filename, header);
+
+	Info info;
+	info.fractal = get_str(header + H_FRACTAL);
+	const std::string arith = get_str(header + H_ARITH);
+	info.arith = Fractal::Maths::MathsType::MAX;
+	for (int i=0; i<(int)Fractal::Maths::MathsType::MAX; i++)
+		if (arith == Fractal::Maths::name((Fractal::Maths::MathsType)i))
+			info.arith = (Fractal::Maths::MathsType)i;
+	if (info.arith == Fractal::Maths::MathsType::MAX)
+		THROW(BrotException, filename+" needs maths type "+arith+", which this build doesn't have");
+	info.centre = Fractal::Point(str_value(header + H_CENTRE_RE), str_value(header + H_CENTRE_IM));
+	info.size = Fractal::Point(str_value(header + H_SIZE_RE), str_value(header + H_SIZE_IM));
+	info.width = get_le(header + H_WIDTH);
+	info.height = get_le(header + H_HEIGHT);
+	info.passes = get_le(header + H_PASSES);
+	info.maxiter = get_le(header + H_MAXITER);
+	info.finished = get_le(header + H_FINISHED) != 0;
+	return info;
+}
+
+void Checkpoint::restore(Plot3Plot& plot, const std::string& filename)
+{
+	const Info info = read_info(filename);
+	if (info.fractal != plot.fract.name || info.centre != plot.centre || info.size != plot.size
+			|| info.width != plot.width || info.height != plot.height)
+		THROW(BrotException, filename+" is a checkpoint of a different plot");
+	ASSERT(plot._chunks.empty()); // not yet started
+
+	std::ifstream fs(filename, std::fstream::in | std::fstream::binary);
+	if (!fs)
+		THROW(BrotException, "Could not open "+filename);
+	unsigned char header[HEADER];
+	read_header(fs, filename, header);
+
+	plot.divide(info.arith);
+	if (get_le(header + H_CHUNKS) != plot._chunks.size())
+		THROW(BrotException, filename+" was cut up differently");
+
+	std::shared_ptr<IterHistogram> histogram = std::make_shared<IterHistogram>();
+	for (auto chunk : plot._chunks) {
+		unsigned char ch[16];
+		fs.read((char*)ch, sizeof ch);
+		if (!fs)
+			THROW(BrotException, filename+" is truncated");
+		if (get_le(ch) != chunk->_offX || get_le(ch + 4) != chunk->_offY
+				|| get_le(ch + 8) != chunk->_width || get_le(ch + 12) != chunk->_height)
+			THROW(BrotException, filename+" was cut up differently");
+
+		// The origins aren't saved; this works them out again.
+		Fractal::PointData *data = chunk->restore_data();
+		unsigned char px[PIXEL_BYTES];
+		for (unsigned i=0; i<chunk->pixel_count(); i++) {
+			Fractal::PointData& pt = data[i];
+			fs.read((char*)px, PIXEL_BYTES);
+			const uint32_t iterf = get_le(px + 4);
+			pt.iter = (int32_t)get_le(px);
+			memcpy(&pt.iterf, &iterf, sizeof pt.iterf);
+			pt.nomore = px[8];
+			if (!pt.nomore) {
+				Fractal::Value re, im;
+				fs.read((char*)&re, sizeof re);
+				fs.read((char*)&im, sizeof im);
+				pt.point = Fractal::Point(re, im);
+			}
+			if (!fs)
+				THROW(BrotException, filename+" is truncated");
+		}
+		chunk->restored();
+		histogram->merge(chunk->histogram());
+	}
+
+	plot.plotted_passes = info.passes;
+	plot.plotted_maxiter = info.maxiter;
+	plot.plotted_finished = info.finished;
+	plot._restored = true;
+	plot.plotted_live = get_le(header + H_LIVE);
+	plot.maxiter_scale = get_le(header + H_SCALE);
+	plot.delta_threshold = get_le(header + H_DELTA);
+	if (info.passes)
+		plot._histogram = histogram;
+}
+
+} // namespace Plot3
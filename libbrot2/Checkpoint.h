@@ -0,0 +1,96 @@
+/*
+    Checkpoint.h: Saving a plot part way through, to carry on later
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <stdint.h>
+#include <string>
+#include "Fractal.h"
+#include "Plot3Plot.h"
+
+namespace Plot3 {
+
+/*
+ * Everything a Plot3Plot needs to carry on from the end of a pass, as if
+ * it had never stopped: every pixel's state, and where the schedule had
+ * got to. A long plot can then survive being killed, and a finished one
+ * can be taken further (see Plot3Plot::set_target_maxiter).
+ *
+ * The file is a 512-byte header, then each chunk in the order the
+ * divider made them: its offset and size (4 x uint32), then for each
+ * pixel its iter (int32), iterf (float32) and nomore (uint8), and if it's
+ * still live, the real and imaginary parts of its current point. Those
+ * are Fractal::Values as they are in memory, so a checkpoint is only good
+ * on the same kind of machine; the header says what kind, and we refuse
+ * anything else. Everything else is little-endian.
+ *
+ * Header:
+ *    0  char[8]  "brot2ckp"
+ *    8  uint32   format version (2)
+ *   12  uint32   width
+ *   16  uint32   height
+ *   20  uint32   passes plotted
+ *   24  uint32   maxiter of the last pass
+ *   28  uint32   how much more the next pass's maxiter will be
+ *   32  uint32   the delta threshold, as the passes have left it
+ *   36  uint32   live pixels
+ *   40  uint32   chunks
+ *   44  uint32   sizeof(Fractal::Value), plus 0x100 if big-endian
+ *   48  uint32   1 if the plot decided it had finished, else 0
+ *   52  char[64] fractal name
+ *  116  char[64] maths type name
+ *  180  char[64] x4  centre real, centre imaginary, axis length real,
+ *                    axis length imaginary; as decimal, to full precision
+ * The strings are NUL-padded. The rest of the header is zero.
+ */
+class Checkpoint {
+public:
+	static const uint32_t VERSION = 2;
+	static const unsigned HEADER = 512;
+	static const unsigned NAME_LEN = 64;
+
+	/* What a checkpoint is of; enough to construct the plot to restore() */
+	struct Info {
+		std::string fractal;
+		Fractal::Maths::MathsType arith;
+		Fractal::Point centre, size;
+		unsigned width, height;
+		unsigned passes, maxiter;
+		bool finished; // Resuming won't plot any more passes unless asked to
+	};
+
+	/* Saves plot. It must be between passes (call this from its
+	 * set_checkpoint function) or stopped, and not retiring its chunks.
+	 * The file is written under a temporary name and renamed into place,
+	 * so whatever is there is always a whole checkpoint. Throws
+	 * BrotException if it can't be written. */
+	static void write(const Plot3Plot& plot, const std::string& filename);
+
+	/* Reads just the header. Throws BrotException if it's not one of ours. */
+	static Info read_info(const std::string& filename);
+
+	/* Loads a checkpoint into plot, which must be the plot read_info()
+	 * describes and not yet started; then start(info.arith) carries on
+	 * from it. Throws BrotException if anything doesn't match. */
+	static void restore(Plot3Plot& plot, const std::string& filename);
+};
+
+} // namespace Plot3
+
+#endif /* CHECKPOINT_H_ */
@@ -0,0 +1,124 @@
+/*
+    ChunkOrdering.cpp: Decides which order the chunks of a Plot3 are run in
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ChunkOrdering.h"
+#include <stdint.h>
+#include <utility>
+
+namespace Plot3 {
+namespace ChunkOrdering {
+
+	Base* Base::create(int which) {
+		switch(which) {
+#define CREATE(_num,_class,_str) case _num: return new _class();
+			ALL_CHUNK_ORDERINGS(CREATE)
+#undef CREATE
+		}
+		return 0;
+	}
+
+	std::string Base::name(int which) {
+		switch(which) {
+#define NAMEIT(_num,_class,_str) case _num: return _str;
+			ALL_CHUNK_ORDERINGS(NAMEIT)
+#undef NAMEIT
+		}
+		return "???";
+	}
+
+	/* The middle pixel of a chunk, in plot pixels with a TOP-left origin
+	 * (chunk offsets are bottom-left, but the curves look better if they
+	 * start at the top, same as the dividers do). */
+	static inline void chunk_middle(const Plot3Chunk& c, unsigned height, unsigned& x, unsigned& y) {
+		x = c._offX + c._width/2;
+		unsigned blo = c._offY + c._height/2;
+		y = (blo < height) ? height - 1 - blo : 0;
+	}
+
+	static inline double distance2(const Plot3Chunk& c, double x, double y) {
+		// Compares bottom-left-origin positions, so no flip needed here.
+		double dx = c._offX + c._width/2.0 - x,
+			   dy = c._offY + c._height/2.0 - y;
+		return dx*dx + dy*dy;
+	}
+
+	double AsDivided::key(const Plot3Chunk&, unsigned, unsigned) const {
+		return 0; // all equal, so the tie-break gives us divider order
+	}
+
+	double CentreFirst::key(const Plot3Chunk& c, unsigned width, unsigned height) const {
+		return distance2(c, width/2.0, height/2.0);
+	}
+
+	void PointerFirst::set_focus(int x, int y) {
+		_x = x;
+		_y = y;
+		_valid = true;
+		touch();
+	}
+
+	void PointerFirst::clear_focus() {
+		_valid = false;
+		touch();
+	}
+
+	double PointerFirst::key(const Plot3Chunk& c, unsigned width, unsigned height) const {
+		if (!_valid)
+			return CentreFirst::key(c, width, height);
+		// A torn read of x and y doesn't matter, we'll be re-sorted again shortly.
+		return distance2(c, _x, _y);
+	}
+
+	double ZOrder::key(const Plot3Chunk& c, unsigned, unsigned height) const {
+		unsigned x, y;
+		chunk_middle(c, height, x, y);
+		// Interleave the bits. 26 bits apiece fits exactly in a double's mantissa.
+		uint64_t rv = 0;
+		for (unsigned i=0; i<26; i++) {
+			rv |= (uint64_t)((x >> i) & 1) << (2*i);
+			rv |= (uint64_t)((y >> i) & 1) << (2*i+1);
+		}
+		return rv;
+	}
+
+	double Hilbert::key(const Plot3Chunk& c, unsigned width, unsigned height) const {
+		unsigned x, y;
+		chunk_middle(c, height, x, y);
+		uint64_t n = 1;
+		while (n < width || n < height)
+			n <<= 1;
+		// Classic xy-to-distance conversion, see
+		// https://en.wikipedia.org/wiki/Hilbert_curve
+		uint64_t d = 0;
+		for (uint64_t s = n/2; s > 0; s /= 2) {
+			unsigned rx = (x & s) ? 1 : 0,
+					 ry = (y & s) ? 1 : 0;
+			d += s * s * ((3 * rx) ^ ry);
+			if (ry == 0) {
+				if (rx == 1) {
+					x = n-1 - x;
+					y = n-1 - y;
+				}
+				std::swap(x, y);
+			}
+		}
+		return d;
+	}
+
+} // Plot3::ChunkOrdering
+} // Plot3
@@ -0,0 +1,113 @@
+/*
+    ChunkOrdering.h: Decides which order the chunks of a Plot3 are run in
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHUNKORDERING_H_
+#define CHUNKORDERING_H_
+
+#include <atomic>
+#include <string>
+#include "Plot3Chunk.h"
+
+namespace Plot3 {
+
+namespace ChunkOrdering {
+
+// Second-order macro listing the known orderings.
+// DO macro takes three args: numeric constant, class name, friendly string.
+// The numbers are what we store in the prefs, so don't renumber them.
+#define ALL_CHUNK_ORDERINGS(DO) \
+	DO(0, AsDivided, "As divided") \
+	DO(1, CentreFirst, "Centre first") \
+	DO(2, PointerFirst, "Pointer first") \
+	DO(3, ZOrder, "Z-order") \
+	DO(4, Hilbert, "Hilbert curve")
+
+	class Base {
+		/*
+		 * An ordering assigns each chunk a key; a Plot3Pass runs the
+		 * chunks with the lowest keys first. Chunks with equal keys are run
+		 * in the order the ChunkDivider produced them.
+		 *
+		 * Orderings may change their mind while a pass is running (say,
+		 * because the mouse pointer moved). When they do, they bump their
+		 * generation count and the pass re-sorts whatever it hasn't yet
+		 * started.
+		 */
+		std::atomic<unsigned> _generation;
+	protected:
+		void touch() { ++_generation; }
+	public:
+		Base() : _generation(0) {}
+		virtual ~Base() {}
+
+		/* Computes the sort key for a chunk within a plot of the given
+		 * size in pixels. May be called from any thread. */
+		virtual double key(const Plot3Chunk& chunk, unsigned width, unsigned height) const = 0;
+
+		unsigned generation() const { return _generation; }
+
+		/* Factory. Returns a new instance of the numbered ordering (see
+		 * ALL_CHUNK_ORDERINGS), or 0 if the number is not known.
+		 * Caller must delete. */
+		static Base* create(int which);
+		static std::string name(int which);
+		static const int MIN = 0;
+		static const int MAX = 4;
+	};
+
+	/* The order the ChunkDivider produced them in, i.e. the old behaviour. */
+	class AsDivided: public Base {
+	public:
+		virtual double key(const Plot3Chunk& chunk, unsigned width, unsigned height) const;
+	};
+
+	/* Nearest the middle of the plot first. */
+	class CentreFirst: public Base {
+	public:
+		virtual double key(const Plot3Chunk& chunk, unsigned width, unsigned height) const;
+	};
+
+	/* Nearest a focus point first; behaves as CentreFirst if there isn't one.
+	 * The focus is in plot pixels, bottom-left origin (as pixel_to_set_blo). */
+	class PointerFirst: public CentreFirst {
+		std::atomic<int> _x, _y;
+		std::atomic<bool> _valid;
+	public:
+		PointerFirst() : _x(0), _y(0), _valid(false) {}
+		void set_focus(int x, int y);
+		void clear_focus();
+		virtual double key(const Plot3Chunk& chunk, unsigned width, unsigned height) const;
+	};
+
+	/* Morton order: chunks close together in the plot are run close together in time. */
+	class ZOrder: public Base {
+	public:
+		virtual double key(const Plot3Chunk& chunk, unsigned width, unsigned height) const;
+	};
+
+	/* Like ZOrder, but successive chunks are always neighbours. */
+	class Hilbert: public Base {
+	public:
+		virtual double key(const Plot3Chunk& chunk, unsigned width, unsigned height) const;
+	};
+
+} // Plot3::ChunkOrdering
+
+} // Plot3
+
+#endif // CHUNKORDERING_H_
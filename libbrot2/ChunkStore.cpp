@@ -0,0 +1,104 @@
+/*
+    ChunkStore.cpp: Chunk pixel data in a scratch file
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ChunkStore.h"
+#include "Plot3Chunk.h"
+#include "Exception.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+namespace Plot3 {
+
+ChunkStore::ChunkStore(const std::list<Plot3Chunk*>& chunks, const std::string& dir) :
+	_fd(-1), _map(MAP_FAILED), _size(0), _page(sysconf(_SC_PAGESIZE))
+{
+	for (auto chunk : chunks)
+		_size += whole(chunk->pixel_count() * sizeof(Fractal::PointData));
+	ASSERT(_size > 0);
+
+	std::string name = dir + "/brot2-chunks-XXXXXX";
+	std::vector<char> tmpl(name.begin(), name.end());
+	tmpl.push_back(0);
+	_fd = mkstemp(&tmpl[0]);
+	if (_fd == -1)
+		THROW(BrotException, "Could not create a scratch file in "+dir+": "+strerror(errno));
+	unlink(&tmpl[0]);
+	// Sparse, so the disk only fills as the chunks do
+	if (ftruncate(_fd, _size) == -1) {
+		int err = errno;
+		close(_fd);
+		THROW(BrotException, std::string("Could not size the scratch file: ")+strerror(err));
+	}
+	_map = mmap(0, _size, PROT_READ|PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (_map == MAP_FAILED) {
+		int err = errno;
+		close(_fd);
+		THROW(BrotException, std::string("Could not map the scratch file: ")+strerror(err));
+	}
+
+	size_t offset = 0;
+	for (auto chunk : chunks) {
+		const size_t bytes = chunk->pixel_count() * sizeof(Fractal::PointData);
+		chunk->set_store(this, offset);
+		offset += whole(bytes);
+	}
+}
+
+ChunkStore::~ChunkStore()
+{
+	munmap(_map, _size);
+	close(_fd);
+}
+
+std::string ChunkStore::default_dir()
+{
+	const char *tmp = getenv("TMPDIR");
+	if (tmp && *tmp)
+		return tmp;
+	return "/tmp";
+}
+
+void ChunkStore::page_out(void *p, size_t bytes) const
+{
+	// Only a hint, so no matter if it doesn't take.
+#ifdef MADV_PAGEOUT
+	if (madvise(p, whole(bytes), MADV_PAGEOUT) == 0)
+		return;
+#endif
+	// Shared file pages aren't lost by this, only unmapped; the kernel
+	// then writes them back and reclaims them as it sees fit.
+	msync(p, whole(bytes), MS_ASYNC);
+	madvise(p, whole(bytes), MADV_DONTNEED);
+}
+
+void ChunkStore::discard(void *p, size_t bytes) const
+{
+#ifdef MADV_REMOVE
+	if (madvise(p, whole(bytes), MADV_REMOVE) == 0)
+		return;
+#endif
+	// Not every filesystem can punch holes. The blocks stay until we
+	// go, then, but the pages can at least be reclaimed.
+	madvise(p, whole(bytes), MADV_DONTNEED);
+}
+
+} // namespace Plot3
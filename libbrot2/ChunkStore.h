@@ -0,0 +1,84 @@
+/*
+    ChunkStore.h: Chunk pixel data in a scratch file
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHUNKSTORE_H_
+#define CHUNKSTORE_H_
+
+#include <stddef.h>
+#include <list>
+#include <string>
+
+namespace Plot3 {
+
+class Plot3Chunk;
+
+/*
+ * Somewhere other than the heap for chunks to keep their pixels: a scratch
+ * file, mapped into memory. The kernel can then write out whatever we
+ * aren't using and page it back in when we are, so a plot too big for
+ * memory runs at disk speed rather than getting us killed. (See
+ * PREF(PlotMemoryBudget), which is what makes a Plot3Plot use one.)
+ *
+ * Each chunk gets a page-aligned slot of its own, so we can tell the
+ * kernel about a chunk at a time: once all its pixels have escaped it has
+ * no more work to do, so its pages are the first to go; once it has been
+ * released, they're thrown away, disk blocks and all.
+ *
+ * The file is unlinked as soon as it's made, so it goes away with us,
+ * however we go.
+ */
+class ChunkStore {
+public:
+	/* Makes room for all of chunks' pixels (and calls their set_store()),
+	 * in a file in dir. Throws BrotException if it can't. */
+	ChunkStore(const std::list<Plot3Chunk*>& chunks, const std::string& dir);
+	virtual ~ChunkStore();
+
+	/* $TMPDIR, or /tmp */
+	static std::string default_dir();
+
+	/* How big the file is; a little more than the pixels, as every slot
+	 * is a whole number of pages. */
+	size_t size() const { return _size; }
+
+	/* Where the slot at offset is. */
+	void *at(size_t offset) const { return static_cast<char*>(_map) + offset; }
+
+	/* The slot at p (bytes long, as given to set_store) won't be looked at
+	 * for a while: write it out and drop it from memory. Its contents are
+	 * kept. */
+	void page_out(void *p, size_t bytes) const;
+	/* The slot at p is finished with; its contents are lost. */
+	void discard(void *p, size_t bytes) const;
+
+private:
+	ChunkStore(const ChunkStore&) = delete;
+	const ChunkStore& operator= (const ChunkStore&) = delete;
+
+	int _fd;
+	void *_map;
+	size_t _size;
+	size_t _page;
+
+	/* The whole pages that make up a slot */
+	size_t whole(size_t bytes) const { return (bytes + _page - 1) / _page * _page; }
+};
+
+} // namespace Plot3
+
+#endif /* CHUNKSTORE_H_ */
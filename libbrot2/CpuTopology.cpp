@@ -0,0 +1,205 @@
+/*
+    CpuTopology.cpp: Where on the machine should the plot threads run?
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "CpuTopology.h"
+#include "ThreadPool.h"
+#include "Prefs.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace CpuTopology {
+
+	static const std::string SYS_CPU = "/sys/devices/system/cpu";
+	static const std::string SYS_NODE = "/sys/devices/system/node";
+
+	static std::string read_line(const std::string& path) {
+		std::ifstream f(path.c_str());
+		std::string rv;
+		if (f)
+			std::getline(f, rv);
+		return rv;
+	}
+
+	static int read_int(const std::string& path, int dflt) {
+		std::string s = read_line(path);
+		char *end;
+		long rv = strtol(s.c_str(), &end, 10);
+		if (s.empty() || end == s.c_str())
+			return dflt;
+		return (int)rv;
+	}
+
+	std::vector<int> parse_cpulist(const std::string& list) {
+		std::vector<int> rv;
+		std::istringstream ss(list);
+		std::string item;
+		while (std::getline(ss, item, ',')) {
+			char *end;
+			long lo = strtol(item.c_str(), &end, 10);
+			if (end == item.c_str() || lo < 0)
+				continue;
+			long hi = lo;
+			if (*end == '-') {
+				const char *p = end+1;
+				hi = strtol(p, &end, 10);
+				if (end == p || hi < lo)
+					continue;
+			}
+			for (long i=lo; i<=hi; i++)
+				rv.push_back((int)i);
+		}
+		return rv;
+	}
+
+	std::vector<Cpu> available() {
+		std::vector<int> online = parse_cpulist(read_line(SYS_CPU + "/online"));
+		if (online.empty()) {
+			long n = sysconf(_SC_NPROCESSORS_ONLN);
+			if (n < 1) n = 1;
+			for (long i=0; i<n; i++)
+				online.push_back((int)i);
+		}
+
+		std::map<int,int> node_of;
+		for (int node : parse_cpulist(read_line(SYS_NODE + "/online"))) {
+			std::ostringstream path;
+			path << SYS_NODE << "/node" << node << "/cpulist";
+			for (int c : parse_cpulist(read_line(path.str())))
+				node_of[c] = node;
+		}
+
+#ifdef __linux__
+		cpu_set_t mask;
+		CPU_ZERO(&mask);
+		bool have_mask = (0 == sched_getaffinity(0, sizeof mask, &mask));
+#endif
+
+		std::vector<Cpu> rv;
+		for (int c : online) {
+#ifdef __linux__
+			if (have_mask && c < CPU_SETSIZE && !CPU_ISSET(c, &mask))
+				continue;
+#endif
+			std::ostringstream topo;
+			topo << SYS_CPU << "/cpu" << c << "/topology/";
+			Cpu cpu;
+			cpu.id = c;
+			cpu.node = node_of.count(c) ? node_of[c] : 0;
+			cpu.package = read_int(topo.str() + "physical_package_id", 0);
+			cpu.core = read_int(topo.str() + "core_id", c);
+			rv.push_back(cpu);
+		}
+		if (rv.empty()) {
+			Cpu cpu = { 0, 0, 0, 0 };
+			rv.push_back(cpu);
+		}
+		return rv;
+	}
+
+	/* Which SMT sibling is this CPU within its core? The lowest-numbered
+	 * CPU of each core gets rank 0, the next rank 1, and so on. */
+	static std::vector<unsigned> smt_rank(const std::vector<Cpu>& cpus) {
+		std::vector<unsigned> rv(cpus.size(), 0);
+		for (unsigned i=0; i<cpus.size(); i++)
+			for (unsigned j=0; j<cpus.size(); j++)
+				if (cpus[j].package == cpus[i].package && cpus[j].core == cpus[i].core
+						&& cpus[j].id < cpus[i].id)
+					++rv[i];
+		return rv;
+	}
+
+	unsigned physical_cores(const std::vector<Cpu>& cpus) {
+		std::set<std::pair<int,int> > cores;
+		for (auto it = cpus.begin(); it != cpus.end(); it++)
+			cores.insert(std::make_pair(it->package, it->core));
+		return cores.size();
+	}
+
+	Plan plan(const std::vector<Cpu>& all, unsigned nthreads,
+			bool pin, bool numa, bool physical_only) {
+		Plan rv;
+		rv.cpus.resize(nthreads);
+		rv.partition.assign(nthreads, 0);
+		if (!nthreads || all.empty() || !(pin || numa || physical_only))
+			return rv; // Let the kernel get on with it.
+
+		// Put the first sibling of every core ahead of any second siblings.
+		std::vector<unsigned> rank = smt_rank(all);
+		std::vector<std::pair<unsigned,const Cpu*> > sorted;
+		for (unsigned i=0; i<all.size(); i++) {
+			if (physical_only && rank[i] > 0)
+				continue;
+			sorted.push_back(std::make_pair(rank[i], &all[i]));
+		}
+		std::stable_sort(sorted.begin(), sorted.end(),
+				[](const std::pair<unsigned,const Cpu*>& a, const std::pair<unsigned,const Cpu*>& b) {
+					return a.first < b.first;
+				});
+
+		// Group by node, then deal them out round-robin.
+		std::map<int, std::vector<const Cpu*> > by_node;
+		for (auto it = sorted.begin(); it != sorted.end(); it++)
+			by_node[numa ? it->second->node : 0].push_back(it->second);
+		std::vector<const Cpu*> order;
+		std::vector<int> order_part;
+		for (unsigned i=0; order.size() < sorted.size(); i++) {
+			int part = 0;
+			for (auto it = by_node.begin(); it != by_node.end(); it++, part++) {
+				if (i < it->second.size()) {
+					order.push_back(it->second[i]);
+					order_part.push_back(part);
+				}
+			}
+		}
+
+		for (unsigned w=0; w<nthreads; w++) {
+			unsigned slot = w % order.size();
+			const Cpu* c = order[slot];
+			if (pin)
+				rv.cpus[w].push_back(c->id);
+			else {
+				// Anywhere within our node (or anywhere we're allowed, if not numa)
+				const std::vector<const Cpu*>& peers = by_node[numa ? c->node : 0];
+				for (auto it = peers.begin(); it != peers.end(); it++)
+					rv.cpus[w].push_back((*it)->id);
+				std::sort(rv.cpus[w].begin(), rv.cpus[w].end());
+			}
+			if (numa)
+				rv.partition[w] = order_part[slot];
+		}
+		return rv;
+	}
+
+	std::shared_ptr<ThreadPool> make_threadpool(std::shared_ptr<const BrotPrefs::Prefs> prefs) {
+		unsigned n = BrotPrefs::threadpool_size(prefs);
+		Plan p = plan(available(), n,
+				prefs->get(PREF(PinThreads)),
+				prefs->get(PREF(NumaPartitions)),
+				prefs->get(PREF(PhysicalCoresOnly)));
+		return std::shared_ptr<ThreadPool>(new ThreadPool(n, p.cpus, p.partition));
+	}
+
+} // CpuTopology
@@ -0,0 +1,74 @@
+/*
+    CpuTopology.h: Where on the machine should the plot threads run?
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CPUTOPOLOGY_H_
+#define CPUTOPOLOGY_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+namespace BrotPrefs {
+	class Prefs;
+}
+
+namespace CpuTopology {
+
+	struct Cpu {
+		int id;      // as the kernel numbers it
+		int node;    // NUMA node
+		int package; // physical socket
+		int core;    // core within the package; SMT siblings share this
+	};
+
+	/* The CPUs this process is allowed to run on, as described by sysfs.
+	 * Never empty: if we can't find out, we pretend there's a single flat
+	 * node with one core per online CPU.
+	 * N.B. Linux-specific; ports to other OSes need different code. */
+	std::vector<Cpu> available();
+
+	/* Parses a kernel CPU list ("0-3,8,10-11"). Garbage is ignored. */
+	std::vector<int> parse_cpulist(const std::string& list);
+
+	/* How many physical cores (i.e. not counting SMT siblings) are there? */
+	unsigned physical_cores(const std::vector<Cpu>& cpus);
+
+	struct Plan {
+		// The CPUs each worker may run on. Empty means "anywhere".
+		std::vector< std::vector<int> > cpus;
+		// Each worker's NUMA partition: a compact index, 0 to nodes-1.
+		std::vector<int> partition;
+	};
+
+	/* Decides where each of a pool's worker threads should run.
+	 *  pin: one CPU per worker.
+	 *  numa: each worker stays within one NUMA node; workers are dealt out
+	 *        round-robin across nodes.
+	 *  physical_only: never use a core's SMT siblings.
+	 * Workers are spread across physical cores before any core gets a
+	 * second thread. If there are more workers than CPUs, we wrap round. */
+	Plan plan(const std::vector<Cpu>& cpus, unsigned nthreads,
+			bool pin, bool numa, bool physical_only);
+
+	/* Helper: Creates a ThreadPool sized and placed according to prefs. */
+	std::shared_ptr<ThreadPool> make_threadpool(std::shared_ptr<const BrotPrefs::Prefs> prefs);
+
+} // CpuTopology
+
+#endif // CPUTOPOLOGY_H_
@@ -0,0 +1,127 @@
+/*
+    EqualisedPalette.cpp: Histogram-equalised colouring with any palette
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "EqualisedPalette.h"
+#include <algorithm>
+#include <limits.h>
+#include <math.h>
+
+using namespace Plot3;
+
+EqualisedPalette::EqualisedPalette(const BasePalette& base) :
+	BasePalette("Equalised " + base.name), _base(base)
+{
+}
+
+EqualisedPalette::~EqualisedPalette()
+{
+}
+
+void EqualisedPalette::set_histogram(std::shared_ptr<const IterHistogram> histogram)
+{
+	std::shared_ptr<Table> table;
+	if (histogram && histogram->total()) {
+		table = std::make_shared<Table>();
+		table->histogram = histogram;
+
+		const unsigned n = histogram->bins();
+		unsigned first = 0, last = n-1;
+		while (!histogram->count(first))
+			++first;
+		while (!histogram->count(last))
+			--last;
+
+		const BakeAxis axis = _base.bake_axis();
+		const bool periodic = axis.kind == BakeAxis::ITER_PERIODIC || axis.kind == BakeAxis::ITERF_PERIODIC;
+		double lo, hi;
+		if (periodic) {
+			lo = 0;
+			hi = axis.param;
+		} else {
+			lo = std::max(IterHistogram::bin_floor(first), Fractal::PointData::ITERF_LOW_CLAMP);
+			hi = last+1 < n ? IterHistogram::bin_floor(last+1) : IterHistogram::bin_floor(last);
+			if (hi <= lo)
+				hi = lo * 2;
+		}
+
+		table->iterf.resize(n+1);
+		uint64_t below = 0;
+		for (unsigned i=0; i<=n; i++) {
+			const double rank = (double)below / histogram->total();
+			table->iterf[i] = periodic ? lo + rank * (hi - lo) : lo * pow(hi / lo, rank);
+			if (i < n)
+				below += histogram->count(i);
+		}
+		if (periodic) // the very top would wrap round to the bottom
+			table->iterf[n] = nextafterf(hi, 0);
+	}
+	std::atomic_store(&_table, std::shared_ptr<const Table>(table));
+}
+
+std::shared_ptr<const IterHistogram> EqualisedPalette::histogram() const
+{
+	std::shared_ptr<const Table> t = std::atomic_load(&_table);
+	return t ? t->histogram : std::shared_ptr<const IterHistogram>();
+}
+
+inline void EqualisedPalette::remap(const Table& t, const Fractal::PointData &in, Fractal::PointData &out)
+{
+	const unsigned b = IterHistogram::bin(in.iterf);
+	const float frac = IterHistogram::bin_fraction(in.iterf);
+	out.iterf = t.iterf[b] + (t.iterf[b+1] - t.iterf[b]) * frac;
+	out.iter = out.iterf < INT_MAX ? (int)out.iterf : INT_MAX;
+	out.nomore = true;
+}
+
+Fractal::PointData EqualisedPalette::remap(const Fractal::PointData &pt) const
+{
+	std::shared_ptr<const Table> t = std::atomic_load(&_table);
+	Fractal::PointData rv(pt);
+	if (t && pt.iterf >= 0)
+		remap(*t, pt, rv);
+	return rv;
+}
+
+rgb EqualisedPalette::get(const Fractal::PointData &pt) const
+{
+	return _base.get(remap(pt));
+}
+
+void EqualisedPalette::get_span(const Fractal::PointData *pts, unsigned n, int local_inf, rgb *out) const
+{
+	const BasePalette& base = _base.baked();
+	std::shared_ptr<const Table> t = std::atomic_load(&_table);
+	if (!t) {
+		base.get_span(pts, n, local_inf, out);
+		return;
+	}
+	// Remapped a few at a time, so the base palette can do its span loop
+	static const unsigned BATCH = 64;
+	Fractal::PointData buf[BATCH];
+	for (unsigned done = 0; done < n; done += BATCH) {
+		const unsigned m = std::min(BATCH, n - done);
+		for (unsigned i=0; i<m; i++) {
+			const Fractal::PointData& pt = pts[done+i];
+			if (pt.iter == local_inf || pt.iterf < 0)
+				buf[i].mark_infinite();
+			else
+				remap(*t, pt, buf[i]);
+		}
+		base.get_span(buf, m, -1, out + done);
+	}
+}
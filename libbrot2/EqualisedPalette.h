@@ -0,0 +1,76 @@
+/*
+    EqualisedPalette.h: Histogram-equalised colouring with any palette
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EQUALISEDPALETTE_H_
+#define EQUALISEDPALETTE_H_
+
+#include <memory>
+#include <vector>
+#include "palette.h"
+#include "IterHistogram.h"
+
+/*
+ * Colours by rank rather than by iterf: each escaped pixel's iterf is
+ * replaced by where it comes in the plot's histogram, scaled to suit the
+ * underlying palette, so every part of the palette gets an equal share of
+ * the picture whatever the zoom level.
+ *
+ * - A palette that repeats (BakeAxis ITER_PERIODIC or ITERF_PERIODIC)
+ *   gets one period, from the first pixel to escape to the last.
+ * - Anything else gets the plot's own range of iterf, spread out evenly
+ *   on a log scale.
+ *
+ * The histogram comes from the plot as each pass completes (see
+ * IPlot3DataSink::pass_complete), so there's no scan over the picture to
+ * build it. Until we have one, we colour just as the underlying palette.
+ */
+class EqualisedPalette : public BasePalette {
+public:
+	// The base palette must outlive us.
+	EqualisedPalette(const BasePalette& base);
+	virtual ~EqualisedPalette();
+
+	/* Thread-safe, even against get() and get_span(). */
+	void set_histogram(std::shared_ptr<const Plot3::IterHistogram> histogram);
+	std::shared_ptr<const Plot3::IterHistogram> histogram() const;
+
+	virtual rgb get(const Fractal::PointData &pt) const;
+	virtual void get_span(const Fractal::PointData *pts, unsigned n, int local_inf, rgb *out) const;
+
+	const BasePalette& base() const { return _base; }
+
+	/* The point the base palette is asked about, in place of pt.
+	 * Infinite points (iterf < 0) are left alone. */
+	Fractal::PointData remap(const Fractal::PointData &pt) const;
+
+private:
+	const BasePalette& _base;
+
+	/* What we've worked out from a histogram: the iterf to give the base
+	 * palette at the bottom of each bin, and the top of the last. Within a
+	 * bin we interpolate, as we don't know any better. */
+	struct Table {
+		std::shared_ptr<const Plot3::IterHistogram> histogram;
+		std::vector<float> iterf;
+	};
+	std::shared_ptr<const Table> _table; // Only with std::atomic_load/store; may be null
+
+	static inline void remap(const Table& t, const Fractal::PointData &in, Fractal::PointData &out);
+};
+
+#endif /* EQUALISEDPALETTE_H_ */
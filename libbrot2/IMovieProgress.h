@@ -43,7 +43,7 @@ class IMovieProgressReporter : public Plot3::IPlot3DataSink {
 
 		// We also inherit from  Plot3::IPlot3DataSink:
 		// virtual void chunk_done(Plot3::Plot3Chunk* job) = 0;
-		// virtual void pass_complete(std::string& msg, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels) = 0;
+		// virtual void pass_complete(std::string& msg, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels, std::shared_ptr<const Plot3::IterHistogram> histogram) = 0;
 		// virtual void plot_complete() = 0; // One plot = one FRAME of the movie.
 
 		virtual ~IMovieProgressReporter() {}
@@ -58,7 +58,7 @@ class MovieNullProgress : public IMovieProgressReporter {
 		virtual void set_chunks_count(int);
 		virtual void frames_traversed(int);
 		virtual void chunk_done(Plot3::Plot3Chunk*);
-		virtual void pass_complete(std::string&, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels);
+		virtual void pass_complete(std::string&, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels, std::shared_ptr<const Plot3::IterHistogram> histogram);
 		virtual void plot_complete();
 };
 
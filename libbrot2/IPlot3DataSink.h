@@ -19,11 +19,13 @@
 #ifndef IPLOT3DATASINK_H_
 #define IPLOT3DATASINK_H_
 
+#include <memory>
 #include <string>
 
 namespace Plot3 {
 
 class Plot3Chunk;
+class IterHistogram;
 
 class IPlot3DataSink {
 public:
@@ -33,11 +35,19 @@ public:
 	 * require. */
 	virtual void chunk_done(Plot3Chunk* job) = 0;
 
+	/**Optional. When behind an AsyncDataSink, called after each batch of
+	 * chunk_done() calls; a good moment to update progress displays.
+	 * Never called when the plot delivers to us directly. */
+	virtual void batch_done() {}
+
 	/**Signals that a pass is completed.
 	 * The string provides optional commentary about the plot so far.
+	 * The histogram covers every pixel that has escaped so far (see
+	 * Plot3Plot::histogram()); it's ours to keep.
 	 * The implementor should not take too long here, as the next pass won't
 	 * start until this function returns. */
-	virtual void pass_complete(std::string&, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels) = 0;
+	virtual void pass_complete(std::string&, unsigned passes_plotted, unsigned maxiter, unsigned pixels_still_live, unsigned total_pixels,
+			std::shared_ptr<const IterHistogram> histogram) = 0;
 
 	/**Signals that the plot has finished work.
 	 * It might have completed, or it might have been told to stop. */
@@ -0,0 +1,57 @@
+/*
+    IterHistogram.cpp: How a plot's escaped pixels are spread over iterf
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "IterHistogram.h"
+#include "Exception.h"
+#include <algorithm>
+
+namespace Plot3 {
+
+const uint32_t IterHistogram::_base;
+const uint32_t IterHistogram::_top;
+const unsigned IterHistogram::_nbins;
+
+IterHistogram::IterHistogram() : _counts(_nbins, 0), _total(0)
+{
+	ASSERT(bin_floor(0) <= Fractal::PointData::ITERF_LOW_CLAMP);
+}
+
+void IterHistogram::merge(const IterHistogram& other)
+{
+	ASSERT(other._counts.size() == _counts.size());
+	for (unsigned i=0; i<_counts.size(); i++)
+		_counts[i] += other._counts[i];
+	_total += other._total;
+}
+
+void IterHistogram::clear()
+{
+	std::fill(_counts.begin(), _counts.end(), 0);
+	_total = 0;
+}
+
+float IterHistogram::bin_floor(unsigned bin)
+{
+	ASSERT(bin < _nbins);
+	uint32_t u = _base + (bin << SHIFT);
+	float rv;
+	memcpy(&rv, &u, sizeof rv);
+	return rv;
+}
+
+} // namespace Plot3
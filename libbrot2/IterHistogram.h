@@ -0,0 +1,92 @@
+/*
+    IterHistogram.h: How a plot's escaped pixels are spread over iterf
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ITERHISTOGRAM_H_
+#define ITERHISTOGRAM_H_
+
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include "Fractal.h"
+
+namespace Plot3 {
+
+/*
+ * A histogram of iterf over the pixels that have escaped.
+ *
+ * iterf runs over many orders of magnitude, so the bins are logarithmic:
+ * like BakedPalette's ITERF_LOG tables, we index by the top bits of the
+ * float, which gives BINS_PER_OCTAVE bins per power of two from 2^-14
+ * (just below ITERF_LOW_CLAMP) to 2^31 (more than any maxiter). Anything
+ * past the top goes in the last bin.
+ *
+ * Each chunk keeps its own, so adding to it needs no locking; the plot
+ * adds them up when the pass is done (see Plot3Plot::histogram()).
+ */
+class IterHistogram {
+public:
+	static const unsigned MANTISSA_BITS = 4;
+	static const unsigned BINS_PER_OCTAVE = 1 << MANTISSA_BITS;
+
+	IterHistogram();
+
+	/* Counts one escaped pixel. iterf must be at least ITERF_LOW_CLAMP,
+	 * as Plot3Chunk makes sure it is. */
+	inline void add(float iterf) {
+		++_counts[bin(iterf)];
+		++_total;
+	}
+	void merge(const IterHistogram& other);
+	void clear();
+
+	uint64_t total() const { return _total; }
+	unsigned bins() const { return _counts.size(); }
+	uint32_t count(unsigned bin) const { return _counts[bin]; }
+
+	/* Which bin an iterf goes in, and how far through it (0..1). */
+	static inline unsigned bin(float iterf) {
+		uint32_t u = float_bits(iterf);
+		return u <= _base ? 0 : u >= _top ? _nbins - 1 : (u - _base) >> SHIFT;
+	}
+	static inline float bin_fraction(float iterf) {
+		uint32_t u = float_bits(iterf);
+		if (u <= _base || u >= _top)
+			return 0;
+		return ((u - _base) & ((1u << SHIFT) - 1)) / (float)(1u << SHIFT);
+	}
+	/* The lowest iterf that goes in a bin. The last bin (at 2^31) has no top. */
+	static float bin_floor(unsigned bin);
+
+private:
+	static const unsigned SHIFT = 23 - MANTISSA_BITS; // float has 23 mantissa bits
+	static const uint32_t _base = (127 - 14) << 23; // bit pattern of 2^-14
+	static const uint32_t _top = (127 + 31) << 23; // and of 2^31
+	static const unsigned _nbins = ((_top - _base) >> SHIFT) + 1;
+	std::vector<uint32_t> _counts;
+	uint64_t _total;
+
+	static inline uint32_t float_bits(float f) {
+		uint32_t rv;
+		memcpy(&rv, &f, sizeof rv);
+		return rv;
+	}
+};
+
+} // namespace Plot3
+
+#endif /* ITERHISTOGRAM_H_ */
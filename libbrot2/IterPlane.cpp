@@ -0,0 +1,87 @@
+/*
+    IterPlane.cpp: A compact copy of a plot's results, for quick recolouring
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "IterPlane.h"
+#include "Exception.h"
+
+namespace Render2 {
+
+using namespace Plot3;
+
+void IterPlane::reset(unsigned width, unsigned height) {
+	std::unique_lock<std::mutex> lock(_lock);
+	_width = width;
+	_height = height;
+	Plot3Chunk::Sample infinite;
+	infinite.iter = -1;
+	infinite.iterf = -1;
+	_data.assign(width * height, infinite);
+	_ss.clear();
+}
+
+void IterPlane::update(const Plot3Chunk& chunk, Base* target) {
+	ASSERT(chunk._offX + chunk._width <= _width);
+	ASSERT(chunk._offY + chunk._height <= _height);
+	std::unique_lock<std::mutex> lock(_lock);
+
+	const Fractal::PointData* src = chunk.get_data();
+	for (unsigned j=0; j<chunk._height; j++) {
+		const unsigned base = (chunk._offY + j) * _width + chunk._offX;
+		Plot3Chunk::Sample* dst = &_data[base];
+		for (unsigned i=0; i<chunk._width; i++, src++) {
+			dst[i].iter = src->iter;
+			dst[i].iterf = src->iterf;
+		}
+		_ss.erase(_ss.lower_bound(base), _ss.lower_bound(base + chunk._width));
+	}
+
+	const std::vector<unsigned>& pixels = chunk.ss_pixels();
+	const unsigned nsamples = chunk.ss_factor() * chunk.ss_factor();
+	for (unsigned n=0; n<pixels.size(); n++) {
+		const unsigned i = pixels[n] % chunk._width, j = pixels[n] / chunk._width;
+		const Plot3Chunk::Sample* s = chunk.ss_samples(n);
+		_ss[(chunk._offY + j) * _width + chunk._offX + i].assign(s, s + nsamples);
+	}
+
+	if (target)
+		target->process(chunk);
+}
+
+void IterPlane::update(const std::list<Plot3Chunk*>& chunks) {
+	for (auto chunk : chunks)
+		update(*chunk);
+}
+
+void IterPlane::recolour(Base& target, const BasePalette* pal, ThreadPool& pool, QoS cls) {
+	std::unique_lock<std::mutex> lock(_lock);
+	if (pal)
+		target.fresh_palette(*pal);
+	target.process(*this, pool, cls);
+}
+
+void IterPlane::get_points(unsigned y, Fractal::PointData* out) const {
+	ASSERT(y < _height);
+	const Plot3Chunk::Sample* src = &_data[y * _width];
+	for (unsigned i=0; i<_width; i++) {
+		out[i].iter = src[i].iter;
+		out[i].iterf = src[i].iterf;
+		out[i].nomore = true;
+	}
+}
+
+} // namespace Render2
@@ -0,0 +1,91 @@
+/*
+    IterPlane.h: A compact copy of a plot's results, for quick recolouring
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ITERPLANE_H_
+#define ITERPLANE_H_
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include "Plot3Chunk.h"
+#include "Render2.h"
+#include "ThreadPool.h"
+
+namespace Render2 {
+
+/*
+ * Just what the palettes look at - iter and iterf - for every pixel of a
+ * plot, plus any adaptive supersamples. That's 8 bytes a pixel, laid out
+ * as the whole plot rather than chunk by chunk, against a PointData's
+ * hundred-odd.
+ *
+ * Feed it chunks as they come in, and a change of palette can be
+ * recoloured from here, in parallel, whether or not the plot is still
+ * running: we never touch the chunks again. Pixels we haven't heard about
+ * yet are infinite.
+ *
+ * update() and recolour() may be called from different threads; each
+ * waits for the other.
+ *
+ * We are the size of the plot, not of the display: when antialiasing,
+ * that is four samples to a displayed pixel, 32 bytes (a 1920x1080 window
+ * takes some 66MB, against the chunks' 800MB or so). We can't shrink to
+ * one sample a pixel, because the antialiaser averages colours, not
+ * iterations; a pixel coloured from its samples' mean iterf is not the
+ * pixel the plot drew, and a recolour would visibly change the picture.
+ */
+class IterPlane : public IPointRows {
+public:
+	IterPlane() : _width(0), _height(0) {}
+	IterPlane(unsigned width, unsigned height) { reset(width, height); }
+
+	/* Resizes (to the size of the plot) and forgets everything. */
+	void reset(unsigned width, unsigned height);
+	virtual unsigned width() const { return _width; }
+	virtual unsigned height() const { return _height; }
+
+	/* Copies in the chunk's latest results, replacing whatever we had for
+	 * its pixels. If target is given, also has it process the chunk, so
+	 * that a recolour() can't get in between and leave it stale. */
+	void update(const Plot3::Plot3Chunk& chunk, Base* target = 0);
+	void update(const std::list<Plot3::Plot3Chunk*>& chunks);
+
+	/* Renders everything to target, first switching it to pal if given.
+	 * The rows are shared out between the caller and the pool. */
+	void recolour(Base& target, const BasePalette* pal, ThreadPool& pool, QoS cls = QoS::INTERACTIVE);
+
+	/* For the renderers. Row y of the plot (bottom-left origin, like the
+	 * chunks) as width() PointData, with only iter, iterf and nomore set. */
+	virtual void get_points(unsigned y, Fractal::PointData* out) const;
+	/* The supersampled pixels of row y, keyed by y*width()+x. */
+	virtual SupersampleMap::const_iterator ss_begin(unsigned y) const { return _ss.lower_bound(y * _width); }
+	virtual SupersampleMap::const_iterator ss_end(unsigned y) const { return _ss.lower_bound((y+1) * _width); }
+
+private:
+	IterPlane(const IterPlane&) = delete;
+	const IterPlane& operator= (const IterPlane&) = delete;
+
+	unsigned _width, _height;
+	std::vector<Plot3::Plot3Chunk::Sample> _data;
+	SupersampleMap _ss;
+	std::mutex _lock; // Held by update() and recolour()
+};
+
+} // namespace Render2
+
+#endif /* ITERPLANE_H_ */
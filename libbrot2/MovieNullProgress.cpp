@@ -25,6 +25,6 @@ void Movie::MovieNullProgress::set_chunks_count(int) {}
 void Movie::MovieNullProgress::frames_traversed(int) {}
 
 void Movie::MovieNullProgress::chunk_done(Plot3::Plot3Chunk*) {}
-void Movie::MovieNullProgress::pass_complete(std::string&, unsigned, unsigned, unsigned, unsigned) {}
+void Movie::MovieNullProgress::pass_complete(std::string&, unsigned, unsigned, unsigned, unsigned, std::shared_ptr<const Plot3::IterHistogram>) {}
 void Movie::MovieNullProgress::plot_complete() {}
 
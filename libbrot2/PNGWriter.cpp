@@ -0,0 +1,262 @@
+/*
+    PNGWriter.cpp: PNG output, compressed in parallel
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PNGWriter.h"
+#include "ParallelJob.h"
+#include "Exception.h"
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <algorithm>
+
+namespace Render2 {
+
+static const unsigned char SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+static const size_t DICT_MAX = 32768; // deflate's window
+static const unsigned BPP = 3; // bytes per pixel
+
+static inline void put32(unsigned char *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+PNGWriter::PNGWriter(std::ostream& os, unsigned width, unsigned height, const PNGCompression& comp) :
+	_os(os), _width(width), _height(height), _comp(comp), _rowbytes(BPP * (size_t)width),
+	_rows_in(0), _stream_started(false), _stream_ended(false), _finished(false),
+	_raw_rows(0), _prev(_rowbytes, 0), _dict(0), _adler(adler32(0, 0, 0))
+{
+	ASSERT(width > 0 && height > 0);
+	ASSERT(comp.level >= -1 && comp.level <= 9);
+	_block_rows = std::max<size_t>(1, comp.block_bytes / (1 + _rowbytes));
+	_window = comp.threads ? comp.threads : comp.pool ? comp.pool->size() + 1 : 1;
+	_raw.resize((size_t)_window * _block_rows * _rowbytes);
+
+	_os.write((const char*)SIGNATURE, sizeof SIGNATURE);
+	unsigned char ihdr[13];
+	put32(ihdr, width);
+	put32(ihdr+4, height);
+	ihdr[8] = 8; // bit depth
+	ihdr[9] = 2; // colour type: RGB
+	ihdr[10] = ihdr[11] = ihdr[12] = 0; // deflate, adaptive filtering, not interlaced
+	chunk("IHDR", ihdr, sizeof ihdr);
+	static const char software[] = "Software\0" PACKAGE_STRING;
+	chunk("tEXt", (const unsigned char*)software, sizeof software - 1);
+}
+
+PNGWriter::~PNGWriter()
+{
+}
+
+void PNGWriter::chunk(const char* type, const unsigned char* data, size_t len)
+{
+	unsigned char head[8], tail[4];
+	put32(head, len);
+	memcpy(head+4, type, 4);
+	uLong crc = crc32(0, head+4, 4);
+	if (len)
+		crc = crc32(crc, data, len);
+	put32(tail, crc);
+	_os.write((const char*)head, sizeof head);
+	_os.write((const char*)data, len);
+	_os.write((const char*)tail, sizeof tail);
+	if (!_os)
+		THROW(BrotException, "Failed writing PNG");
+}
+
+void PNGWriter::write_rows(const unsigned char* rows, unsigned n, size_t stride)
+{
+	ASSERT(!_finished);
+	ASSERT(_rows_in + n <= _height);
+	for (unsigned i=0; i<n; i++) {
+		memcpy(&_raw[_raw_rows * _rowbytes], rows + i * stride, _rowbytes);
+		++_rows_in;
+		if (++_raw_rows == _window * _block_rows)
+			compress(_rows_in == _height);
+	}
+}
+
+void PNGWriter::finish()
+{
+	if (_finished)
+		return;
+	if (_rows_in < _height)
+		THROW(BrotException, "PNG output is incomplete");
+	if (!_stream_ended) // the last window may have ended it already
+		compress(true);
+	chunk("IEND", 0, 0);
+	_os.flush();
+	_finished = true;
+}
+
+static inline unsigned char paeth(int a, int b, int c) {
+	const int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	return (pa <= pb && pa <= pc) ? a : pb <= pc ? b : c;
+}
+
+/* Filters one row into dst (the filter type byte, then the row), picking
+ * whichever filter gives the smallest sum of absolute values, as libpng
+ * does. level 0 won't compress it, so we don't bother. */
+static void filter_row(unsigned char *dst, const unsigned char *cur, const unsigned char *prev, size_t len, int level,
+		std::vector<unsigned char>& tmp)
+{
+	if (level == 0) {
+		dst[0] = 0;
+		memcpy(dst+1, cur, len);
+		return;
+	}
+	static const unsigned NFILTERS = 5;
+	unsigned long best_sum = (unsigned long)-1;
+	tmp.resize(len);
+	for (unsigned f=0; f<NFILTERS; f++) {
+		unsigned long sum = 0;
+		for (size_t i=0; i<len; i++) {
+			const int a = i >= BPP ? cur[i-BPP] : 0, b = prev[i], c = i >= BPP ? prev[i-BPP] : 0;
+			unsigned char v;
+			switch (f) {
+			case 0: v = cur[i]; break;
+			case 1: v = cur[i] - a; break;
+			case 2: v = cur[i] - b; break;
+			case 3: v = cur[i] - ((a + b) >> 1); break;
+			default: v = cur[i] - paeth(a, b, c); break;
+			}
+			tmp[i] = v;
+			sum += v < 128 ? v : 256 - v;
+		}
+		if (sum < best_sum) {
+			best_sum = sum;
+			dst[0] = f;
+			memcpy(dst+1, &tmp[0], len);
+		}
+	}
+}
+
+/* Deflates one block as a raw stream, primed with dict. Unless last, it's
+ * sync-flushed, so the next block can start on a byte boundary. */
+static void deflate_block(const unsigned char *in, size_t len, const unsigned char *dict, size_t dictlen,
+		int level, bool last, std::vector<unsigned char>& out)
+{
+	z_stream z;
+	memset(&z, 0, sizeof z);
+	if (deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_FILTERED) != Z_OK)
+		THROW(BrotException, "Could not start PNG compression");
+	if (dictlen && deflateSetDictionary(&z, dict, dictlen) != Z_OK) {
+		deflateEnd(&z);
+		THROW(BrotException, "Could not prime PNG compression");
+	}
+	out.resize(deflateBound(&z, len) + 16);
+	z.next_in = const_cast<unsigned char*>(in);
+	z.avail_in = len;
+	z.next_out = &out[0];
+	z.avail_out = out.size();
+	const int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+	while (true) {
+		const int rv = deflate(&z, flush);
+		if (rv == Z_STREAM_ERROR) {
+			deflateEnd(&z);
+			THROW(BrotException, "PNG compression failed");
+		}
+		if (z.avail_in == 0 && (last ? rv == Z_STREAM_END : z.avail_out != 0))
+			break;
+		// Out of room, somehow
+		const size_t done = out.size() - z.avail_out;
+		out.resize(out.size() * 2);
+		z.next_out = &out[done];
+		z.avail_out = out.size() - done;
+	}
+	out.resize(out.size() - z.avail_out);
+	deflateEnd(&z);
+}
+
+void PNGWriter::compress(bool last)
+{
+	const size_t stride = 1 + _rowbytes;
+	const unsigned nrows = _raw_rows;
+	const unsigned nblocks = std::max(1u, (nrows + _block_rows - 1) / _block_rows);
+
+	// The dictionary (the tail of what went before) is already at the front.
+	_filtered.resize(_dict + nrows * stride);
+	std::vector<std::vector<unsigned char> > out(nblocks);
+	std::vector<uLong> adlers(nblocks);
+
+	auto run = [this, nblocks] (std::function<void(unsigned)> fn) {
+		if (_comp.pool && nblocks > 1)
+			ParallelJob::run(nblocks, fn, *_comp.pool, _comp.qos);
+		else
+			for (unsigned i=0; i<nblocks; i++)
+				fn(i);
+	};
+
+	// Each row's filter looks at the row above, unfiltered, so the rows
+	// are independent.
+	run([this, nrows, stride] (unsigned b) {
+		const unsigned r1 = std::min(nrows, (b+1) * _block_rows);
+		std::vector<unsigned char> tmp;
+		for (unsigned r = b * _block_rows; r < r1; r++) {
+			const unsigned char *prev = r ? &_raw[(r-1) * _rowbytes] : &_prev[0];
+			filter_row(&_filtered[_dict + r * stride], &_raw[r * _rowbytes], prev, _rowbytes, _comp.level, tmp);
+		}
+	});
+	// Each block wants all the data before it as its dictionary, so this
+	// has to wait until they're all filtered.
+	run([this, nrows, stride, nblocks, last, &out, &adlers] (unsigned b) {
+		const size_t start = _dict + b * _block_rows * stride,
+				end = _dict + std::min(nrows, (b+1) * _block_rows) * stride,
+				dictlen = std::min(start, DICT_MAX);
+		const unsigned char *base = _filtered.empty() ? 0 : &_filtered[0];
+		deflate_block(base + start, end - start, base + start - dictlen, dictlen,
+				_comp.level, last && b == nblocks-1, out[b]);
+		adlers[b] = adler32(adler32(0, 0, 0), base + start, end - start);
+	});
+
+	for (unsigned b=0; b<nblocks; b++) {
+		std::vector<unsigned char>& data = out[b];
+		const size_t start = _dict + b * _block_rows * stride,
+				end = _dict + std::min(nrows, (b+1) * _block_rows) * stride;
+		_adler = adler32_combine(_adler, adlers[b], end - start);
+		if (!_stream_started) {
+			// The very start of the stream: the zlib header, for deflate with a 32k window.
+			const int level = _comp.level == -1 ? 6 : _comp.level;
+			unsigned char head[2] = { 0x78, (unsigned char)((level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6) };
+			head[1] += (31 - (head[0] * 256 + head[1]) % 31) % 31;
+			data.insert(data.begin(), head, head + 2);
+			_stream_started = true;
+		}
+		if (last && b == nblocks-1) {
+			unsigned char tail[4];
+			put32(tail, _adler);
+			data.insert(data.end(), tail, tail + 4);
+		}
+		if (!data.empty())
+			chunk("IDAT", &data[0], data.size());
+	}
+
+	// Keep the tail as the next lot's dictionary, and the last row for its filter.
+	const size_t keep = std::min(_filtered.size(), DICT_MAX);
+	std::copy(_filtered.end() - keep, _filtered.end(), _filtered.begin());
+	_dict = keep;
+	if (nrows)
+		memcpy(&_prev[0], &_raw[(nrows-1) * _rowbytes], _rowbytes);
+	_raw_rows = 0;
+	if (last)
+		_stream_ended = true;
+}
+
+}; // namespace Render2
@@ -0,0 +1,98 @@
+/*
+    PNGWriter.h: PNG output, compressed in parallel
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PNGWRITER_H_
+#define PNGWRITER_H_
+
+#include <stdint.h>
+#include <iostream>
+#include <vector>
+#include "ThreadPool.h"
+
+namespace Render2 {
+
+/* How hard, and how widely, to compress a PNG. */
+struct PNGCompression {
+	int level; // zlib's: 0 (none) to 9 (smallest), or -1 for its default
+	ThreadPool* pool; // May be null, in which case we do it all ourselves
+	unsigned threads; // Blocks to compress at once; 0 means one per pool thread, plus the caller
+	QoS qos;
+	unsigned block_bytes; // Uncompressed data per block
+
+	static const unsigned DEFAULT_BLOCK = 128*1024; // as pigz
+
+	PNGCompression(int lvl=-1, ThreadPool* p=0, unsigned nthreads=0, QoS cls=QoS::EXPORT) :
+		level(lvl), pool(p), threads(nthreads), qos(cls), block_bytes(DEFAULT_BLOCK) {}
+};
+
+/*
+ * Writes an 8-bit RGB PNG, a few rows at a time.
+ *
+ * The image data is cut into blocks of whole rows, which are filtered and
+ * deflated independently, as pigz does: each block is primed with the
+ * 32k of data before it as its dictionary, and all but the last end on a
+ * byte boundary, so they join up into one zlib stream that any inflater
+ * can read. We do a window of blocks at a time, one per thread; and as
+ * the blocks are cut the same way whatever the window, the file doesn't
+ * depend on how many threads there were.
+ *
+ * Rows are held until there's a window's worth, so we never hold much
+ * more than that.
+ */
+class PNGWriter {
+public:
+	/* os must outlive us. Writes the PNG header straight away. */
+	PNGWriter(std::ostream& os, unsigned width, unsigned height, const PNGCompression& comp = PNGCompression());
+	~PNGWriter();
+
+	/* Adds the next n rows, top first. Each is width packed RGB pixels
+	 * (3 bytes each); they are stride bytes apart. */
+	void write_rows(const unsigned char* rows, unsigned n, size_t stride);
+	/* Compresses whatever's left and ends the file. Throws BrotException
+	 * if we haven't had all the rows. */
+	void finish();
+
+	unsigned rows_in() const { return _rows_in; }
+
+private:
+	PNGWriter(const PNGWriter&) = delete;
+	const PNGWriter& operator= (const PNGWriter&) = delete;
+
+	std::ostream& _os;
+	const unsigned _width, _height;
+	const PNGCompression _comp;
+	const size_t _rowbytes; // of a packed row, without the filter byte
+	unsigned _block_rows, _window; // rows per block; blocks at once
+	unsigned _rows_in; // rows we've been given
+	bool _stream_started, _stream_ended, _finished; // zlib header out; adler32 out; IEND out
+
+	std::vector<unsigned char> _raw; // rows waiting to be compressed
+	unsigned _raw_rows;
+	std::vector<unsigned char> _prev; // the row before those (zero at the top)
+	std::vector<unsigned char> _filtered; // the dictionary, then the rows, filtered
+	size_t _dict; // how much of _filtered is dictionary
+	uint32_t _adler; // of all the filtered data so far
+
+	/* Compresses and writes out everything in _raw. If last, ends the zlib stream. */
+	void compress(bool last);
+	void chunk(const char* type, const unsigned char* data, size_t len);
+};
+
+}; // namespace Render2
+
+#endif /* PNGWRITER_H_ */
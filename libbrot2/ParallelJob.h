@@ -0,0 +1,82 @@
+/*
+    ParallelJob.h: Shares a batch of work between the caller and a ThreadPool
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PARALLELJOB_H_
+#define PARALLELJOB_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include "ThreadPool.h"
+
+namespace Render2 {
+
+/* Shares out n items of work between the caller and the pool. The
+ * helpers hold a reference to this because they may not get to run until
+ * after the caller has returned, by which time there's nothing left for
+ * them to do. */
+struct ParallelJob {
+	const unsigned n;
+	const std::function<void(unsigned)> fn;
+	std::atomic<unsigned> next, done;
+	std::mutex lock;
+	std::condition_variable all_done;
+	std::exception_ptr error; // protected by lock
+
+	ParallelJob(unsigned count, std::function<void(unsigned)> f) : n(count), fn(f), next(0), done(0) {}
+
+	void work() {
+		unsigned i;
+		while ((i = next++) < n) {
+			try {
+				fn(i);
+			} catch (...) {
+				std::unique_lock<std::mutex> guard(lock);
+				if (!error)
+					error = std::current_exception();
+			}
+			if (++done == n) {
+				std::unique_lock<std::mutex> guard(lock);
+				all_done.notify_all();
+			}
+		}
+	}
+
+	static void run(unsigned count, std::function<void(unsigned)> f, ThreadPool& pool, QoS cls) {
+		if (!count)
+			return;
+		std::shared_ptr<ParallelJob> job(new ParallelJob(count, f));
+		const unsigned helpers = std::min<size_t>(pool.size(), count-1);
+		for (unsigned i=0; i<helpers; i++)
+			pool.enqueue<void>([job] { job->work(); }, cls);
+		job->work(); // We're not just going to sit here.
+
+		std::unique_lock<std::mutex> guard(job->lock);
+		job->all_done.wait(guard, [job, count] { return job->done == count; });
+		if (job->error)
+			std::rethrow_exception(job->error);
+	}
+};
+
+}; // namespace Render2
+
+#endif /* PARALLELJOB_H_ */
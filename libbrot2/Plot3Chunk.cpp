@@ -19,7 +19,11 @@
 #include "Plot3Chunk.h"
 #include "IPlot3DataSink.h"
 #include "Exception.h"
+#include "ThreadPool.h"
+#include "ChunkStore.h"
 #include <complex.h>
+#include <memory>
+#include <random>
 
 using namespace Fractal;
 
@@ -29,8 +33,10 @@ Plot3Chunk::Plot3Chunk(IPlot3DataSink* sink, const Fractal::FractalImpl& f,
 		unsigned width, unsigned height, unsigned offX, unsigned offY,
 		const Fractal::Point origin, const Fractal::Point size,
 		Maths::MathsType ty) :
-		_sink(sink), _data(NULL), _running(false), _prepared(false),
+		_sink(sink), _data(NULL), _store(0), _slot(0),
+		_running(false), _prepared(false), _released(false), _paged_out(false),
 		_plotted_passes(0), _live_pixels(0), _max_iters(0),
+		_cancel(0), _interrupted(false), _home(-1), _ss_factor(0),
 		_fract(f),
 		_origin(origin),
 		_size(size),
@@ -44,8 +50,10 @@ Plot3Chunk::Plot3Chunk(IPlot3DataSink* sink, const Fractal::FractalImpl& f,
 }
 
 Plot3Chunk::Plot3Chunk(const Plot3Chunk& other) :
-		_sink(other._sink), _data(NULL), _running(false), _prepared(false),
+		_sink(other._sink), _data(NULL), _store(0), _slot(0),
+		_running(false), _prepared(false), _released(false), _paged_out(false),
 		_plotted_passes(0), _live_pixels(0), _max_iters(other._max_iters),
+		_cancel(other._cancel), _interrupted(false), _home(-1), _ss_factor(0),
 		_fract(other._fract), _origin(other._origin), _size(other._size),
 		_width(other._width), _height(other._height), _offX(other._offX),
 		_offY(other._offY), _valtype(other._valtype)
@@ -53,11 +61,32 @@ Plot3Chunk::Plot3Chunk(const Plot3Chunk& other) :
 }
 
 Plot3Chunk::~Plot3Chunk() {
-	if (_data)
+	free_data();
+}
+
+void Plot3Chunk::free_data() {
+	if (!_data)
+		return;
+	if (_store)
+		_store->discard(_data, pixel_count() * sizeof(PointData));
+	else
 		delete[] _data;
 	_data = 0;
 }
 
+void Plot3Chunk::set_store(ChunkStore* store, size_t offset) {
+	ASSERT(!_data);
+	_store = store;
+	_slot = offset;
+}
+
+void Plot3Chunk::page_out() {
+	if (!_store || !_data || _paged_out)
+		return;
+	_store->page_out(_data, pixel_count() * sizeof(PointData));
+	_paged_out = true;
+}
+
 /* Returns data for a single point, identified by its pixel co-ordinates within the plot. */
 const Fractal::PointData& Plot3Chunk::get_pixel_point(int x, int y) const
 {
@@ -70,6 +99,8 @@ const Fractal::PointData& Plot3Chunk::get_pixel_point(int x, int y) const
 
 void Plot3Chunk::run() {
 	ASSERT(!_running);
+	if (_released)
+		return; // We were final, and have been written out
 	_running = true;
 	if (!_prepared)
 		prepare();
@@ -80,11 +111,40 @@ void Plot3Chunk::run() {
 	_running = false;
 }
 
+Fractal::PointData* Plot3Chunk::restore_data() {
+	ASSERT(!_running && !_released);
+	prepare();
+	_prepared = true;
+	return _data;
+}
+
+void Plot3Chunk::restored() {
+	ASSERT(_data);
+	_live_pixels = 0;
+	_histogram.clear();
+	for (unsigned i=0; i<pixel_count(); i++) {
+		const PointData& pt = _data[i];
+		if (!pt.nomore)
+			++_live_pixels;
+		else if (pt.iterf >= Fractal::PointData::ITERF_LOW_CLAMP)
+			_histogram.add(pt.iterf); // escaped, as opposed to known to be infinite
+	}
+}
+
 void Plot3Chunk::prepare()
 {
-	if (_data) delete[] _data;
-	_data = new PointData[_width * _height];
+	free_data();
+	// We fill in the data right here, so under first-touch allocation it
+	// lives on whichever NUMA node this thread is on.
+	if (_store) {
+		_data = static_cast<PointData*>(_store->at(_slot));
+		std::uninitialized_fill_n(_data, pixel_count(), PointData());
+	} else
+		_data = new PointData[_width * _height];
+	_paged_out = false;
+	_home = ThreadPool::current_partition();
 	_live_pixels = _width * _height;
+	_histogram.clear();
 
 	unsigned i,j, out_index = 0;
 	//std::cout << "render centre " << centre << "; size " << size << "; origin " << origin << std::endl;
@@ -107,22 +167,48 @@ void Plot3Chunk::prepare()
 	}
 }
 
+bool Plot3Chunk::iterate(PointData& pt, unsigned max_iters, const CancelToken* cancel) const {
+	/* Iterate in slices so we notice cancellation promptly.
+	 * The fractals save their state when they reach the limit
+	 * they're given, so this gives the same answer as running
+	 * straight to max_iters. */
+	unsigned limit = pt.iter > 0 ? pt.iter : 0;
+	while (true) {
+		if (cancel && cancel->cancelled())
+			return false;
+		if (limit >= max_iters || max_iters - limit <= CANCEL_POLL_ITERS)
+			limit = max_iters;
+		else
+			limit += CANCEL_POLL_ITERS;
+		_fract.plot_pixel(limit, pt, _valtype);
+		if (pt.nomore || limit == max_iters)
+			return true;
+	}
+}
+
 void Plot3Chunk::plot() {
 	unsigned i, j, out_index = 0;
+	_interrupted = false;
+	if (!_live_pixels)
+		return; // Nothing to do, so don't touch the data (it may be paged out)
 	for (j=0; j<_height; j++) {
 		for (i=0; i<_width; i++) {
 			PointData& pt = _data[out_index];
 			if (!pt.nomore) {
-				_fract.plot_pixel(_max_iters, pt, _valtype);
+				// Once interrupted, we leave the rest of the pixels alone.
+				if (!_interrupted && !iterate(pt, _max_iters, _cancel))
+					_interrupted = true;
 				if (pt.nomore) {
 					// point has escaped
 					--_live_pixels;
 					if (pt.iterf <= Fractal::PointData::ITERF_LOW_CLAMP)
 						pt.iterf = Fractal::PointData::ITERF_LOW_CLAMP;
+					_histogram.add(pt.iterf);
 				}
 				else {
 					// still alive, but has reached the current iteration
-					// limit so is effectively infinite (for now)
+					// limit (or we were interrupted) so is effectively
+					// infinite (for now)
 					pt.iterf = -1;
 				}
 			}
@@ -131,6 +217,81 @@ void Plot3Chunk::plot() {
 	}
 }
 
+void Plot3Chunk::supersample(const std::vector<unsigned>& pixels, unsigned factor, unsigned maxiter)
+{
+	ASSERT(!_running);
+	ASSERT(factor > 0);
+	clear_supersamples();
+	_ss_factor = factor;
+	_ss_pixels.reserve(pixels.size());
+	_ss_samples.reserve(pixels.size() * factor * factor);
+	_interrupted = false;
+
+	for (auto px : pixels) {
+		ASSERT(px < pixel_count());
+		ASSERT(_ss_pixels.empty() || px > _ss_pixels.back());
+		const unsigned i = px % _width, j = px / _width;
+		/* One sample in each cell of a factor x factor grid over the pixel,
+		 * at a random point within the cell. Seeded by the pixel's position
+		 * in the plot so a replot comes out the same. */
+		std::minstd_rand rng(1 + (_offY + j) * 65521u + (_offX + i));
+		std::uniform_real_distribution<double> jitter(0.0, 1.0);
+		for (unsigned sy=0; sy<factor; sy++) {
+			for (unsigned sx=0; sx<factor; sx++) {
+				double dx = (sx + jitter(rng)) / factor, dy = (sy + jitter(rng)) / factor;
+				Sample s;
+				if (!sample(i, j, dx, dy, maxiter, s, _cancel)) {
+					_interrupted = true;
+					// Drop this pixel's partial samples
+					_ss_samples.resize(_ss_pixels.size() * factor * factor);
+					return;
+				}
+				_ss_samples.push_back(s);
+			}
+		}
+		_ss_pixels.push_back(px);
+	}
+}
+
+bool Plot3Chunk::sample(unsigned i, unsigned j, double dx, double dy,
+		unsigned maxiter, Sample& out, const CancelToken* cancel) const
+{
+	ASSERT(i < _width && j < _height);
+	const Value pixw = real(_size) / _width, pixh = imag(_size) / _height;
+	Point p = _origin + Point(pixw * (i + dx), pixh * (j + dy));
+	PointData pt;
+	_fract.prepare_pixel(p, pt);
+	if (!pt.nomore && !iterate(pt, maxiter, cancel))
+		return false;
+	out.iter = pt.iter;
+	if (!pt.nomore)
+		out.iterf = -1; // infinite, as far as we know
+	else if (pt.iterf <= Fractal::PointData::ITERF_LOW_CLAMP)
+		out.iterf = Fractal::PointData::ITERF_LOW_CLAMP;
+	else
+		out.iterf = pt.iterf;
+	return true;
+}
+
+void Plot3Chunk::clear_supersamples()
+{
+	_ss_factor = 0;
+	_ss_pixels.clear();
+	_ss_samples.clear();
+}
+
+void Plot3Chunk::release()
+{
+	ASSERT(!_running);
+	free_data();
+	_home = -1;
+	clear_supersamples();
+	// clear() keeps the memory, and it's the memory we're after
+	std::vector<unsigned>().swap(_ss_pixels);
+	std::vector<Sample>().swap(_ss_samples);
+	_released = true;
+}
+
 void Plot3Chunk::reset_max_iters(unsigned max) {
 	ASSERT(!_running);
 	_max_iters = max;
@@ -19,11 +19,26 @@
 #ifndef PLOT3CHUNK_H_
 #define PLOT3CHUNK_H_
 
+#include <atomic>
+#include <vector>
 #include "Fractal.h"
+#include "IterHistogram.h"
 
 namespace Plot3 {
 
 class IPlot3DataSink;
+class ChunkStore;
+
+/* Shared between a plot and its chunks, so that a running pass can be
+ * abandoned promptly rather than at the end of the pass. */
+class CancelToken {
+	std::atomic<bool> _cancelled;
+public:
+	CancelToken() : _cancelled(false) {}
+	void cancel() { _cancelled.store(true, std::memory_order_relaxed); }
+	void reset() { _cancelled.store(false, std::memory_order_relaxed); }
+	bool cancelled() const { return _cancelled.load(std::memory_order_relaxed); }
+};
 
 class Plot3Chunk {
 public:
@@ -39,6 +54,10 @@ public:
 protected:
 	virtual void prepare();
 	virtual void plot();
+	void free_data();
+	/* Runs a single point up to limit, in slices. Returns false if the
+	 * cancel token (which may be null) went off first. */
+	bool iterate(Fractal::PointData& pt, unsigned limit, const CancelToken* cancel) const;
 
 private:
 	const Plot3Chunk& operator= (const Plot3Chunk&) = delete; // Disallowed.
@@ -46,11 +65,29 @@ private:
     /* Where should this chunk poke its data when complete? */
 	IPlot3DataSink* _sink;
 	Fractal::PointData* _data; // We own this data. Allocated when needed.
-	bool _running, _prepared;
+	ChunkStore* _store; // Where _data lives; null for the heap
+	size_t _slot; // Our offset within _store
+	bool _running, _prepared, _released;
+	bool _paged_out; // Have we told _store we're done with _data for now?
 	/* Plot statistics: */
 	unsigned _plotted_passes; // How many passes before bailing?
 	unsigned _live_pixels; // How many pixels are still live? Initialised by prepare().
 	unsigned _max_iters; // Iteration limit
+	const CancelToken* _cancel; // May be null
+	bool _interrupted; // Did the last run() give up early?
+	int _home; // ThreadPool partition our data was allocated in; -1 if none
+	IterHistogram _histogram; // Of our escaped pixels, so far
+
+public:
+	/* A supersample only needs what the palettes look at. */
+	struct Sample {
+		int iter;
+		float iterf;
+	};
+private:
+	unsigned _ss_factor;
+	std::vector<unsigned> _ss_pixels; // Sorted pixel indices
+	std::vector<Sample> _ss_samples; // _ss_factor^2 per entry in _ss_pixels
 
 public:
 	/* What is this chunk about? */
@@ -70,6 +107,11 @@ public:
 	// How many pixels are live?
 	unsigned livecount() const { return _live_pixels; }
 
+	/* How our escaped pixels are spread over iterf, counting every pass so
+	 * far (supersamples don't count). Only we write to it, as pixels
+	 * escape, so don't look while we're running. */
+	const IterHistogram& histogram() const { return _histogram; }
+
 	/* Returns data for a single point, identified by its pixel co-ordinates within.
 	 * NB that the pixel co-ords are relative to this chunk only.
 	 * Call this before completion at your peril... */
@@ -77,6 +119,60 @@ public:
 
 	/** Updates our idea of the iteration limit */
 	void reset_max_iters(unsigned max);
+
+	/* How often (in fractal iterations) a pixel checks for cancellation. */
+	static const unsigned CANCEL_POLL_ITERS = 4096;
+
+	/** If the token is cancelled while we're running, we stop early.
+	 * Pixels we didn't get to keep their state, so a later run picks up
+	 * where we left off. */
+	void set_cancel_token(const CancelToken* token) { _cancel = token; }
+
+	/** Was the last run() cut short by the cancel token? */
+	bool interrupted() const { return _interrupted; }
+
+	/** Frees our data and any supersamples, once whoever needed them has
+	 * had them (see Plot3Plot::set_retire). We keep our statistics and
+	 * histogram, but get_data() is null from now on and run() does nothing. */
+	void release();
+	bool released() const { return _released; }
+
+	/** Keep our data in store, at offset, rather than on the heap (see
+	 * ChunkStore, which calls this). Before we first run. */
+	void set_store(ChunkStore* store, size_t offset);
+	/** We have no more live pixels, so only whoever renders us will look
+	 * at our data again: if it's in a ChunkStore, it can go out to disk
+	 * until then. */
+	void page_out();
+
+	/** For Checkpoint: sets up our data as the first run() would, for the
+	 * caller to overwrite with what was saved; restored() then recounts
+	 * our live pixels and histogram from it. Before we first run. */
+	Fractal::PointData* restore_data();
+	void restored();
+
+	/** Which ThreadPool partition (NUMA node) first touched our data?
+	 * Later passes should run there too. -1 if we don't mind. */
+	int home() const { return _home; }
+
+	/** Adaptive supersampling (see Plot3Plot::set_supersample).
+	 * Samples each of the given pixels (indices into get_data(), ascending)
+	 * at factor x factor jittered points within it, up to maxiter.
+	 * Replaces any earlier supersamples. If cancelled part way through,
+	 * keeps the pixels it finished. */
+	void supersample(const std::vector<unsigned>& pixels, unsigned factor, unsigned maxiter);
+	void clear_supersamples();
+	/** Computes one extra sample of pixel (i,j), at (dx,dy) within it (each
+	 * in [0,1)), up to maxiter. Doesn't touch the chunk, so may be called
+	 * from several threads at once, but not while the chunk is running.
+	 * Returns false if the cancel token (may be null) went off first. */
+	bool sample(unsigned i, unsigned j, double dx, double dy, unsigned maxiter,
+			Sample& out, const CancelToken* cancel) const;
+	/** The pixels that have been supersampled, ascending, and their samples:
+	 * ss_samples(n) gives the ss_factor()^2 samples of ss_pixels()[n]. */
+	unsigned ss_factor() const { return _ss_factor; }
+	const std::vector<unsigned>& ss_pixels() const { return _ss_pixels; }
+	const Sample* ss_samples(unsigned n) const { return &_ss_samples[n * _ss_factor * _ss_factor]; }
 };
 
 } // namespace Plot3
@@ -17,22 +17,65 @@
 */
 
 #include "Plot3Pass.h"
+#include <algorithm>
 
 using namespace std;
 
 namespace Plot3 {
 
-Plot3Pass::Plot3Pass(std::shared_ptr<ThreadPool> pool, std::list<Plot3Chunk*>& chunks) :
-	_pool(pool), _chunks(chunks) {
+Plot3Pass::Plot3Pass(std::shared_ptr<ThreadPool> pool, std::list<Plot3Chunk*>& chunks,
+		std::shared_ptr<const ChunkOrdering::Base> order, QoS qos) :
+	_pool(pool), _chunks(chunks), _order(order), _qos(qos), _generation(0), _width(0), _height(0) {
 }
 
 Plot3Pass::~Plot3Pass() {
 }
 
+void Plot3Pass::sort_pending() {
+	_generation = _order->generation();
+	for (auto& it : _pending)
+		it.key = _order->key(*it.chunk, _width, _height);
+	std::make_heap(_pending.begin(), _pending.end());
+}
+
+void Plot3Pass::run_next() {
+	Plot3Chunk *chunk;
+	{
+		std::unique_lock<std::mutex> lock(_pending_lock);
+		if (_generation != _order->generation())
+			sort_pending();
+		std::pop_heap(_pending.begin(), _pending.end());
+		chunk = _pending.back().chunk;
+		_pending.pop_back();
+	}
+	chunk->run();
+}
+
 void Plot3Pass::run() {
 	list<future<void> > results;
-	for (auto it=_chunks.begin(); it != _chunks.end(); it++) {
-		results.push_back(_pool->enqueue<void>([=]{(*it)->run();}));
+	if (!_order) {
+		for (auto it=_chunks.begin(); it != _chunks.end(); it++) {
+			// Send the chunk back to wherever its data lives, if we can.
+			results.push_back(_pool->enqueue<void>([=]{(*it)->run();}, _qos, (*it)->home()));
+		}
+	} else {
+		{
+			std::unique_lock<std::mutex> lock(_pending_lock);
+			_pending.clear();
+			_width = _height = 0;
+			unsigned seq = 0;
+			for (auto it : _chunks) {
+				_pending.push_back( { 0, seq++, it } );
+				_width = std::max(_width, it->_offX + it->_width);
+				_height = std::max(_height, it->_offY + it->_height);
+			}
+			sort_pending();
+		}
+		// Each job takes whichever chunk is most urgent when it starts.
+		// Urgency beats NUMA locality here, so no partition hint.
+		for (unsigned i=0; i<_chunks.size(); i++) {
+			results.push_back(_pool->enqueue<void>([=]{ this->run_next(); }, _qos));
+		}
 	}
 
 	for (auto it=results.begin(); it != results.end(); it++) {
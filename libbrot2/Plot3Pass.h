@@ -20,8 +20,11 @@
 #define PLOT3PASS_H_
 
 #include <list>
+#include <vector>
+#include <mutex>
 #include "libbrot2/ThreadPool.h"
 #include "libbrot2/Plot3Chunk.h"
+#include "libbrot2/ChunkOrdering.h"
 
 namespace Plot3 {
 
@@ -39,12 +42,36 @@ class Plot3Pass {
 	 * threadpool, which will stop processing ASAP, but the unstarted futures
 	 * will never be satisfied so the thread running the pass will block
 	 * forever.
+	 *
+	 * If given a ChunkOrdering, the chunks are not bound to pool jobs
+	 * up front; each job picks the most urgent chunk remaining at the
+	 * moment it starts. This lets the ordering change its mind mid-pass.
 	 */
 	std::shared_ptr<ThreadPool> _pool;
 	std::list<Plot3Chunk*>& _chunks;
+	std::shared_ptr<const ChunkOrdering::Base> _order; // May be null, in which case chunks run in list order.
+	const QoS _qos; // Scheduling class for our jobs on the pool
+
+	struct Pending {
+		double key;
+		unsigned seq; // Tie-breaker: position in _chunks
+		Plot3Chunk *chunk;
+		// Heap order: the top of the heap is the lowest key
+		bool operator<(const Pending& other) const {
+			return (key > other.key) || (key == other.key && seq > other.seq);
+		}
+	};
+	std::mutex _pending_lock;
+	std::vector<Pending> _pending; // A heap. Protected by _pending_lock.
+	unsigned _generation; // Of _order, when we last sorted. Protected by _pending_lock.
+	unsigned _width, _height; // Extent of the plot, worked out from the chunks
+
+	void sort_pending(); // Call with _pending_lock held
+	void run_next();
 
 public:
-	Plot3Pass(std::shared_ptr<ThreadPool> pool, std::list<Plot3Chunk*>& chunks);
+	Plot3Pass(std::shared_ptr<ThreadPool> pool, std::list<Plot3Chunk*>& chunks,
+			std::shared_ptr<const ChunkOrdering::Base> order = 0, QoS qos = QoS::INTERACTIVE);
 	virtual ~Plot3Pass();
 
 	/** Runs all the chunks, blocks until they are done. */
@@ -16,12 +16,16 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stdint.h>
 #include <unistd.h>
 #include <values.h>
 #include "Plot3Plot.h"
 #include "Prefs.h"
 #include "ChunkDivider.h"
+#include <atomic>
+#include <math.h>
 #include <thread>
+#include <future>
 #include "libbrot2/ThreadPool.h"
 #include "Exception.h"
 
@@ -59,8 +63,6 @@ using namespace std;
 
 namespace Plot3 {
 
-ThreadPool Plot3Plot::runner_pool(1);
-
 Plot3Plot::Plot3Plot(std::shared_ptr<ThreadPool> pool, IPlot3DataSink* s, const FractalImpl& f, ChunkDivider::Base& d,
 		Point centre, Point size,
 		unsigned width, unsigned height, unsigned max_passes) :
@@ -68,9 +70,12 @@ Plot3Plot::Plot3Plot(std::shared_ptr<ThreadPool> pool, IPlot3DataSink* s, const
 		centre(centre), size(size),
 		width(width), height(height),
 		prefs(Prefs::getMaster()),
-		_shutdown(false), _running(false), _stop(false),
-		plotted_maxiter(0), plotted_passes(0),
-		passes_max(max_passes)
+		_shutdown(false), _running(false), _completing(false), _stop(false),
+		plotted_maxiter(0), plotted_passes(0), plotted_finished(false),
+		passes_max(max_passes), plotted_live(0), maxiter_scale(0), delta_threshold(0),
+		stop_latency_ms(-1),
+		_qos(QoS::INTERACTIVE), _ss_factor(0), _ss_threshold(0), _ss_count(0), _fixed_passes(0),
+		_target_maxiter(0), _restored(false)
 		// Note: Initialisation order is crucial when the threadfunc will immediately lock _lock !
 		//callback(0), _data(0), _abort(false), _done(false), _outstanding(0),
 		//_completed(0), jobs(0)
@@ -169,26 +174,45 @@ void Plot3Plot::start() {
 	start(arithtype);
 }
 
+void Plot3Plot::divide(Fractal::Maths::MathsType arithtype) {
+	ASSERT(_chunks.empty());
+	divider.dividePlot(_chunks, sink, fract, centre, size, width, height, arithtype);
+	for (auto it : _chunks)
+		it->set_cancel_token(&_cancel);
+	// Too big to trust to memory?
+	const uint64_t budget = prefs->get(PREF(PlotMemoryBudget));
+	if (budget && (uint64_t)width * height * sizeof(PointData) > (budget << 20))
+		_store.reset(new ChunkStore(_chunks, ChunkStore::default_dir()));
+}
+
 /* Starts a plot. The actual work happens in the background. */
 void Plot3Plot::start(Fractal::Maths::MathsType arithtype) {
-	divider.dividePlot(_chunks, sink, fract, centre, size, width, height, arithtype);
+	if (_chunks.empty())
+		divide(arithtype);
 	std::unique_lock<std::mutex> lock(_lock);
 	_running = true;
+	_completing = true;
 	_stop = false;
+	_cancel.reset();
+	stop_latency_ms = -1;
 	lock.unlock();
-	completion = runner_pool.enqueue<void>([=]{ this->run(); });
+	completion = std::async(std::launch::async, [=]{ this->run(); });
 }
 
 /* Asynch stop, return immediately */
 void Plot3Plot::stop() {
 	std::unique_lock<std::mutex> lock(_lock);
+	if (!_stop)
+		_stop_requested = std::chrono::steady_clock::now();
 	_stop = true; // We'll notify when we've actually stopped.
+	_cancel.cancel();
 }
 
 /* Wait for completion. Does not call stop() first. */
 void Plot3Plot::wait() {
 	std::unique_lock<std::mutex> lock(_lock);
-	while (_running)
+	// A sink may wait() from within its own plot_complete(); don't deadlock it.
+	while (_running || (_completing && std::this_thread::get_id() != _runner))
 		_waiters_cond.wait(lock);
 }
 
@@ -198,30 +222,54 @@ void Plot3Plot::wait() {
 void Plot3Plot::run() {
 	std::unique_lock<std::mutex> lock(_lock);
 
-	Plot3Pass pass(_pool, _chunks);
+	Plot3Pass pass(_pool, _chunks, _order, _qos);
 	unsigned live_pixels = width * height, live_pixels_prev;
 	float live_threshold = prefs->get(PREF(LiveThreshold));
 	unsigned minimum_escapee_percent = prefs->get(PREF(MinEscapeePct));
-	unsigned delta_threshold = width * height * live_threshold;
 
 	unsigned this_pass_maxiter = prefs->get(PREF(InitialMaxIter)),
 			last_pass_maxiter = plotted_maxiter,
-			maxiter_scale = 0,
 			passcount = plotted_passes;
 
 	_running = true;
+	_runner = std::this_thread::get_id();
 
-	if (last_pass_maxiter) {
+	if (last_pass_maxiter && plotted_finished && !_restored) {
+		// Asked for more iterations on a plot that had finished: push on
+		// from its maxiter, and let the thresholds judge it afresh.
 		if (passcount&1)
 			maxiter_scale = last_pass_maxiter/2;
 		else
 			maxiter_scale = last_pass_maxiter/3;
+		if (maxiter_scale<1) maxiter_scale=1;
+		delta_threshold = width * height * live_threshold;
 		this_pass_maxiter = last_pass_maxiter + maxiter_scale;
+		plotted_finished = false;
+		if (!plotted_live || this_pass_maxiter >= (INT_MAX/2))
+			_stop = plotted_finished = true; // Nothing more to find
+	} else if (last_pass_maxiter) {
+		// Carrying on from where we stopped (or a Checkpoint did).
+		live_pixels = plotted_live;
+		this_pass_maxiter = last_pass_maxiter + maxiter_scale;
+		if (plotted_finished && (!live_pixels ||
+				(_target_maxiter <= last_pass_maxiter && _fixed_passes <= passcount)))
+			_stop = true; // The checkpointed plot finished, and nobody has asked for more.
+		else
+			plotted_finished = false;
+		if (passcount >= passes_max || (_fixed_passes && passcount >= _fixed_passes))
+			_stop = true;
 		if (this_pass_maxiter >= (INT_MAX/2))
-			_stop=true;
+			_stop = plotted_finished = true;
 	} else {
 		maxiter_scale = this_pass_maxiter;
+		delta_threshold = width * height * live_threshold;
 	}
+	_restored = false; // Any later start() is ours
+
+	// Any supersamples are about to go stale
+	for (auto chunk : _chunks)
+		chunk->clear_supersamples();
+	_ss_count = 0;
 
 	while (!_stop & !_shutdown) {
 		for (auto chunk : _chunks)
@@ -230,21 +278,30 @@ void Plot3Plot::run() {
 		lock.unlock();
 		pass.run();
 		lock.lock();
+		if (_cancel.cancelled())
+			break; // Pass incomplete, don't count it. Chunks keep their state so we can resume.
 		DEBUG_LIVECOUNT(cout << "pass " << passcount << ", maxiter=" << this_pass_maxiter << endl );
 
 		live_pixels_prev = live_pixels;
 		live_pixels = 0;
-		for (auto chunk : _chunks)
+		// The chunks are all done, so their histograms hold still while we add them up.
+		std::shared_ptr<IterHistogram> histogram = std::make_shared<IterHistogram>();
+		for (auto chunk : _chunks) {
 			live_pixels += chunk->livecount();
+			histogram->merge(chunk->histogram());
+			if (!chunk->livecount() && !_retire)
+				chunk->page_out(); // Done, bar the rendering (retiring would render and free it straight away)
+		}
+		_histogram = histogram;
 		unsigned pixel_threshold = width * height * (100-minimum_escapee_percent) / 100;
 		DEBUG_LIVECOUNT(printf("total %u live pixels remain, threshold=%u\n", live_pixels, pixel_threshold));
 		if (live_pixels==0) {
-			_stop = true;
+			_stop = plotted_finished = true;
 			DEBUG_LIVECOUNT(printf("No live pixels left - all done!\n"));
-		} else if (live_pixels < pixel_threshold) {
+		} else if (!_fixed_passes && this_pass_maxiter >= _target_maxiter && live_pixels < pixel_threshold) {
 			unsigned delta = live_pixels_prev - live_pixels;
 			if (delta < delta_threshold) {
-				_stop = true;
+				_stop = plotted_finished = true;
 				DEBUG_LIVECOUNT(printf("Threshold hit (only %d changed) - halting\n",live_pixels_prev - live_pixels));
 			} else if (delta < 2*delta_threshold) {
 				// This idea lifted from fanf's code.
@@ -258,6 +315,7 @@ void Plot3Plot::run() {
 
 		plotted_passes = ++passcount;
 		plotted_maxiter = last_pass_maxiter = this_pass_maxiter;
+		plotted_live = live_pixels;
 
 		{
 			// Notify this pass is complete
@@ -266,35 +324,140 @@ void Plot3Plot::run() {
 			info << ": " << live_pixels << " pixels live";
 			string infos = info.str();
 			lock.unlock();
-			sink->pass_complete(infos, passcount, plotted_maxiter, live_pixels, width*height);
+			sink->pass_complete(infos, passcount, plotted_maxiter, live_pixels, width*height, histogram);
 			lock.lock();
 		}
 
+		if (_retire)
+			retire(lock, false);
+
 		if (plotted_passes >= passes_max) { _stop = true; }
+		if (_fixed_passes && plotted_passes >= _fixed_passes) { _stop = true; }
 		// Now set up for next pass
 		if (passcount & 1) maxiter_scale = this_pass_maxiter / 2;
 		if (maxiter_scale<1) maxiter_scale=1;
 		this_pass_maxiter += maxiter_scale;
-		if (this_pass_maxiter >= (INT_MAX/2)) _stop=true; // lest we overflow
+		if (this_pass_maxiter >= (INT_MAX/2)) _stop = plotted_finished = true; // lest we overflow
+
+		if (_checkpoint && !_shutdown) {
+			// No chunk runs between passes, so they hold still without the lock.
+			lock.unlock();
+			_checkpoint();
+			lock.lock();
+		}
 	}
 
 	// Any pixel still alive is considered to be infinite.
 	// P3Chunk ensures that the point data is set up correctly for this.
 
+	if (_ss_factor > 1 && !_retire && plotted_passes && !_cancel.cancelled() && !_shutdown) {
+		lock.unlock();
+		unsigned n = refine();
+		lock.lock();
+		if (!_cancel.cancelled()) {
+			live_pixels = 0;
+			for (auto chunk : _chunks)
+				live_pixels += chunk->livecount();
+			ostringstream info;
+			info << plotted_passes << " pass" << (plotted_passes==1 ? "" : "es") << " plotted: maxiter=" << plotted_maxiter;
+			info << ": " << n << " pixels supersampled " << _ss_factor << "x" << _ss_factor;
+			string infos = info.str();
+			std::shared_ptr<const IterHistogram> histogram = _histogram; // supersamples don't change it
+			lock.unlock();
+			sink->pass_complete(infos, plotted_passes, plotted_maxiter, live_pixels, width*height, histogram);
+			lock.lock();
+		}
+	}
+
+	if (_retire && plotted_passes && !_cancel.cancelled() && !_shutdown)
+		retire(lock, true);
+
+	if (_cancel.cancelled()) {
+		std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - _stop_requested;
+		stop_latency_ms = latency.count();
+	}
 	_running = false;
 	lock.unlock();
 	sink->plot_complete();
 	lock.lock();
+	_completing = false;
 	_waiters_cond.notify_all();
 }
 
+void Plot3Plot::retire(std::unique_lock<std::mutex>& lock, bool all) {
+	std::list<Plot3Chunk*> done;
+	for (auto chunk : _chunks)
+		if (!chunk->released() && (all || !chunk->livecount()))
+			done.push_back(chunk);
+	if (done.empty())
+		return;
+	// No chunk runs between passes, so they hold still without the lock.
+	lock.unlock();
+	_retire(done);
+	for (auto chunk : done)
+		chunk->release();
+	lock.lock();
+}
+
+/* Does this pixel stand out from its neighbour? */
+static inline bool ss_differ(const PointData& a, const PointData& b, double threshold) {
+	bool a_inf = a.iterf < 0, b_inf = b.iterf < 0;
+	if (a_inf || b_inf)
+		return a_inf != b_inf;
+	// Both are at least ITERF_LOW_CLAMP, so this is safe.
+	return fabs(log(a.iterf) - log(b.iterf)) > threshold;
+}
+
+unsigned Plot3Plot::refine() {
+	/* Where's every pixel? Edges are often along chunk boundaries, so
+	 * we need to be able to see across them. */
+	std::vector<const PointData*> grid(width * height, 0);
+	for (auto chunk : _chunks) {
+		const PointData* data = chunk->get_data();
+		for (unsigned j=0; j<chunk->_height; j++)
+			for (unsigned i=0; i<chunk->_width; i++)
+				grid[(chunk->_offY + j) * width + chunk->_offX + i] = &data[j*chunk->_width + i];
+	}
+
+	std::atomic<unsigned> total(0);
+	std::list<std::future<void>> done;
+	for (auto chunk : _chunks) {
+		done.push_back(_pool->enqueue<void>([=, &grid, &total] {
+			std::vector<unsigned> pixels;
+			for (unsigned j=0; j<chunk->_height; j++) {
+				const unsigned y = chunk->_offY + j;
+				for (unsigned i=0; i<chunk->_width; i++) {
+					const unsigned x = chunk->_offX + i;
+					const PointData& me = *grid[y*width + x];
+					if ((x > 0 && ss_differ(me, *grid[y*width + x-1], _ss_threshold))
+							|| (x+1 < width && ss_differ(me, *grid[y*width + x+1], _ss_threshold))
+							|| (y > 0 && ss_differ(me, *grid[(y-1)*width + x], _ss_threshold))
+							|| (y+1 < height && ss_differ(me, *grid[(y+1)*width + x], _ss_threshold)))
+						pixels.push_back(j*chunk->_width + i);
+				}
+			}
+			if (pixels.empty())
+				return;
+			chunk->supersample(pixels, _ss_factor, plotted_maxiter);
+			total += chunk->ss_pixels().size();
+			sink->chunk_done(chunk);
+		}, _qos, chunk->home()));
+	}
+	for (auto& f : done)
+		f.get();
+	_ss_count = total.load();
+	return total;
+}
+
 Plot3Plot::~Plot3Plot() {
 	{
 		std::unique_lock<std::mutex> lock(_lock);
 		_shutdown = true;
+		_cancel.cancel();
 	}
 	// Must wait for all jobs to finish before we delete any data, otherwise things will get messy
-	if (_running)
+	// (Including the sink's plot_complete(), which runs after _running is cleared.)
+	if (completion.valid())
 		completion.get();
 	for (auto it: _chunks) {
 		delete it;
@@ -326,6 +489,11 @@ bool Plot3Plot::is_running() {
 	return _running;
 }
 
+std::shared_ptr<const IterHistogram> Plot3Plot::histogram() {
+	std::unique_lock<std::mutex> lock(_lock);
+	return _histogram;
+}
+
 /* Converts an (x,y) pair on the render (say, from a mouse click) to their complex co-ordinates */
 Point Plot3Plot::pixel_to_set_blo(int x, int y) const
 {
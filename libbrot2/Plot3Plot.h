@@ -19,13 +19,18 @@
 #ifndef PLOT3_H_
 #define PLOT3_H_
 
+#include <atomic>
 #include <thread>
 #include <queue>
+#include <chrono>
+#include <functional>
 #include "Fractal.h"
 #include "Plot3Chunk.h"
 #include "Plot3Pass.h"
 #include "IPlot3DataSink.h"
 #include "ChunkDivider.h"
+#include "ChunkOrdering.h"
+#include "ChunkStore.h"
 
 namespace BrotPrefs {
 class Prefs;
@@ -33,6 +38,8 @@ class Prefs;
 
 namespace Plot3 {
 
+class Checkpoint;
+
 class Plot3Plot {
 public:
 	/* What is this plot about? */
@@ -68,13 +75,20 @@ public:
 	 * The maths type to use is automatically determined
 	 * from the plot centre and size. */
 	void start();
-	// Could maybe do a resume() - or is it part of start()?
 
 	/* Starts a plot with an explicit maths type. */
 	void start(Fractal::Maths::MathsType arith);
 
 	/* Instructs the running plot to stop what it's doing ASAP.
-	 * Does NOT block; the plot may carry on for a little while. */
+	 * Does NOT block; the plot may carry on for a little while.
+	 * The pass in progress is abandoned part way through and isn't counted,
+	 * but every chunk keeps its pixels as they were, and the plot keeps its
+	 * pass count, maxiter and schedule. Once wait() has returned, start()
+	 * (either form; it keeps the chunks it has) runs the abandoned pass
+	 * again at the same maxiter, each pixel carrying on from where it
+	 * stopped, then carries on as if nothing had happened. Supersamples
+	 * aren't kept (they're redone at the end), and a plot that retires its
+	 * chunks (set_retire) can't be resumed. */
 	void stop();
 
 	/**
@@ -89,11 +103,93 @@ public:
 	unsigned get_passes() const { return plotted_passes; }
 	int get_maxiter() const { return plotted_maxiter; }
 	bool is_running();
+	// How long (in ms) the last stop() took to bring the plot to a halt; negative if it hasn't been stopped.
+	double get_stop_latency() const { return stop_latency_ms; }
 
 	// Provides a means to override the prefs.
 	void set_prefs(std::shared_ptr<BrotPrefs::Prefs>& newprefs);
 	void set_prefs(std::shared_ptr<const BrotPrefs::Prefs>& newprefs);
 
+	// Which order to run the chunks in (default: as the divider made them).
+	// Set before start(). The ordering itself may change its mind while
+	// the plot is running; the running pass will follow it.
+	void set_ordering(std::shared_ptr<const ChunkOrdering::Base> order) { _order = order; }
+
+	// Scheduling class for this plot's work on the shared pool (default: interactive).
+	// Set before start().
+	void set_qos(QoS qos) { _qos = qos; }
+	QoS qos() const { return _qos; }
+
+	// The pool we run on; renderers may borrow it afterwards (see Render2::Base::process).
+	ThreadPool& pool() const { return *_pool; }
+
+	/* Adaptive supersampling. Once the plot has otherwise finished, we run
+	 * a refinement pass over the pixels that stand out from a neighbour -
+	 * one is infinite and the other isn't, or their iterf differ by more
+	 * than threshold on a log scale - giving each factor x factor jittered
+	 * samples (see Plot3Chunk::supersample). The chunks are passed to the
+	 * sink again as they're done, then the sink is told the pass is complete.
+	 * factor 0 or 1 disables this (the default). Set before start(). */
+	void set_supersample(unsigned factor, double threshold) { _ss_factor = factor; _ss_threshold = threshold; }
+	unsigned supersample_factor() const { return _ss_factor; }
+	unsigned supersampled_pixels() const { return _ss_count; }
+
+	/* Retirement, so a big plot needn't hold all its data until the end.
+	 * After each pass, fn is given the chunks which that pass finished
+	 * (no live pixels left, so nothing more will change), then they are
+	 * released (see Plot3Chunk::release); when the plot completes, it's
+	 * given all the rest. It runs on the plot's own thread, so the next
+	 * pass waits for it. A stopped plot keeps the chunks it hasn't retired
+	 * yet, but once it has completed it can't be resumed, and the chunks
+	 * list no longer has any data. Supersampling needs the whole plot at
+	 * once, so doesn't happen. Set before start().
+	 * This frees memory early; it doesn't bound it. Every chunk has its
+	 * data from the start, and one with a pixel that never escapes keeps
+	 * it to the end. A plot that must fit in less uses a TiledPlot. */
+	typedef std::function<void(const std::list<Plot3Chunk*>&)> RetireFn;
+	void set_retire(RetireFn fn) { _retire = fn; }
+
+	/* A fixed schedule: run exactly this many passes (fewer only if every
+	 * pixel escapes first), ignoring the live-pixel thresholds that
+	 * normally decide when we're done. As the maxiter of each pass only
+	 * depends on how many passes went before, separate plots of adjoining
+	 * parts of a view then agree along their edges. 0 (the default) goes
+	 * back to deciding for ourselves. Set before start(). */
+	void set_fixed_passes(unsigned passes) { _fixed_passes = passes; }
+
+	/* Checkpointing: fn is called on the plot's own thread after each
+	 * complete pass, while no chunk is running, so it may save the plot
+	 * (see Checkpoint::write). The next pass waits for it. Set before
+	 * start(). */
+	typedef std::function<void()> PassFn;
+	void set_checkpoint(PassFn fn) { _checkpoint = fn; }
+
+	/* Keep going until maxiter reaches at least this, whatever the
+	 * live-pixel thresholds say (though we still stop if every pixel
+	 * escapes, or at max_passes); to take a finished plot further, say.
+	 * 0 (the default) leaves it to the thresholds. Set before start().
+	 * Restoring a checkpoint of a plot that had finished plots nothing
+	 * more unless this, or set_fixed_passes, asks for more. (Starting a
+	 * finished plot again in memory asks for more iterations, as ever.) */
+	void set_target_maxiter(unsigned maxiter) { _target_maxiter = maxiter; }
+
+	/* Takes on another plot's pass count and maxiter as our own, for a
+	 * plot that is never run but stands for others that were (the tiles
+	 * of a TiledPlot, say), so info() tells the truth. */
+	void adopt_statistics(const Plot3Plot& other) {
+		plotted_passes = other.plotted_passes;
+		plotted_maxiter = other.plotted_maxiter;
+	}
+
+	/* How big a scratch file the chunks are keeping their data in (see
+	 * ChunkStore and PREF(PlotMemoryBudget)); 0 if they're on the heap.
+	 * Only meaningful after start(). */
+	size_t scratch_size() const { return _store ? _store->size() : 0; }
+
+	/* How the escaped pixels are spread over iterf, as of the last complete
+	 * pass; null before the first. This is what the sink was given. */
+	std::shared_ptr<const IterHistogram> histogram();
+
 	/* Converts an (x,y) pair on the render (say, from a mouse click) to their complex co-ordinates.
 	 * Returns 1 for success, 0 if the point was outside of the render.
 	 * N.B. that we assume that pixel co-ordinates have a bottom-left origin! */
@@ -112,25 +208,56 @@ protected:
 
 	bool _shutdown; // Set only when we are being deleted. PROTECT by _lock !
 	bool _running; // Set when we are running. PROTECT by _lock !
+	bool _completing; // Set until the sink's plot_complete() has returned. PROTECT by _lock !
+	std::thread::id _runner; // The control thread of the current run. PROTECT by _lock !
 	bool _stop; // Set to ask the running plot to stop. PROTECT by _lock !
 
 	/* Plot statistics: */
 	unsigned plotted_maxiter; // How far did we get before bailing?
 	unsigned plotted_passes; // How many passes before bailing?
+	bool plotted_finished; // Did the plot decide it was done (rather than being stopped, or hitting a pass limit)?
 	unsigned passes_max; // Do we have an absolute limit on the number of passes?
+	/* Where the schedule had got to, so a stopped plot (or a checkpoint)
+	 * carries on exactly as it would have. All 0 before the first pass. */
+	unsigned plotted_live; // Pixels still live after the last pass
+	unsigned maxiter_scale; // How much more the next pass's maxiter is than the last
+	unsigned delta_threshold; // How few pixels a pass may finish before we call it a day
+	double stop_latency_ms; // See get_stop_latency()
 
 	void run(); // Actually does the work. Runs in its own thread (set up by constructor, called on start()).
+	unsigned refine(); // The supersampling pass, called by run(). Returns the number of pixels supersampled.
+	void retire(std::unique_lock<std::mutex>& lock, bool all); // Hands over and releases the final chunks (or all of them). Called by run(), holding _lock.
 
 private:
 	std::list<Plot3Chunk*> _chunks;
+	std::unique_ptr<ChunkStore> _store; // Where the chunks keep their data, if not on the heap
+	std::shared_ptr<const ChunkOrdering::Base> _order;
+	CancelToken _cancel; // Polled by the chunks
+	QoS _qos;
+	unsigned _ss_factor;
+	double _ss_threshold;
+	std::atomic<unsigned> _ss_count; // Pixels supersampled by the last refine(); read from any thread
+	RetireFn _retire; // May be empty
+	unsigned _fixed_passes; // 0 if we decide
+	unsigned _target_maxiter; // 0 if the thresholds decide
+	bool _restored; // Set by Checkpoint::restore until the next run starts
+	PassFn _checkpoint; // May be empty
+	std::shared_ptr<const IterHistogram> _histogram; // PROTECT by _lock !
+	std::chrono::steady_clock::time_point _stop_requested; // PROTECT by _lock !
 
 	/* Message passing between threads within the class */
 	std::mutex _lock;
 	std::condition_variable _waiters_cond; // Protected by _lock. For anybody wait()ing on us to finish.
 
-	static ThreadPool runner_pool; // LP#1099061: A single threaded "pool", runs our plot threads.
+	// Each running plot has its own control thread (which mostly sleeps, waiting
+	// for passes to complete) so plots don't queue behind one another; the real
+	// work is shared out on _pool according to _qos.
 	std::future<void> completion; // Use get() in the destructor, to ensure all jobs finished. Callers should use wait().
 
+	// Cuts the plot into chunks, ready to run; start() does this unless a Checkpoint already has.
+	void divide(Fractal::Maths::MathsType arith);
+	friend class Checkpoint;
+
 public:
 	// Wormhole to access the chunks list. Calls wait() first.
 	const std::list<Plot3Chunk*>& get_chunks__only_after_completion();
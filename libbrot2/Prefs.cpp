@@ -27,6 +27,7 @@
 #include <string.h>
 #include <unistd.h>
 #include "misc.h"
+#include "CpuTopology.h"
 BROT2_GLIBMM_BEFORE
 #include <glibmm/keyfile.h>
 #include <glibmm/fileutils.h>
@@ -337,6 +338,8 @@ int threadpool_size(std::shared_ptr<const Prefs> prefs)
 	int rv = prefs->get(PREF(MaxPlotThreads));
 	if (rv==-1)
 		rv = INT_MAX;
+	if (rv==0 && prefs->get(PREF(PhysicalCoresOnly)))
+		rv = CpuTopology::physical_cores(CpuTopology::available());
 	if (rv==0) {
 		rv = sysconf(_SC_NPROCESSORS_ONLN);
 		// N.B. Ports to other OSes need different code.
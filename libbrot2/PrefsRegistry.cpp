@@ -37,6 +37,15 @@ namespace BrotPrefs {
 				true, Groups::UI, "show_controls"),
         TileSize("Render tile size", "Size of tiles to render",
                 10, 64, INT_MAX, Groups::UI, "render_tile_size"),
+		TileOrder("Tile order",
+				"Which order to plot tiles in: 0=as divided, 1=centre first, "
+				"2=nearest the mouse pointer first, 3=Z-order, 4=Hilbert curve",
+				0, 2, 4, Groups::UI, "render_tile_order"),
+		IdleRefineSamples("Refine while idle",
+				"Once a plot has finished, keep antialiasing it in the "
+				"background, up to this many samples per pixel "
+				"(0 to disable)",
+				0, 64, 1024, Groups::UI, "idle_refine_samples"),
 
 		InitialMaxIter("Initial maxiter",
 				"First pass iteration limit (minimum 2)",
@@ -52,12 +61,44 @@ namespace BrotPrefs {
 				"is considered finished",
 				0, 14, 100,
 				Groups::PLOT_CONTROL, "minimum_done_percent"),
+		SupersampleFactor("Adaptive supersampling",
+				"Once a plot has finished, resample pixels at the edges "
+				"of features at up to NxN points each (0 to disable; "
+				"3, 4 or 8 are good choices)",
+				0, 0, 8,
+				Groups::PLOT_CONTROL, "supersample_factor"),
+		SupersampleThreshold("Supersampling threshold",
+				"How much a pixel must stand out from a neighbour to be "
+				"supersampled (difference in log iterations)",
+				0.0, 0.1, 10.0,
+				Groups::PLOT_CONTROL, "supersample_threshold"),
+		ExactColours("Exact colours",
+				"Work out every pixel's colour in full, rather than from "
+				"a table that may be out by 1 in each channel (slower)",
+				false, Groups::PLOT_CONTROL, "exact_colours"),
 
 		MaxPlotThreads("Max plot threads",
 				"The number of plotting threads to run at once, "
 				"or 0 to autodetect",
 				0, 0, 1000,
 				Groups::PLOT_CONTROL, "max_plot_threads"),
+		PhysicalCoresOnly("Physical cores only",
+				"Don't run plot threads on SMT (hyperthread) siblings; "
+				"autodetect one thread per physical core",
+				false, Groups::PLOT_CONTROL, "physical_cores_only"),
+		PinThreads("Pin plot threads",
+				"Pin each plot thread to its own CPU",
+				false, Groups::PLOT_CONTROL, "pin_threads"),
+		NumaPartitions("NUMA-aware plot threads",
+				"Keep each plot thread, and the tiles it works on, "
+				"on a single NUMA node",
+				false, Groups::PLOT_CONTROL, "numa_partitions"),
+		PlotMemoryBudget("Plot memory budget",
+				"The most memory (in MiB) a plot's pixels may take; "
+				"bigger plots keep them in a scratch file in $TMPDIR "
+				"instead (0 for no limit)",
+				0, 0, INT_MAX,
+				Groups::PLOT_CONTROL, "plot_memory_budget"),
 
 		HUDVerticalOffset("HUD Vertical offset %",
 				"HUD Vertical offset in % of window",
@@ -60,12 +60,21 @@ typedef Base<std::string> String;
 #define ALL_PREFS(DO) \
 	DO(Boolean,ShowControls) \
     DO(Int,TileSize) \
+    DO(Int,TileOrder) \
+	DO(Int,IdleRefineSamples) \
 	\
 	DO(Int,InitialMaxIter)\
 	DO(Float,LiveThreshold)\
 	DO(Int,MinEscapeePct) \
+	DO(Int,SupersampleFactor) \
+	DO(Float,SupersampleThreshold) \
+	DO(Boolean,ExactColours) \
 	\
 	DO(Int,MaxPlotThreads) \
+	DO(Boolean,PhysicalCoresOnly) \
+	DO(Boolean,PinThreads) \
+	DO(Boolean,NumaPartitions) \
+	DO(Int,PlotMemoryBudget) \
 	\
 	DO(Int,HUDVerticalOffset)\
 	DO(Int,HUDHorizontalOffset)\
@@ -0,0 +1,196 @@
+/*
+    ProgressiveRefiner.cpp: Stochastic supersampling of a finished plot, while idle
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ProgressiveRefiner.h"
+#include "Exception.h"
+#include <list>
+#include <random>
+
+using namespace Fractal;
+
+namespace Plot3 {
+
+namespace {
+/* Captures a plain render of the plot, so we start from exactly what's
+ * on the screen (including any adaptive supersamples). */
+class CaptureRender : public Render2::Base {
+	std::vector<float>& _acc;
+public:
+	CaptureRender(unsigned width, unsigned height, const BasePalette& pal, std::vector<float>& acc) :
+		Render2::Base(width, height, -1, false, pal, false), _acc(acc) {}
+	virtual void pixel_done(unsigned X, unsigned Y, const rgb& p) {
+		float *dst = &_acc[3 * (Y*_width + X)];
+		dst[0] = p.r;
+		dst[1] = p.g;
+		dst[2] = p.b;
+	}
+	virtual void pixel_get(unsigned, unsigned, rgb&) {
+		THROW(BrotFatalException, "CaptureRender cannot read back");
+	}
+};
+}
+
+ProgressiveRefiner::ProgressiveRefiner(Plot3Plot& plot, const BasePalette& pal, Callback cb,
+		unsigned max_samples, unsigned interval_ms) :
+	_plot(plot), _pal(pal.baked()), _cb(cb), _width(plot.width), _height(plot.height),
+	_maxiter(plot.get_maxiter()), _max_samples(max_samples), _interval(interval_ms),
+	_samples(0)
+{
+}
+
+ProgressiveRefiner::~ProgressiveRefiner() {
+	stop();
+	if (_completion.valid())
+		_completion.wait(); // Don't throw from a destructor
+}
+
+void ProgressiveRefiner::start() {
+	ASSERT(!_completion.valid());
+	_completion = std::async(std::launch::async, [=]{ this->run(); });
+}
+
+void ProgressiveRefiner::stop() {
+	_cancel.cancel();
+}
+
+void ProgressiveRefiner::wait() {
+	if (_completion.valid())
+		_completion.get();
+}
+
+unsigned ProgressiveRefiner::samples() const {
+	std::unique_lock<std::mutex> lock(_lock);
+	return _samples;
+}
+
+void ProgressiveRefiner::render(Render2::Base& target) const {
+	std::unique_lock<std::mutex> lock(_lock);
+	if (!_samples)
+		return;
+	ASSERT(target.width() == _width && target.height() == _height);
+	for (unsigned y=0; y<_height; y++)
+		target.row_done(0, y, &_image[y*_width], _width);
+}
+
+void ProgressiveRefiner::prepare() {
+	const std::list<Plot3Chunk*>& chunks = _plot.get_chunks__only_after_completion();
+
+	_acc.assign(3 * _width * _height, 0);
+	CaptureRender capture(_width, _height, _pal, _acc);
+	capture.process(chunks);
+
+	// A pixel is interior if it and its neighbours are all infinite.
+	std::vector<bool> inf(_width * _height, false);
+	for (auto chunk : chunks) {
+		const PointData* data = chunk->get_data();
+		for (unsigned j=0; j<chunk->_height; j++)
+			for (unsigned i=0; i<chunk->_width; i++)
+				inf[(_height - 1 - (chunk->_offY + j)) * _width + chunk->_offX + i] = data[j*chunk->_width + i].iterf < 0;
+	}
+	_skip.assign(_width * _height, false);
+	for (unsigned y=0; y<_height; y++) {
+		for (unsigned x=0; x<_width; x++) {
+			const unsigned idx = y*_width + x;
+			_skip[idx] = inf[idx]
+				&& (x == 0 || inf[idx-1]) && (x+1 == _width || inf[idx+1])
+				&& (y == 0 || inf[idx-_width]) && (y+1 == _height || inf[idx+_width]);
+		}
+	}
+}
+
+void ProgressiveRefiner::sample_chunk(const Plot3Chunk& chunk, unsigned round) {
+	// Seeded by round and chunk, so a given refinement is repeatable.
+	std::minstd_rand rng(1 + round * 65521u + chunk._offY * _width + chunk._offX);
+	std::uniform_real_distribution<double> jitter(0.0, 1.0);
+	std::vector<PointData> row(chunk._width);
+	std::vector<rgb> colours(chunk._width);
+	std::vector<unsigned> where(chunk._width);
+
+	for (unsigned j=0; j<chunk._height; j++) {
+		const unsigned y = _height - 1 - (chunk._offY + j);
+		unsigned n = 0;
+		for (unsigned i=0; i<chunk._width; i++) {
+			const unsigned idx = y*_width + chunk._offX + i;
+			if (_skip[idx])
+				continue;
+			double dx = jitter(rng), dy = jitter(rng);
+			Plot3Chunk::Sample s;
+			if (!chunk.sample(i, j, dx, dy, _maxiter, s, &_cancel))
+				return;
+			row[n].iter = s.iter;
+			row[n].iterf = s.iterf;
+			row[n].nomore = true;
+			where[n] = idx;
+			++n;
+		}
+		if (!n)
+			continue;
+		_pal.get_span(&row[0], n, -1, &colours[0]);
+		for (unsigned k=0; k<n; k++) {
+			float *dst = &_acc[3 * where[k]];
+			dst[0] += colours[k].r;
+			dst[1] += colours[k].g;
+			dst[2] += colours[k].b;
+		}
+	}
+}
+
+void ProgressiveRefiner::publish(unsigned samples) {
+	std::unique_lock<std::mutex> lock(_lock);
+	_image.resize(_width * _height);
+	for (unsigned idx=0; idx<_width*_height; idx++) {
+		const float *src = &_acc[3*idx];
+		// Skipped pixels were never sampled, so still have just the plot's colour
+		const float n = _skip[idx] ? 1 : samples;
+		_image[idx] = rgb(src[0] / n + 0.5f, src[1] / n + 0.5f, src[2] / n + 0.5f);
+	}
+	_samples = samples;
+}
+
+void ProgressiveRefiner::run() {
+	prepare();
+	std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+	ThreadPool& pool = _plot.pool();
+
+	// The plot itself is the first sample.
+	for (unsigned samples = 1; samples < _max_samples; ) {
+		std::list<std::future<void>> done;
+		for (auto chunk : _plot.get_chunks__only_after_completion()) {
+			done.push_back(pool.enqueue<void>([=] {
+				sample_chunk(*chunk, samples);
+			}, QoS::BATCH, chunk->home()));
+		}
+		// Let them all finish before looking for trouble; they use our buffers.
+		for (auto& f : done)
+			f.wait();
+		for (auto& f : done)
+			f.get();
+		if (_cancel.cancelled())
+			return; // this round is incomplete
+		++samples;
+
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (samples == _max_samples || now - last >= _interval) {
+			publish(samples);
+			last = now;
+			_cb(samples);
+		}
+	}
+}
+
+} // namespace Plot3
@@ -0,0 +1,107 @@
+/*
+    ProgressiveRefiner.h: Stochastic supersampling of a finished plot, while idle
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROGRESSIVEREFINER_H_
+#define PROGRESSIVEREFINER_H_
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <vector>
+#include "Plot3Plot.h"
+#include "Render2.h"
+#include "palette.h"
+
+namespace Plot3 {
+
+/*
+ * Once a plot has finished and the user is looking at it, we can spend the
+ * idle time antialiasing it. Each round takes one more sample of every
+ * pixel, at a random point within it, colours it and adds it into a float
+ * accumulation buffer; the picture we show is the running average, so it
+ * keeps getting smoother until we reach max_samples or are stopped.
+ *
+ * Pixels deep inside the set (infinite, with all four neighbours infinite)
+ * are skipped: they're the most expensive to sample and the least likely
+ * to change.
+ *
+ * The rounds run on the plot's pool as QoS::BATCH, so anything the user
+ * starts goes ahead of them; stop() cancels the round in progress (the
+ * samples poll for it, as a plot does). The callback is told about a new
+ * average at most once per interval_ms, and always about the last one, so
+ * a fast machine doesn't spend its time repainting.
+ */
+class ProgressiveRefiner {
+public:
+	/* Called on our own thread, each time there's a new picture for render();
+	 * samples is how many samples per pixel it has (including the plot's own). */
+	typedef std::function<void(unsigned samples)> Callback;
+
+	static const unsigned DEFAULT_MAX_SAMPLES = 64;
+	static const unsigned DEFAULT_INTERVAL_MS = 250;
+
+	/* The plot must have finished, and it and the palette must outlive us.
+	 * Nothing happens until start(). */
+	ProgressiveRefiner(Plot3Plot& plot, const BasePalette& pal, Callback cb,
+			unsigned max_samples = DEFAULT_MAX_SAMPLES, unsigned interval_ms = DEFAULT_INTERVAL_MS);
+	virtual ~ProgressiveRefiner(); // Stops and waits.
+
+	void start();
+	/* Asks us to stop ASAP. Does not block. */
+	void stop();
+	/* Waits for us to finish or stop. Rethrows anything that went wrong. */
+	void wait();
+
+	/* How many samples per pixel the current picture has; 0 if none yet. */
+	unsigned samples() const;
+
+	/* Writes the current picture to the target, which must be the size of
+	 * the plot and not antialiasing. Does nothing if there isn't one yet. */
+	void render(Render2::Base& target) const;
+
+private:
+	ProgressiveRefiner(const ProgressiveRefiner&) = delete;
+	const ProgressiveRefiner& operator= (const ProgressiveRefiner&) = delete;
+
+	Plot3Plot& _plot;
+	const BasePalette& _pal; // the baked() version of what we were given
+	const Callback _cb;
+	const unsigned _width, _height, _maxiter, _max_samples;
+	const std::chrono::milliseconds _interval;
+	CancelToken _cancel;
+	std::future<void> _completion;
+
+	/* All indexed by render co-ordinates (top-left origin). Only our thread
+	 * and its pool jobs touch _acc and _skip; each job has its own pixels. */
+	std::vector<float> _acc; // 3 channels per pixel, summed over the samples so far
+	std::vector<bool> _skip;
+
+	mutable std::mutex _lock;
+	std::vector<rgb> _image; // PROTECT by _lock
+	unsigned _samples; // PROTECT by _lock
+
+	void run();
+	void prepare(); // Sets up _acc (from the plot as it stands) and _skip
+	void sample_chunk(const Plot3Chunk& chunk, unsigned round);
+	void publish(unsigned samples);
+};
+
+} // namespace Plot3
+
+#endif /* PROGRESSIVEREFINER_H_ */
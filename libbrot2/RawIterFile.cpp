@@ -0,0 +1,244 @@
+/*
+    RawIterFile.cpp: Binary, memory-mappable dump of a plot's iteration counts
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "RawIterFile.h"
+#include "Exception.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <locale>
+#include <sstream>
+#include <vector>
+
+namespace Plot3 {
+
+static const char MAGIC[8] = { 'b','r','o','t','2','r','a','w' };
+
+// Header field offsets; see RawIterFile.h.
+enum {
+	H_MAGIC = 0, H_VERSION = 8, H_WIDTH = 12, H_HEIGHT = 16, H_MAXITER = 20,
+	H_ITERF_OFFSET = 24, H_ITER_OFFSET = 32, H_FRACTAL = 40, H_CENTRE_RE = 104,
+	H_CENTRE_IM = H_CENTRE_RE + RawIterFile::NAME_LEN,
+	H_SIZE_RE = H_CENTRE_IM + RawIterFile::NAME_LEN,
+	H_SIZE_IM = H_SIZE_RE + RawIterFile::NAME_LEN,
+	H_END = H_SIZE_IM + RawIterFile::NAME_LEN,
+};
+static_assert(H_END <= RawIterFile::PAGE, "RawIterFile header overflows its page");
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static inline uint32_t le32(uint32_t v) { return __builtin_bswap32(v); }
+static const bool HOST_IS_LE = false;
+#else
+static inline uint32_t le32(uint32_t v) { return v; }
+static const bool HOST_IS_LE = true;
+#endif
+
+static void put_le(unsigned char *p, uint64_t v, unsigned bytes) {
+	for (unsigned i=0; i<bytes; i++)
+		p[i] = v >> (8*i);
+}
+
+static uint64_t get_le(const unsigned char *p, unsigned bytes) {
+	uint64_t rv = 0;
+	for (unsigned i=0; i<bytes; i++)
+		rv |= (uint64_t)p[i] << (8*i);
+	return rv;
+}
+
+static void put_str(unsigned char *p, const std::string& s) {
+	memcpy(p, s.data(), std::min<size_t>(s.length(), RawIterFile::NAME_LEN-1));
+}
+
+static std::string get_str(const unsigned char *p) {
+	const char *s = (const char*)p;
+	return std::string(s, strnlen(s, RawIterFile::NAME_LEN-1));
+}
+
+// Enough digits to get the very same value back. Always in the "C"
+// locale, so that a file reads the same whatever locale opens it.
+static std::string value_str(Fractal::Value v) {
+	std::ostringstream os;
+	os.imbue(std::locale::classic());
+	os.precision(std::numeric_limits<Fractal::Value>::max_digits10);
+	os << v;
+	return os.str();
+}
+
+static Fractal::Value str_value(const unsigned char *p) {
+	std::istringstream is(get_str(p));
+	is.imbue(std::locale::classic());
+	Fractal::Value v = 0;
+	is >> v;
+	return v;
+}
+
+static inline uint64_t page_round(uint64_t n) {
+	return (n + RawIterFile::PAGE - 1) / RawIterFile::PAGE * RawIterFile::PAGE;
+}
+
+static void pad(std::ostream& os, uint64_t from, uint64_t to) {
+	static const char zeroes[RawIterFile::PAGE] = {0};
+	ASSERT(to >= from && to - from <= RawIterFile::PAGE);
+	os.write(zeroes, to - from);
+}
+
+typedef std::vector<std::vector<const Plot3Chunk*> > RowIndex;
+
+/* Writes one plane, a row at a time, top row first. VALUE picks out the
+ * 32 bits we want from each point. */
+template<typename VALUE>
+static void write_plane(std::ostream& os, const RowIndex& rows, unsigned width, VALUE value) {
+	std::vector<uint32_t> buf(width);
+	for (unsigned y=0; y<rows.size(); y++) {
+		// Chunks have a bottom-left origin.
+		const unsigned plot_y = rows.size() - 1 - y;
+		unsigned done = 0;
+		for (auto chunk : rows[plot_y]) {
+			const Fractal::PointData *src = chunk->get_data() + (plot_y - chunk->_offY) * chunk->_width;
+			uint32_t *dst = &buf[chunk->_offX];
+			for (unsigned i=0; i<chunk->_width; i++)
+				dst[i] = le32(value(src[i]));
+			done += chunk->_width;
+		}
+		ASSERT(done == width); // every pixel exactly once, or the chunks are amiss
+		os.write((const char*)&buf[0], width * sizeof buf[0]);
+	}
+}
+
+void RawIterFile::write(Plot3Plot& plot, std::ostream& os) {
+	const unsigned width = plot.width, height = plot.height;
+	const uint64_t plane_bytes = (uint64_t)width * height * 4;
+	const uint64_t iterf_offset = PAGE, iter_offset = page_round(iterf_offset + plane_bytes);
+
+	RowIndex rows(height);
+	for (auto chunk : plot.get_chunks__only_after_completion()) {
+		ASSERT(chunk->_offX + chunk->_width <= width);
+		ASSERT(chunk->_offY + chunk->_height <= height);
+		for (unsigned j=0; j<chunk->_height; j++)
+			rows[chunk->_offY + j].push_back(chunk);
+	}
+
+	unsigned char header[PAGE] = {0};
+	memcpy(header + H_MAGIC, MAGIC, sizeof MAGIC);
+	put_le(header + H_VERSION, VERSION, 4);
+	put_le(header + H_WIDTH, width, 4);
+	put_le(header + H_HEIGHT, height, 4);
+	put_le(header + H_MAXITER, plot.get_maxiter(), 4);
+	put_le(header + H_ITERF_OFFSET, iterf_offset, 8);
+	put_le(header + H_ITER_OFFSET, iter_offset, 8);
+	put_str(header + H_FRACTAL, plot.fract.name);
+	put_str(header + H_CENTRE_RE, value_str(real(plot.centre)));
+	put_str(header + H_CENTRE_IM, value_str(imag(plot.centre)));
+	put_str(header + H_SIZE_RE, value_str(real(plot.size)));
+	put_str(header + H_SIZE_IM, value_str(imag(plot.size)));
+	os.write((const char*)header, PAGE);
+
+	write_plane(os, rows, width, [](const Fractal::PointData& pt) {
+		uint32_t u;
+		memcpy(&u, &pt.iterf, sizeof u);
+		return u;
+	});
+	pad(os, iterf_offset + plane_bytes, iter_offset);
+	write_plane(os, rows, width, [](const Fractal::PointData& pt) {
+		// A pixel still live when the plot stopped has got as far as maxiter (or
+		// less, if it was stopped); but it didn't escape, so it's as infinite.
+		return (uint32_t)(int32_t)(pt.iterf < 0 ? -1 : pt.iter);
+	});
+	if (!os)
+		THROW(BrotException, "Failed writing raw iteration data");
+}
+
+void RawIterFile::write(Plot3Plot& plot, const std::string& filename) {
+	std::ofstream fs;
+	fs.open(filename, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+	if (!fs)
+		THROW(BrotException, "Could not open "+filename+" for writing");
+	write(plot, fs);
+	fs.close();
+}
+
+RawIterFile::RawIterFile(const std::string& filename) : _map(0), _maplen(0) {
+	if (!HOST_IS_LE)
+		THROW(BrotException, "Raw iteration files can only be mapped on little-endian machines");
+
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		THROW(BrotException, "Could not open "+filename+": "+strerror(errno));
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)PAGE) {
+		close(fd);
+		THROW(BrotException, filename+" is not a raw iteration file (too short)");
+	}
+	_maplen = st.st_size;
+	_map = mmap(0, _maplen, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd); // the mapping keeps its own reference
+	if (_map == MAP_FAILED) {
+		_map = 0;
+		THROW(BrotException, "Could not map "+filename+": "+strerror(errno));
+	}
+
+	try {
+		const unsigned char *header = (const unsigned char*)_map;
+		if (memcmp(header + H_MAGIC, MAGIC, sizeof MAGIC))
+			THROW(BrotException, filename+" is not a raw iteration file");
+		if (get_le(header + H_VERSION, 4) != VERSION)
+			THROW(BrotException, filename+" is a raw iteration file of an unknown version");
+		_width = get_le(header + H_WIDTH, 4);
+		_height = get_le(header + H_HEIGHT, 4);
+		_maxiter = get_le(header + H_MAXITER, 4);
+		const uint64_t plane_bytes = (uint64_t)_width * _height * 4,
+				iterf_offset = get_le(header + H_ITERF_OFFSET, 8),
+				iter_offset = get_le(header + H_ITER_OFFSET, 8);
+		if (iterf_offset % PAGE || iter_offset % PAGE
+				|| iterf_offset + plane_bytes > _maplen || iter_offset + plane_bytes > _maplen)
+			THROW(BrotException, filename+" is truncated or corrupt");
+		_fractal = get_str(header + H_FRACTAL);
+		_centre = Fractal::Point(str_value(header + H_CENTRE_RE), str_value(header + H_CENTRE_IM));
+		_size = Fractal::Point(str_value(header + H_SIZE_RE), str_value(header + H_SIZE_IM));
+		_iterf = (const float*)(header + iterf_offset);
+		_iter = (const int32_t*)(header + iter_offset);
+	} catch (...) {
+		munmap(_map, _maplen);
+		throw;
+	}
+}
+
+RawIterFile::~RawIterFile() {
+	if (_map)
+		munmap(_map, _maplen);
+}
+
+void RawIterFile::get_points(unsigned y, Fractal::PointData* out) const {
+	ASSERT(y < _height);
+	const float *iterf = iterf_row(_height - 1 - y);
+	const int32_t *iter = iter_row(_height - 1 - y);
+	for (unsigned x=0; x<_width; x++) {
+		out[x].iter = iter[x];
+		out[x].iterf = iterf[x];
+		out[x].nomore = true;
+	}
+}
+
+} // namespace Plot3
@@ -0,0 +1,104 @@
+/*
+    RawIterFile.h: Binary, memory-mappable dump of a plot's iteration counts
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAWITERFILE_H_
+#define RAWITERFILE_H_
+
+#include <stdint.h>
+#include <iostream>
+#include <string>
+#include "Fractal.h"
+#include "Plot3Plot.h"
+#include "Render2.h"
+
+namespace Plot3 {
+
+/*
+ * What a finished plot computed, for post-processing elsewhere: iterf and
+ * iter for every pixel, without a palette in sight.
+ *
+ * The file is a 4096-byte header page, then the iterf plane (float32),
+ * then the iter plane (int32), each starting on a 4096-byte boundary so
+ * a reader can mmap the whole thing and use the planes in place. Both are
+ * little-endian, row-major, width x height, with the top row first (as
+ * in a PNG). Pixels that didn't escape (whether known to be infinite, or
+ * still live when the plot stopped) have iter and iterf of -1.
+ *
+ * Header (all integers little-endian):
+ *    0  char[8]  "brot2raw"
+ *    8  uint32   format version (1)
+ *   12  uint32   width
+ *   16  uint32   height
+ *   20  uint32   maxiter
+ *   24  uint64   offset of the iterf plane
+ *   32  uint64   offset of the iter plane
+ *   40  char[64] fractal name
+ *  104  char[64] x4  centre real, centre imaginary, axis length real,
+ *                    axis length imaginary; as decimal, to full precision
+ * The strings are NUL-padded. The rest of the page is zero.
+ *
+ * A mapped file can be rendered directly (see Render2::Base::process).
+ */
+class RawIterFile : public Render2::IPointRows {
+public:
+	static const uint32_t VERSION = 1;
+	static const unsigned PAGE = 4096;
+	static const unsigned NAME_LEN = 64;
+
+	/* Writes the plot out straight from its chunks; we only buffer a row.
+	 * The plot must have finished. */
+	static void write(Plot3Plot& plot, std::ostream& os);
+	static void write(Plot3Plot& plot, const std::string& filename);
+
+	/* Maps an existing file, read-only. Throws BrotException if it's not
+	 * one of ours or it's the wrong size. */
+	RawIterFile(const std::string& filename);
+	virtual ~RawIterFile();
+
+	virtual unsigned width() const { return _width; }
+	virtual unsigned height() const { return _height; }
+	unsigned maxiter() const { return _maxiter; }
+	const std::string& fractal() const { return _fractal; }
+	Fractal::Point centre() const { return _centre; }
+	Fractal::Point size() const { return _size; }
+
+	/* Row y of each plane, width() entries, straight out of the mapping.
+	 * These are in file order, so y has a top-left origin. */
+	const float* iterf_row(unsigned y) const { return _iterf + (size_t)y * _width; }
+	const int32_t* iter_row(unsigned y) const { return _iter + (size_t)y * _width; }
+
+	/* Both planes' worth of row y, as the renderers like them; this y has
+	 * a bottom-left origin, like the chunks. */
+	virtual void get_points(unsigned y, Fractal::PointData* out) const;
+
+private:
+	RawIterFile(const RawIterFile&) = delete;
+	const RawIterFile& operator= (const RawIterFile&) = delete;
+
+	void *_map;
+	size_t _maplen;
+	unsigned _width, _height, _maxiter;
+	std::string _fractal;
+	Fractal::Point _centre, _size;
+	const float *_iterf;
+	const int32_t *_iter;
+};
+
+} // namespace Plot3
+
+#endif /* RAWITERFILE_H_ */
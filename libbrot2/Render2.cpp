@@ -17,8 +17,24 @@
 */
 
 #include <png++/png.hpp>
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include "Render2.h"
+#include "ParallelJob.h"
+#include "IterPlane.h"
 #include "Plot3Chunk.h"
 #include "palette.h"
 #include "Exception.h"
@@ -28,8 +44,10 @@ namespace Render2 {
 
 using namespace Plot3;
 
+const IPointRows::SupersampleMap IPointRows::NO_SUPERSAMPLES;
+
 Base::Base(unsigned width, unsigned height, int local_inf, bool antialias, const BasePalette& pal, bool upscale) :
-		_width(width), _height(height), _local_inf(local_inf), _antialias(antialias), _upscale(upscale), _pal(&pal) {
+		_width(width), _height(height), _local_inf(local_inf), _antialias(antialias), _upscale(upscale), _pal(&pal.baked()) {
 	ASSERT( ! (_antialias && _upscale) ); // These two are not compatible, UI should prevent both being selected
 	if (_upscale) {
 		ASSERT(!(width%2));
@@ -55,6 +73,31 @@ void Base::process(const std::list<Plot3Chunk*>& chunks)
 	}
 }
 
+void Base::process(const std::list<Plot3Chunk*>& chunks, ThreadPool& pool, QoS cls)
+{
+	const std::vector<Plot3Chunk*> v(chunks.begin(), chunks.end());
+	ParallelJob::run(v.size(), [this, &v] (unsigned i) { process(*v[i]); }, pool, cls);
+}
+
+// Rows of output per job when rendering from an IterPlane, so there's
+// enough in each to be worth handing out.
+static const unsigned PLANE_BAND_ROWS = 16;
+
+void Base::process(const IPointRows& plane, ThreadPool& pool, QoS cls)
+{
+	if (_antialias) {
+		ASSERT(plane.width() == 2*_width && plane.height() == 2*_height);
+	} else if (_upscale) {
+		ASSERT(2*plane.width() >= _width && 2*plane.height() >= _height);
+	} else {
+		ASSERT(plane.width() == _width && plane.height() == _height);
+	}
+	const unsigned nbands = (_height + PLANE_BAND_ROWS - 1) / PLANE_BAND_ROWS;
+	ParallelJob::run(nbands, [this, &plane] (unsigned i) {
+		process_rows(plane, i * PLANE_BAND_ROWS, std::min(_height, (i+1) * PLANE_BAND_ROWS));
+	}, pool, cls);
+}
+
 void Base::process_plain(const Plot3Chunk& chunk)
 {
 	const Fractal::PointData * data = chunk.get_data();
@@ -62,20 +105,35 @@ void Base::process_plain(const Plot3Chunk& chunk)
 	// Slight twist: We've plotted the fractal from a bottom-left origin,
 	// but the rest of the universe assumes a top-left origin.
 
-	unsigned i,j;
+	unsigned j;
 
 	// Sanity checks
 	ASSERT( chunk._offX + chunk._width <= _width );
 	ASSERT( chunk._offY + chunk._height <= _height );
 
+	// Supersamples, if any. The palettes want PointData, so we make some.
+	const std::vector<unsigned>& ss_pixels = chunk.ss_pixels();
+	const unsigned nsamples = chunk.ss_factor() * chunk.ss_factor();
+	unsigned ss = 0;
+	std::vector<Fractal::PointData> samples(nsamples);
+	std::vector<rgb> sample_colours(nsamples);
+
+	std::vector<rgb> row(chunk._width);
 	for (j=0; j<chunk._height; j++) {
 		const Fractal::PointData * src = &data[j*chunk._width];
-
-		for (i=0; i<chunk._width; i++) {
-			rgb pix = render_pixel(src[i], _local_inf, _pal);
-			int xx = i+chunk._offX, yy = _height-(1+j+chunk._offY);
-			pixel_done(xx, yy, pix);
+		_pal->get_span(src, chunk._width, _local_inf, &row[0]);
+
+		for (; ss < ss_pixels.size() && ss_pixels[ss] < (j+1)*chunk._width; ss++) {
+			const Plot3Chunk::Sample* s = chunk.ss_samples(ss);
+			for (unsigned k=0; k<nsamples; k++) {
+				samples[k].iter = s[k].iter;
+				samples[k].iterf = s[k].iterf;
+				samples[k].nomore = true;
+			}
+			_pal->get_span(&samples[0], nsamples, _local_inf, &sample_colours[0]);
+			row[ss_pixels[ss] - j*chunk._width] = antialias_pixels(&sample_colours[0], nsamples);
 		}
+		row_done(chunk._offX, _height-(1+j+chunk._offY), &row[0], chunk._width);
 	}
 }
 
@@ -93,19 +151,20 @@ void Base::process_upscale(const Plot3Chunk& chunk)
 	ASSERT( outOffX + outW <= _width + 1 );
 	ASSERT( outOffY + outH <= _height + 1);
 
+	std::vector<rgb> row(chunk._width), doubled(outW);
+	// Don't run over the right-hand edge where the output size isn't a multiple of 2.
+	const unsigned n = std::min(outW, _width - outOffX);
 	for (j=0; j<chunk._height; j++) {
 		const Fractal::PointData * src = &data[j*chunk._width];
-
-		for (i=0; i<chunk._width; i++) {
-			rgb pix = render_pixel(src[i], _local_inf, _pal);
-			// Same co-ordinate conversion as in process_plain(), then we upscale
-			int xx = 2*(i+chunk._offX), yy = _height - 2 *(1 + j + chunk._offY);
-			if ((xx<0) || (yy<0)) continue; // This stops us from running over the edge where output size is not a multiple of 2. We could be fancier here but it's only a draft render so it's not worth the complexity.
-			pixel_done(xx+0, yy+0, pix);
-			pixel_done(xx+1, yy+0, pix);
-			pixel_done(xx+0, yy+1, pix);
-			pixel_done(xx+1, yy+1, pix);
-		}
+		_pal->get_span(src, chunk._width, _local_inf, &row[0]);
+		for (i=0; i<chunk._width; i++)
+			doubled[2*i] = doubled[2*i+1] = row[i];
+
+		// Same co-ordinate conversion as in process_plain(), then we upscale
+		int yy = _height - 2 *(1 + j + chunk._offY);
+		if (yy<0) continue; // Likewise the top edge. We could be fancier here but it's only a draft render so it's not worth the complexity.
+		row_done(outOffX, yy+0, &doubled[0], n);
+		row_done(outOffX, yy+1, &doubled[0], n);
 	}
 }
 
@@ -126,19 +185,78 @@ void Base::process_antialias(const Plot3Chunk& chunk)
 	ASSERT( outOffX + outW <= _width );
 	ASSERT( outOffY + outH <= _height);
 
+	// Colour each pair of input rows, then average down.
+	std::vector<rgb> rows(2 * chunk._width), out(outW);
+	rgb * const upper = &rows[0], * const lower = &rows[chunk._width];
 	for (j=0; j<outH; j++) {
+		_pal->get_span(&data[2*j*chunk._width], chunk._width, _local_inf, upper);
+		_pal->get_span(&data[(1+2*j)*chunk._width], chunk._width, _local_inf, lower);
+
 		for (i=0; i<outW; i++) {
 			rgb pix[4];
+			pix[0] = upper[2*i];
+			pix[1] = upper[2*i+1];
+			pix[2] = lower[2*i];
+			pix[3] = lower[2*i+1];
+			out[i] = antialias_pixel4(pix);
+		}
+		row_done(outOffX, _height-(1+j+outOffY), &out[0], outW);
+	}
+}
 
-			const Fractal::PointData * base = &data[2*j*chunk._width];
-			pix[0] = render_pixel(base[2*i], _local_inf, _pal);
-			pix[1] = render_pixel(base[2*i+1], _local_inf, _pal);
-
-			base = &data[(1+2*j)*chunk._width];
-			pix[2] = render_pixel(base[2*i], _local_inf, _pal);
-			pix[3] = render_pixel(base[2*i+1], _local_inf, _pal);
-
-			pixel_done(i+outOffX, _height-(1+j+outOffY), antialias_pixel4(pix));
+void Base::process_rows(const IPointRows& plane, unsigned y0, unsigned y1)
+{
+	// The same co-ordinate conversions as process_*(); see there.
+	const unsigned pw = plane.width();
+	std::vector<Fractal::PointData> pts(2 * pw); // Two rows, for antialiasing
+	std::vector<rgb> colours(2 * pw), out(std::max(_width, 2 * pw));
+	std::vector<Fractal::PointData> samples;
+	std::vector<rgb> sample_colours;
+
+	for (unsigned y=y0; y<y1; y++) {
+		if (_antialias) {
+			const unsigned k = _height - 1 - y;
+			plane.get_points(2*k, &pts[0]);
+			plane.get_points(2*k + 1, &pts[pw]);
+			_pal->get_span(&pts[0], 2 * pw, _local_inf, &colours[0]);
+			const rgb * const upper = &colours[0], * const lower = &colours[pw];
+			for (unsigned i=0; i<_width; i++) {
+				rgb pix[4];
+				pix[0] = upper[2*i];
+				pix[1] = upper[2*i+1];
+				pix[2] = lower[2*i];
+				pix[3] = lower[2*i+1];
+				out[i] = antialias_pixel4(pix);
+			}
+			row_done(0, y, &out[0], _width);
+
+		} else if (_upscale) {
+			const unsigned k = (_height - 1 - y) / 2;
+			if (k >= plane.height())
+				continue;
+			plane.get_points(k, &pts[0]);
+			_pal->get_span(&pts[0], pw, _local_inf, &colours[0]);
+			for (unsigned i=0; i<pw; i++)
+				out[2*i] = out[2*i+1] = colours[i];
+			row_done(0, y, &out[0], std::min(2 * pw, _width));
+
+		} else {
+			const unsigned k = _height - 1 - y;
+			plane.get_points(k, &pts[0]);
+			_pal->get_span(&pts[0], pw, _local_inf, &out[0]);
+			for (auto it = plane.ss_begin(k); it != plane.ss_end(k); ++it) {
+				const std::vector<Plot3Chunk::Sample>& s = it->second;
+				samples.resize(s.size());
+				sample_colours.resize(s.size());
+				for (unsigned n=0; n<s.size(); n++) {
+					samples[n].iter = s[n].iter;
+					samples[n].iterf = s[n].iterf;
+					samples[n].nomore = true;
+				}
+				_pal->get_span(&samples[0], s.size(), _local_inf, &sample_colours[0]);
+				out[it->first - k * pw] = antialias_pixels(&sample_colours[0], s.size());
+			}
+			row_done(0, y, &out[0], _width);
 		}
 	}
 }
@@ -148,7 +266,13 @@ void Base::fresh_local_inf(unsigned local_inf) {
 }
 
 void Base::fresh_palette(const BasePalette& pal) {
-	_pal = &pal;
+	_pal = &pal.baked();
+}
+
+void Base::row_done(unsigned X, unsigned Y, const rgb* pix, unsigned n)
+{
+	for (unsigned i=0; i<n; i++)
+		pixel_done(X+i, Y, pix[i]);
 }
 
 void Base::pixel_overlay(unsigned X, unsigned Y, const rgba& other)
@@ -159,8 +283,114 @@ void Base::pixel_overlay(unsigned X, unsigned Y, const rgba& other)
 	this->pixel_done(X, Y, pixel);
 }
 
+/* Cairo stores its pixels as native-endian words. */
+static inline uint32_t argb32_at(const unsigned char *src, unsigned x) {
+	uint32_t w;
+	memcpy(&w, src + 4*x, sizeof w);
+	return w;
+}
+
+/* Blends an ARGB32 word over a pixel, exactly as rgb::overlay() would.
+ * There are no branches (at alpha 0 and 255 the arithmetic comes out the
+ * same as the early returns there), so the compiler can vectorise loops
+ * of these. */
+static inline void blend_argb32(rgb& dst, uint32_t w)
+{
+	const unsigned alpha = w >> 24, invalpha = 255 - alpha;
+	dst.r = (((w >> 16) & 0xff) * alpha) / 255 + (dst.r * invalpha) / 255;
+	dst.g = (((w >> 8) & 0xff) * alpha) / 255 + (dst.g * invalpha) / 255;
+	dst.b = ((w & 0xff) * alpha) / 255 + (dst.b * invalpha) / 255;
+}
+
+static void blend_argb32_row(rgb *dst, const unsigned char *src, unsigned n)
+{
+	for (unsigned i=0; i<n; i++)
+		blend_argb32(dst[i], argb32_at(src, i));
+}
+
+/* The part [a,b) of an ARGB32 row of n pixels that has anything on it. */
+static inline void argb32_span(const unsigned char *src, unsigned n, unsigned& a, unsigned& b)
+{
+	a = 0;
+	b = n;
+	while (a < b && !(argb32_at(src, a) >> 24))
+		++a;
+	while (b > a && !(argb32_at(src, b-1) >> 24))
+		--b;
+}
+
+void Base::overlay_argb32(const unsigned char* data, int stride, unsigned top, unsigned rows)
+{
+	ASSERT(top + rows <= _height);
+	std::vector<rgb> row(_width);
+	for (unsigned j = 0; j<rows; j++) {
+		const unsigned char *src = data + j * stride;
+		unsigned a, b;
+		argb32_span(src, _width, a, b);
+		if (a == b)
+			continue;
+		for (unsigned x = a; x<b; x++)
+			pixel_get(x, top + j, row[x-a]);
+		blend_argb32_row(&row[0], src + 4*a, b-a);
+		row_done(a, top + j, &row[0], b-a);
+	}
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+/* The pixel packers. One of each per format, instantiated from the
+ * templates below, so the loops inline down to plain stores. */
+struct Cairo32 { // CAIRO_FORMAT_ARGB32 and _RGB24; alpha=1.0 so these are the same
+	static const unsigned STEP = 4;
+	// Cairo stores its pixels as native-endian words, so let the compiler sort out the byte order.
+	static inline void pack(unsigned char *dst, const rgb& pix) {
+		uint32_t w = 0xff000000 | (pix.r << 16) | (pix.g << 8) | pix.b;
+		memcpy(dst, &w, sizeof w);
+	}
+	static inline void unpack(const unsigned char *src, rgb& pix) {
+		uint32_t w;
+		memcpy(&w, src, sizeof w);
+		pix.r = w >> 16;
+		pix.g = w >> 8;
+		pix.b = w;
+	}
+};
+
+struct PackedRGB24 {
+	static const unsigned STEP = 3;
+	static inline void pack(unsigned char *dst, const rgb& pix) {
+		dst[0] = pix.r;
+		dst[1] = pix.g;
+		dst[2] = pix.b;
+	}
+	static inline void unpack(const unsigned char *src, rgb& pix) {
+		pix.r = src[0];
+		pix.g = src[1];
+		pix.b = src[2];
+	}
+};
+
+template<class FMT>
+static void pack_row(unsigned char *dst, const rgb *pix, unsigned n) {
+	for (unsigned i=0; i<n; i++, dst += FMT::STEP)
+		FMT::pack(dst, pix[i]);
+}
+
+template<class FMT>
+static void unpack_one(const unsigned char *src, rgb& pix) {
+	FMT::unpack(src, pix);
+}
+
+template<class FMT>
+static void blend_row(unsigned char *dst, const unsigned char *src, unsigned n) {
+	for (unsigned i=0; i<n; i++, dst += FMT::STEP) {
+		rgb pix;
+		FMT::unpack(dst, pix);
+		blend_argb32(pix, argb32_at(src, i));
+		FMT::pack(dst, pix);
+	}
+}
+
 MemoryBuffer::MemoryBuffer(unsigned char *buf, int rowstride, unsigned width, unsigned height,
 		bool antialias, const int local_inf, pixpack_format fmt, const BasePalette& pal, bool upscale) :
 					Base(width, height, local_inf, antialias, pal, upscale),
@@ -172,10 +402,16 @@ MemoryBuffer::MemoryBuffer(unsigned char *buf, int rowstride, unsigned width, un
 	switch(_fmt) {
 	case CAIRO_FORMAT_ARGB32:
 	case CAIRO_FORMAT_RGB24:
-		_pixelstep = 4;
+		_pixelstep = Cairo32::STEP;
+		_pack = pack_row<Cairo32>;
+		_unpack = unpack_one<Cairo32>;
+		_blend = blend_row<Cairo32>;
 		break;
 	case pixpack_format::PACKED_RGB_24:
-		_pixelstep = 3;
+		_pixelstep = PackedRGB24::STEP;
+		_pack = pack_row<PackedRGB24>;
+		_unpack = unpack_one<PackedRGB24>;
+		_blend = blend_row<PackedRGB24>;
 		break;
 	default:
 		THROW(BrotFatalException,"Unhandled pixpack format "+(int)fmt);
@@ -189,52 +425,168 @@ MemoryBuffer::~MemoryBuffer()
 
 void MemoryBuffer::pixel_done(unsigned X, unsigned Y, const rgb& pix)
 {
-	unsigned char *dst = &_buf[ Y * _rowstride + X * _pixelstep];
-	switch(_fmt) {
-	case CAIRO_FORMAT_ARGB32:
-	case CAIRO_FORMAT_RGB24:
-	// Cairo stores its bytes native-endian...
-#ifdef WORDS_BIGENDIAN
-		dst[0] = 0xff;
-		dst[1] = pix.r;
-		dst[2] = pix.g;
-		dst[3] = pix.b;
-#else
-		dst[3] = 0xff;
-		dst[2] = pix.r;
-		dst[1] = pix.g;
-		dst[0] = pix.b;
-#endif
-		dst += _pixelstep; // 4
-		break;
-		// alpha=1.0 so these cases are the same.
-	case pixpack_format::PACKED_RGB_24:
-		dst[0] = pix.r;
-		dst[1] = pix.g;
-		dst[2] = pix.b;
-		dst += _pixelstep; // 3
-		break;
-	}
+	_pack(&_buf[ Y * _rowstride + X * _pixelstep], &pix, 1);
+}
+
+void MemoryBuffer::row_done(unsigned X, unsigned Y, const rgb* pix, unsigned n)
+{
+	_pack(&_buf[ Y * _rowstride + X * _pixelstep], pix, n);
 }
 
 void MemoryBuffer::pixel_get(unsigned X, unsigned Y, rgb& pix)
+{
+	_unpack(&_buf[ Y * _rowstride + X * _pixelstep], pix);
+}
+
+void MemoryBuffer::pixel_overlay(unsigned X, unsigned Y, const rgba& other)
 {
 	unsigned char *dst = &_buf[ Y * _rowstride + X * _pixelstep];
-	switch(_fmt) {
-	case CAIRO_FORMAT_ARGB32:
-	case CAIRO_FORMAT_RGB24:
-		pix.r = dst[2];
-		pix.g = dst[1];
-		pix.b = dst[0];
-		dst += _pixelstep; // 4
-		break;
-		// alpha=1.0 so these cases are the same.
-	case pixpack_format::PACKED_RGB_24:
-		pix.r = dst[0];
-		pix.g = dst[1];
-		pix.b = dst[2];
-		dst += _pixelstep; // 3
-		break;
+	rgb pixel;
+	_unpack(dst, pixel);
+	pixel.overlay(other);
+	_pack(dst, &pixel, 1);
+}
+
+void MemoryBuffer::overlay_argb32(const unsigned char* data, int stride, unsigned top, unsigned rows)
+{
+	ASSERT(top + rows <= _height);
+	for (unsigned j = 0; j<rows; j++) {
+		const unsigned char *src = data + j * stride;
+		unsigned a, b;
+		argb32_span(src, _width, a, b);
+		if (a < b)
+			_blend(&_buf[ (top + j) * _rowstride + a * _pixelstep], src + 4*a, b-a);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+/* BT.601 studio range, in the usual 8-bit fixed point. The chroma
+ * functions take the sum of two pixels, as that's what we have. */
+static inline unsigned char yuv_y(int r, int g, int b) {
+	return ((66*r + 129*g + 25*b + 128) >> 8) + 16;
+}
+static inline unsigned char yuv_u2(int r2, int g2, int b2) {
+	return ((-38*r2 - 74*g2 + 112*b2 + 256) >> 9) + 128;
+}
+static inline unsigned char yuv_v2(int r2, int g2, int b2) {
+	return ((112*r2 - 94*g2 - 18*b2 + 256) >> 9) + 128;
+}
+static inline unsigned char clip8(int v) {
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+YUV420P::YUV420P(unsigned char * const planes[3], const int linesize[3], unsigned width, unsigned height,
+		bool antialias, const int local_inf, const BasePalette& pal, bool upscale) :
+			Base(width, height, local_inf, antialias, pal, upscale),
+			_half((width/2) * (height/2), 0)
+{
+	ASSERT(width % 2 == 0);
+	ASSERT(height % 2 == 0);
+	set_planes(planes, linesize);
+}
+
+YUV420P::~YUV420P()
+{
+}
+
+void YUV420P::set_planes(unsigned char * const planes[3], const int linesize[3])
+{
+	for (int i=0; i<3; i++) {
+		ASSERT(planes[i]);
+		_plane[i] = planes[i];
+		_linesize[i] = linesize[i];
+	}
+	ASSERT((unsigned)_linesize[0] >= _width);
+	ASSERT((unsigned)_linesize[1] >= _width/2);
+	ASSERT((unsigned)_linesize[2] >= _width/2);
+}
+
+void YUV420P::row_done(unsigned X, unsigned Y, const rgb* pix, unsigned n)
+{
+	ASSERT(X % 2 == 0 && n % 2 == 0);
+	ASSERT(X + n <= _width && Y < _height);
+	unsigned char *luma = _plane[0] + Y * _linesize[0] + X;
+	for (unsigned i=0; i<n; i++)
+		luma[i] = yuv_y(pix[i].r, pix[i].g, pix[i].b);
+
+	const unsigned cy = Y / 2, cx = X / 2;
+	unsigned char *u = _plane[1] + cy * _linesize[1] + cx,
+				  *v = _plane[2] + cy * _linesize[2] + cx,
+				  *half = &_half[cy * (_width/2) + cx];
+	std::unique_lock<std::mutex> lock(_chroma_lock[cy % CHROMA_LOCKS]);
+	for (unsigned c=0; c<n/2; c++) {
+		const rgb& a = pix[2*c], & b = pix[2*c+1];
+		const int r2 = a.r + b.r, g2 = a.g + b.g, b2 = a.b + b.b;
+		const unsigned char uu = yuv_u2(r2, g2, b2), vv = yuv_v2(r2, g2, b2);
+		if (!half[c]) {
+			u[c] = uu;
+			v[c] = vv;
+		} else {
+			u[c] = (u[c] + uu + 1) >> 1;
+			v[c] = (v[c] + vv + 1) >> 1;
+		}
+		half[c] = !half[c];
+	}
+}
+
+void YUV420P::pixel_done(unsigned X, unsigned Y, const rgb& pix)
+{
+	ASSERT(X < _width && Y < _height);
+	_plane[0][Y * _linesize[0] + X] = yuv_y(pix.r, pix.g, pix.b);
+	// We don't know what this pixel was, so count the block's chroma as that.
+	unsigned char *u = &_plane[1][(Y/2) * _linesize[1] + X/2],
+				  *v = &_plane[2][(Y/2) * _linesize[2] + X/2];
+	std::unique_lock<std::mutex> lock(_chroma_lock[(Y/2) % CHROMA_LOCKS]);
+	*u = (3 * *u + yuv_u2(2*pix.r, 2*pix.g, 2*pix.b) + 2) / 4;
+	*v = (3 * *v + yuv_v2(2*pix.r, 2*pix.g, 2*pix.b) + 2) / 4;
+}
+
+void YUV420P::pixel_get(unsigned X, unsigned Y, rgb& pix)
+{
+	ASSERT(X < _width && Y < _height);
+	const int c = _plane[0][Y * _linesize[0] + X] - 16,
+			  d = _plane[1][(Y/2) * _linesize[1] + X/2] - 128,
+			  e = _plane[2][(Y/2) * _linesize[2] + X/2] - 128;
+	pix.r = clip8((298*c + 409*e + 128) >> 8);
+	pix.g = clip8((298*c - 100*d - 208*e + 128) >> 8);
+	pix.b = clip8((298*c + 516*d + 128) >> 8);
+}
+
+void YUV420P::overlay_argb32(const unsigned char* data, int stride, unsigned top, unsigned rows)
+{
+	/* Blending is linear, so we can do it in YUV as well as in RGB. Luma
+	 * per pixel; each chroma sample takes the block's average of the
+	 * overlay, weighted by alpha. A band may start or end half way
+	 * through a block; the rows outside it count as transparent. */
+	ASSERT(top + rows <= _height);
+	if (!rows)
+		return;
+	for (unsigned cy=top/2; cy<=(top+rows-1)/2; cy++) {
+		unsigned char *u = _plane[1] + cy * _linesize[1],
+					  *v = _plane[2] + cy * _linesize[2];
+		for (unsigned cx=0; cx<_width/2; cx++) {
+			int alpha_sum = 0, u_sum = 0, v_sum = 0;
+			for (unsigned k=0; k<4; k++) {
+				const unsigned x = 2*cx + (k & 1), y = 2*cy + (k >> 1);
+				if (y < top || y >= top + rows)
+					continue;
+				const uint32_t w = argb32_at(data + (y - top) * stride, x);
+				const int alpha = w >> 24;
+				if (!alpha)
+					continue;
+				const int r = (w >> 16) & 0xff, g = (w >> 8) & 0xff, b = w & 0xff;
+				unsigned char *luma = &_plane[0][y * _linesize[0] + x];
+				*luma = (yuv_y(r, g, b) * alpha + *luma * (255 - alpha)) / 255;
+				alpha_sum += alpha;
+				u_sum += yuv_u2(2*r, 2*g, 2*b) * alpha;
+				v_sum += yuv_v2(2*r, 2*g, 2*b) * alpha;
+			}
+			if (alpha_sum) {
+				u[cx] = (u_sum + u[cx] * (4*255 - alpha_sum) + 510) / (4*255);
+				v[cx] = (v_sum + v[cx] * (4*255 - alpha_sum) + 510) / (4*255);
+			}
+		}
 	}
 }
 
@@ -261,6 +613,12 @@ void PNG::pixel_done(unsigned X, unsigned Y, const rgb& pix) {
 	_png[Y][X] = png::rgb_pixel(pix.r, pix.g, pix.b);
 }
 
+void PNG::row_done(unsigned X, unsigned Y, const rgb* pix, unsigned n) {
+	png::rgb_pixel *dst = &_png[Y][X];
+	for (unsigned i=0; i<n; i++)
+		dst[i] = png::rgb_pixel(pix[i].r, pix[i].g, pix[i].b);
+}
+
 void PNG::pixel_get(unsigned X, unsigned Y, rgb& pix) {
 	png::rgb_pixel p = _png[Y][X];
 	pix.r = p.red;
@@ -268,96 +626,297 @@ void PNG::pixel_get(unsigned X, unsigned Y, rgb& pix) {
 	pix.b = p.blue;
 }
 
+void PNG::overlay_argb32(const unsigned char* data, int stride, unsigned top, unsigned rows)
+{
+	ASSERT(top + rows <= _height);
+	for (unsigned j = 0; j<rows; j++) {
+		const unsigned char *src = data + j * stride;
+		unsigned a, b;
+		argb32_span(src, _width, a, b);
+		png::rgb_pixel *dst = &_png[top + j][0];
+		for (unsigned x = a; x<b; x++) {
+			rgb pix(dst[x].red, dst[x].green, dst[x].blue);
+			blend_argb32(pix, argb32_at(src, x));
+			dst[x] = png::rgb_pixel(pix.r, pix.g, pix.b);
+		}
+	}
+}
+
 
 void PNG::write(const std::string& filename)
 {
-	// TODO: Set png info text (software, comment) once png++ supports this.
-	_png.write(filename);
+	std::ofstream fs;
+	fs.open(filename, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+	if (!fs)
+		THROW(BrotException, "Could not open "+filename+" for writing");
+	write(fs);
+	fs.close();
 }
 
 void PNG::write(std::ostream& os)
 {
-	_png.write_stream<std::ostream>(os);
+	PNGWriter writer(os, _width, _height, _comp);
+	std::vector<unsigned char> row(RGB_BYTES_PER_PIXEL * _width);
+	for (unsigned y=0; y<_height; y++) {
+		const png::rgb_pixel *src = &_png[y][0];
+		for (unsigned x=0; x<_width; x++) {
+			row[3*x] = src[x].red;
+			row[3*x+1] = src[x].green;
+			row[3*x+2] = src[x].blue;
+		}
+		writer.write_rows(&row[0], 1, 0);
+	}
+	writer.finish();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+PNGStream::PNGStream(std::ostream& os, unsigned width, unsigned height,
+		const BasePalette& palette, int local_inf, bool antialias, bool upscale, const PNGCompression& comp) :
+				Base(width, height, local_inf, antialias, palette, upscale),
+				_os(os), _writer(os, width, height, comp), _next(0), _hud_top(0), _hud_rows(0),
+				_packed(RGB_BYTES_PER_PIXEL * width)
+{
+}
+
+PNGStream::~PNGStream()
+{
+}
+
+void PNGStream::row_done(unsigned X, unsigned Y, const rgb* pix, unsigned n) {
+	ASSERT(X + n <= _width && Y < _height);
+	ASSERT(Y >= _next); // that row has gone
+	std::unique_lock<std::mutex> lock(_lock);
+	Row& row = _rows[Y];
+	if (row.pix.empty()) {
+		row.pix.resize(_width);
+		row.filled = 0;
+	}
+	std::copy(pix, pix+n, &row.pix[X]);
+	row.filled += n;
+	ASSERT(row.filled <= _width);
+}
+
+void PNGStream::pixel_done(unsigned X, unsigned Y, const rgb& pix) {
+	row_done(X, Y, &pix, 1);
+}
+
+void PNGStream::pixel_get(unsigned X, unsigned Y, rgb& pix) {
+	std::unique_lock<std::mutex> lock(_lock);
+	auto it = _rows.find(Y);
+	if (X >= _width || it == _rows.end())
+		THROW(BrotFatalException, "PNGStream can only read back the rows it's holding");
+	pix = it->second.pix[X];
+}
+
+void PNGStream::overlay_argb32(const unsigned char* data, int stride, unsigned top, unsigned rows)
+{
+	ASSERT(top + rows <= _height);
+	ASSERT(top >= _next);
+	ASSERT(_hud.empty()); // just the one
+	const unsigned len = 4 * _width;
+	_hud.resize(rows * len);
+	for (unsigned j=0; j<rows; j++)
+		memcpy(&_hud[j * len], data + j * stride, len);
+	_hud_top = top;
+	_hud_rows = rows;
+}
+
+unsigned PNGStream::rows_pending() {
+	std::unique_lock<std::mutex> lock(_lock);
+	return _rows.size();
+}
+
+void PNGStream::write_row(unsigned y, std::vector<rgb>& pix) {
+	if (y >= _hud_top && y < _hud_top + _hud_rows)
+		blend_argb32_row(&pix[0], &_hud[(y - _hud_top) * 4 * _width], _width);
+	pack_row<PackedRGB24>(&_packed[0], &pix[0], _width);
+	_writer.write_rows(&_packed[0], 1, 0);
+}
+
+void PNGStream::flush() {
+	while (_next < _height) {
+		std::vector<rgb> pix;
+		{
+			std::unique_lock<std::mutex> lock(_lock);
+			auto it = _rows.find(_next);
+			if (it == _rows.end() || it->second.filled < _width)
+				break;
+			pix.swap(it->second.pix);
+			_rows.erase(it);
+		}
+		write_row(_next, pix);
+		++_next;
+	}
+	_os.flush();
+}
+
+void PNGStream::finish() {
+	flush();
+	if (_next < _height)
+		THROW(BrotException, "PNG output is incomplete");
+	_writer.finish();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+Tile::Tile(Base& target, unsigned x0, unsigned y0, unsigned width, unsigned height,
+		const BasePalette& palette, int local_inf, bool antialias, bool upscale) :
+				Base(width, height, local_inf, antialias, palette, upscale),
+				_target(target), _x0(x0), _y0(y0) {
+	ASSERT(x0 + width <= target.width());
+	ASSERT(y0 + height <= target.height());
+}
+
+Tile::~Tile() {
+}
+
+void Tile::pixel_done(unsigned X, unsigned Y, const rgb& pix) {
+	ASSERT(X < _width && Y < _height);
+	_target.pixel_done(_x0 + X, _y0 + Y, pix);
+}
+
+void Tile::row_done(unsigned X, unsigned Y, const rgb* pix, unsigned n) {
+	ASSERT(X + n <= _width && Y < _height);
+	_target.row_done(_x0 + X, _y0 + Y, pix, n);
+}
+
+void Tile::pixel_get(unsigned X, unsigned Y, rgb& pix) {
+	ASSERT(X < _width && Y < _height);
+	_target.pixel_get(_x0 + X, _y0 + Y, pix);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 
 CSV::CSV(unsigned width, unsigned height,
 		const BasePalette& palette, int local_inf, bool antialias) :
-				Writable(width, height, local_inf, antialias, palette, false) {
-	_points = new Fractal::PointData[width*height];
+				Writable(width, height, local_inf, antialias, palette, false),
+				_next(0) {
 	ASSERT(!_upscale); // Not compatible, this mode only does raw
 }
 
 CSV::~CSV() {
-	delete[] _points;
 }
 
+/* If antialiasing, it doesn't make much sense to average over four
+ * fractal points, so we just take the base point of each. */
 void CSV::process(const Plot3::Plot3Chunk& chunk) {
-	if (_antialias)
-		return raw_process_antialias(chunk);
-	else
-		return raw_process_plain(chunk);
-}
-
-void CSV::raw_process_plain(const Plot3::Plot3Chunk& chunk) {
-	// This is the same as the original Base::process_plain but with the serial numbers filed off.
-	const Fractal::PointData * data = chunk.get_data();
-	unsigned i,j;
-	// Sanity checks
-	ASSERT( chunk._offX + chunk._width <= _width );
-	ASSERT( chunk._offY + chunk._height <= _height );
-	for (j=0; j<chunk._height; j++) {
-		const Fractal::PointData * src = &data[j*chunk._width];
-		for (i=0; i<chunk._width; i++) {
-			_point(i+chunk._offX, _height-(1+j+chunk._offY)) = src[i];
+	const unsigned step = _antialias ? 2 : 1;
+	ASSERT( chunk._offX % step == 0 && chunk._offY % step == 0 );
+	ASSERT( chunk._width % step == 0 && chunk._height % step == 0 );
+	ASSERT( chunk._offX + chunk._width <= _width*step );
+	ASSERT( chunk._offY + chunk._height <= _height*step );
+
+	// Formatted outside the lock, so several chunks can go at once.
+	// snprintf() follows the C locale, which needn't use a dot.
+	const char point = localeconv()->decimal_point[0];
+	char tmp[32];
+	std::vector<std::string> text(chunk._height / step);
+	for (unsigned j=0; j<text.size(); j++) {
+		const Fractal::PointData *src = chunk.get_data() + j * step * chunk._width;
+		std::string& out = text[j];
+		for (unsigned i=0; i<chunk._width; i+=step) {
+			// Same as operator<<(float) would give us
+			int len = snprintf(tmp, sizeof tmp, "%g", (double)src[i].iterf);
+			if (point != '.')
+				std::replace(tmp, tmp+len, point, '.');
+			if (i)
+				out.push_back(',');
+			out.append(tmp, len);
 		}
 	}
-}
 
-void CSV::raw_process_antialias(const Plot3::Plot3Chunk& chunk) {
-	// It doesn't make much sense to average over four fractal points, so we'll just take the base point.
-	const Fractal::PointData * data = chunk.get_data();
-	unsigned i,j;
-	const unsigned outW = chunk._width / 2,
-				   outH = chunk._height / 2,
-				   outOffX = chunk._offX / 2,
-				   outOffY = chunk._offY / 2;
-	ASSERT( chunk._width % 2 == 0);
-	ASSERT( chunk._height % 2 == 0);
-	ASSERT( chunk._offX + chunk._width <= _width*2 );
-	ASSERT( chunk._offY + chunk._height <= _height*2 );
-	ASSERT( outOffX + outW <= _width );
-	ASSERT( outOffY + outH <= _height);
-	for (j=0; j<outH; j++) {
-		const Fractal::PointData * base = &data[2*j*chunk._width];
-		for (i=0; i<outW; i++) {
-			_point(i+outOffX, _height-(1+j+outOffY)) = base[2*i];
-		}
+	const unsigned X = chunk._offX / step, n = chunk._width / step;
+	std::unique_lock<std::mutex> lock(_lock);
+	for (unsigned j=0; j<text.size(); j++) {
+		// Chunks have a bottom-left origin.
+		const unsigned Y = _height - 1 - chunk._offY / step - j;
+		ASSERT(Y >= _next); // those rows have gone
+		Row& row = _rows[Y];
+		auto it = row.parts.find(X);
+		if (it == row.parts.end()) {
+			row.parts[X].swap(text[j]);
+			row.filled += n;
+		} else
+			it->second.swap(text[j]);
+		ASSERT(row.filled <= _width);
 	}
 }
 
-void CSV::write(const std::string& filename) {
-	std::ofstream fs;
-	fs.open(filename, std::fstream::out);
-	write(fs);
-	fs.close();
+unsigned CSV::band_rows() const {
+	// A typical iterf comes out at about 8 characters, plus the comma.
+	return std::max(1u, (1u<<20) / (9 * _width));
 }
 
-std::ostream& operator<<(std::ostream &stream, const Fractal::PointData& pd) {
-	stream << pd.iterf;
-	return stream;
+unsigned CSV::rows_pending() {
+	std::unique_lock<std::mutex> lock(_lock);
+	return _rows.size();
 }
 
-void CSV::write(std::ostream& os) {
-	for (unsigned j=0; j<_height; j++) {
-		os << _point(0,j);
-		for (unsigned i=1; i<_width; i++) {
-			os << "," << _point(i,j);
+/* The complete rows at the top go out a band at a time. */
+void CSV::emit(Sink sink) {
+	const unsigned band = band_rows();
+	std::string buf;
+	for (;;) {
+		buf.clear();
+		{
+			std::unique_lock<std::mutex> lock(_lock);
+			for (unsigned i=0; i<band; i++) {
+				auto it = _rows.find(_next);
+				if (it == _rows.end() || it->second.filled < _width)
+					break;
+				bool first = true;
+				for (auto& part : it->second.parts) {
+					if (!first)
+						buf.push_back(',');
+					buf.append(part.second);
+					first = false;
+				}
+				buf.push_back('\n');
+				_rows.erase(it);
+				++_next;
+			}
 		}
-		os << std::endl;
+		if (buf.empty())
+			break;
+		sink(buf.data(), buf.length());
 	}
+}
 
+void CSV::flush(std::ostream& os) {
+	emit([&os](const char* p, size_t n) { os.write(p, n); });
+	os.flush();
+}
+
+void CSV::write(const std::string& filename) {
+	int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1)
+		THROW(BrotException, "Could not open "+filename+": "+strerror(errno));
+	try {
+		emit([fd, &filename](const char* p, size_t n) {
+			while (n) {
+				ssize_t done = ::write(fd, p, n);
+				if (done == -1) {
+					if (errno == EINTR)
+						continue;
+					THROW(BrotException, "Could not write "+filename+": "+strerror(errno));
+				}
+				p += done;
+				n -= done;
+			}
+		});
+		ASSERT(_next == _height); // every row, or the chunks are amiss
+	} catch (...) {
+		close(fd);
+		throw;
+	}
+	if (close(fd) == -1)
+		THROW(BrotException, "Could not write "+filename+": "+strerror(errno));
+}
+
+void CSV::write(std::ostream& os) {
+	flush(os);
+	ASSERT(_next == _height); // every row, or the chunks are amiss
 }
 
 
@@ -19,7 +19,13 @@
 #ifndef RENDER2_H_
 #define RENDER2_H_
 
+#include <atomic>
+#include <functional>
 #include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
 #include <vector>
 #include <cairo/cairo.h>
 #include <png++/png.hpp>
@@ -27,6 +33,8 @@
 #include "Fractal.h"
 #include "palette.h"
 #include "Plot3Chunk.h"
+#include "ThreadPool.h"
+#include "PNGWriter.h"
 
 namespace Render2 {
 
@@ -37,6 +45,7 @@ class pixpack_format {
 	int f; // Pixel format - one of cairo_format_t or our internal constants
 public:
 	static const int PACKED_RGB_24 = CAIRO_FORMAT_RGB16_565 + 1000000;
+	// (Planar YUV 4:2:0 isn't one of these: it's three buffers, so it's a target class, YUV420P.)
 	pixpack_format(int c): f(c) {};
 	inline operator int() const { return f; }
 };
@@ -71,6 +80,38 @@ inline rgb antialias_pixel4(const rgb * const pix) { // Assumes pix array length
 	return rgb(R/4, G/4, B/4);
 }
 
+inline rgb antialias_pixels(const rgb * const pix, unsigned n) {
+	unsigned R=0,G=0,B=0;
+	for (unsigned i=0; i<n; i++) {
+		R+=pix[i].r;
+		G+=pix[i].g;
+		B+=pix[i].b;
+	}
+	return rgb(R/n, G/n, B/n);
+}
+
+/*
+ * Something that holds a whole plot's results, a row at a time, in the
+ * form the palettes want: an IterPlane, or a saved RawIterFile.
+ */
+class IPointRows {
+public:
+	typedef std::map<unsigned, std::vector<Plot3::Plot3Chunk::Sample> > SupersampleMap;
+
+	virtual ~IPointRows() {}
+	virtual unsigned width() const = 0;
+	virtual unsigned height() const = 0;
+	/* Row y of the plot (bottom-left origin, like the chunks) as width()
+	 * PointData, with only iter, iterf and nomore set. */
+	virtual void get_points(unsigned y, Fractal::PointData* out) const = 0;
+	/* The supersampled pixels of row y, keyed by y*width()+x. By default
+	 * there aren't any. */
+	virtual SupersampleMap::const_iterator ss_begin(unsigned) const { return NO_SUPERSAMPLES.end(); }
+	virtual SupersampleMap::const_iterator ss_end(unsigned) const { return NO_SUPERSAMPLES.end(); }
+protected:
+	static const SupersampleMap NO_SUPERSAMPLES;
+};
+
 class Base {
 public:
 	// width and height are the OUTPUT size. The caller is expected to pass in 4x (or 0.25x) the pixels via the chunks mechanism.
@@ -82,6 +123,24 @@ public:
 	virtual void process(const Plot3::Plot3Chunk& chunk);
 	/** Processes a list of chunks. This leads to repeated calls to process(chunk). */
 	virtual void process(const std::list<Plot3::Plot3Chunk*>& chunks);
+	/**
+	 * As above, but shares the chunks out between the calling thread and
+	 * the pool, returning when all are done. Chunks must not overlap;
+	 * process(chunk) is then called concurrently for different chunks, and
+	 * must cope (ours all do). Safe to call from one of the pool's own
+	 * threads. Rethrows the first exception any of them threw.
+	 */
+	void process(const std::list<Plot3::Plot3Chunk*>& chunks, ThreadPool& pool, QoS cls = QoS::INTERACTIVE);
+	/**
+	 * Renders from an IterPlane (or other IPointRows) instead of the
+	 * chunks, sharing our rows out in the same way. Comes out the same as
+	 * processing the chunks that went into it would (for palettes that only
+	 * look at iter and iterf, which is all of the real ones). The plane is
+	 * the size of the plot, so twice ours if antialiasing, or half if
+	 * upscaling. It mustn't be updated meanwhile; IterPlane::recolour()
+	 * sees to that.
+	 */
+	void process(const IPointRows& plane, ThreadPool& pool, QoS cls = QoS::INTERACTIVE);
 
 	/**
 	 * If you want to re-process a render for a new local_inf and/or palette, call fresh_*(), then process(your chunks).
@@ -95,10 +154,12 @@ public:
 protected:
 	unsigned _width, _height, _local_inf;
 	bool _antialias, _upscale;
-	const BasePalette* _pal;
+	const BasePalette* _pal; // N.B. the baked() version of what we were given
 
 	/**
 	 * Non-antialiased chunk processing.
+	 * Supersampled pixels (see Plot3Plot::set_supersample) get the average
+	 * colour of their samples. The other modes ignore supersamples.
 	 */
 	void process_plain(const Plot3::Plot3Chunk& chunk);
 	/**
@@ -107,12 +168,20 @@ protected:
 	void process_antialias(const Plot3::Plot3Chunk& chunk);
 	/* And the upscaled version */
 	void process_upscale(const Plot3::Plot3Chunk& chunk);
+	/* Output rows [y0,y1) from a plane, in whichever mode we're in. */
+	void process_rows(const IPointRows& plane, unsigned y0, unsigned y1);
 public:
 	/**
 	 * Called by process_* functions for each output pixel.
 	 * The X and Y parameters are relative to the output width/height.
 	 */
 	virtual void pixel_done(unsigned X, unsigned Y, const rgb& p) = 0;
+	/**
+	 * Called by process_* functions for each run of n output pixels,
+	 * starting at (X,Y) and going rightwards. The default calls pixel_done()
+	 * for each; subclasses that can do better should override it.
+	 */
+	virtual void row_done(unsigned X, unsigned Y, const rgb* p, unsigned n);
 	/**
 	 * Retrieves a pixel
 	 */
@@ -121,6 +190,14 @@ public:
 	 * Overlays an alpha-blended pixel
 	 */
 	virtual void pixel_overlay(unsigned X, unsigned Y, const rgba& other);
+	/**
+	 * Overlays a band of an image in Cairo's ARGB32 format (the HUD, for
+	 * instance): data is our full width, and its first row lands on our
+	 * row top. The default blends the non-transparent span of each row,
+	 * fetched with pixel_get() and written back with row_done(); those
+	 * with a buffer of their own blend on it in place.
+	 */
+	virtual void overlay_argb32(const unsigned char* data, int stride, unsigned top, unsigned rows);
 };
 
 class MemoryBuffer : public Base {
@@ -137,6 +214,15 @@ class MemoryBuffer : public Base {
 	const pixpack_format _fmt;
 	unsigned _pixelstep; // effectively const
 
+	/* Pixel (un)packers and blender for _fmt, chosen at construction so we
+	 * don't switch on the format for every pixel. See Render2.cpp. */
+	typedef void (*pack_fn)(unsigned char *dst, const rgb *pix, unsigned n);
+	typedef void (*unpack_fn)(const unsigned char *src, rgb& pix);
+	pack_fn _pack; // effectively const
+	unpack_fn _unpack; // effectively const
+	typedef void (*blend_fn)(unsigned char *dst, const unsigned char *argb32, unsigned n);
+	blend_fn _blend; // effectively const
+
 public:
 	/*
 	 * buf: Where to put the data. This should be at least
@@ -162,12 +248,54 @@ public:
 	virtual ~MemoryBuffer();
 
 	virtual void pixel_done(unsigned X, unsigned Y, const rgb& p);
+	virtual void row_done(unsigned X, unsigned Y, const rgb* p, unsigned n);
 	virtual void pixel_get(unsigned X, unsigned Y, rgb& p);
+	virtual void pixel_overlay(unsigned X, unsigned Y, const rgba& other);
+	virtual void overlay_argb32(const unsigned char* data, int stride, unsigned top, unsigned rows);
 
 	unsigned pixelstep() { return _pixelstep; }
 	unsigned rowstride() { return _rowstride; }
 };
 
+class YUV420P : public Base {
+	/*
+	 * Renders straight into planar YUV 4:2:0 (libav's AV_PIX_FMT_YUV420P;
+	 * BT.601 studio range, as swscale does by default), so a movie frame
+	 * needs neither an RGB buffer nor a conversion pass. Luma is written as
+	 * each row comes in. Each chroma sample averages a 2x2 block: the first
+	 * of its two rows to arrive leaves its half there, the second combines.
+	 *
+	 * So width and height must be even, rows must come in whole horizontal
+	 * pairs (X and n even) - as they do from chunks at even offsets, which
+	 * antialiasing needs anyway - and each row must be written exactly
+	 * once per frame. pixel_done() on its own can only nudge the chroma,
+	 * and pixel_get() gives back the block's; overlay with overlay_argb32().
+	 */
+	unsigned char *_plane[3];
+	int _linesize[3];
+	std::vector<unsigned char> _half; // per chroma sample: is one row in?
+	static const unsigned CHROMA_LOCKS = 16;
+	std::mutex _chroma_lock[CHROMA_LOCKS]; // by chroma row
+
+public:
+	/*
+	 * planes, linesize: Y, U and V, as in an AVFrame. U and V are half
+	 * the width and height.
+	 * The rest are as for MemoryBuffer.
+	 */
+	YUV420P(unsigned char * const planes[3], const int linesize[3], unsigned width, unsigned height,
+			bool antialias, const int local_inf, const BasePalette& pal, bool upscale=false);
+	virtual ~YUV420P();
+
+	/* If the buffers move (say, av_frame_make_writable() reallocated them). */
+	void set_planes(unsigned char * const planes[3], const int linesize[3]);
+
+	virtual void pixel_done(unsigned X, unsigned Y, const rgb& p);
+	virtual void row_done(unsigned X, unsigned Y, const rgb* p, unsigned n);
+	virtual void pixel_get(unsigned X, unsigned Y, rgb& p);
+	virtual void overlay_argb32(const unsigned char* data, int stride, unsigned top, unsigned rows);
+};
+
 class Writable : public Base {
 	/* Base class for renders which can write to a file */
 	public:
@@ -190,6 +318,7 @@ class PNG : public Writable {
 	 */
 protected:
 	png::image< png::rgb_pixel > _png;
+	PNGCompression _comp;
 
 public:
 	/*
@@ -205,16 +334,107 @@ public:
 	PNG(unsigned width, unsigned height, const BasePalette& palette, int local_inf, bool antialias=false, bool upscale=false);
 	virtual ~PNG();
 
+	/* How write() compresses (default: zlib's default level, on the calling thread). */
+	void set_compression(const PNGCompression& comp) { _comp = comp; }
+
 	virtual void write(const std::string& filename);
 	virtual void write(std::ostream& ostream);
 
 	virtual void pixel_done(unsigned X, unsigned Y, const rgb& p);
+	virtual void row_done(unsigned X, unsigned Y, const rgb* p, unsigned n);
 	virtual void pixel_get(unsigned X, unsigned Y, rgb& p);
+	virtual void overlay_argb32(const unsigned char* data, int stride, unsigned top, unsigned rows);
 
 	size_t png_height() { return _png.get_height(); }
 	size_t png_width() { return _png.get_width(); }
 };
 
+class PNGStream : public Base {
+	/*
+	 * Renders a plot as a PNG, sending out each row as soon as it and all
+	 * the rows above it are complete, so we only ever hold the rows that
+	 * are waiting on something above them. That isn't bounded by a band:
+	 * every row below a chunk that hasn't been processed yet is held, as
+	 * RGB, until it is. Fed from Plot3Plot::set_retire, that's until the
+	 * chunk has no live pixels left, or the plot ends; so it's little when
+	 * the top of the image escapes early, but could be all of it. (A
+	 * TiledPlot feeding one of these does hold only a row of tiles.)
+	 * Workflow:
+	 * 1. Open your output stream
+	 * 2. Instantiate this class, and apply the HUD if you want it
+	 * 3. Process chunks as they become final (see Plot3Plot::set_retire),
+	 *    calling flush() after each lot; after that they may be freed
+	 * 4. Call finish() once every chunk has been processed.
+	 *
+	 * Every pixel must come in exactly once (as it does from the chunks),
+	 * as that's how we know a row is complete, so overlay with
+	 * overlay_argb32(). That has to happen before any rows have gone out;
+	 * we keep the band and blend it in as its rows go.
+	 */
+public:
+	/*
+	 * os must outlive us. comp is as for PNG::set_compression(); rows are
+	 * compressed a window of blocks at a time, so may not go out to os
+	 * straight away. The rest are as for PNG.
+	 */
+	PNGStream(std::ostream& os, unsigned width, unsigned height, const BasePalette& palette, int local_inf,
+			bool antialias=false, bool upscale=false, const PNGCompression& comp = PNGCompression());
+	virtual ~PNGStream();
+
+	/* Sends all the complete rows at the top of the image on to be
+	 * compressed. Only one thread should call this (or finish()) at once. */
+	void flush();
+	/* Writes out the rest, which must all be complete, and ends the file. */
+	void finish();
+
+	unsigned rows_written() const { return _next; }
+	/* How many rows we're holding, waiting to go out */
+	unsigned rows_pending();
+
+	virtual void pixel_done(unsigned X, unsigned Y, const rgb& p);
+	virtual void row_done(unsigned X, unsigned Y, const rgb* p, unsigned n);
+	/* Only for rows we're still holding */
+	virtual void pixel_get(unsigned X, unsigned Y, rgb& p);
+	virtual void overlay_argb32(const unsigned char* data, int stride, unsigned top, unsigned rows);
+
+protected:
+	struct Row {
+		std::vector<rgb> pix;
+		unsigned filled;
+	};
+	std::ostream& _os;
+	PNGWriter _writer;
+	std::mutex _lock;
+	std::map<unsigned, Row> _rows; // by Y; PROTECT by _lock
+	std::atomic<unsigned> _next; // The next row to go out
+	std::vector<unsigned char> _hud; // ARGB32, _width wide, unpadded
+	unsigned _hud_top, _hud_rows;
+	std::vector<unsigned char> _packed; // One row, as the PNGWriter wants it
+
+	void write_row(unsigned y, std::vector<rgb>& pix);
+};
+
+class Tile : public Base {
+	/*
+	 * One tile of a bigger render: processes the chunks of a plot of just
+	 * that tile (whose offsets are relative to the tile) into the part of
+	 * target whose top-left output pixel is (x0,y0). width and height are
+	 * the tile's output size; the modes must be the same as the target's.
+	 * Everything goes straight through, so this is as thread-safe as the
+	 * target is; several tiles can feed one target at once.
+	 */
+	Base& _target;
+	const unsigned _x0, _y0;
+public:
+	Tile(Base& target, unsigned x0, unsigned y0, unsigned width, unsigned height,
+			const BasePalette& palette, int local_inf, bool antialias=false, bool upscale=false);
+	virtual ~Tile();
+
+	virtual void pixel_done(unsigned X, unsigned Y, const rgb& p);
+	virtual void row_done(unsigned X, unsigned Y, const rgb* p, unsigned n);
+	virtual void pixel_get(unsigned X, unsigned Y, rgb& p);
+};
+
 class CSV : public Writable {
 	/*
 	 * Renders a plot as a CSV file.
@@ -224,15 +444,29 @@ class CSV : public Writable {
 	 * 3. Process your chunks
 	 * 4. Call write() when you're ready to write the file.
 	 *
-	 * Note that this class contains a nontrivial memory buffer throughout its lifetime.
+	 * Each chunk is formatted as it comes in (so process(chunks, pool)
+	 * does it in parallel), and needn't be kept afterwards; we hold the
+	 * text. A chunk that comes in again replaces what it said before.
+	 *
+	 * Or send it out as we go, as PNGStream does: process chunks as they
+	 * become final (see Plot3Plot::set_retire), calling flush() after each
+	 * lot, then write() the rest to the same stream at the end. Then we
+	 * only hold the rows that are waiting on a chunk above them.
 	 *
 	 * Upscaling doesn't make sense for CSV files, so this option isn't offered.
 	 */
 protected:
-	// Raw data array and accessor
-	Fractal::PointData* _points;
-	Fractal::PointData& _point(unsigned x, unsigned y) { return _points[y*_width+x]; }
-	const Fractal::PointData& _point(unsigned x, unsigned y) const { return _points[y*_width+x]; }
+	struct Row {
+		std::map<unsigned, std::string> parts; // by X; each chunk's values, comma-separated
+		unsigned filled;
+		Row() : filled(0) {}
+	};
+	std::mutex _lock;
+	std::map<unsigned, Row> _rows; // by Y; PROTECT by _lock
+	std::atomic<unsigned> _next; // The next row to go out
+
+	typedef std::function<void(const char*, size_t)> Sink;
+	void emit(Sink sink);
 public:
 	/*
 	 * Width and height are in pixels.
@@ -248,12 +482,21 @@ public:
 
 	using Base::process; // for virtual void process(const std::list<Plot3::Plot3Chunk*>& chunks);
 	virtual void process(const Plot3::Plot3Chunk& chunk);
-	void raw_process_plain(const Plot3::Plot3Chunk& chunk);
-	void raw_process_antialias(const Plot3::Plot3Chunk& chunk);
 
+	/* Sends the complete rows at the top of the file to os. Only one
+	 * thread should call this (or write()) at once. */
+	void flush(std::ostream& os);
+	/* Write out the rest, which must all be complete. */
 	virtual void write(const std::string& filename);
 	virtual void write(std::ostream& ostream);
 
+	unsigned rows_written() const { return _next; }
+	/* How many rows we're holding, waiting to go out */
+	unsigned rows_pending();
+
+	/* Most rows of output we send at once: as many as make about 1MB of text. */
+	virtual unsigned band_rows() const;
+
 	/* We need to provide these but they don't make sense for us: */
 	virtual void pixel_done(unsigned X, unsigned Y, const rgb& p);
 	virtual void pixel_get(unsigned X, unsigned Y, rgb& p);
@@ -30,18 +30,61 @@ freely, subject to the following restrictions:
 
 #include "libbrot2/ThreadPool.h"
 #include "libbrot2/Exception.h"
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+/* QoS weights. Stride scheduling: each dispatch advances its class's pass
+ * by STRIDE_BASE/weight, and we always serve the backlogged class with the
+ * lowest pass. -wry */
+static const unsigned long long STRIDE_BASE = 1<<20;
+static const unsigned QOS_WEIGHT[] = {
+    8, // INTERACTIVE
+    2, // EXPORT
+    1, // BATCH
+};
+static_assert(sizeof(QOS_WEIGHT)/sizeof(QOS_WEIGHT[0]) == (unsigned)QoS::MAX, "QoS weights must match the QoS classes");
+
+/* How far down a queue we'll look for a task in our own partition before
+ * giving up and taking the one at the front. -wry */
+static const unsigned PARTITION_LOOKAHEAD = 64;
+
+static thread_local int my_partition = -1;
+
+int ThreadPool::current_partition()
+{
+    return my_partition;
+}
+
+void Worker::place()
+{
+    if (index < pool.worker_partitions.size())
+        my_partition = pool.worker_partitions[index];
+#ifdef __linux__
+    if (index >= pool.worker_cpus.size() || pool.worker_cpus[index].empty())
+        return;
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (auto it = pool.worker_cpus[index].begin(); it != pool.worker_cpus[index].end(); it++)
+        if (*it >= 0 && *it < CPU_SETSIZE)
+            CPU_SET(*it, &mask);
+    // Failure isn't fatal (we might be in a restricted cpuset); we just run unpinned.
+    if (0 != sched_setaffinity(0, sizeof mask, &mask))
+        std::cerr << "Warning: could not set CPU affinity for worker " << index << std::endl;
+#endif
+}
 
 void Worker::operator()()
 {
+    place();
     while(true)
     {
         std::unique_lock<std::mutex> lock(pool.queue_mutex);
-        while(!pool.stop && pool.tasks.empty())
+        while(!pool.stop && pool.empty())
             pool.condition.wait(lock);
         if(pool.stop)
             return;
-        any_packaged_task task(pool.tasks.front());
-        pool.tasks.pop_front();
+        any_packaged_task task(pool.next_task(my_partition));
         lock.unlock();
 		/* Added exception handler around task() -wry */
 		try {
@@ -53,12 +96,70 @@ void Worker::operator()()
     }
 }
 
+bool ThreadPool::empty() const
+{
+    for (unsigned i=0; i<NCLASSES; i++)
+        if (!tasks[i].empty())
+            return false;
+    return true;
+}
+
+void ThreadPool::on_enqueue(unsigned cls)
+{
+    // A class that has been idle doesn't get to bank credit.
+    if (tasks[cls].empty() && pass[cls] < vtime)
+        pass[cls] = vtime;
+}
+
+any_packaged_task ThreadPool::next_task(int partition)
+{
+    unsigned best = NCLASSES;
+    for (unsigned i=0; i<NCLASSES; i++) {
+        if (tasks[i].empty()) continue;
+        if (best == NCLASSES || pass[i] < pass[best])
+            best = i;
+    }
+    ASSERT(best < NCLASSES);
+    vtime = pass[best];
+    pass[best] += STRIDE_BASE / QOS_WEIGHT[best];
+
+    // Within the class, prefer a task that wants our partition.
+    std::deque<queued_task>& q = tasks[best];
+    auto pick = q.begin();
+    if (partition != -1) {
+        unsigned n = 0;
+        for (auto it = q.begin(); it != q.end() && n < PARTITION_LOOKAHEAD; it++, n++) {
+            if (it->partition == partition || it->partition == -1) {
+                pick = it;
+                break;
+            }
+        }
+    }
+    any_packaged_task task(pick->task);
+    q.erase(pick);
+    return task;
+}
+
 // the constructor just launches some amount of workers
 ThreadPool::ThreadPool(size_t threads)
-    :   stop(false)
+    :   vtime(0), stop(false)
+{
+    init(threads);
+}
+
+ThreadPool::ThreadPool(size_t threads, const std::vector< std::vector<int> >& cpus,
+        const std::vector<int>& partitions)
+    :   worker_cpus(cpus), worker_partitions(partitions), vtime(0), stop(false)
+{
+    init(threads);
+}
+
+void ThreadPool::init(size_t threads)
 {
+    for (unsigned i=0; i<NCLASSES; i++)
+        pass[i] = 0;
     for(size_t i = 0;i<threads;++i)
-        workers.push_back(std::thread(Worker(*this)));
+        workers.push_back(std::thread(Worker(*this, i)));
 }
 
 
@@ -74,29 +74,69 @@ private:
 
 class ThreadPool;
 
+/* Scheduling classes. When the pool is contended, each class with work
+ * waiting gets a share of the dispatches in proportion to its weight
+ * (see ThreadPool.cpp), so no class is ever starved. -wry */
+enum class QoS {
+    INTERACTIVE, // Whatever the user is looking at right now
+    EXPORT,      // Save-as-PNG and the like
+    BATCH,       // Movie frames, long-running background jobs
+    MAX
+};
+
 // our worker thread objects
 class Worker {
 public:
-    Worker(ThreadPool &s) : pool(s) { }
+    Worker(ThreadPool &s, size_t i) : pool(s), index(i) { }
     void operator()();
 private:
     ThreadPool &pool;
+    size_t index;
+    void place(); // applies our CPU affinity, if any -wry
 };
 
 // the actual thread pool
 class ThreadPool {
 public:
     ThreadPool(size_t);
+    /* Placement-aware constructor (see CpuTopology). Worker i is confined to
+     * cpus[i] (empty or missing means anywhere) and belongs to NUMA
+     * partition partitions[i] (missing means -1, none). -wry */
+    ThreadPool(size_t, const std::vector< std::vector<int> >& cpus,
+            const std::vector<int>& partitions);
+    /* A task with a partition hint prefers to run on a worker in that
+     * partition, though any worker may take it rather than leave it
+     * waiting. -1 means no preference. -wry */
     template<class T, class F>
-    std::future<T> enqueue(F f);
+    std::future<T> enqueue(F f, QoS cls = QoS::INTERACTIVE, int partition = -1);
     ~ThreadPool();
+
+    size_t size() const { return workers.size(); }
+
+    /* The partition of the calling worker thread, or -1 if the caller
+     * isn't a placed worker. -wry */
+    static int current_partition();
 private:
     friend class Worker;
+    void init(size_t threads);
 
     // need to keep track of threads so we can join them
     std::vector< std::thread > workers;
-    // the task queue
-    std::deque< any_packaged_task > tasks;
+    // the task queues, one per QoS class
+    static const unsigned NCLASSES = (unsigned)QoS::MAX;
+    struct queued_task {
+        any_packaged_task task;
+        int partition;
+    };
+    std::deque< queued_task > tasks[NCLASSES];
+    std::vector< std::vector<int> > worker_cpus;
+    std::vector<int> worker_partitions;
+    // Weighted fair queueing state, see ThreadPool.cpp. Protected by queue_mutex.
+    unsigned long long pass[NCLASSES];
+    unsigned long long vtime;
+    void on_enqueue(unsigned cls); // call with queue_mutex held
+    bool empty() const; // ditto
+    any_packaged_task next_task(int partition); // ditto; must not be empty()
     
     // synchronization
     std::mutex queue_mutex;
@@ -106,13 +146,15 @@ private:
 
 // add new work item to the pool
 template<class T, class F>
-std::future<T> ThreadPool::enqueue(F f)
+std::future<T> ThreadPool::enqueue(F f, QoS cls, int partition)
 {
     std::packaged_task<T()> task(f);
     std::future<T> res= task.get_future();    
     {
         std::unique_lock<std::mutex> lock(queue_mutex);    
-        tasks.push_back(any_packaged_task(std::move(task)));
+        on_enqueue((unsigned)cls);
+        queued_task qt = { any_packaged_task(std::move(task)), partition };
+        tasks[(unsigned)cls].push_back(qt);
     }
     condition.notify_one();
     return res;
@@ -0,0 +1,268 @@
+/*
+    TilePyramid.cpp: Deep Zoom image pyramids of a plot
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TilePyramid.h"
+#include "ParallelJob.h"
+#include "Exception.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <png++/png.hpp>
+
+namespace Plot3 {
+
+static bool exists(const std::string& path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0;
+}
+
+TilePyramid::TilePyramid(TiledPlot& plot, const std::string& name, const BasePalette& palette, bool antialias,
+		const Render2::PNGCompression& comp) :
+	_plot(plot), _name(name), _palette(palette), _antialias(antialias), _comp(comp),
+	_width(plot.width / (antialias ? 2 : 1)), _height(plot.height / (antialias ? 2 : 1)),
+	_tile(plot.tile / (antialias ? 2 : 1)), _written(0), _skipped(0)
+{
+	ASSERT(!antialias || (plot.tile % 2 == 0 && plot.width % 2 == 0 && plot.height % 2 == 0));
+	_comp.pool = 0; // it's one tile each
+	// Enough levels that the first is a single pixel
+	unsigned n = 0;
+	while ((1u << n) < std::max(_width, _height))
+		++n;
+	_levels = n + 1;
+}
+
+TilePyramid::~TilePyramid()
+{
+	for (auto& f : _writes)
+		f.wait();
+}
+
+unsigned TilePyramid::level_width(unsigned level) const
+{
+	ASSERT(level < _levels);
+	unsigned w = _width;
+	for (unsigned l = _levels-1; l > level; l--)
+		w = (w + 1) / 2;
+	return w;
+}
+
+unsigned TilePyramid::level_height(unsigned level) const
+{
+	ASSERT(level < _levels);
+	unsigned h = _height;
+	for (unsigned l = _levels-1; l > level; l--)
+		h = (h + 1) / 2;
+	return h;
+}
+
+std::string TilePyramid::tile_path(unsigned level, unsigned col, unsigned row) const
+{
+	std::ostringstream os;
+	os << _name << "_files/" << level << "/" << col << "_" << row << ".png";
+	return os.str();
+}
+
+void TilePyramid::make_dir(const std::string& path)
+{
+	if (mkdir(path.c_str(), 0777) == -1 && errno != EEXIST)
+		THROW(BrotException, "Could not create "+path+": "+strerror(errno));
+}
+
+void TilePyramid::write_tile(const std::string& path, const unsigned char* rgb, unsigned w, unsigned h)
+{
+	const std::string tmp = path + ".tmp";
+	{
+		std::ofstream fs(tmp, std::fstream::out | std::fstream::binary | std::fstream::trunc);
+		if (!fs)
+			THROW(BrotException, "Could not open "+tmp+" for writing");
+		Render2::PNGWriter writer(fs, w, h, _comp);
+		writer.write_rows(rgb, h, 3 * w);
+		writer.finish();
+	}
+	if (rename(tmp.c_str(), path.c_str()) == -1)
+		THROW(BrotException, "Could not rename "+tmp+": "+strerror(errno));
+	++_written;
+}
+
+Render2::Base* TilePyramid::begin(unsigned col, unsigned row, unsigned, unsigned, unsigned w, unsigned h)
+{
+	if (exists(tile_path(_levels-1, col, row))) {
+		++_skipped;
+		return 0;
+	}
+	std::shared_ptr<Pending> p(new Pending());
+	p->w = w;
+	p->h = h;
+	p->buf.resize(3 * w * h);
+	p->render.reset(new Render2::MemoryBuffer(&p->buf[0], 3 * w, w, h, _antialias, -1,
+				Render2::pixpack_format::PACKED_RGB_24, _palette));
+	_pending[p->render.get()] = p;
+	return p->render.get();
+}
+
+void TilePyramid::end(unsigned col, unsigned row, Render2::Base* render, bool complete)
+{
+	auto it = _pending.find(render);
+	ASSERT(it != _pending.end());
+	std::shared_ptr<Pending> p = it->second;
+	_pending.erase(it);
+	if (!complete)
+		return;
+	const std::string path = tile_path(_levels-1, col, row);
+	// The pool's busy plotting, but this is a small job.
+	_writes.push_back(_plot.pool().enqueue<void>([this, p, path] {
+		write_tile(path, &p->buf[0], p->w, p->h);
+	}, _plot.qos()));
+	// Throw at the first failure, rather than keep on plotting.
+	while (!_writes.empty() && _writes.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		_writes.front().get();
+		_writes.pop_front();
+	}
+}
+
+void TilePyramid::wait_writes()
+{
+	while (!_writes.empty()) {
+		std::future<void> f = std::move(_writes.front());
+		_writes.pop_front();
+		f.get();
+	}
+}
+
+/* Reads a tile back, as packed RGB. */
+static void read_tile(const std::string& path, unsigned w, unsigned h, std::vector<unsigned char>& out)
+{
+	std::ifstream fs(path, std::fstream::in | std::fstream::binary);
+	if (!fs)
+		THROW(BrotException, "Could not open "+path+" (has its level been plotted?)");
+	try {
+		png::image<png::rgb_pixel> img(fs);
+		if (img.get_width() != w || img.get_height() != h)
+			THROW(BrotException, path+" is the wrong size for this pyramid");
+		out.resize(3 * w * h);
+		for (unsigned y=0; y<h; y++)
+			for (unsigned x=0; x<w; x++) {
+				const png::rgb_pixel& px = img[y][x];
+				unsigned char *dst = &out[3 * (y*w + x)];
+				dst[0] = px.red;
+				dst[1] = px.green;
+				dst[2] = px.blue;
+			}
+	} catch (std::runtime_error& e) { // png++'s
+		THROW(BrotException, "Could not read "+path+": "+e.what());
+	}
+}
+
+void TilePyramid::halve(unsigned level, unsigned col, unsigned row)
+{
+	const std::string path = tile_path(level, col, row);
+	if (exists(path)) {
+		++_skipped;
+		return;
+	}
+	const unsigned below_w = level_width(level+1), below_h = level_height(level+1),
+			w = std::min(_tile, level_width(level) - col * _tile),
+			h = std::min(_tile, level_height(level) - row * _tile),
+			// What this tile covers of the level below
+			src_w = std::min(2 * _tile, below_w - 2 * col * _tile),
+			src_h = std::min(2 * _tile, below_h - 2 * row * _tile);
+
+	// The (up to) four tiles below, side by side
+	std::vector<unsigned char> src(3 * src_w * src_h), child;
+	for (unsigned dy=0; dy<2; dy++) {
+		for (unsigned dx=0; dx<2; dx++) {
+			const unsigned x0 = dx * _tile, y0 = dy * _tile;
+			if (x0 >= src_w || y0 >= src_h)
+				continue;
+			const unsigned cw = std::min(_tile, src_w - x0), ch = std::min(_tile, src_h - y0);
+			read_tile(tile_path(level+1, 2*col + dx, 2*row + dy), cw, ch, child);
+			for (unsigned y=0; y<ch; y++)
+				memcpy(&src[3 * ((y0 + y) * src_w + x0)], &child[3 * y * cw], 3 * cw);
+		}
+	}
+
+	// Each pixel is the average of the 2x2 below it (fewer at an odd edge).
+	std::vector<unsigned char> out(3 * w * h);
+	for (unsigned y=0; y<h; y++) {
+		const unsigned sy = 2*y, ny = std::min(2u, src_h - sy);
+		for (unsigned x=0; x<w; x++) {
+			const unsigned sx = 2*x, nx = std::min(2u, src_w - sx);
+			for (unsigned c=0; c<3; c++) {
+				unsigned sum = 0;
+				for (unsigned j=0; j<ny; j++)
+					for (unsigned i=0; i<nx; i++)
+						sum += src[3 * ((sy + j) * src_w + sx + i) + c];
+				out[3 * (y*w + x) + c] = sum / (nx * ny);
+			}
+		}
+	}
+	write_tile(path, &out[0], w, h);
+}
+
+void TilePyramid::run()
+{
+	make_dir(_name + "_files");
+	for (unsigned l=0; l<_levels; l++) {
+		std::ostringstream os;
+		os << _name << "_files/" << l;
+		make_dir(os.str());
+	}
+
+	try {
+		_plot.run(*this, _antialias);
+	} catch (...) {
+		_pending.clear();
+		for (auto& f : _writes)
+			f.wait();
+		_writes.clear();
+		throw;
+	}
+	wait_writes();
+	if (_progress)
+		_progress(_levels-1);
+
+	for (unsigned l = _levels-1; l-- > 0; ) {
+		const unsigned cols = level_cols(l);
+		Render2::ParallelJob::run(cols * level_rows(l), [this, l, cols] (unsigned i) {
+			halve(l, i % cols, i / cols);
+		}, _plot.pool(), _plot.qos());
+		if (_progress)
+			_progress(l);
+	}
+
+	const std::string dzi = dzi_path(), tmp = dzi + ".tmp";
+	{
+		std::ofstream fs(tmp, std::fstream::out | std::fstream::trunc);
+		fs << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>" << std::endl
+			<< "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" TileSize=\"" << _tile
+			<< "\" Overlap=\"0\" Format=\"png\">" << std::endl
+			<< "  <Size Width=\"" << _width << "\" Height=\"" << _height << "\"/>" << std::endl
+			<< "</Image>" << std::endl;
+		if (!fs)
+			THROW(BrotException, "Could not write "+tmp);
+	}
+	if (rename(tmp.c_str(), dzi.c_str()) == -1)
+		THROW(BrotException, "Could not rename "+tmp+": "+strerror(errno));
+}
+
+} // namespace Plot3
@@ -0,0 +1,121 @@
+/*
+    TilePyramid.h: Deep Zoom image pyramids of a plot
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TILEPYRAMID_H_
+#define TILEPYRAMID_H_
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "TiledPlot.h"
+#include "PNGWriter.h"
+#include "Render2.h"
+
+namespace Plot3 {
+
+/*
+ * A plot as a Deep Zoom image pyramid, for web viewers (OpenSeadragon and
+ * the like): NAME.dzi describes it, and NAME_files/L/C_R.png are the tiles
+ * of level L, column C, row R. Level 0 is a single pixel; each level is
+ * twice the size of the one before, up to the last, which is the full
+ * size of the plot.
+ *
+ * We only plot the last level, a tile at a time (see TiledPlot); each
+ * level above is made by halving the one below, tile by tile, in
+ * parallel on the pool. Tiles that are already there are left alone, so
+ * an interrupted run picks up where it left off; and so that a tile is
+ * only ever there if it's complete, each is written under a temporary
+ * name and renamed into place.
+ */
+class TilePyramid : private TiledPlot::Target {
+public:
+	static const unsigned DEFAULT_TILE = 256;
+	/* Called as each level is finished, the biggest first */
+	typedef std::function<void(unsigned level)> LevelFn;
+
+	/* plot's tiles must be our tile size (twice that to antialias); its
+	 * prefs, progress and so on are the caller's business. comp is for
+	 * each tile (its pool is ignored, as the tiles go in parallel). */
+	TilePyramid(TiledPlot& plot, const std::string& name, const BasePalette& palette, bool antialias,
+			const Render2::PNGCompression& comp = Render2::PNGCompression());
+	virtual ~TilePyramid();
+
+	void set_progress(LevelFn fn) { _progress = fn; }
+
+	/* Plots what's missing of the last level, builds the rest and writes
+	 * the .dzi. Blocking. Throws BrotException if anything can't be
+	 * written (or read back). */
+	void run();
+
+	unsigned width() const { return _width; }
+	unsigned height() const { return _height; }
+	unsigned tile() const { return _tile; }
+	unsigned levels() const { return _levels; }
+	/* Size of a level, in pixels; and in tiles */
+	unsigned level_width(unsigned level) const;
+	unsigned level_height(unsigned level) const;
+	unsigned level_cols(unsigned level) const { return (level_width(level) + _tile - 1) / _tile; }
+	unsigned level_rows(unsigned level) const { return (level_height(level) + _tile - 1) / _tile; }
+
+	std::string dzi_path() const { return _name + ".dzi"; }
+	std::string tile_path(unsigned level, unsigned col, unsigned row) const;
+
+	unsigned tiles_written() const { return _written; }
+	unsigned tiles_skipped() const { return _skipped; }
+
+private:
+	TilePyramid(const TilePyramid&) = delete;
+	const TilePyramid& operator= (const TilePyramid&) = delete;
+
+	TiledPlot& _plot;
+	const std::string _name;
+	const BasePalette& _palette;
+	const bool _antialias;
+	Render2::PNGCompression _comp;
+	const unsigned _width, _height, _tile;
+	unsigned _levels;
+	LevelFn _progress;
+	std::atomic<unsigned> _written, _skipped;
+
+	// The last level's tiles, while they're being plotted and written
+	struct Pending {
+		std::vector<unsigned char> buf; // packed RGB
+		std::unique_ptr<Render2::MemoryBuffer> render;
+		unsigned w, h;
+	};
+	std::map<Render2::Base*, std::shared_ptr<Pending> > _pending;
+	std::list<std::future<void> > _writes;
+
+	virtual Render2::Base* begin(unsigned col, unsigned row, unsigned x, unsigned y, unsigned w, unsigned h);
+	virtual void end(unsigned col, unsigned row, Render2::Base* render, bool complete);
+
+	/* Makes tile (col,row) of level from the four below it. */
+	void halve(unsigned level, unsigned col, unsigned row);
+	void write_tile(const std::string& path, const unsigned char* rgb, unsigned w, unsigned h);
+	void make_dir(const std::string& path);
+	void wait_writes();
+};
+
+} // namespace Plot3
+
+#endif /* TILEPYRAMID_H_ */
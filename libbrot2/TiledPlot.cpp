@@ -0,0 +1,202 @@
+/*
+    TiledPlot.cpp: Plots too big to hold at once, a tile at a time
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TiledPlot.h"
+#include "Exception.h"
+#include <algorithm>
+
+namespace Plot3 {
+
+TiledPlot::TiledPlot(std::shared_ptr<ThreadPool> pool, const Fractal::FractalImpl& f,
+		Fractal::Point centre, Fractal::Point size, unsigned width, unsigned height,
+		unsigned tile, unsigned max_passes) :
+	width(width), height(height), tile(tile),
+	_pool(pool), _fract(f), _centre(centre), _size(size), _max_passes(max_passes),
+	_qos(QoS::EXPORT), _window(0), _passes(0), _maxiter(0), _done(0), _stop(false)
+{
+	ASSERT(width > 0 && height > 0 && tile > 0);
+	_cols = (width + tile - 1) / tile;
+	_rows = (height + tile - 1) / tile;
+	_window = _cols + 1;
+	_arith = Fractal::FractalCommon::select_maths_type(size, width, height);
+	if (_arith == Fractal::Maths::MathsType::MAX)
+		THROW(BrotException,"Pixels are too small for all known types");
+	_view.reset(new Plot3Plot(_pool, &_sink, _fract, _divider, centre, size, width, height, max_passes));
+}
+
+TiledPlot::~TiledPlot()
+{
+	stop();
+	for (auto job : _running) {
+		job->plot->wait();
+		delete job;
+	}
+}
+
+Plot3Plot& TiledPlot::survey()
+{
+	if (_survey)
+		return *_survey;
+	const unsigned longest = std::max(width, height),
+			scale = (longest + SURVEY_SIZE - 1) / SURVEY_SIZE;
+	_survey.reset(new Plot3Plot(_pool, &_sink, _fract, _divider, _centre, _size,
+				std::max(1u, width / scale), std::max(1u, height / scale), _max_passes));
+	if (_prefs) {
+		std::shared_ptr<const BrotPrefs::Prefs> prefs = _prefs;
+		_survey->set_prefs(prefs);
+	}
+	_survey->set_qos(_qos);
+	_survey->start(_arith);
+	_survey->wait();
+	_passes = _survey->get_passes();
+	_maxiter = _survey->get_maxiter();
+	_view->adopt_statistics(*_survey);
+	return *_survey;
+}
+
+TiledPlot::Job* TiledPlot::start(unsigned col, unsigned row, Target& target, bool antialias)
+{
+	const unsigned aa = antialias ? 2 : 1;
+	// Where is it on the plot? The chunks have a bottom-left origin.
+	const unsigned x = col * tile, w = std::min(tile, width - x),
+			h = std::min(tile, height - row * tile), y = height - row * tile - h;
+	Render2::Base *render = target.begin(col, row, x / aa, row * tile / aa, w / aa, h / aa);
+	if (!render)
+		return 0;
+
+	const Fractal::Value pixw = real(_size) / width, pixh = imag(_size) / height;
+	const Fractal::Point origin = _centre - _size / (Fractal::Value)2.0 + Fractal::Point(pixw * x, pixh * y),
+			size(pixw * w, pixh * h);
+	Job *job = new Job();
+	job->col = col;
+	job->row = row;
+	job->render = render;
+	job->plot.reset(new Plot3Plot(_pool, &_sink, _fract, _divider, origin + size / (Fractal::Value)2.0, size, w, h));
+	if (_prefs) {
+		std::shared_ptr<const BrotPrefs::Prefs> prefs = _prefs;
+		job->plot->set_prefs(prefs);
+	}
+	job->plot->set_qos(_qos);
+	job->plot->set_fixed_passes(_passes);
+	job->plot->set_retire([this, render] (const std::list<Plot3Chunk*>& chunks) {
+		try {
+			render->process(chunks, *_pool, _qos);
+		} catch (BrotException &e) {
+			fail(e.msg); // stops us all, this one included
+		}
+	});
+	job->plot->start(_arith);
+	return job;
+}
+
+void TiledPlot::run(Target& target, bool antialias)
+{
+	ASSERT(!antialias || (tile % 2 == 0 && width % 2 == 0 && height % 2 == 0));
+	survey();
+
+	unsigned next = 0; // in raster order, top row first
+	std::unique_lock<std::mutex> lock(_lock);
+	while (true) {
+		while (!_stop && next < tiles_total() && _running.size() < std::max(1u, _window)) {
+			lock.unlock();
+			Job *job = start(next % _cols, next / _cols, target, antialias);
+			lock.lock();
+			++next;
+			if (!job) {
+				++_done;
+				continue;
+			}
+			_running.push_back(job);
+			if (_stop) // we missed it
+				job->plot->stop();
+		}
+		if (_running.empty())
+			break;
+		// The oldest is the one holding up the output.
+		Job *job = _running.front();
+		lock.unlock();
+		job->plot->wait();
+		// Retiring the last of them is the last thing a completed plot does.
+		bool complete = true;
+		for (auto chunk : job->plot->get_chunks__only_after_completion())
+			complete = complete && chunk->released();
+		lock.lock();
+		_running.pop_front();
+		complete = complete && _error.empty();
+		lock.unlock();
+		try {
+			target.end(job->col, job->row, job->render, complete);
+		} catch (BrotException &e) {
+			fail(e.msg);
+		}
+		delete job;
+		const unsigned done = ++_done;
+		if (_progress)
+			_progress(done, tiles_total());
+		lock.lock();
+	}
+	if (_error.length())
+		THROW(BrotException, _error);
+}
+
+namespace {
+/* Tiles of a PNGStream */
+class StreamTarget : public TiledPlot::Target {
+	Render2::PNGStream& _out;
+	const BasePalette& _palette;
+	const bool _antialias;
+public:
+	StreamTarget(Render2::PNGStream& out, const BasePalette& palette, bool antialias) :
+		_out(out), _palette(palette), _antialias(antialias) {}
+	virtual Render2::Base* begin(unsigned, unsigned, unsigned x, unsigned y, unsigned w, unsigned h) {
+		return new Render2::Tile(_out, x, y, w, h, _palette, -1, _antialias);
+	}
+	virtual void end(unsigned, unsigned, Render2::Base* render, bool) {
+		delete render;
+		_out.flush();
+	}
+};
+}
+
+void TiledPlot::run(Render2::PNGStream& out, const BasePalette& palette, bool antialias)
+{
+	ASSERT(out.width() * (antialias ? 2 : 1) == width);
+	ASSERT(out.height() * (antialias ? 2 : 1) == height);
+	StreamTarget target(out, palette, antialias);
+	run(target, antialias);
+}
+
+void TiledPlot::stop()
+{
+	std::unique_lock<std::mutex> lock(_lock);
+	_stop = true;
+	for (auto job : _running)
+		job->plot->stop();
+}
+
+void TiledPlot::fail(const std::string& msg)
+{
+	std::unique_lock<std::mutex> lock(_lock);
+	if (_error.empty())
+		_error = msg;
+	_stop = true;
+	for (auto job : _running)
+		job->plot->stop();
+}
+
+} // namespace Plot3
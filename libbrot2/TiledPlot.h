@@ -0,0 +1,173 @@
+/*
+    TiledPlot.h: Plots too big to hold at once, a tile at a time
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TILEDPLOT_H_
+#define TILEDPLOT_H_
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "Fractal.h"
+#include "Plot3Plot.h"
+#include "ChunkDivider.h"
+#include "IPlot3DataSink.h"
+#include "Render2.h"
+#include "ThreadPool.h"
+
+namespace Plot3 {
+
+/*
+ * A plot cut into square tiles, each its own Plot3Plot on the shared pool,
+ * so we only ever hold a few rows of tiles; a whole Plot3Plot holds every
+ * pixel (some 80 bytes each) until it's done.
+ *
+ * Left to themselves, tiles would each decide when they were finished
+ * and wouldn't agree along their edges. So first we survey the whole view
+ * at low resolution, the usual way, and every tile then runs as many
+ * passes as that took (see Plot3Plot::set_fixed_passes), so they all end
+ * at the same maxiter.
+ *
+ * Each tile's chunks go to a render of just that tile as they finish
+ * (see Plot3Plot::set_retire), and are freed. The renders come from a
+ * Target: a Render2::PNGStream of the whole image, say, or a file per
+ * tile (see TilePyramid).
+ */
+class TiledPlot {
+public:
+	/* Called after each tile, from run()'s thread. */
+	typedef std::function<void(unsigned done, unsigned total)> ProgressFn;
+
+	/* Where the tiles go. */
+	class Target {
+	public:
+		virtual ~Target() {}
+		/* Tile (col,row) is about to be plotted. Its top-left output pixel
+		 * is (x,y), and it's w x h output pixels. Returns the render to
+		 * process its chunks into, which must cope with being fed from
+		 * several threads at once (the Render2 ones do); or null to skip
+		 * the tile. Called on run()'s thread. */
+		virtual Render2::Base* begin(unsigned col, unsigned row, unsigned x, unsigned y, unsigned w, unsigned h) = 0;
+		/* That tile's plot has finished with render; complete says whether
+		 * it has every pixel (it won't, if we were stopped). Called on
+		 * run()'s thread, in the order the tiles began, so the tiles
+		 * above are always done by now. Throw BrotException to stop. */
+		virtual void end(unsigned col, unsigned row, Render2::Base* render, bool complete) = 0;
+	};
+
+	/* The largest the survey plot gets, on its longer side */
+	static const unsigned SURVEY_SIZE = 512;
+
+	/* width, height and tile (the side of a tile; the ones at the right
+	 * and bottom may be smaller) are in plot pixels, so all must be even
+	 * to antialias. max_passes is as for Plot3Plot, and limits the survey. */
+	TiledPlot(std::shared_ptr<ThreadPool> pool, const Fractal::FractalImpl& f,
+			Fractal::Point centre, Fractal::Point size, unsigned width, unsigned height,
+			unsigned tile, unsigned max_passes=0);
+	virtual ~TiledPlot();
+
+	/* As for Plot3Plot; all the plots get them. Set before survey(). */
+	void set_prefs(std::shared_ptr<const BrotPrefs::Prefs> prefs) { _prefs = prefs; }
+	void set_qos(QoS qos) { _qos = qos; }
+	QoS qos() const { return _qos; }
+	ThreadPool& pool() const { return *_pool; }
+	void set_progress(ProgressFn fn) { _progress = fn; }
+	/* How many tiles may be on the go at once (default: a row of them,
+	 * plus one, so the next row is under way as the last of one finishes).
+	 * That's what decides how much memory we need. */
+	void set_window(unsigned tiles) { _window = tiles; }
+
+	/* Plots the whole view at low resolution to find how many passes the
+	 * tiles need. Blocking. The plot is kept; its histogram will do for an
+	 * EqualisedPalette. run() calls this if you haven't. */
+	Plot3Plot& survey();
+
+	/* The whole plot, as a Plot3Plot. It is never run, but once we've
+	 * surveyed it reports the tiles' schedule as its own; so it's the
+	 * one to ask for info(), or to give the HUD. */
+	Plot3Plot& view() { return *_view; }
+
+	/* Plots every tile, top row first, into target, freeing each as it
+	 * goes. Output pixels are plot pixels, or half that if antialias.
+	 * Blocking. Throws BrotException if the output failed, and stops
+	 * early if stop()ped. */
+	void run(Target& target, bool antialias);
+	/* The same, into out (the whole output), flushing it after each
+	 * tile; the caller then finish()es it. */
+	void run(Render2::PNGStream& out, const BasePalette& palette, bool antialias);
+
+	/* Asks run() to stop soon. Doesn't block. */
+	void stop();
+
+	unsigned tiles_total() const { return _cols * _rows; }
+	unsigned tiles_done() const { return _done; }
+	/* The schedule every tile follows; 0 until we've surveyed. */
+	unsigned passes() const { return _passes; }
+	unsigned maxiter() const { return _maxiter; }
+
+	const unsigned width, height, tile;
+
+private:
+	TiledPlot(const TiledPlot&) = delete;
+	const TiledPlot& operator= (const TiledPlot&) = delete;
+
+	class Sink : public IPlot3DataSink {
+		// The tiles report to the renders, through their retirement.
+		virtual void chunk_done(Plot3Chunk*) {}
+		virtual void pass_complete(std::string&, unsigned, unsigned, unsigned, unsigned,
+				std::shared_ptr<const IterHistogram>) {}
+		virtual void plot_complete() {}
+	};
+	struct Job {
+		unsigned col, row;
+		Render2::Base* render; // the target's
+		std::unique_ptr<Plot3Plot> plot;
+	};
+
+	std::shared_ptr<ThreadPool> _pool;
+	const Fractal::FractalImpl& _fract;
+	const Fractal::Point _centre, _size;
+	const unsigned _max_passes;
+	std::shared_ptr<const BrotPrefs::Prefs> _prefs;
+	QoS _qos;
+	ProgressFn _progress;
+	unsigned _window;
+	unsigned _cols, _rows; // of tiles
+	Fractal::Maths::MathsType _arith; // of the whole plot, so every tile uses the same
+	unsigned _passes, _maxiter;
+	std::atomic<unsigned> _done;
+
+	Sink _sink;
+	ChunkDivider::Horizontal10px _divider;
+	std::unique_ptr<Plot3Plot> _survey, _view;
+
+	std::mutex _lock;
+	std::deque<Job*> _running; // oldest first; PROTECT by _lock
+	bool _stop; // PROTECT by _lock
+	std::string _error; // the first thing that went wrong; PROTECT by _lock
+
+	/* Starts the plot of tile (col,row) (row 0 at the top); null if the target skipped it. */
+	Job* start(unsigned col, unsigned row, Target& target, bool antialias);
+	void fail(const std::string& msg);
+};
+
+} // namespace Plot3
+
+#endif /* TILEDPLOT_H_ */
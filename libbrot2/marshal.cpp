@@ -17,6 +17,9 @@
 */
 
 #include "marshal.h"
+#include <stdint.h>
+#include <cmath>
+#include <limits>
 #include <typeinfo>
 
 namespace b2marsh {
@@ -29,13 +32,133 @@ bool runtime_type_check(void) {
 	return (ti1.hash_code() == ti2.hash_code());
 }
 
-void Value2Wire(const Fractal::Value& val, b2msg::Float* wire)
+typedef std::numeric_limits<Fractal::Value> ValueLimits;
+// Does every Fractal::Value fit exactly in x87 extended?
+static const bool VALUE_FITS_EXTENDED = ValueLimits::radix == 2 && ValueLimits::digits <= 64
+	&& ValueLimits::max_exponent <= 16384 && ValueLimits::min_exponent >= -16381;
+
+static const int EXTENDED_BIAS = 16383;
+
+static std::string to_extended(Fractal::Value val)
+{
+	uint64_t mant = 0;
+	unsigned exp = 0; // biased
+	if (std::isnan(val)) {
+		mant = 0xC000000000000000ULL;
+		exp = 0x7fff;
+	} else if (std::isinf(val)) {
+		mant = 0x8000000000000000ULL;
+		exp = 0x7fff;
+	} else if (val != 0) {
+		int e;
+		const Fractal::Value m = std::frexp(std::fabs(val), &e); // in [0.5,1), so m * 2^64 fits
+		mant = (uint64_t)std::ldexp(m, 64);
+		int biased = e - 1 + EXTENDED_BIAS;
+		if (biased <= 0) { // denormal
+			mant = 1 - biased < 64 ? mant >> (1 - biased) : 0;
+			biased = 0;
+		}
+		exp = biased;
+	}
+	if (std::signbit(val))
+		exp |= 0x8000;
+	std::string rv(10, 0);
+	for (unsigned i=0; i<8; i++)
+		rv[i] = (char)(mant >> (8*i));
+	rv[8] = (char)exp;
+	rv[9] = (char)(exp >> 8);
+	return rv;
+}
+
+static Fractal::Value from_extended(const std::string& bytes)
 {
-	// FRAGILE: Relies on Fractal::Value being long double. See the runtime check above, called from tests.
-	std::stringstream str;
-	str.precision(LD_precision);
-	str << val;
-	wire->set_longdouble(str.str());
+	if (bytes.length() != 10)
+		return NAN;
+	uint64_t mant = 0;
+	for (unsigned i=0; i<8; i++)
+		mant |= (uint64_t)(unsigned char)bytes[i] << (8*i);
+	const unsigned sexp = (unsigned char)bytes[8] | (unsigned char)bytes[9] << 8,
+			exp = sexp & 0x7fff;
+	Fractal::Value rv;
+	if (exp == 0x7fff)
+		rv = (mant << 1) ? NAN : INFINITY;
+	else
+		rv = std::ldexp((Fractal::Value)mant, (exp ? exp : 1) - EXTENDED_BIAS - 63);
+	return (sexp & 0x8000) ? -rv : rv;
+}
+
+static void to_bigfloat(Fractal::Value val, b2msg::Float::BigFloat* wire)
+{
+	int e = 0;
+	Fractal::Value m = std::frexp(std::fabs(val), &e);
+	std::string mantissa;
+	// A byte at a time off the top; each step is exact.
+	while (m != 0) {
+		m = std::ldexp(m, 8);
+		const int byte = (int)m;
+		mantissa.push_back((char)byte);
+		m -= byte;
+		e -= 8;
+	}
+	wire->set_negative(std::signbit(val));
+	wire->set_mantissa(mantissa);
+	wire->set_exponent(e);
+}
+
+static Fractal::Value from_bigfloat(const b2msg::Float::BigFloat& wire)
+{
+	const std::string& mantissa = wire.mantissa();
+	// Any bytes beyond these are more than we could hold anyway
+	const unsigned used = std::min<size_t>(mantissa.length(), 2 + (ValueLimits::digits + 7) / 8);
+	Fractal::Value rv = 0;
+	for (unsigned i=0; i<used; i++)
+		rv = std::ldexp(rv, 8) + (unsigned char)mantissa[i];
+	rv = std::ldexp(rv, wire.exponent() + 8 * (int)(mantissa.length() - used));
+	return wire.negative() ? -rv : rv;
+}
+
+void Value2Wire(const Fractal::Value& val, b2msg::Float* wire, Encoding enc)
+{
+	const double hi = (double)val, lo = std::isfinite(hi) ? (double)(val - hi) : 0;
+	if (enc == Encoding::BIGFLOAT && !std::isfinite(val))
+		enc = Encoding::AUTO; // A BigFloat can't say infinity or NaN; AUTO never picks one for them
+	if (enc == Encoding::AUTO) {
+		if (hi == val)
+			enc = Encoding::DOUBLEDOUBLE; // lo is 0, so isn't sent
+		else if (VALUE_FITS_EXTENDED)
+			enc = Encoding::EXTENDED;
+		else if (std::isfinite(hi) && (Fractal::Value)hi + lo == val)
+			enc = Encoding::DOUBLEDOUBLE;
+		else if (std::isfinite(val))
+			enc = Encoding::BIGFLOAT;
+		else
+			enc = Encoding::DECIMAL;
+	}
+
+	switch (enc) {
+	case Encoding::EXTENDED:
+		wire->set_extended(to_extended(val));
+		break;
+	case Encoding::DOUBLEDOUBLE: {
+		b2msg::Float::DoubleDouble* dd = wire->mutable_dd();
+		dd->set_hi(hi);
+		if (lo != 0)
+			dd->set_lo(lo);
+		break;
+	}
+	case Encoding::BIGFLOAT:
+		to_bigfloat(val, wire->mutable_big());
+		break;
+	case Encoding::DECIMAL:
+	case Encoding::AUTO: {
+		// FRAGILE: Relies on Fractal::Value being long double. See the runtime check above, called from tests.
+		std::stringstream str;
+		str.precision(LD_precision);
+		str << val;
+		wire->set_longdouble(str.str());
+		break;
+	}
+	}
 }
 
 void Point2Wire(const Fractal::Point& pt, b2msg::Point* wire)
@@ -46,8 +169,17 @@ void Point2Wire(const Fractal::Point& pt, b2msg::Point* wire)
 
 void Wire2Value(const b2msg::Float& wire, Fractal::Value& val)
 {
-	if (wire.has_longdouble()) // TODO later switch on case
+	if (wire.has_longdouble())
 		val = std::stold(wire.longdouble());
+	else if (wire.has_extended())
+		val = from_extended(wire.extended());
+	else if (wire.has_dd()) {
+		val = wire.dd().hi();
+		if (wire.dd().lo() != 0) // else -0 would come back as 0
+			val += wire.dd().lo();
+	}
+	else if (wire.has_big())
+		val = from_bigfloat(wire.big());
 	else
 		val = NAN;
 }
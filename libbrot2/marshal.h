@@ -26,9 +26,18 @@ namespace b2marsh {
 
 bool runtime_type_check(void); // Sanity check, called by unit tests. If this returns false, marshalling code is broken.
 
+// How a b2msg::Float is encoded (see brot2msgs.proto)
+enum class Encoding {
+	AUTO, // the most compact that's exact
+	DECIMAL, // LongDouble; the old way, which older readers understand
+	EXTENDED, // exact if Fractal::Value fits in x87 extended
+	DOUBLEDOUBLE, // exact if the value is the sum of two doubles
+	BIGFLOAT, // exact for any finite value; infinities and NaN are sent as AUTO would
+};
+
 // Type helpers
-void Value2Wire(const Fractal::Value& val, b2msg::Float* wire);
-void Wire2Value(const b2msg::Float& wire, Fractal::Value& val);
+void Value2Wire(const Fractal::Value& val, b2msg::Float* wire, Encoding enc = Encoding::AUTO);
+void Wire2Value(const b2msg::Float& wire, Fractal::Value& val); // Anything more precise than Fractal::Value is rounded; unknown encodings give NAN
 
 // Complex helpers
 void Point2Wire(const Fractal::Point& pt, b2msg::Point* wire);
@@ -76,6 +76,15 @@ hsvf::operator rgb() {
 	ASSERT(false); // unreachable
 }
 
+void BasePalette::get_span(const PointData *pts, unsigned n, int local_inf, rgb *out) const {
+	for (unsigned i=0; i<n; i++) {
+		if (pts[i].iter == local_inf || pts[i].iterf < 0)
+			out[i] = black;
+		else
+			out[i] = get(pts[i]);
+	}
+}
+
 std::ostream& operator<<(std::ostream &stream, hsvf o) {
 	  stream << "hsvf(" << o.h << "," << o.s << "," << o.v << ")";
 	  return stream;
@@ -86,6 +95,7 @@ std::ostream& operator<<(std::ostream &stream, hsvf o) {
 class Kaleidoscopic : public DiscretePalette {
 public:
 	Kaleidoscopic(int n) : DiscretePalette("Kaleidoscopic", n) {};
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITER_RANGE, 65536); }
 	virtual rgb get(const PointData &pt) const {
 		// This one jumps at random around the hue space.
 			hsvf h(0.5+cos(pt.iter)/2.0, 0.87, 0.87);
@@ -127,6 +137,7 @@ public:
 class PastelSalad : public DiscretePalette {
 public:
 	PastelSalad(int n) : DiscretePalette("Pastel salad", n) {};
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITER_RANGE, 65536); }
 	virtual rgb get(const PointData &pt) const {
 		return rgb((size-pt.iter)*255/size,
 					144,
@@ -140,6 +151,7 @@ protected:
 	rgbf point1, point2;
 public:
 	SawtoothGradient(std::string name, int n, const rgbf p1, const rgbf p2) : DiscretePalette(name, n), point1(p1), point2(p2) {};
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITER_PERIODIC, size); }
 
 	virtual rgb get(const PointData &pt) const {
 		// I tried a sinusoid function here as well, but it didn't work so well.
@@ -205,6 +217,7 @@ public:
 	const double wrap;
 	const hsvf pointa, pointb; // Points to smooth between
 	HueCycle(string name, float wrap, hsvf pa, hsvf pb) : SmoothPalette(name), wrap(wrap), pointa(pa), pointb(pb) {};
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITERF_PERIODIC, wrap); }
 	rgb get(const PointData &pt) const {
 		float tau,tmp;
 		tau = pt.iterf / wrap;
@@ -238,6 +251,7 @@ class LogSmoothed : public SmoothPalette {
 public:
 	LogSmoothed() : SmoothPalette("Logarithmic rainbow") {};
 	LogSmoothed(string name) : SmoothPalette(name) {};
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITERF_LOG); }
 	hsvf get_hsvf(const PointData &pt) const {
 		hsvf rv;
 		float f = pt.iterf;
@@ -261,6 +275,7 @@ public:
 	/* What to call it? I originally called it _fast_, but it could mislead as
 	 * it doesn't make the plot any faster; the gradient is _steeper_ perhaps? */
 	FastLogSmoothed() : SmoothPalette("Logarithmic rainbow (steep)") {};
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITERF_LOG); }
 	hsvf get_hsvf(const PointData &pt) const {
 		float f = pt.iterf;
 		if (f < Fractal::PointData::ITERF_LOW_CLAMP)
@@ -279,6 +294,7 @@ public:
 class SinLogSmoothed : public SmoothPalette {
 public:
 	SinLogSmoothed() : SmoothPalette("sin(log)") {};
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITERF_LOG); }
 	hsvf get_hsvf(const PointData &pt) const {
 		float f = pt.iterf;
 		if (f < Fractal::PointData::ITERF_LOW_CLAMP)
@@ -299,6 +315,7 @@ class SlowSineLog : public SmoothPalette {
 public:
 	SlowSineLog() : SmoothPalette("sin(log) shallow") {};
 	SlowSineLog(std::string name) : SmoothPalette(name) {};
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITERF_LOG); }
 	rgb get(const PointData &pt) const {
 		hsvf rv;
 		rv.h = 0.5 + sin(log(pt.iterf)/3*M_PI)/2.0;
@@ -311,6 +328,7 @@ public:
 class FastSineLog : public SmoothPalette {
 public:
 	FastSineLog() : SmoothPalette("sin(log) steep") {};
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITERF_LOG); }
 	rgb get(const PointData &pt) const {
 		float f = pt.iterf;
 		if (f < Fractal::PointData::ITERF_LOW_CLAMP)
@@ -327,6 +345,7 @@ public:
 class CosLogSmoothed : public SmoothPalette {
 public:
 	CosLogSmoothed() : SmoothPalette("cos(log)") {};
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITERF_LOG); }
 	hsvf get_hsvf(const PointData &pt) const {
 		float f = pt.iterf;
 		if (f < Fractal::PointData::ITERF_LOW_CLAMP)
@@ -347,6 +366,7 @@ class SlowCosLog : public SmoothPalette {
 public:
 	SlowCosLog() : SmoothPalette("cos(log) shallow") {};
 	SlowCosLog(std::string name) : SmoothPalette(name) {};
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITERF_LOG); }
 	rgb get(const PointData &pt) const {
 		hsvf rv;
 		rv.h = 0.5 + cos(log(pt.iterf)/3*M_PI)/2.0;
@@ -359,6 +379,7 @@ public:
 class FastCosLog : public SmoothPalette {
 public:
 	FastCosLog() : SmoothPalette("cos(log) steep") {};
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITERF_LOG); }
 	rgb get(const PointData &pt) const {
 		float f = pt.iterf;
 		if (f < Fractal::PointData::ITERF_LOW_CLAMP)
@@ -377,6 +398,8 @@ class Mandy : public SmoothPalette {
  * See http://www.greenend.org.uk/rjk/mandy/ */
 public:
 	Mandy() : SmoothPalette("rjk.mandy") {};
+	// cos(sqrt) is too busy at high iterf to tabulate by log.
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITERF_SQRT, 1<<24); }
 	rgb get(const PointData &pt) const {
 		float f = pt.iterf;
 		rgb rv;
@@ -394,6 +417,7 @@ class MandyBlue : public SmoothPalette {
 /* A derivative of Mandy that I discovered while noodling around. */
 public:
 	MandyBlue() : SmoothPalette("rjk.mandy.blue") {};
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITERF_LOG); }
 	rgb get(const PointData &pt) const {
 		float f = log(pt.iterf); // one log, that's all the difference
 		rgb rv;
@@ -412,6 +436,7 @@ class fanfBlackFade: public SmoothPalette {
  * See http://dotat.at/prog/mandelbrot/ */
 public:
 	fanfBlackFade() : SmoothPalette("fanf.black.fade") {};
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITERF_LOG); }
 	rgb get(const PointData &pt) const {
 		double f = log(pt.iterf);
 		rgb rv;
@@ -429,6 +454,7 @@ class fanfWhiteFade: public SmoothPalette {
  * See http://dotat.at/prog/mandelbrot/ */
 public:
 	fanfWhiteFade() : SmoothPalette("fanf.white.fade") {};
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITERF_LOG); }
 	rgb get(const PointData &pt) const {
 		double f = log(pt.iterf);
 		rgb rv;
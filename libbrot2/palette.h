@@ -22,6 +22,9 @@
 #include <string>
 #include <map>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <atomic>
 #include "Fractal.h"
 #include "Registry.h"
 
@@ -128,14 +131,56 @@ public:
 
 std::ostream& operator<<(std::ostream &stream, rgbf o);
 
+/* How a palette may be tabulated by BakedPalette. The colour must be a
+ * pure function of pt.iter (ITER_*) or of pt.iterf (ITERF_*). */
+struct BakeAxis {
+	enum Kind {
+		NONE,           // Don't bake. The default.
+		ITER_PERIODIC,  // Repeats every param iterations
+		ITER_RANGE,     // Tabulate iterations 0 to param-1; compute the rest
+		ITERF_PERIODIC, // A function of modff(iterf / param), computed in float
+		ITERF_LOG,      // A function of log(iterf), for iterf >= ITERF_LOW_CLAMP
+		ITERF_SQRT,     // Smooth in sqrt(iterf); tabulate up to iterf = param
+	} kind;
+	double param;
+	BakeAxis(Kind k = NONE, double p = 0) : kind(k), param(p) {}
+};
+
 class BasePalette {
 public:
-	BasePalette(std::string& _name): name(_name) {}
+	BasePalette(const std::string& _name): name(_name) {}
 	virtual ~BasePalette() {}
 
 	virtual rgb get(const Fractal::PointData &pt) const = 0;
 
+	/* Colours n consecutive points into out[0..n-1]. Points that haven't
+	 * escaped (iter == local_inf, or iterf < 0) come out black, as in
+	 * Render2::render_pixel. The default just calls get() for each. */
+	virtual void get_span(const Fractal::PointData *pts, unsigned n, int local_inf, rgb *out) const;
+
+	/* How get() may be tabulated. Palettes that are already cheap, or
+	 * whose output can't be tabulated, leave this alone. */
+	virtual BakeAxis bake_axis() const { return BakeAxis(); }
+
+	/* A version of this palette that is cheap to call, built on first use
+	 * and kept for our lifetime; or this palette itself, if it can't be
+	 * baked, or if exact colours are wanted. Thread-safe. See BakedPalette.h. */
+	const BasePalette& baked() const;
+
+	/* Whether baked() should only ever return the palette itself. Baked
+	 * colours are within 1 in each channel of get(); exact ones cost the
+	 * full sum for every pixel. Applies to all palettes, from the next
+	 * baked() call (renderers ask at construction and on fresh_palette()).
+	 * The ExactColours pref drives this. */
+	static void set_exact(bool exact) { _exact = exact; }
+	static bool exact() { return _exact; }
+
 	const std::string name;
+
+private:
+	static std::atomic<bool> _exact;
+	mutable std::once_flag _bake_once;
+	mutable std::unique_ptr<const BasePalette> _baked;
 };
 
 
@@ -0,0 +1,35 @@
+/*
+    CaptureRender.h: For unit testing
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CAPTURERENDER_H_
+#define CAPTURERENDER_H_
+
+#include <vector>
+#include "Render2.h"
+
+// Renders one pixel at a time, the old-fashioned way, into pix.
+class CaptureRender : public Render2::Base {
+public:
+	std::vector<rgb> pix;
+	CaptureRender(unsigned w, unsigned h, const BasePalette& pal, bool aa = false, bool upscale = false) :
+		Render2::Base(w, h, -1, aa, pal, upscale), pix(w*h) {}
+	virtual void pixel_done(unsigned X, unsigned Y, const rgb& p) { pix[Y*_width+X] = p; }
+	virtual void pixel_get(unsigned X, unsigned Y, rgb& p) { p = pix[Y*_width+X]; }
+};
+
+#endif /* CAPTURERENDER_H_ */
@@ -52,6 +52,8 @@ int MockPrefs::get(const BrotPrefs::Numeric<int>& B) const {
 		return 20;
 	if(B._name == "Initial maxiter")
 		return 1;
+	if(B._name == "Plot memory budget")
+		return 0;
 	THROW(PrefsException,"Unknown "+B._name);
 	return 0;
 }
@@ -0,0 +1,261 @@
+/*  PaletteTest: Unit tests for palettes and their baked versions
+    Copyright (C) 2016 Ross Younger
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <math.h>
+#include <limits.h>
+#include <algorithm>
+#include <vector>
+#include "gtest/gtest.h"
+#include "palette.h"
+#include "BakedPalette.h"
+#include "EqualisedPalette.h"
+#include "MockPalette.h"
+
+using namespace Fractal;
+
+static int channel_error(const rgb& a, const rgb& b) {
+	int e = abs(a.r - b.r);
+	e = std::max(e, abs(a.g - b.g));
+	e = std::max(e, abs(a.b - b.b));
+	return e;
+}
+
+static PointData point(int iter, float iterf) {
+	PointData rv;
+	rv.iter = iter;
+	rv.iterf = iterf;
+	rv.nomore = true;
+	return rv;
+}
+
+class BakedPaletteTest : public ::testing::TestWithParam<std::string> {
+protected:
+	const BasePalette *pal;
+	virtual void SetUp() {
+		DiscretePalette::register_base();
+		SmoothPalette::register_base();
+		pal = DiscretePalette::all.get(GetParam());
+		if (!pal)
+			pal = SmoothPalette::all.get(GetParam());
+		ASSERT_TRUE(pal != 0);
+	}
+};
+
+TEST_P(BakedPaletteTest, WithinOneLSB) {
+	const BasePalette& baked = pal->baked();
+	EXPECT_EQ(&baked, &pal->baked()); // only baked once
+	if (&baked == pal)
+		return; // not bakeable, nothing more to check
+
+	int worst = 0;
+	float worst_at = 0;
+	// Sweep iterf logarithmically, from below the clamp to beyond the tables
+	for (double f = 1e-5; f < 1e10; f *= 1.0013) {
+		int iter = f < INT_MAX ? (int)f : INT_MAX;
+		PointData pt = point(iter, f);
+		int e = channel_error(pal->get(pt), baked.get(pt));
+		if (e > worst) {
+			worst = e;
+			worst_at = f;
+		}
+	}
+	// And linearly, where the discrete palettes live
+	srand(42);
+	for (int i=0; i<100000; i++) {
+		int iter = i < 70000 ? i : rand();
+		float f = iter + rand() / (float)RAND_MAX;
+		PointData pt = point(iter, f);
+		int e = channel_error(pal->get(pt), baked.get(pt));
+		if (e > worst) {
+			worst = e;
+			worst_at = f;
+		}
+	}
+	EXPECT_GE(1, worst) << "at iterf " << worst_at;
+}
+
+INSTANTIATE_TEST_SUITE_P(AllPalettes, BakedPaletteTest,
+		::testing::Values("Kaleidoscopic", "Rainbow", "Pastel salad",
+			"Red-cyan sawtooth", "Optical Illusion", "Linear rainbow",
+			"Logarithmic rainbow", "Logarithmic rainbow (steep)",
+			"sin(log)", "sin(log) steep", "sin(log) shallow",
+			"cos(log)", "cos(log) steep", "cos(log) shallow",
+			"rjk.mandy", "rjk.mandy.blue",
+			"fanf.black.fade", "fanf.white.fade"));
+
+TEST(BakedPalette, UnbakeablePassesThrough) {
+	MockPalette mock;
+	EXPECT_EQ(&mock, &mock.baked());
+}
+
+TEST(BakedPalette, ExactSkipsTheTables) {
+	SmoothPalette::register_base();
+	const BasePalette *pal = SmoothPalette::all.get("Linear rainbow");
+	ASSERT_TRUE(pal != 0);
+	BasePalette::set_exact(true);
+	const BasePalette& exact = pal->baked();
+	BasePalette::set_exact(false);
+	EXPECT_EQ(pal, &exact);
+	EXPECT_TRUE(dynamic_cast<const BakedPalette*>(&pal->baked()) != 0);
+}
+
+TEST(BakedPalette, TablesAreBounded) {
+	SmoothPalette::register_base();
+	const BakedPalette *b = dynamic_cast<const BakedPalette*>(&SmoothPalette::all.get("cos(log)")->baked());
+	ASSERT_TRUE(b != 0);
+	EXPECT_GT(200000, b->table_size());
+}
+
+TEST_P(BakedPaletteTest, SpanMatchesGet) {
+	const int local_inf = -1;
+	std::vector<PointData> pts;
+	srand(7);
+	// (iter is kept small because Rainbow can't cope with large ones.)
+	for (double f = 1e-3; f < 1e9; f *= 1.07)
+		pts.push_back(point((int)fmod(f, 1000), f));
+	for (int i=0; i<1000; i++)
+		pts.push_back(point(rand() % 1000, rand() / (float)RAND_MAX * 100000));
+	pts.push_back(point(local_inf, local_inf)); // infinite
+	pts.push_back(point(5, -1.0)); // escaped early, also drawn black
+
+	const BasePalette* pals[] = { pal, &pal->baked() };
+	for (auto p : pals) {
+		std::vector<rgb> out(pts.size());
+		p->get_span(&pts[0], pts.size(), local_inf, &out[0]);
+		for (unsigned i=0; i<pts.size(); i++) {
+			rgb expected = (pts[i].iter == local_inf || pts[i].iterf < 0) ? rgb(0,0,0) : p->get(pts[i]);
+			ASSERT_EQ(expected, out[i]) << "at iterf " << pts[i].iterf;
+		}
+	}
+}
+
+TEST(IterHistogram, BinsAreOrdered) {
+	Plot3::IterHistogram h;
+	EXPECT_EQ(0u, h.bin(0));
+	EXPECT_GE(Fractal::PointData::ITERF_LOW_CLAMP, h.bin_floor(h.bin(Fractal::PointData::ITERF_LOW_CLAMP)));
+	EXPECT_EQ(h.bins()-1, h.bin(1e12));
+	unsigned prev = 0;
+	for (double f = Fractal::PointData::ITERF_LOW_CLAMP; f < 2e9; f *= 1.01) {
+		unsigned b = h.bin(f);
+		ASSERT_LE(prev, b) << "at " << f;
+		ASSERT_LE(h.bin_floor(b), (float)f);
+		ASSERT_GT(h.bin_floor(b+1), (float)f);
+		float frac = h.bin_fraction(f);
+		ASSERT_LE(0, frac);
+		ASSERT_GT(1, frac);
+		prev = b;
+	}
+}
+
+TEST(IterHistogram, Merges) {
+	Plot3::IterHistogram a, b;
+	for (int i=1; i<=100; i++)
+		a.add(i);
+	for (int i=1; i<=50; i++)
+		b.add(i * 1000);
+	a.merge(b);
+	EXPECT_EQ(150u, a.total());
+	uint64_t sum = 0;
+	for (unsigned i=0; i<a.bins(); i++)
+		sum += a.count(i);
+	EXPECT_EQ(150u, sum);
+	EXPECT_EQ(1u, a.count(a.bin(1)));
+	a.clear();
+	EXPECT_EQ(0u, a.total());
+	EXPECT_EQ(0u, a.count(a.bin(1)));
+}
+
+class RampPalette : public BasePalette {
+	// One ramp over iterf 0..256, repeating
+public:
+	RampPalette() : BasePalette("Ramp") {}
+	virtual rgb get(const Fractal::PointData &pt) const {
+		float tmp;
+		return rgb(256 * modff(pt.iterf / 256, &tmp), 0, 0);
+	}
+	virtual BakeAxis bake_axis() const { return BakeAxis(BakeAxis::ITERF_PERIODIC, 256); }
+};
+
+TEST(EqualisedPalette, SpreadsColoursEvenly) {
+	RampPalette ramp;
+	EqualisedPalette eq(ramp);
+	// Bunched up at the bottom, with a long tail
+	std::vector<PointData> pts;
+	srand(3);
+	for (int i=0; i<20000; i++) {
+		float f = 1 + 1000 * pow(rand() / (float)RAND_MAX, 2);
+		pts.push_back(point(f, f));
+	}
+	std::shared_ptr<Plot3::IterHistogram> h = std::make_shared<Plot3::IterHistogram>();
+	for (auto& p : pts)
+		h->add(p.iterf);
+
+	// Before it has a histogram, it's just the ramp (baked, as it's a span)
+	std::vector<rgb> out(pts.size());
+	eq.get_span(&pts[0], pts.size(), -1, &out[0]);
+	for (unsigned i=0; i<pts.size(); i++)
+		ASSERT_EQ(ramp.baked().get(pts[i]), out[i]);
+
+	eq.set_histogram(h);
+	EXPECT_EQ(h, eq.histogram());
+	eq.get_span(&pts[0], pts.size(), -1, &out[0]);
+	unsigned buckets[8] = {0};
+	for (unsigned i=0; i<pts.size(); i++) {
+		ASSERT_EQ(ramp.baked().get(eq.remap(pts[i])), out[i]);
+		buckets[out[i].r / 32]++;
+	}
+	for (int i=0; i<8; i++) {
+		EXPECT_LT(pts.size() / 8 * 0.9, buckets[i]) << "bucket " << i;
+		EXPECT_GT(pts.size() / 8 * 1.1, buckets[i]) << "bucket " << i;
+	}
+	// Rank order is kept
+	EXPECT_LT(eq.remap(point(2,2)).iterf, eq.remap(point(20,20)).iterf);
+
+	// Infinity is still black
+	PointData inf[2] = { point(-1, -1), point(7, 7) };
+	eq.get_span(inf, 2, 7, &out[0]);
+	EXPECT_EQ(black, out[0]);
+	EXPECT_EQ(black, out[1]);
+}
+
+TEST(EqualisedPalette, WorksWithAllPalettes) {
+	DiscretePalette::register_base();
+	SmoothPalette::register_base();
+	std::shared_ptr<Plot3::IterHistogram> h = std::make_shared<Plot3::IterHistogram>();
+	std::vector<PointData> pts;
+	for (float f = 1; f < 1e6; f *= 1.1) {
+		h->add(f);
+		pts.push_back(point(f, f));
+	}
+	std::vector<BasePalette*> pals;
+	for (auto name : DiscretePalette::all.names())
+		pals.push_back(DiscretePalette::all.get(name));
+	for (auto name : SmoothPalette::all.names())
+		pals.push_back(SmoothPalette::all.get(name));
+	for (auto pal : pals) {
+		EqualisedPalette eq(*pal);
+		eq.set_histogram(h);
+		std::vector<rgb> out(pts.size());
+		eq.get_span(&pts[0], pts.size(), -1, &out[0]);
+		for (unsigned i=0; i<pts.size(); i++) {
+			PointData mapped = eq.remap(pts[i]);
+			ASSERT_LE(0, mapped.iter) << pal->name;
+			ASSERT_LE(0, mapped.iterf) << pal->name;
+		}
+	}
+}
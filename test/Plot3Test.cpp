@@ -17,22 +17,45 @@
 
 #define _ISOC99_SOURCE
 #include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
 
 #include <list>
+#include <set>
+#include <algorithm>
+#include <vector>
 #include <functional>
 #include <thread>
 #include <chrono>
+#include <memory>
+#include <atomic>
+#include <locale>
+#include <sstream>
 
 #include "gtest/gtest.h"
 #include "libbrot2/Plot3Chunk.h"
+#include "libbrot2/ChunkStore.h"
+#include "libbrot2/Checkpoint.h"
 #include "libbrot2/ChunkDivider.h"
 #include "libbrot2/IPlot3DataSink.h"
 #include "libbrot2/Plot3Plot.h"
 #include "libbrot2/Plot3Pass.h"
 #include "libbrot2/ThreadPool.h"
+#include "libbrot2/CpuTopology.h"
+#include "libbrot2/AsyncDataSink.h"
+#include "libbrot2/ProgressiveRefiner.h"
+#include "libbrot2/RawIterFile.h"
+#include "libbrot2/TiledPlot.h"
+#include "libbrot2/TilePyramid.h"
+#include "libbrot2/Render2.h"
+#include "libbrot2/palette.h"
 #include "MockFractal.h"
 #include "MockPrefs.h"
+#include "CaptureRender.h"
 #include "Exception.h"
+#include <fstream>
+#include <png++/png.hpp>
 
 using namespace std;
 using namespace Plot3;
@@ -68,7 +91,7 @@ public:
 class NullSink : public IPlot3DataSink {
 public:
 	virtual void chunk_done(Plot3Chunk*) {}
-	virtual void pass_complete(string&, unsigned, unsigned, unsigned, unsigned) {}
+	virtual void pass_complete(string&, unsigned, unsigned, unsigned, unsigned, std::shared_ptr<const IterHistogram>) {}
 	virtual void plot_complete() {}
 };
 
@@ -181,7 +204,7 @@ public:
 		EXPECT_EQ(0,nfailed) << " double-touches in job " << std::hex << (void*)(job);
 	}
 
-	virtual void pass_complete(string&, unsigned, unsigned, unsigned, unsigned) {}
+	virtual void pass_complete(string&, unsigned, unsigned, unsigned, unsigned, std::shared_ptr<const IterHistogram>) {}
 	virtual void plot_complete() {}
 
 	virtual void final_check() {
@@ -306,6 +329,122 @@ TEST_F(ChunkTest,ParallelThreadsWork) {
 	}
 }
 
+TEST(ThreadPoolQoS, WeightedFairShare) {
+	ThreadPool tp(1);
+	std::mutex gate;
+	std::vector<QoS> order;
+	list<future<void> > results;
+
+	// Hold up the only worker while we fill the queues
+	gate.lock();
+	results.push_back(tp.enqueue<void>([&]{ std::unique_lock<std::mutex> l(gate); }));
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	for (int i=0; i<20; i++) {
+		results.push_back(tp.enqueue<void>([&]{ order.push_back(QoS::BATCH); }, QoS::BATCH));
+		results.push_back(tp.enqueue<void>([&]{ order.push_back(QoS::INTERACTIVE); }, QoS::INTERACTIVE));
+	}
+	gate.unlock();
+	for (auto& it : results)
+		it.get();
+
+	ASSERT_EQ(40, order.size());
+	// Interactive work mostly goes first, but batch work isn't starved.
+	unsigned interactive = std::count(order.begin(), order.begin()+10, QoS::INTERACTIVE);
+	EXPECT_LE(8, interactive);
+	EXPECT_GT(10, interactive);
+}
+
+// Two nodes, two cores per node, two SMT threads per core.
+// Siblings are numbered the way Linux usually does it (0 and 4 share a core).
+static std::vector<CpuTopology::Cpu> fake_topology() {
+	std::vector<CpuTopology::Cpu> rv;
+	for (int id=0; id<8; id++) {
+		CpuTopology::Cpu c;
+		c.id = id;
+		c.node = (id & 2) ? 1 : 0;
+		c.package = c.node;
+		c.core = id & 1;
+		rv.push_back(c);
+	}
+	return rv;
+}
+
+TEST(CpuTopologyTest, ParseCpulist) {
+	std::vector<int> expect = { 0, 1, 2, 3, 8, 10, 11 };
+	EXPECT_EQ(expect, CpuTopology::parse_cpulist("0-3,8,10-11"));
+	EXPECT_TRUE(CpuTopology::parse_cpulist("").empty());
+	EXPECT_TRUE(CpuTopology::parse_cpulist("bogus").empty());
+	EXPECT_EQ(4, CpuTopology::physical_cores(fake_topology()));
+	EXPECT_FALSE(CpuTopology::available().empty());
+}
+
+TEST(CpuTopologyTest, NoPlacementByDefault) {
+	CpuTopology::Plan p = CpuTopology::plan(fake_topology(), 5, false, false, false);
+	ASSERT_EQ(5, p.cpus.size());
+	ASSERT_EQ(5, p.partition.size());
+	for (auto& it : p.cpus)
+		EXPECT_TRUE(it.empty());
+}
+
+TEST(CpuTopologyTest, PinPrefersPhysicalCores) {
+	CpuTopology::Plan p = CpuTopology::plan(fake_topology(), 4, true, false, false);
+	std::set<int> used;
+	for (auto& it : p.cpus) {
+		ASSERT_EQ(1, it.size());
+		used.insert(it[0]);
+	}
+	// One thread on each core before any sibling gets used
+	EXPECT_EQ(std::set<int>({0,1,2,3}), used);
+
+	p = CpuTopology::plan(fake_topology(), 8, true, false, false);
+	used.clear();
+	for (auto& it : p.cpus)
+		used.insert(it[0]);
+	EXPECT_EQ(8, used.size());
+}
+
+TEST(CpuTopologyTest, PhysicalOnlyNeverUsesSiblings) {
+	CpuTopology::Plan p = CpuTopology::plan(fake_topology(), 8, true, false, true);
+	for (auto& it : p.cpus) {
+		ASSERT_EQ(1, it.size());
+		EXPECT_GT(4, it[0]);
+	}
+	p = CpuTopology::plan(fake_topology(), 2, false, false, true);
+	std::vector<int> expect = { 0, 1, 2, 3 };
+	for (auto& it : p.cpus)
+		EXPECT_EQ(expect, it);
+}
+
+TEST(CpuTopologyTest, NumaPartitions) {
+	CpuTopology::Plan p = CpuTopology::plan(fake_topology(), 4, false, true, false);
+	std::vector<int> node0 = { 0, 1, 4, 5 }, node1 = { 2, 3, 6, 7 };
+	for (unsigned i=0; i<4; i++) {
+		// Dealt out round-robin
+		EXPECT_EQ((int)i%2, p.partition[i]);
+		EXPECT_EQ(p.partition[i] ? node1 : node0, p.cpus[i]);
+	}
+}
+
+TEST(CpuTopologyTest, PoolReportsPartitions) {
+	std::vector< std::vector<int> > anywhere(2);
+	std::vector<int> parts = { 0, 1 };
+	ThreadPool tp(2, anywhere, parts);
+	EXPECT_EQ(-1, ThreadPool::current_partition());
+
+	std::mutex lock;
+	std::multiset<int> seen;
+	list<future<void> > results;
+	for (int i=0; i<20; i++)
+		results.push_back(tp.enqueue<void>([&]{
+			std::unique_lock<std::mutex> l(lock);
+			seen.insert(ThreadPool::current_partition());
+		}, QoS::INTERACTIVE, i%2));
+	for (auto& it : results)
+		it.get();
+	// Hints are only hints, but everything must run on a placed worker.
+	EXPECT_EQ(20, seen.size());
+	EXPECT_EQ(20, seen.count(0) + seen.count(1));
+}
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
@@ -391,6 +530,181 @@ TEST_F(Plot3PassTest, BasicConcurrencyCheck) {
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
+// Never escapes, and takes real time per iteration; for testing cancellation.
+class SpinningFractal : public Fractal::FractalImpl {
+public:
+	SpinningFractal() : Fractal::FractalImpl("", "", -1.0, 1.0, -1.0, 1.0, 42) {}
+	virtual void prepare_pixel(const Fractal::Point coords, Fractal::PointData& out) const {
+		out.origin = out.point = coords;
+		out.iter = 0;
+	}
+	virtual void plot_pixel(const int maxiter, Fractal::PointData& out, Fractal::Maths::MathsType) const {
+		volatile double spin = 0;
+		int iter;
+		for (iter=out.iter; iter<maxiter; iter++)
+			spin = spin + 1.0;
+		out.iter = iter;
+	}
+};
+
+TEST(CancelTest, ChunkStopsAndResumes) {
+	SpinningFractal fract;
+	NullSink sink;
+	CancelToken token;
+	Plot3Chunk chunk(&sink, fract, 2, 2, 0, 0, Fractal::Point(0.1,0.1), Fractal::Point(0.001,0.001), Fractal::Maths::MathsType::LongDouble);
+	chunk.set_cancel_token(&token);
+	chunk.reset_max_iters(INT_MAX/2); // Would take many seconds to complete
+
+	std::thread runner([&]{ chunk.run(); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	auto t0 = std::chrono::steady_clock::now();
+	token.cancel();
+	runner.join();
+	std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - t0;
+	EXPECT_LT(latency.count(), 500.0); // Generous, in case we're running under valgrind
+	EXPECT_TRUE(chunk.interrupted());
+
+	// Partial state is kept...
+	const Fractal::PointData& pt = chunk.get_pixel_point(0,0);
+	int iters_so_far = pt.iter;
+	EXPECT_GT(iters_so_far, 0);
+	EXPECT_LT(iters_so_far, INT_MAX/2);
+	EXPECT_FALSE(pt.nomore);
+
+	// ... and we resume from it.
+	token.reset();
+	chunk.reset_max_iters(iters_so_far + 10000);
+	chunk.run();
+	EXPECT_FALSE(chunk.interrupted());
+	for (int y=0; y<2; y++)
+		for (int x=0; x<2; x++)
+			EXPECT_EQ(iters_so_far + 10000, chunk.get_pixel_point(x,y).iter);
+}
+
+TEST(CancelTest, PlotStopsPromptly) {
+	SpinningFractal fract;
+	NullSink sink;
+	std::shared_ptr<ThreadPool> pool(new ThreadPool(2));
+	std::shared_ptr<Prefs> prefs(new MockPrefs());
+	ChunkDivider::Horizontal10px divider;
+	Plot3Plot p3(pool, &sink, fract, divider, Fractal::Point(0,0), Fractal::Point(1,1), 40, 40);
+	p3.set_prefs(prefs);
+	EXPECT_GT(0, p3.get_stop_latency());
+	p3.start();
+	// Maxiter grows by 50% per pass, so after a while the passes are slow.
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	p3.stop();
+	p3.wait();
+	EXPECT_LE(0, p3.get_stop_latency());
+	EXPECT_GT(500, p3.get_stop_latency()); // Ditto
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+class OrderRecordingSink : public IPlot3DataSink {
+public:
+	std::vector<Plot3Chunk*> order;
+	std::function<void(Plot3Chunk*)> hook; // Called after each chunk, if set
+
+	virtual void chunk_done(Plot3Chunk* job) {
+		order.push_back(job);
+		if (hook) hook(job);
+	}
+	virtual void pass_complete(string&, unsigned, unsigned, unsigned, unsigned, std::shared_ptr<const IterHistogram>) {}
+	virtual void plot_complete() {}
+};
+
+class ChunkOrderingTest : public ::testing::Test {
+protected:
+	MockFractal fract;
+	OrderRecordingSink sink;
+	std::shared_ptr<ThreadPool> pool; // Single-threaded, so the order is deterministic
+	std::list<Plot3Chunk*> chunks;
+
+	ChunkOrderingTest() : pool(new ThreadPool(1)) {
+		// 64x64 plot in 8x8 tiles
+		ChunkDivider::SuperpixelInstance<8> divider;
+		divider.dividePlot(chunks, &sink, fract, Fractal::Point(-0.4,-0.3), Fractal::Point(0.01,0.01),
+				64, 64, Fractal::Maths::MathsType::LongDouble);
+	}
+	virtual ~ChunkOrderingTest() {
+		for (auto it : chunks)
+			delete it;
+	}
+
+	void run(std::shared_ptr<const ChunkOrdering::Base> order) {
+		Plot3Pass pass(pool, chunks, order);
+		pass.run();
+		ASSERT_EQ(chunks.size(), sink.order.size());
+		std::set<Plot3Chunk*> seen(sink.order.begin(), sink.order.end());
+		EXPECT_EQ(chunks.size(), seen.size()); // i.e. every chunk exactly once
+	}
+};
+
+TEST_F(ChunkOrderingTest, Factory) {
+	for (int i=ChunkOrdering::Base::MIN; i<=ChunkOrdering::Base::MAX; i++) {
+		std::unique_ptr<ChunkOrdering::Base> o(ChunkOrdering::Base::create(i));
+		EXPECT_NE(nullptr, o.get());
+		EXPECT_NE("???", ChunkOrdering::Base::name(i));
+	}
+	EXPECT_EQ(nullptr, ChunkOrdering::Base::create(ChunkOrdering::Base::MAX+1));
+}
+
+TEST_F(ChunkOrderingTest, AsDivided) {
+	run(std::make_shared<ChunkOrdering::AsDivided>());
+	EXPECT_TRUE(std::equal(chunks.begin(), chunks.end(), sink.order.begin()));
+}
+
+TEST_F(ChunkOrderingTest, CentreFirst) {
+	run(std::make_shared<ChunkOrdering::CentreFirst>());
+	// One of the four middle tiles comes first...
+	EXPECT_TRUE(sink.order.front()->_offX == 24 || sink.order.front()->_offX == 32);
+	EXPECT_TRUE(sink.order.front()->_offY == 24 || sink.order.front()->_offY == 32);
+	// ... and one of the corners last.
+	EXPECT_TRUE(sink.order.back()->_offX == 0 || sink.order.back()->_offX == 56);
+	EXPECT_TRUE(sink.order.back()->_offY == 0 || sink.order.back()->_offY == 56);
+}
+
+TEST_F(ChunkOrderingTest, PointerFirst) {
+	auto order = std::make_shared<ChunkOrdering::PointerFirst>();
+	order->set_focus(0,0);
+	run(order);
+	EXPECT_EQ(0, sink.order.front()->_offX);
+	EXPECT_EQ(0, sink.order.front()->_offY);
+}
+
+TEST_F(ChunkOrderingTest, FocusMovesDuringPass) {
+	auto order = std::make_shared<ChunkOrdering::PointerFirst>();
+	order->set_focus(0,0);
+	sink.hook = [&](Plot3Chunk*) { order->set_focus(63,63); };
+	run(order);
+	EXPECT_EQ(0, sink.order[0]->_offX);
+	EXPECT_EQ(0, sink.order[0]->_offY);
+	EXPECT_EQ(56, sink.order[1]->_offX);
+	EXPECT_EQ(56, sink.order[1]->_offY);
+}
+
+TEST_F(ChunkOrderingTest, ZOrder) {
+	run(std::make_shared<ChunkOrdering::ZOrder>());
+	// Starts at the top left, then its right-hand neighbour
+	EXPECT_EQ(0, sink.order[0]->_offX);
+	EXPECT_EQ(56, sink.order[0]->_offY);
+	EXPECT_EQ(8, sink.order[1]->_offX);
+	EXPECT_EQ(56, sink.order[1]->_offY);
+}
+
+TEST_F(ChunkOrderingTest, Hilbert) {
+	run(std::make_shared<ChunkOrdering::Hilbert>());
+	// Every step of the curve is to a neighbouring tile
+	for (unsigned i=1; i<sink.order.size(); i++) {
+		int dx = (int)sink.order[i]->_offX - (int)sink.order[i-1]->_offX,
+			dy = (int)sink.order[i]->_offY - (int)sink.order[i-1]->_offY;
+		EXPECT_EQ(8, abs(dx)+abs(dy)) << "at step " << i;
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
 using namespace ChunkDivider;
 
 class PassTestingSink: public IPlot3DataSink {
@@ -404,7 +718,7 @@ public:
 	virtual void chunk_done(Plot3Chunk*) {
 		++chunks;
 	}
-	virtual void pass_complete(std::string&, unsigned, unsigned, unsigned, unsigned) {
+	virtual void pass_complete(std::string&, unsigned, unsigned, unsigned, unsigned, std::shared_ptr<const IterHistogram>) {
 		++passes;
 	}
 	virtual void plot_complete() {
@@ -493,6 +807,120 @@ TEST_F(Plot3Test, PassNotifies) {
 	notifies_test(100,15);
 }
 
+TEST_F(Plot3Test, FixedPasses) {
+	// However few pixels escape, we keep going...
+	NullSink sink;
+	fract.set_iters(1000);
+	p3 = new Plot3Plot(pool, &sink, fract, divider, CENTRE, SIZE, _W, _H);
+	setDummyPrefs();
+	p3->set_fixed_passes(6);
+	p3->start();
+	p3->wait();
+	EXPECT_EQ(6, p3->get_passes());
+	delete p3;
+	// ...unless they all have.
+	fract.set_iters(2);
+	p3 = new Plot3Plot(pool, &sink, fract, divider, CENTRE, SIZE, _W, _H);
+	setDummyPrefs();
+	p3->set_fixed_passes(6);
+	p3->start();
+	p3->wait();
+	EXPECT_EQ(2, p3->get_passes());
+}
+
+TEST_F(Plot3Test, AsyncSinkNotifies) {
+	PassTestingSink sink;
+	AsyncDataSink async(&sink);
+	fract.set_iters(8);
+	p3 = new Plot3Plot(pool, &async, fract, divider, CENTRE, SIZE, _W, _H, 9);
+	setDummyPrefs();
+	p3->start();
+	p3->wait();
+	// Passes and completions wait for delivery, so everything's arrived.
+	sink.expect_chunks(7);
+	sink.expect_passes(7);
+	sink.expect_completions(1);
+}
+
+class LingeringSink : public NullSink {
+public:
+	std::atomic<bool> entered, completed;
+	LingeringSink() : entered(false), completed(false) {}
+	virtual void plot_complete() {
+		entered = true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		completed = true;
+	}
+};
+
+TEST_F(Plot3Test, WaitCoversPlotComplete) {
+	LingeringSink sink;
+	fract.set_iters(2);
+	p3 = new Plot3Plot(pool, &sink, fract, divider, CENTRE, SIZE, _W, _H, 3);
+	setDummyPrefs();
+	p3->start();
+	// Arrive while the completion is being delivered, after the plot has stopped running.
+	while (!sink.entered)
+		std::this_thread::yield();
+	p3->wait();
+	EXPECT_TRUE(sink.completed);
+}
+
+class SlowSink : public IPlot3DataSink {
+public:
+	std::mutex gate; // chunk_done blocks while this is held
+	std::thread::id consumer;
+	unsigned chunks, batches, chunks_at_pass;
+	SlowSink() : chunks(0), batches(0), chunks_at_pass(0) {}
+	virtual void chunk_done(Plot3Chunk*) {
+		std::unique_lock<std::mutex> lock(gate);
+		consumer = std::this_thread::get_id();
+		++chunks;
+	}
+	virtual void batch_done() { ++batches; }
+	virtual void pass_complete(std::string&, unsigned, unsigned, unsigned, unsigned, std::shared_ptr<const IterHistogram>) {
+		chunks_at_pass = chunks;
+	}
+	virtual void plot_complete() {}
+};
+
+TEST(AsyncSinkTest, WorkersDontWaitForSink) {
+	SlowSink sink;
+	AsyncDataSink async(&sink);
+	std::string dummy;
+
+	sink.gate.lock();
+	std::vector<std::thread> workers;
+	for (int t=0; t<4; t++)
+		workers.push_back(std::thread([&]{
+			for (int i=0; i<100; i++)
+				async.chunk_done(0);
+		}));
+	for (auto& it : workers)
+		it.join(); // Would hang if chunk_done blocked on the sink
+	EXPECT_EQ(0, sink.chunks);
+	sink.gate.unlock();
+
+	async.pass_complete(dummy, 1, 1, 0, 1, 0);
+	EXPECT_EQ(400, sink.chunks_at_pass);
+	EXPECT_LE(1, sink.batches);
+	EXPECT_GE(400, sink.batches); // Coalesced, not one per chunk
+	EXPECT_NE(std::this_thread::get_id(), sink.consumer);
+}
+
+TEST(AsyncSinkTest, NoLostWakeups) {
+	// The consumer sleeps between every round; a lost wakeup hangs it.
+	SlowSink sink;
+	AsyncDataSink async(&sink);
+	std::string dummy;
+	for (unsigned round=1; round<=2000; round++) {
+		std::thread worker([&]{ async.chunk_done(0); });
+		worker.join();
+		async.pass_complete(dummy, round, 1, 0, 1, 0);
+		ASSERT_EQ(round, sink.chunks_at_pass);
+	}
+}
+
 TEST_F(Plot3Test, PixelToSet) {
 	// Known answer tests. We check the corner points, and overruns clip.
 	TestSink sink(_W,_H); // This tests the points are touched
@@ -588,3 +1016,924 @@ CHUNK_DIVIDER_TEST(1,1)
 // one that trips up the 10px horizontal divider:
 CHUNK_DIVIDER_TEST(1,50)
 CHUNK_DIVIDER_TEST(50,1)
+
+TEST(ThreadPoolQoS, ConcurrentPlots) {
+	// A long-running batch plot doesn't hold up an interactive one.
+	SpinningFractal spinner;
+	MockFractal fract;
+	NullSink sink1;
+	PassTestingSink sink2;
+	std::shared_ptr<ThreadPool> pool(new ThreadPool(2));
+	std::shared_ptr<Prefs> prefs(new MockPrefs());
+	ChunkDivider::Horizontal10px divider;
+
+	Plot3Plot batch(pool, &sink1, spinner, divider, Fractal::Point(0,0), Fractal::Point(1,1), 40, 40);
+	batch.set_prefs(prefs);
+	batch.set_qos(QoS::BATCH);
+	batch.start();
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+	Plot3Plot interactive(pool, &sink2, fract, divider, Fractal::Point(0,0), Fractal::Point(1,1), 40, 40, 1);
+	interactive.set_prefs(prefs);
+	interactive.start();
+	interactive.wait();
+	sink2.expect_completions(1);
+	EXPECT_TRUE(batch.is_running());
+
+	batch.stop();
+	batch.wait();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+TEST(SupersampleTest, ChunkSamples) {
+	MockFractal fract(3);
+	NullSink sink;
+	Plot3Chunk chunk(&sink, fract, 4, 3, 0, 0, Fractal::Point(0.1,0.1), Fractal::Point(0.001,0.001), Fractal::Maths::MathsType::LongDouble);
+	chunk.reset_max_iters(10);
+	chunk.run();
+	EXPECT_EQ(0, chunk.ss_factor());
+
+	std::vector<unsigned> pixels = { 1, 5, 11 };
+	chunk.supersample(pixels, 3, 10);
+	EXPECT_EQ(3, chunk.ss_factor());
+	EXPECT_EQ(pixels, chunk.ss_pixels());
+	for (unsigned n=0; n<pixels.size(); n++) {
+		const Plot3Chunk::Sample* s = chunk.ss_samples(n);
+		for (unsigned k=0; k<9; k++) {
+			EXPECT_EQ(3, s[k].iter);
+			EXPECT_LE(Fractal::PointData::ITERF_LOW_CLAMP, s[k].iterf);
+		}
+	}
+
+	chunk.clear_supersamples();
+	EXPECT_EQ(0, chunk.ss_factor());
+	EXPECT_TRUE(chunk.ss_pixels().empty());
+
+	std::vector<unsigned> unsorted = { 5, 1 };
+	EXPECT_THROW(chunk.supersample(unsorted, 3, 10), BrotAssert);
+}
+
+class CountingSink : public IPlot3DataSink {
+public:
+	std::atomic<unsigned> chunks, passes;
+	std::shared_ptr<const IterHistogram> histogram; // the last one
+	CountingSink() : chunks(0), passes(0) {}
+	virtual void chunk_done(Plot3Chunk*) { ++chunks; }
+	virtual void pass_complete(string&, unsigned, unsigned, unsigned, unsigned, std::shared_ptr<const IterHistogram> h) {
+		++passes;
+		histogram = h;
+	}
+	virtual void plot_complete() {}
+};
+
+class MandelbrotPlotTest : public ::testing::Test {
+	// A small, real plot, for the features that work on one
+protected:
+	static const unsigned W = 48, H = 40;
+	Fractal::FractalImpl *fract;
+	CountingSink sink;
+	std::shared_ptr<ThreadPool> pool;
+	std::shared_ptr<Prefs> prefs;
+	ChunkDivider::Horizontal10px divider;
+
+	MandelbrotPlotTest() : fract(0), pool(new ThreadPool(3)), prefs(new MockPrefs()) {}
+	virtual void SetUp() {
+		Fractal::FractalCommon::load_base();
+		fract = Fractal::FractalCommon::registry.get("Mandelbrot");
+		ASSERT_TRUE(fract != 0);
+	}
+};
+
+class SupersamplePlotTest : public MandelbrotPlotTest {};
+
+TEST_F(SupersamplePlotTest, OffByDefault) {
+	Plot3Plot p3(pool, &sink, *fract, divider, Fractal::Point(-0.5,0), Fractal::Point(3,2.5), W, H);
+	p3.set_prefs(prefs);
+	p3.start();
+	p3.wait();
+	EXPECT_EQ(0, p3.supersampled_pixels());
+	EXPECT_EQ(p3.get_passes(), sink.passes);
+	for (auto c : p3.get_chunks__only_after_completion())
+		EXPECT_EQ(0, c->ss_factor());
+}
+
+TEST_F(SupersamplePlotTest, RefinesEdgesOnly) {
+	Plot3Plot p3(pool, &sink, *fract, divider, Fractal::Point(-0.5,0), Fractal::Point(3,2.5), W, H);
+	p3.set_prefs(prefs);
+	p3.set_supersample(4, 0.3);
+	p3.start();
+	p3.wait();
+	EXPECT_EQ(p3.get_passes() + 1, sink.passes); // the refinement pass
+
+	// Rebuild the whole picture, so we can check neighbours
+	std::vector<const Fractal::PointData*> grid(W*H);
+	std::set<unsigned> sampled;
+	for (auto c : p3.get_chunks__only_after_completion()) {
+		for (unsigned j=0; j<c->_height; j++)
+			for (unsigned i=0; i<c->_width; i++)
+				grid[(c->_offY+j)*W + c->_offX+i] = &c->get_pixel_point(i,j);
+		for (auto px : c->ss_pixels()) {
+			EXPECT_EQ(4, c->ss_factor());
+			sampled.insert((c->_offY + px / c->_width) * W + c->_offX + px % c->_width);
+		}
+	}
+	EXPECT_EQ(p3.supersampled_pixels(), sampled.size());
+	EXPECT_LT(0, sampled.size());
+	EXPECT_GT(W*H/2, sampled.size()); // adaptive, not everywhere
+
+	// Pixels deep inside the set, or in flat areas, are left alone
+	for (unsigned y=1; y<H-1; y++) {
+		for (unsigned x=1; x<W-1; x++) {
+			const Fractal::PointData *me = grid[y*W+x];
+			bool all_inf = me->iterf < 0;
+			for (int d : { -1, 1, -(int)W, (int)W })
+				all_inf = all_inf && grid[y*W+x+d]->iterf < 0;
+			if (all_inf) {
+				EXPECT_EQ(0, sampled.count(y*W+x)) << "at " << x << "," << y;
+			}
+		}
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+class PlotHistogramTest : public MandelbrotPlotTest {};
+
+TEST_F(PlotHistogramTest, CountsEscapees) {
+	Plot3Plot p3(pool, &sink, *fract, divider, Fractal::Point(-0.5,0), Fractal::Point(3,2.5), W, H);
+	p3.set_prefs(prefs);
+	EXPECT_FALSE(p3.histogram());
+	p3.start();
+	p3.wait();
+	std::shared_ptr<const IterHistogram> h = p3.histogram();
+	ASSERT_TRUE(h != 0);
+	EXPECT_EQ(h, sink.histogram);
+
+	IterHistogram expected;
+	for (auto c : p3.get_chunks__only_after_completion()) {
+		const Fractal::PointData *data = c->get_data();
+		for (unsigned i=0; i<c->pixel_count(); i++)
+			if (data[i].iterf >= 0)
+				expected.add(data[i].iterf);
+	}
+	EXPECT_LT(0u, expected.total());
+	EXPECT_GT((uint64_t)W*H, expected.total()); // some are inside the set
+	EXPECT_EQ(expected.total(), h->total());
+	for (unsigned i=0; i<h->bins(); i++)
+		ASSERT_EQ(expected.count(i), h->count(i)) << "bin " << i;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/* Numbers with a decimal comma, as in much of Europe: the global C++
+ * locale for as long as one of these lives. */
+class DecimalCommaLocale {
+	struct Comma : public std::numpunct<char> {
+		virtual char do_decimal_point() const { return ','; }
+	};
+	std::locale _prev;
+public:
+	DecimalCommaLocale() : _prev(std::locale::global(std::locale(std::locale::classic(), new Comma))) {
+		std::ostringstream os;
+		os << 0.5;
+		EXPECT_EQ("0,5", os.str()); // or we aren't testing anything
+	}
+	~DecimalCommaLocale() { std::locale::global(_prev); }
+};
+
+class RawIterFileTest : public MandelbrotPlotTest {};
+
+TEST_F(RawIterFileTest, RoundTrips) {
+	ChunkDivider::SuperpixelInstance<16> tiles; // several chunks to a row
+	Plot3Plot p3(pool, &sink, *fract, tiles, Fractal::Point(-0.5,0.1), Fractal::Point(3,2.5), W, H);
+	p3.set_prefs(prefs);
+	p3.start();
+	p3.wait();
+
+	char name[] = "/tmp/b2rawXXXXXX";
+	int fd = mkstemp(name);
+	ASSERT_NE(-1, fd);
+	close(fd);
+	RawIterFile::write(p3, name);
+	{
+		RawIterFile raw(name);
+		EXPECT_EQ((unsigned)W, raw.width());
+		EXPECT_EQ((unsigned)H, raw.height());
+		EXPECT_EQ(p3.get_maxiter(), (int)raw.maxiter());
+		EXPECT_EQ(fract->name, raw.fractal());
+		EXPECT_EQ(p3.centre, raw.centre());
+		EXPECT_EQ(p3.size, raw.size());
+		EXPECT_EQ(0u, ((uintptr_t)raw.iterf_row(0)) % RawIterFile::PAGE);
+		EXPECT_EQ(0u, ((uintptr_t)raw.iter_row(0)) % RawIterFile::PAGE);
+
+		std::vector<Fractal::PointData> row(W);
+		unsigned still_live = 0;
+		for (auto c : p3.get_chunks__only_after_completion()) {
+			for (unsigned j=0; j<c->_height; j++) {
+				const unsigned y = H - 1 - (c->_offY + j); // the file is top row first
+				raw.get_points(c->_offY + j, &row[0]);
+				for (unsigned i=0; i<c->_width; i++) {
+					const Fractal::PointData& pt = c->get_pixel_point(i,j);
+					ASSERT_EQ(pt.iterf, raw.iterf_row(y)[c->_offX + i]);
+					if (pt.iterf < 0) {
+						// Didn't escape, so -1, however far it got
+						ASSERT_EQ(-1, raw.iter_row(y)[c->_offX + i]);
+						if (!pt.nomore)
+							++still_live;
+					} else
+						ASSERT_EQ(pt.iter, raw.iter_row(y)[c->_offX + i]);
+					ASSERT_EQ(pt.iterf, row[c->_offX + i].iterf);
+				}
+			}
+		}
+		EXPECT_LT(0u, still_live);
+	}
+	unlink(name);
+	EXPECT_THROW(RawIterFile bad("/dev/null"), BrotException);
+}
+
+TEST_F(RawIterFileTest, IgnoresLocale) {
+	Plot3Plot p3(pool, &sink, *fract, divider, Fractal::Point(-0.5,0.1), Fractal::Point(3,2.5), W, H, 1);
+	p3.set_prefs(prefs);
+	p3.start();
+	p3.wait();
+
+	char name[] = "/tmp/b2rawXXXXXX";
+	int fd = mkstemp(name);
+	ASSERT_NE(-1, fd);
+	close(fd);
+	{
+		DecimalCommaLocale comma;
+		RawIterFile::write(p3, name);
+	}
+	{
+		RawIterFile raw(name);
+		EXPECT_EQ(p3.centre, raw.centre());
+		EXPECT_EQ(p3.size, raw.size());
+	}
+	RawIterFile::write(p3, name);
+	{
+		DecimalCommaLocale comma;
+		RawIterFile raw(name);
+		EXPECT_EQ(p3.centre, raw.centre());
+		EXPECT_EQ(p3.size, raw.size());
+	}
+	unlink(name);
+}
+
+TEST_F(RawIterFileTest, RendersLikeChunks) {
+	SmoothPalette::register_base();
+	const BasePalette *pal = SmoothPalette::all.get("Logarithmic rainbow");
+	ASSERT_TRUE(pal != 0);
+	Plot3Plot p3(pool, &sink, *fract, divider, Fractal::Point(-0.5,0.1), Fractal::Point(3,2.5), W, H);
+	p3.set_prefs(prefs);
+	p3.start();
+	p3.wait();
+
+	char name[] = "/tmp/b2rawXXXXXX";
+	int fd = mkstemp(name);
+	ASSERT_NE(-1, fd);
+	close(fd);
+	RawIterFile::write(p3, name);
+	{
+		RawIterFile raw(name);
+		for (bool aa : { false, true }) {
+			const unsigned w = aa ? W/2 : W, h = aa ? H/2 : H;
+			CaptureRender expected(w, h, *pal, aa), got(w, h, *pal, aa);
+			expected.process(p3.get_chunks__only_after_completion());
+			got.process(raw, *pool);
+			for (unsigned i=0; i<w*h; i++)
+				ASSERT_EQ(expected.pix[i], got.pix[i]) << "pixel " << i << (aa ? " antialiased" : "");
+		}
+	}
+	unlink(name);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+class RetireTest : public MandelbrotPlotTest {};
+
+TEST_F(RetireTest, HandsOverFinalChunks) {
+	SmoothPalette::register_base();
+	const BasePalette *pal = SmoothPalette::all.get("Logarithmic rainbow");
+	ASSERT_TRUE(pal != 0);
+	ChunkDivider::SuperpixelInstance<16> tiles; // so some finish early
+	const Fractal::Point centre(-0.5,0.1), size(3,2.5);
+
+	Plot3Plot ref(pool, &sink, *fract, tiles, centre, size, W, H);
+	ref.set_prefs(prefs);
+	ref.start();
+	ref.wait();
+	CaptureRender expected(W, H, *pal, false);
+	expected.process(ref.get_chunks__only_after_completion());
+
+	CountingSink sink2;
+	Plot3Plot p3(pool, &sink2, *fract, tiles, centre, size, W, H);
+	p3.set_prefs(prefs);
+	p3.set_supersample(4, 0.3); // which retiring turns off
+	CaptureRender got(W, H, *pal, false);
+	std::set<Plot3Chunk*> seen;
+	unsigned calls = 0, early = 0;
+	p3.set_retire([&] (const std::list<Plot3Chunk*>& chunks) {
+		++calls;
+		for (auto c : chunks) {
+			ASSERT_TRUE(seen.insert(c).second) << "retired twice";
+			ASSERT_FALSE(c->released());
+			ASSERT_TRUE(c->get_data() != 0);
+			if (!c->livecount())
+				++early;
+			got.process(*c);
+		}
+	});
+	p3.start();
+	p3.wait();
+	EXPECT_EQ(ref.get_maxiter(), p3.get_maxiter());
+	EXPECT_EQ(0, p3.supersampled_pixels());
+	EXPECT_LT(1u, calls);
+	EXPECT_LT(0u, early);
+	EXPECT_EQ(p3.chunks_total(), seen.size());
+	for (auto c : p3.get_chunks__only_after_completion()) {
+		EXPECT_TRUE(c->released());
+		EXPECT_TRUE(c->get_data() == 0);
+	}
+	for (unsigned i=0; i<W*H; i++)
+		ASSERT_EQ(expected.pix[i], got.pix[i]) << "pixel " << i;
+	// What the plot knows about itself survives the chunks
+	ASSERT_TRUE(p3.histogram() != 0);
+	EXPECT_EQ(ref.histogram()->total(), p3.histogram()->total());
+}
+
+class LatticeFractal : public Fractal::FractalImpl {
+	/* Plotted on the unit lattice, each pixel escapes after its own number
+	 * of iterations, or never; and the co-ordinates are exact, however
+	 * the plot is cut up. */
+public:
+	LatticeFractal() : Fractal::FractalImpl("Lattice", "", 0, 1000, 0, 1000, 99) {}
+	virtual void prepare_pixel(const Fractal::Point coords, Fractal::PointData& out) const {
+		out.origin = out.point = coords;
+	}
+	virtual void plot_pixel(const int maxiter, Fractal::PointData& out, Fractal::Maths::MathsType) const {
+		const long n = (lroundl(real(out.origin)) * 7 + lroundl(imag(out.origin)) * 13) % 97;
+		if (n % 5 == 0 || n > maxiter) {
+			out.iter = maxiter;
+		} else {
+			out.iter = n;
+			out.nomore = true;
+		}
+	}
+};
+
+class IterPalette : public BasePalette {
+public:
+	IterPalette() : BasePalette("Iter") {}
+	virtual rgb get(const Fractal::PointData &pt) const {
+		return rgb(pt.iter * 2, 255 - pt.iter, pt.iter * 37);
+	}
+};
+
+class StreamPeak {
+	// Streams a plot to a PNG as its chunks retire, noting the most rows it held at once.
+public:
+	unsigned rows;
+	StreamPeak(std::shared_ptr<ThreadPool> pool, std::shared_ptr<Prefs> prefs, const Fractal::FractalImpl& fract,
+			ChunkDivider::Base& divider, Fractal::Point centre, Fractal::Point size, unsigned W, unsigned H) : rows(0) {
+		NullSink sink;
+		IterPalette palette;
+		std::ostringstream os;
+		Render2::PNGStream png(os, W, H, palette, -1);
+		Plot3Plot p3(pool, &sink, fract, divider, centre, size, W, H);
+		p3.set_prefs(prefs);
+		p3.set_retire([&] (const std::list<Plot3Chunk*>& done) {
+			for (auto c : done)
+				png.process(*c);
+			rows = std::max(rows, png.rows_pending());
+			png.flush();
+		});
+		p3.start();
+		p3.wait();
+		png.finish();
+	}
+};
+
+TEST_F(RetireTest, StreamingPeakRows) {
+	// Rows go out only once nothing above them can change, so what we hold
+	// depends on where the set is, not on the height of a band.
+	ChunkDivider::Horizontal10px bands;
+	// With the set only at the bottom, the bands above it go early...
+	StreamPeak low(pool, prefs, *fract, bands, Fractal::Point(-0.5,2.0), Fractal::Point(3,2.5), W, H);
+	EXPECT_GT((unsigned)H, low.rows);
+	// ...but with it at the top, we hold the whole image until the end.
+	StreamPeak high(pool, prefs, *fract, bands, Fractal::Point(-0.5,-2.0), Fractal::Point(3,2.5), W, H);
+	EXPECT_EQ((unsigned)H, high.rows);
+}
+
+class TiledPlotTest : public ::testing::TestWithParam<std::tuple<bool, unsigned>> {
+protected:
+	static const unsigned W = 50, H = 38, TILE = 16; // the tiles don't fit exactly
+	LatticeFractal fract;
+	IterPalette palette;
+	std::shared_ptr<ThreadPool> pool;
+	std::shared_ptr<Prefs> prefs;
+	TiledPlotTest() : pool(new ThreadPool(3)), prefs(new MockPrefs()) {}
+};
+
+TEST_P(TiledPlotTest, MatchesWholePlot) {
+	const bool aa = std::get<0>(GetParam());
+	const unsigned step = aa ? 2 : 1, plotW = W*step, plotH = H*step;
+	const Fractal::Point centre(plotW/2.0, plotH/2.0), size(plotW, plotH);
+
+	TiledPlot tiled(pool, fract, centre, size, plotW, plotH, TILE*step);
+	tiled.set_prefs(prefs);
+	if (std::get<1>(GetParam()))
+		tiled.set_window(std::get<1>(GetParam()));
+	unsigned progress = 0;
+	tiled.set_progress([&] (unsigned done, unsigned total) {
+		EXPECT_EQ(++progress, done);
+		EXPECT_EQ(tiled.tiles_total(), total);
+	});
+	std::ostringstream os;
+	Render2::PNGStream png(os, W, H, palette, -1, aa);
+	tiled.run(png, palette, aa);
+	png.finish();
+	EXPECT_EQ(12u, tiled.tiles_total()); // 4 x 3
+	EXPECT_EQ(12u, progress);
+	EXPECT_LT(1u, tiled.passes());
+	EXPECT_EQ(tiled.passes(), tiled.view().get_passes());
+
+	// The same schedule, all at once
+	NullSink sink;
+	ChunkDivider::Horizontal10px divider;
+	Plot3Plot whole(pool, &sink, fract, divider, centre, size, plotW, plotH);
+	whole.set_prefs(prefs);
+	whole.set_fixed_passes(tiled.passes());
+	whole.start();
+	whole.wait();
+	EXPECT_EQ(tiled.maxiter(), (unsigned)whole.get_maxiter());
+	CaptureRender expected(W, H, palette, aa);
+	expected.process(whole.get_chunks__only_after_completion());
+	std::vector<unsigned char> packed;
+	for (auto& p : expected.pix) {
+		packed.push_back(p.r);
+		packed.push_back(p.g);
+		packed.push_back(p.b);
+	}
+	std::ostringstream ref;
+	Render2::PNGWriter writer(ref, W, H);
+	writer.write_rows(&packed[0], H, 3*W);
+	writer.finish();
+	EXPECT_TRUE(ref.str() == os.str());
+}
+
+INSTANTIATE_TEST_SUITE_P(AntialiasAndWindow, TiledPlotTest,
+		::testing::Combine(::testing::Bool(), ::testing::Values(0u, 1u)));
+
+class TilePyramidTest : public TiledPlotTest {
+protected:
+	char dir[32];
+	std::string name;
+	std::unique_ptr<TilePyramid> pyramid;
+
+	virtual void SetUp() {
+		strcpy(dir, "/tmp/b2pyrXXXXXX");
+		ASSERT_TRUE(mkdtemp(dir) != 0);
+		name = std::string(dir) + "/view";
+	}
+	virtual void TearDown() {
+		for (unsigned l=0; pyramid && l<pyramid->levels(); l++) {
+			for (unsigned r=0; r<pyramid->level_rows(l); r++)
+				for (unsigned c=0; c<pyramid->level_cols(l); c++)
+					unlink(pyramid->tile_path(l, c, r).c_str());
+			std::ostringstream os;
+			os << name << "_files/" << l;
+			rmdir(os.str().c_str());
+		}
+		rmdir((name + "_files").c_str());
+		unlink((name + ".dzi").c_str());
+		rmdir(dir);
+	}
+	/* Plots the lot, returning what the plot was */
+	TiledPlot* make(unsigned& written) {
+		const Fractal::Point centre(W/2.0, H/2.0), size(W, H);
+		TiledPlot *tiled = new TiledPlot(pool, fract, centre, size, W, H, TILE);
+		tiled->set_prefs(prefs);
+		pyramid.reset(new TilePyramid(*tiled, name, palette, false));
+		pyramid->run();
+		written = pyramid->tiles_written();
+		return tiled;
+	}
+	std::string slurp(const std::string& path) {
+		std::ifstream fs(path, std::fstream::in | std::fstream::binary);
+		std::ostringstream os;
+		os << fs.rdbuf();
+		return os.str();
+	}
+	/* A whole level, as rgb */
+	std::vector<rgb> level(unsigned l) {
+		const unsigned w = pyramid->level_width(l);
+		std::vector<rgb> rv(w * pyramid->level_height(l));
+		for (unsigned r=0; r<pyramid->level_rows(l); r++)
+			for (unsigned c=0; c<pyramid->level_cols(l); c++) {
+				std::ifstream fs(pyramid->tile_path(l, c, r), std::fstream::in | std::fstream::binary);
+				png::image<png::rgb_pixel> img(fs);
+				for (unsigned y=0; y<img.get_height(); y++)
+					for (unsigned x=0; x<img.get_width(); x++) {
+						const png::rgb_pixel& p = img[y][x];
+						rv[(r*TILE + y) * w + c*TILE + x] = rgb(p.red, p.green, p.blue);
+					}
+			}
+		return rv;
+	}
+};
+
+TEST_F(TilePyramidTest, Builds) {
+	unsigned written;
+	std::unique_ptr<TiledPlot> tiled(make(written));
+	EXPECT_EQ(7u, pyramid->levels()); // 50 wide, up to 64
+	EXPECT_EQ(1u, pyramid->level_width(0));
+	EXPECT_EQ(1u, pyramid->level_height(0));
+	EXPECT_EQ(13u, pyramid->level_width(4));
+	EXPECT_EQ(10u, pyramid->level_height(4));
+	unsigned tiles = 0;
+	for (unsigned l=0; l<pyramid->levels(); l++)
+		tiles += pyramid->level_cols(l) * pyramid->level_rows(l);
+	EXPECT_EQ(tiles, written);
+	EXPECT_EQ(0u, pyramid->tiles_skipped());
+	EXPECT_NE(std::string::npos, slurp(name + ".dzi").find("<Size Width=\"50\" Height=\"38\"/>"));
+
+	// The last level is the plot...
+	NullSink sink;
+	ChunkDivider::Horizontal10px divider;
+	Plot3Plot whole(pool, &sink, fract, divider, Fractal::Point(W/2.0, H/2.0), Fractal::Point(W, H), W, H);
+	whole.set_prefs(prefs);
+	whole.set_fixed_passes(tiled->passes());
+	whole.start();
+	whole.wait();
+	CaptureRender expected(W, H, palette, false);
+	expected.process(whole.get_chunks__only_after_completion());
+	std::vector<rgb> below = level(6);
+	ASSERT_TRUE(expected.pix == below);
+	// ...and each above it is half the one below.
+	for (unsigned l=6; l-- > 0; ) {
+		const unsigned bw = pyramid->level_width(l+1), bh = pyramid->level_height(l+1),
+				w = pyramid->level_width(l);
+		std::vector<rgb> got = level(l);
+		for (unsigned y=0; y<pyramid->level_height(l); y++)
+			for (unsigned x=0; x<w; x++) {
+				unsigned R=0, G=0, B=0, n=0;
+				for (unsigned j=2*y; j<std::min(2*y+2, bh); j++)
+					for (unsigned i=2*x; i<std::min(2*x+2, bw); i++, n++) {
+						R += below[j*bw+i].r;
+						G += below[j*bw+i].g;
+						B += below[j*bw+i].b;
+					}
+				ASSERT_EQ(rgb(R/n, G/n, B/n), got[y*w+x]) << "level " << l << " at " << x << "," << y;
+			}
+		below = got;
+	}
+}
+
+TEST_F(TilePyramidTest, Resumes) {
+	unsigned written;
+	std::unique_ptr<TiledPlot> tiled(make(written));
+	const std::string bottom = pyramid->tile_path(6, 3, 2), above = pyramid->tile_path(5, 1, 1),
+			bottom_was = slurp(bottom), above_was = slurp(above);
+	unlink(bottom.c_str());
+	unlink(above.c_str());
+
+	tiled.reset(make(written));
+	EXPECT_EQ(2u, written);
+	EXPECT_EQ(bottom_was, slurp(bottom));
+	EXPECT_EQ(above_was, slurp(above));
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+class BudgetPrefs : public MockPrefs {
+public:
+	using MockPrefs::get;
+	virtual int get(const BrotPrefs::Numeric<int>& B) const {
+		if (B._name == PREF(PlotMemoryBudget)._name)
+			return 1; // MiB
+		return MockPrefs::get(B);
+	}
+};
+
+TEST(ChunkStoreTest, PlotsLikeTheHeap) {
+	LatticeFractal fract;
+	NullSink sink;
+	ChunkDivider::Horizontal10px divider;
+	std::shared_ptr<ThreadPool> pool(new ThreadPool(2));
+	std::shared_ptr<Prefs> heap_prefs(new MockPrefs()), file_prefs(new BudgetPrefs());
+	// Some 2MiB of pixels, so over budget
+	const unsigned W = 200, H = 100;
+	const Fractal::Point centre(W/2, H/2), size(W, H);
+
+	Plot3Plot heap(pool, &sink, fract, divider, centre, size, W, H);
+	heap.set_prefs(heap_prefs);
+	heap.start();
+	heap.wait();
+	EXPECT_EQ(0u, heap.scratch_size());
+
+	Plot3Plot file(pool, &sink, fract, divider, centre, size, W, H);
+	file.set_prefs(file_prefs);
+	file.start();
+	file.wait();
+	EXPECT_LE(W * H * sizeof(Fractal::PointData), file.scratch_size());
+
+	EXPECT_EQ(heap.get_passes(), file.get_passes());
+	const std::list<Plot3Chunk*>& hc = heap.get_chunks__only_after_completion(),
+			&fc = file.get_chunks__only_after_completion();
+	ASSERT_EQ(hc.size(), fc.size());
+	for (auto h = hc.begin(), f = fc.begin(); h != hc.end(); ++h, ++f)
+		for (unsigned y=0; y<(*h)->_height; y++)
+			for (unsigned x=0; x<(*h)->_width; x++) {
+				ASSERT_EQ((*h)->get_pixel_point(x,y).iter, (*f)->get_pixel_point(x,y).iter);
+				ASSERT_EQ((*h)->get_pixel_point(x,y).iterf, (*f)->get_pixel_point(x,y).iterf);
+			}
+}
+
+TEST(ChunkStoreTest, KeepsWhatIsPagedOut) {
+	MockFractal fract;
+	fract.set_iters(5); // everything escapes
+	Plot3Chunk chunk(0, fract, 64, 64, 0, 0, Fractal::Point(0,0), Fractal::Point(1,1), Fractal::Maths::MathsType::LongDouble);
+	std::list<Plot3Chunk*> chunks = { &chunk };
+	ChunkStore store(chunks, ChunkStore::default_dir());
+	chunk.reset_max_iters(10);
+	chunk.run();
+	ASSERT_EQ(0u, chunk.livecount());
+	std::vector<Fractal::PointData> was(chunk.get_data(), chunk.get_data() + chunk.pixel_count());
+
+	chunk.page_out();
+	chunk.run(); // has nothing to do, so leaves the pages alone
+	for (unsigned i=0; i<chunk.pixel_count(); i++) {
+		ASSERT_EQ(was[i].iter, chunk.get_data()[i].iter);
+		ASSERT_EQ(was[i].origin, chunk.get_data()[i].origin);
+	}
+	chunk.release();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+class CheckpointTest : public ::testing::Test {
+protected:
+	static const unsigned W = 60, H = 40;
+	LatticeFractal fract;
+	NullSink sink;
+	ChunkDivider::Horizontal10px divider;
+	std::shared_ptr<ThreadPool> pool;
+	std::shared_ptr<Prefs> prefs;
+	const Fractal::Point centre, size;
+	char dir[32];
+	std::string file;
+
+	CheckpointTest() : pool(new ThreadPool(2)), prefs(new MockPrefs()), centre(W/2, H/2), size(W, H) {}
+	virtual void SetUp() {
+		strcpy(dir, "/tmp/b2ckpXXXXXX");
+		ASSERT_TRUE(mkdtemp(dir) != 0);
+		file = std::string(dir) + "/plot.ckp";
+	}
+	virtual void TearDown() {
+		unlink(file.c_str());
+		rmdir(dir);
+	}
+	Plot3Plot* make(unsigned max_passes = 0) {
+		Plot3Plot *p = new Plot3Plot(pool, &sink, fract, divider, centre, size, W, H, max_passes);
+		p->set_prefs(prefs);
+		return p;
+	}
+	void expect_same(Plot3Plot& a, Plot3Plot& b) {
+		EXPECT_EQ(a.get_passes(), b.get_passes());
+		EXPECT_EQ(a.get_maxiter(), b.get_maxiter());
+		const std::list<Plot3Chunk*>& ac = a.get_chunks__only_after_completion(),
+				&bc = b.get_chunks__only_after_completion();
+		ASSERT_EQ(ac.size(), bc.size());
+		for (auto i = ac.begin(), j = bc.begin(); i != ac.end(); ++i, ++j) {
+			EXPECT_EQ((*i)->histogram().total(), (*j)->histogram().total());
+			for (unsigned k=0; k<(*i)->pixel_count(); k++) {
+				const Fractal::PointData &p = (*i)->get_data()[k], &q = (*j)->get_data()[k];
+				ASSERT_EQ(p.iter, q.iter);
+				ASSERT_EQ(p.iterf, q.iterf);
+				ASSERT_EQ(p.nomore, q.nomore);
+				ASSERT_EQ(p.origin, q.origin);
+			}
+		}
+	}
+};
+
+TEST_F(CheckpointTest, ResumesExactly) {
+	std::unique_ptr<Plot3Plot> whole(make());
+	whole->start();
+	whole->wait();
+	ASSERT_LT(3u, whole->get_passes()); // or there's nothing to resume
+
+	std::unique_ptr<Plot3Plot> part(make(3));
+	part->start();
+	part->wait();
+	Checkpoint::write(*part, file);
+
+	Checkpoint::Info info = Checkpoint::read_info(file);
+	EXPECT_EQ(fract.name, info.fractal);
+	EXPECT_EQ(centre, info.centre);
+	EXPECT_EQ(size, info.size);
+	EXPECT_EQ((unsigned)W, info.width);
+	EXPECT_EQ((unsigned)H, info.height);
+	EXPECT_EQ(3u, info.passes);
+	EXPECT_EQ((unsigned)part->get_maxiter(), info.maxiter);
+
+	std::unique_ptr<Plot3Plot> resumed(make());
+	Checkpoint::restore(*resumed, file);
+	EXPECT_EQ(3u, resumed->get_passes());
+	resumed->start(info.arith);
+	resumed->wait();
+	expect_same(*whole, *resumed);
+}
+
+TEST_F(CheckpointTest, EveryPass) {
+	std::unique_ptr<Plot3Plot> plot(make());
+	unsigned written = 0;
+	plot->set_checkpoint([&] {
+		Checkpoint::write(*plot, file);
+		++written;
+	});
+	plot->start();
+	plot->wait();
+	EXPECT_EQ(plot->get_passes(), written);
+	EXPECT_EQ(plot->get_passes(), Checkpoint::read_info(file).passes);
+}
+
+TEST_F(CheckpointTest, GoesFurther) {
+	std::unique_ptr<Plot3Plot> plot(make());
+	plot->start();
+	plot->wait();
+	Checkpoint::write(*plot, file);
+	const unsigned target = 4 * plot->get_maxiter();
+
+	std::unique_ptr<Plot3Plot> further(make());
+	Checkpoint::restore(*further, file);
+	further->set_target_maxiter(target);
+	further->start(Checkpoint::read_info(file).arith);
+	further->wait();
+	EXPECT_LE(target, (unsigned)further->get_maxiter());
+}
+
+TEST_F(CheckpointTest, ResumesFinished) {
+	std::unique_ptr<Plot3Plot> plot(make());
+	plot->start();
+	plot->wait();
+	Checkpoint::write(*plot, file);
+	EXPECT_TRUE(Checkpoint::read_info(file).finished);
+
+	std::unique_ptr<Plot3Plot> resumed(make());
+	Checkpoint::restore(*resumed, file);
+	resumed->start(Checkpoint::read_info(file).arith);
+	resumed->wait();
+	expect_same(*plot, *resumed);
+}
+
+class StoppingSink : public NullSink {
+	// Stops the plot once it has seen so many chunks
+public:
+	Plot3Plot* plot;
+	std::atomic<unsigned> seen, stop_at;
+	StoppingSink() : plot(0), seen(0), stop_at(0) {}
+	virtual void chunk_done(Plot3Chunk*) {
+		if (++seen == stop_at)
+			plot->stop();
+	}
+};
+
+TEST_F(CheckpointTest, StartAfterStopResumesExactly) {
+	// Not a checkpoint as such, but the same promise: see Plot3Plot::stop().
+	std::unique_ptr<Plot3Plot> whole(make());
+	whole->start();
+	whole->wait();
+	ASSERT_LT(3u, whole->get_passes());
+
+	StoppingSink stopper;
+	std::unique_ptr<Plot3Plot> part(new Plot3Plot(pool, &stopper, fract, divider, centre, size, W, H));
+	part->set_prefs(prefs);
+	stopper.plot = part.get();
+	stopper.stop_at = 2 * (H/10) + 1; // early in the third pass
+	part->start();
+	part->wait();
+	EXPECT_EQ(2u, part->get_passes());
+	part->start();
+	part->wait();
+	expect_same(*whole, *part);
+}
+
+TEST_F(CheckpointTest, StartAfterFinishingPlotsMore) {
+	// As the GUI's "More iterations" does
+	std::unique_ptr<Plot3Plot> plot(make());
+	plot->start();
+	plot->wait();
+	const unsigned passes = plot->get_passes();
+	const int maxiter = plot->get_maxiter();
+	plot->start();
+	plot->wait();
+	EXPECT_LT(passes + 1, plot->get_passes()); // not just the one
+	EXPECT_LT(maxiter, plot->get_maxiter());
+}
+
+TEST_F(CheckpointTest, IgnoresLocale) {
+	Plot3Plot plot(pool, &sink, fract, divider, Fractal::Point(0.25,-1.5), Fractal::Point(2.5,0.75), W, H, 1);
+	plot.set_prefs(prefs);
+	plot.start();
+	plot.wait();
+	{
+		DecimalCommaLocale comma;
+		Checkpoint::write(plot, file);
+	}
+	Checkpoint::Info info = Checkpoint::read_info(file);
+	EXPECT_EQ(plot.centre, info.centre);
+	EXPECT_EQ(plot.size, info.size);
+
+	Checkpoint::write(plot, file);
+	DecimalCommaLocale comma;
+	info = Checkpoint::read_info(file);
+	EXPECT_EQ(plot.centre, info.centre);
+	EXPECT_EQ(plot.size, info.size);
+}
+
+TEST_F(CheckpointTest, RefusesAnotherPlot) {
+	std::unique_ptr<Plot3Plot> plot(make(2));
+	plot->start();
+	plot->wait();
+	Checkpoint::write(*plot, file);
+	Plot3Plot other(pool, &sink, fract, divider, centre, size, W, H+10);
+	EXPECT_THROW(Checkpoint::restore(other, file), BrotException);
+}
+
+class ProgressiveRefinerTest : public SupersamplePlotTest {
+protected:
+	const BasePalette *pal;
+	std::unique_ptr<Plot3Plot> p3;
+	virtual void SetUp() {
+		SupersamplePlotTest::SetUp();
+		SmoothPalette::register_base();
+		pal = SmoothPalette::all.get("Linear rainbow");
+		ASSERT_TRUE(pal != 0);
+		p3.reset(new Plot3Plot(pool, &sink, *fract, divider, Fractal::Point(-0.5,0), Fractal::Point(3,2.5), W, H));
+		p3->set_prefs(prefs);
+		p3->start();
+		p3->wait();
+	}
+};
+
+TEST_F(ProgressiveRefinerTest, Accumulates) {
+	std::vector<unsigned> seen;
+	ProgressiveRefiner ref(*p3, *pal, [&](unsigned n) { seen.push_back(n); }, 5, 0);
+	CaptureRender before(W, H, *pal), after(W, H, *pal);
+	ref.render(after); // nothing yet, so a no-op
+	EXPECT_EQ(0, ref.samples());
+	ref.start();
+	ref.wait();
+	EXPECT_EQ(5, ref.samples());
+	EXPECT_EQ(std::vector<unsigned>({2,3,4,5}), seen);
+
+	before.process(p3->get_chunks__only_after_completion());
+	ref.render(after);
+	// Deep inside the set nothing changes; along the edges, plenty does.
+	unsigned changed = 0;
+	for (unsigned y=1; y<H-1; y++) {
+		for (unsigned x=1; x<W-1; x++) {
+			const unsigned idx = y*W + x;
+			if (before.pix[idx] == after.pix[idx])
+				continue;
+			++changed;
+			bool all_black = before.pix[idx] == black;
+			for (int d : { -1, 1, -(int)W, (int)W })
+				all_black = all_black && before.pix[idx+d] == black;
+			EXPECT_FALSE(all_black) << "at " << x << "," << y;
+		}
+	}
+	EXPECT_LT(0, changed);
+}
+
+TEST_F(ProgressiveRefinerTest, RepaintsAreCapped) {
+	unsigned calls = 0, last = 0;
+	ProgressiveRefiner ref(*p3, *pal, [&](unsigned n) { ++calls; last = n; }, 4, 60000);
+	ref.start();
+	ref.wait();
+	EXPECT_EQ(1, calls); // just the final picture
+	EXPECT_EQ(4, last);
+}
+
+TEST_F(ProgressiveRefinerTest, StopsPromptly) {
+	std::atomic<unsigned> calls(0);
+	ProgressiveRefiner ref(*p3, *pal, [&](unsigned) { ++calls; }, UINT_MAX, 0);
+	ref.start();
+	while (!calls)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	auto t0 = std::chrono::steady_clock::now();
+	ref.stop();
+	ref.wait();
+	std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - t0;
+	EXPECT_GT(500, latency.count());
+	unsigned n = ref.samples();
+	EXPECT_LT(1, n);
+	EXPECT_GT(UINT_MAX, n);
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	EXPECT_EQ(n, ref.samples()); // really stopped
+}
@@ -16,12 +16,20 @@
 */
 
 #include <stdlib.h>
+#include <math.h>
+#include <string.h>
 #include <array>
+#include <sstream>
+#include <tuple>
+#include <png.h>
 #include "gtest/gtest.h"
 #include "Fractal.h"
 #include "MockFractal.h"
 #include "MockPalette.h"
+#include "CaptureRender.h"
 #include "Render2.h"
+#include "IterPlane.h"
+#include "PNGWriter.h"
 #include "libbrot2/Exception.h"
 
 using namespace Plot3;
@@ -520,3 +528,742 @@ TEST_F(OverlayKAT, AnswersCorrect) {
 }
 
 // -----------------------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+
+class CoordPalette: public BasePalette {
+	// Gives every pixel a different colour, so we can tell them apart.
+public:
+	CoordPalette() : BasePalette("Coords") {}
+	virtual rgb get(const Fractal::PointData &pt) const {
+		unsigned x = (unsigned)(pt.origin.real() * 1e6), y = (unsigned)(pt.origin.imag() * 1e5);
+		return rgb(x, y, x^y);
+	}
+};
+
+class Render2RowsP: public ::testing::TestWithParam<std::tuple<int, int>> {
+	/* The row writers must come out the same as pixel_done() would. */
+protected:
+	MockFractal _fract;
+	CoordPalette _palette;
+	static const unsigned W = 38, H = 42; // even, for the upscaler
+};
+
+TEST_P(Render2RowsP, MatchPixelAtATime) {
+	const int fmt = std::get<0>(GetParam()), mode = std::get<1>(GetParam());
+	const bool aa = (mode==1), up = (mode==2);
+	const unsigned step = (fmt == Render2::pixpack_format::PACKED_RGB_24) ? 3 : 4;
+	const unsigned inW = aa ? 2*W : up ? W/2 : W, inH = aa ? 2*H : up ? H/2 : H;
+
+	std::list<Plot3Chunk> chunks;
+	chunks.push_back(Plot3Chunk(NULL, _fract, inW, inH/2, 0, 0, Fractal::Point(0.6,0.7), Fractal::Point(0.001,0.01), Fractal::Maths::MathsType::LongDouble));
+	chunks.push_back(Plot3Chunk(NULL, _fract, inW, inH/2, 0, inH/2, Fractal::Point(0.6,0.71), Fractal::Point(0.001,0.01), Fractal::Maths::MathsType::LongDouble));
+
+	std::vector<unsigned char> buf(W*H*step);
+	Render2::MemoryBuffer mem(&buf[0], W*step, W, H, aa, -1, fmt, _palette, up);
+	CaptureRender ref(W, H, _palette, aa, up);
+	Render2::PNG png(W, H, _palette, -1, aa, up);
+	for (auto& c : chunks) {
+		c.run();
+		mem.process(c);
+		ref.process(c);
+		png.process(c);
+	}
+
+	unsigned fails = 0;
+	for (unsigned j=0; j<H; j++) {
+		for (unsigned i=0; i<W; i++) {
+			rgb expected, got, got_png;
+			ref.pixel_get(i, j, expected);
+			mem.pixel_get(i, j, got);
+			png.pixel_get(i, j, got_png);
+			if (!(expected == got)) ++fails;
+			if (!(expected == got_png)) ++fails;
+		}
+	}
+	EXPECT_EQ(0, fails);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllFormatsAndModes, Render2RowsP,
+	::testing::Combine(
+		::testing::Values(Render2::pixpack_format::PACKED_RGB_24, CAIRO_FORMAT_ARGB32, CAIRO_FORMAT_RGB24),
+		::testing::Values(0, 1, 2))); // plain, antialias, upscale
+
+// -----------------------------------------------------------------------------
+
+class Render2Parallel: public ::testing::Test {
+protected:
+	MockFractal _fract;
+	CoordPalette _palette;
+	static const unsigned W = 64, H = 90, STRIP = 5;
+	std::list<Plot3Chunk*> _chunks;
+	std::vector<unsigned char> _serial, _parallel;
+
+	Render2Parallel() : _serial(W*H*3), _parallel(W*H*3) {}
+	virtual void SetUp() {
+		for (unsigned y=0; y<H; y+=STRIP) {
+			Plot3Chunk *c = new Plot3Chunk(NULL, _fract, W, STRIP, 0, y, Fractal::Point(0.6,0.7+y*0.001), Fractal::Point(0.001,0.001*STRIP), Fractal::Maths::MathsType::LongDouble);
+			c->run();
+			_chunks.push_back(c);
+		}
+		Render2::MemoryBuffer serial(&_serial[0], W*3, W, H, false, -1, Render2::pixpack_format::PACKED_RGB_24, _palette);
+		serial.process(_chunks);
+	}
+	virtual void TearDown() {
+		for (auto c : _chunks)
+			delete c;
+	}
+};
+
+TEST_F(Render2Parallel, MatchesSerial) {
+	ThreadPool pool(4);
+	Render2::MemoryBuffer render(&_parallel[0], W*3, W, H, false, -1, Render2::pixpack_format::PACKED_RGB_24, _palette);
+	render.process(_chunks, pool);
+	EXPECT_TRUE(_serial == _parallel);
+}
+
+TEST_F(Render2Parallel, FromInsideThePool) {
+	// The caller does its share, so this mustn't deadlock even though it occupies the only worker.
+	ThreadPool pool(1);
+	Render2::MemoryBuffer render(&_parallel[0], W*3, W, H, false, -1, Render2::pixpack_format::PACKED_RGB_24, _palette);
+	std::future<void> f = pool.enqueue<void>([&] { render.process(_chunks, pool); });
+	f.get();
+	EXPECT_TRUE(_serial == _parallel);
+}
+
+TEST_F(Render2Parallel, ExceptionsPropagate) {
+	ThreadPool pool(2);
+	Render2::MemoryBuffer render(&_parallel[0], W*3, W/2, H, false, -1, Render2::pixpack_format::PACKED_RGB_24, _palette);
+	EXPECT_THROW(render.process(_chunks, pool), BrotAssert); // chunks are too wide
+}
+
+// -----------------------------------------------------------------------------
+
+/* Decodes an RGB PNG with libpng, independently of our writers. */
+static bool decode_png(const std::string& data, unsigned& w, unsigned& h, std::vector<unsigned char>& out) {
+	png_image img;
+	memset(&img, 0, sizeof img);
+	img.version = PNG_IMAGE_VERSION;
+	if (!png_image_begin_read_from_memory(&img, data.data(), data.size()))
+		return false;
+	img.format = PNG_FORMAT_RGB;
+	w = img.width;
+	h = img.height;
+	out.resize(PNG_IMAGE_SIZE(img));
+	return png_image_finish_read(&img, 0, &out[0], 0, 0);
+}
+
+class PNGWriterP: public ::testing::TestWithParam<std::tuple<int, unsigned>> {
+	/* However it's compressed, in however many blocks, an inflater must
+	 * get back what went in. */
+protected:
+	static const unsigned W = 97, H = 61;
+	std::vector<unsigned char> _image;
+
+	virtual void SetUp() {
+		// Smooth, to give the filters something to do, with a bit of noise.
+		srand(11);
+		_image.resize(3*W*H);
+		for (unsigned y=0; y<H; y++)
+			for (unsigned x=0; x<W; x++)
+				for (unsigned c=0; c<3; c++)
+					_image[3*(y*W+x)+c] = x*(c+1) + y*(3-c) + rand() % 4;
+	}
+	std::string encode(const Render2::PNGCompression& comp, unsigned rows_at_once) {
+		std::ostringstream os;
+		Render2::PNGWriter writer(os, W, H, comp);
+		for (unsigned y=0; y<H; y+=rows_at_once)
+			writer.write_rows(&_image[3*y*W], std::min(rows_at_once, H-y), 3*W);
+		writer.finish();
+		return os.str();
+	}
+};
+
+TEST_P(PNGWriterP, RoundTrips) {
+	ThreadPool pool(3);
+	Render2::PNGCompression comp(std::get<0>(GetParam()), &pool);
+	comp.block_bytes = std::get<1>(GetParam());
+	const std::string png = encode(comp, 7);
+
+	unsigned w, h;
+	std::vector<unsigned char> decoded;
+	ASSERT_TRUE(decode_png(png, w, h, decoded));
+	ASSERT_EQ((unsigned)W, w);
+	ASSERT_EQ((unsigned)H, h);
+	EXPECT_TRUE(_image == decoded);
+
+	// The blocks are cut the same whatever the window, so it's the same file.
+	comp.pool = 0;
+	comp.threads = 1;
+	EXPECT_TRUE(png == encode(comp, 1));
+	comp.threads = 5;
+	EXPECT_TRUE(png == encode(comp, H));
+}
+
+INSTANTIATE_TEST_SUITE_P(LevelsAndBlocks, PNGWriterP,
+		::testing::Combine(
+			::testing::Values(-1, 0, 1, 9),
+			// Blocks smaller than the dictionary, of one row, and all in one
+			::testing::Values(1000u, 1u, Render2::PNGCompression::DEFAULT_BLOCK)));
+
+TEST_F(PNGWriterP, Compresses) {
+	const unsigned stored = encode(Render2::PNGCompression(0), H).size();
+	Render2::PNGCompression fast(1), best(9);
+	fast.block_bytes = best.block_bytes = 1000;
+	EXPECT_GT(stored, encode(fast, H).size());
+	EXPECT_GE(encode(fast, H).size(), encode(best, H).size());
+}
+
+TEST_F(PNGWriterP, WantsAllTheRows) {
+	std::ostringstream os;
+	Render2::PNGWriter writer(os, W, H);
+	writer.write_rows(&_image[0], H-1, 3*W);
+	EXPECT_THROW(writer.finish(), BrotException);
+	writer.write_rows(&_image[0], 1, 3*W);
+	EXPECT_THROW(writer.write_rows(&_image[0], 1, 3*W), BrotAssert);
+	writer.finish();
+}
+
+class Render2PNGStreamP: public ::testing::TestWithParam<int> {
+	/* The rows must go out as soon as everything above them is in, and
+	 * come out the same as rendering the lot at the end would. */
+protected:
+	MockFractal _fract;
+	CoordPalette _palette;
+	static const unsigned W = 38, H = 42;
+};
+
+TEST_P(Render2PNGStreamP, MatchesWholeRender) {
+	const int mode = GetParam();
+	const bool aa = (mode==1), up = (mode==2);
+	const unsigned inW = aa ? 2*W : up ? W/2 : W, inH = aa ? 2*H : up ? H/2 : H;
+	const unsigned BAND = up ? 7 : 6, outBand = aa ? BAND/2 : up ? 2*BAND : BAND;
+
+	std::vector<Plot3Chunk*> chunks; // bottom first
+	for (unsigned y=0; y<inH; y+=BAND) {
+		chunks.push_back(new Plot3Chunk(NULL, _fract, inW, BAND, 0, y, Fractal::Point(0.6,0.7+y*0.001),
+					Fractal::Point(0.001,0.001*BAND), Fractal::Maths::MathsType::LongDouble));
+		chunks.back()->run();
+	}
+	ASSERT_LT(2u, chunks.size());
+
+	// A HUD-like band, across a chunk boundary
+	const unsigned TOP = 5, ROWS = 8;
+	std::vector<uint32_t> overlay(W*ROWS);
+	srand(9);
+	for (auto& w : overlay)
+		w = ((uint32_t)(rand() % 3 ? rand() & 0xff : 0) << 24) | (rand() & 0xffffff);
+
+	std::ostringstream os;
+	Render2::PNGStream png(os, W, H, _palette, -1, aa, up);
+	png.overlay_argb32((const unsigned char*)&overlay[0], W*4, TOP, ROWS);
+
+	// The top band goes out at once...
+	png.process(*chunks.back());
+	png.flush();
+	EXPECT_EQ(outBand, png.rows_written());
+	EXPECT_EQ(0u, png.rows_pending());
+	// ...but the rest wait until the one below the top comes in.
+	for (unsigned i=0; i+2 < chunks.size(); i++) {
+		png.process(*chunks[i]);
+		png.flush();
+		EXPECT_EQ(outBand, png.rows_written());
+	}
+	EXPECT_LT(0u, png.rows_pending());
+	png.process(*chunks[chunks.size()-2]);
+	png.flush();
+	EXPECT_EQ((unsigned)H, png.rows_written());
+	EXPECT_EQ(0u, png.rows_pending());
+	png.finish();
+
+	CaptureRender ref(W, H, _palette, aa, up);
+	for (auto c : chunks)
+		ref.process(*c);
+	ref.overlay_argb32((const unsigned char*)&overlay[0], W*4, TOP, ROWS);
+
+	unsigned w, h;
+	std::vector<unsigned char> decoded;
+	ASSERT_TRUE(decode_png(os.str(), w, h, decoded));
+	ASSERT_EQ((unsigned)W, w);
+	ASSERT_EQ((unsigned)H, h);
+	for (unsigned i=0; i<W*H; i++) {
+		const rgb got(decoded[3*i], decoded[3*i+1], decoded[3*i+2]);
+		ASSERT_EQ(ref.pix[i], got) << "pixel " << i;
+	}
+	for (auto c : chunks)
+		delete c;
+}
+
+INSTANTIATE_TEST_SUITE_P(AllModes, Render2PNGStreamP,
+		::testing::Values(0, 1, 2)); // plain, antialias, upscale
+
+TEST_F(Render2PNGStreamP, RefusesLateOrMissingRows) {
+	Plot3Chunk upper(NULL, _fract, W, H/2, 0, H/2, Fractal::Point(0.6,0.7), Fractal::Point(0.001,0.01), Fractal::Maths::MathsType::LongDouble);
+	upper.run();
+	std::ostringstream os;
+	Render2::PNGStream png(os, W, H, _palette, -1);
+	png.process(upper);
+	png.flush();
+	EXPECT_EQ((unsigned)H/2, png.rows_written());
+	rgb pix;
+	EXPECT_THROW(png.pixel_get(0, 0, pix), BrotFatalException); // gone
+	EXPECT_THROW(png.process(upper), BrotAssert); // those rows have gone
+	EXPECT_THROW(png.finish(), BrotException); // the rest never came
+}
+
+// -----------------------------------------------------------------------------
+
+class SmallBandCSV : public Render2::CSV {
+public:
+	SmallBandCSV(unsigned w, unsigned h, const BasePalette& pal, bool aa) :
+		Render2::CSV(w, h, pal, -1, aa) {}
+	virtual unsigned band_rows() const { return 3; }
+};
+
+class Render2CSVP: public ::testing::TestWithParam<std::tuple<bool, bool>> {
+	/* CSV output must be what we used to get by copying out every point
+	 * and streaming it, whichever way the chunks are cut and ordered. */
+protected:
+	static const unsigned W = 20, H = 16, TILE = 8; // chunks don't divide the width evenly
+	Fractal::FractalImpl *_fract;
+	MockPalette _palette;
+	std::list<Plot3Chunk*> _chunks;
+	virtual void SetUp() {
+		Fractal::FractalCommon::load_base();
+		_fract = Fractal::FractalCommon::registry.get("Mandelbrot");
+		ASSERT_TRUE(_fract != 0);
+	}
+	virtual void TearDown() {
+		for (auto c : _chunks)
+			delete c;
+	}
+	void make_chunks(unsigned inW, unsigned inH) {
+		for (unsigned y=0; y<inH; y+=TILE) {
+			for (unsigned x=0; x<inW; x+=TILE) {
+				const unsigned w = std::min(TILE, inW-x), h = std::min(TILE, inH-y);
+				Plot3Chunk *c = new Plot3Chunk(NULL, *_fract, w, h, x, y,
+						Fractal::Point(-2 + 3.0*x/inW, -1.2 + 2.4*y/inH), Fractal::Point(3.0*w/inW, 2.4*h/inH),
+						Fractal::Maths::MathsType::LongDouble);
+				c->reset_max_iters(50);
+				c->run();
+				_chunks.push_front(c); // backwards, for good measure
+			}
+		}
+	}
+	std::string expected(unsigned inW, unsigned inH, unsigned step) {
+		std::vector<float> grid(inW*inH);
+		for (auto c : _chunks)
+			for (unsigned j=0; j<c->_height; j++)
+				for (unsigned i=0; i<c->_width; i++)
+					grid[(c->_offY+j)*inW + c->_offX+i] = c->get_pixel_point(i,j).iterf;
+		std::ostringstream os;
+		for (unsigned y=0; y<H; y++) {
+			const unsigned plot_y = step * (H-1-y);
+			for (unsigned x=0; x<W; x++)
+				os << (x ? "," : "") << grid[plot_y*inW + x*step];
+			os << std::endl;
+		}
+		return os.str();
+	}
+};
+
+TEST_P(Render2CSVP, MatchesStreamedPoints) {
+	const bool aa = std::get<0>(GetParam()), parallel = std::get<1>(GetParam());
+	const unsigned step = aa ? 2 : 1;
+	make_chunks(W*step, H*step);
+	ThreadPool pool(3);
+	SmallBandCSV csv(W, H, _palette, aa);
+	if (parallel)
+		csv.process(_chunks, pool);
+	else
+		csv.process(_chunks);
+	std::ostringstream os;
+	csv.write(os);
+	EXPECT_EQ(expected(W*step, H*step, step), os.str());
+}
+
+INSTANTIATE_TEST_SUITE_P(AllModes, Render2CSVP,
+		::testing::Combine(::testing::Bool(), ::testing::Bool())); // antialias, parallel
+
+TEST_F(Render2CSVP, StreamsAsChunksArrive) {
+	make_chunks(W, H);
+	const std::string all = expected(W, H, 1);
+	SmallBandCSV csv(W, H, _palette, false);
+	std::ostringstream os;
+
+	// All but one of the top row of chunks: nothing can go out yet.
+	std::list<Plot3Chunk*> bottom, top;
+	for (auto c : _chunks)
+		(c->_offY ? top : bottom).push_back(c);
+	Plot3Chunk *last = top.front();
+	top.pop_front();
+	csv.process(top);
+	csv.flush(os);
+	EXPECT_EQ(0u, csv.rows_written());
+	EXPECT_EQ((unsigned)TILE, csv.rows_pending());
+	EXPECT_EQ("", os.str());
+
+	// A chunk that comes in again replaces itself; then the top rows are
+	// complete, and go out.
+	csv.process(*last);
+	csv.process(*last);
+	csv.flush(os);
+	EXPECT_EQ(H - TILE, csv.rows_written());
+	EXPECT_EQ(0u, csv.rows_pending());
+	EXPECT_EQ(all.substr(0, os.str().length()), os.str());
+	EXPECT_THROW(csv.process(*last), BrotAssert); // those rows have gone
+
+	csv.process(bottom);
+	csv.write(os);
+	EXPECT_EQ((unsigned)H, csv.rows_written());
+	EXPECT_EQ(0u, csv.rows_pending());
+	EXPECT_EQ(all, os.str());
+}
+
+TEST_F(Render2CSVP, MissingChunkAsserts) {
+	make_chunks(W, H);
+	Render2::CSV csv(W, H, _palette, -1);
+	csv.process(*_chunks.front());
+	std::ostringstream os;
+	EXPECT_THROW(csv.write(os), BrotAssert);
+}
+
+// -----------------------------------------------------------------------------
+
+class IterfPalette: public BasePalette {
+public:
+	IterfPalette() : BasePalette("Iterf") {}
+	virtual rgb get(const Fractal::PointData &pt) const {
+		unsigned f = pt.iterf * 10;
+		return rgb(f > 255 ? 255 : f, pt.iter & 0xff, 99);
+	}
+};
+
+TEST(Render2Supersample, PlainAveragesSamples) {
+	Fractal::FractalCommon::load_base();
+	Fractal::FractalImpl *fract = Fractal::FractalCommon::registry.get("Mandelbrot");
+	ASSERT_TRUE(fract != 0);
+	IterfPalette pal;
+	const unsigned W = 8, H = 6;
+	Plot3Chunk chunk(NULL, *fract, W, H, 0, 0, Fractal::Point(-2,-1.2), Fractal::Point(3,2.4), Fractal::Maths::MathsType::LongDouble);
+	chunk.reset_max_iters(50);
+	chunk.run();
+	std::vector<unsigned> pixels = { 0, 3, 9, 10, 47 };
+	chunk.supersample(pixels, 3, 50);
+
+	std::vector<unsigned char> buf(W*H*3);
+	Render2::MemoryBuffer render(&buf[0], W*3, W, H, false, -1, Render2::pixpack_format::PACKED_RGB_24, pal);
+	render.process(chunk);
+
+	unsigned n = 0, changed = 0;
+	for (unsigned px=0; px<W*H; px++) {
+		rgb expected, got;
+		if (n < pixels.size() && pixels[n] == px) {
+			const Plot3Chunk::Sample* s = chunk.ss_samples(n++);
+			unsigned R=0, G=0, B=0;
+			for (unsigned k=0; k<9; k++) {
+				Fractal::PointData pt;
+				pt.iter = s[k].iter;
+				pt.iterf = s[k].iterf;
+				rgb c = Render2::render_pixel(pt, -1, &pal);
+				R += c.r; G += c.g; B += c.b;
+			}
+			expected = rgb(R/9, G/9, B/9);
+			if (!(expected == Render2::render_pixel(chunk.get_data()[px], -1, &pal)))
+				++changed;
+		} else {
+			expected = Render2::render_pixel(chunk.get_data()[px], -1, &pal);
+		}
+		render.pixel_get(px % W, H-1 - px / W, got);
+		EXPECT_EQ(expected, got) << "pixel " << px;
+	}
+	EXPECT_LT(0, changed); // or we haven't tested much
+}
+
+// -----------------------------------------------------------------------------
+
+class Render2PlaneP: public ::testing::TestWithParam<int> {
+	/* Recolouring from an IterPlane must match rendering the chunks. */
+protected:
+	static const unsigned W = 40, H = 30; // even, for the upscaler
+	Fractal::FractalImpl *_fract;
+	IterfPalette _palette;
+	MockPalette _other;
+	std::list<Plot3Chunk*> _chunks;
+	virtual void SetUp() {
+		Fractal::FractalCommon::load_base();
+		_fract = Fractal::FractalCommon::registry.get("Mandelbrot");
+		ASSERT_TRUE(_fract != 0);
+	}
+	virtual void TearDown() {
+		for (auto c : _chunks)
+			delete c;
+	}
+	void make_chunks(unsigned inW, unsigned inH, bool supersample) {
+		const unsigned strip = inH / 3;
+		for (unsigned y=0; y<inH; y+=strip) {
+			Plot3Chunk *c = new Plot3Chunk(NULL, *_fract, inW, strip, 0, y,
+					Fractal::Point(-2, -1.2 + 2.4*y/inH), Fractal::Point(3, 2.4*strip/inH),
+					Fractal::Maths::MathsType::LongDouble);
+			c->reset_max_iters(50);
+			c->run();
+			if (supersample) {
+				std::vector<unsigned> pixels = { 0, 3, inW+1, strip*inW-1 };
+				c->supersample(pixels, 2, 50);
+			}
+			_chunks.push_back(c);
+		}
+	}
+};
+
+TEST_P(Render2PlaneP, MatchesChunks) {
+	const int mode = GetParam();
+	const bool aa = (mode==1), up = (mode==2);
+	const unsigned inW = aa ? 2*W : up ? W/2 : W, inH = aa ? 2*H : up ? H/2 : H;
+	make_chunks(inW, inH, !aa && !up);
+
+	Render2::IterPlane plane(inW, inH);
+	plane.update(_chunks);
+	EXPECT_EQ(inW, plane.width());
+	EXPECT_EQ(inH, plane.height());
+
+	CaptureRender expected(W, H, _palette, aa, up), got(W, H, _other, aa, up);
+	expected.process(_chunks);
+	ThreadPool pool(3);
+	plane.recolour(got, &_palette, pool);
+	for (unsigned i=0; i<W*H; i++)
+		ASSERT_EQ(expected.pix[i], got.pix[i]) << "pixel " << i;
+}
+
+INSTANTIATE_TEST_SUITE_P(AllModes, Render2PlaneP, ::testing::Values(0, 1, 2)); // plain, antialias, upscale
+
+TEST_F(Render2PlaneP, UpdatesAsChunksArrive) {
+	make_chunks(W, H, false);
+	Render2::IterPlane plane(W, H);
+	ThreadPool pool(2);
+	CaptureRender expected(W, H, _palette, false, false), got(W, H, _palette, false, false);
+	expected.process(_chunks);
+
+	// Nothing yet: all infinite
+	plane.recolour(got, 0, pool);
+	for (auto p : got.pix)
+		ASSERT_EQ(black, p);
+
+	// update() can render for us too
+	CaptureRender direct(W, H, _palette, false, false);
+	for (auto c : _chunks)
+		plane.update(*c, &direct);
+	EXPECT_TRUE(expected.pix == direct.pix);
+	plane.recolour(got, 0, pool);
+	EXPECT_TRUE(expected.pix == got.pix);
+
+	// A later pass replaces what we had, supersamples and all
+	Plot3Chunk *c = _chunks.front();
+	std::vector<unsigned> pixels = { 1, 2 };
+	c->supersample(pixels, 3, 50);
+	plane.update(*c);
+	expected.process(*c);
+	plane.recolour(got, 0, pool);
+	EXPECT_TRUE(expected.pix == got.pix);
+	c->clear_supersamples();
+	plane.update(*c);
+	expected.process(*c);
+	plane.recolour(got, 0, pool);
+	EXPECT_TRUE(expected.pix == got.pix);
+
+	plane.reset(W, H);
+	plane.recolour(got, 0, pool);
+	for (auto p : got.pix)
+		ASSERT_EQ(black, p);
+}
+
+// -----------------------------------------------------------------------------
+
+class Render2YUVP: public Render2PlaneP {
+	/* YUV420P must come out as an RGB render converted afterwards would. */
+protected:
+	std::vector<unsigned char> _y, _u, _v;
+	unsigned char *_planes[3];
+	int _linesize[3];
+	Render2YUVP() : _y((W+3)*H), _u((W/2+5)*H/2), _v((W/2+5)*H/2) {
+		// (Padded rows, as libav likes to give us.)
+		_planes[0] = &_y[0]; _planes[1] = &_u[0]; _planes[2] = &_v[0];
+		_linesize[0] = W+3; _linesize[1] = _linesize[2] = W/2+5;
+	}
+	static int to_y(const rgb& p) { return lrint(16 + 0.257*p.r + 0.504*p.g + 0.098*p.b); }
+	static int to_u(double r, double g, double b) { return lrint(128 - 0.148*r - 0.291*g + 0.439*b); }
+	static int to_v(double r, double g, double b) { return lrint(128 + 0.439*r - 0.368*g - 0.071*b); }
+	// Compares the planes with a conversion of an RGB render, to within tol.
+	void check(const std::vector<rgb>& pix, int tol) {
+		for (unsigned y=0; y<H; y++)
+			for (unsigned x=0; x<W; x++)
+				ASSERT_NEAR(to_y(pix[y*W+x]), _y[y*_linesize[0]+x], tol) << "at " << x << "," << y;
+		for (unsigned y=0; y<H/2; y++) {
+			for (unsigned x=0; x<W/2; x++) {
+				double r=0, g=0, b=0;
+				for (unsigned k=0; k<4; k++) {
+					const rgb& p = pix[(2*y + (k>>1))*W + 2*x + (k&1)];
+					r += p.r/4.0; g += p.g/4.0; b += p.b/4.0;
+				}
+				ASSERT_NEAR(to_u(r,g,b), _u[y*_linesize[1]+x], tol) << "at " << x << "," << y;
+				ASSERT_NEAR(to_v(r,g,b), _v[y*_linesize[2]+x], tol) << "at " << x << "," << y;
+			}
+		}
+	}
+};
+
+TEST_P(Render2YUVP, MatchesRGB) {
+	const int mode = GetParam();
+	const bool aa = (mode==1), up = (mode==2);
+	const unsigned inW = aa ? 2*W : up ? W/2 : W, inH = aa ? 2*H : up ? H/2 : H;
+	make_chunks(inW, inH, !aa && !up);
+
+	CaptureRender rgb_render(W, H, _palette, aa, up);
+	Render2::YUV420P yuv(_planes, _linesize, W, H, aa, -1, _palette, up);
+	rgb_render.process(_chunks);
+	yuv.process(_chunks);
+	check(rgb_render.pix, 2);
+
+	// Rows may arrive in any order; the second frame must be just like the first.
+	std::vector<unsigned char> y1(_y), u1(_u), v1(_v);
+	for (auto it = _chunks.rbegin(); it != _chunks.rend(); ++it)
+		yuv.process(**it);
+	EXPECT_TRUE(y1 == _y);
+	EXPECT_TRUE(u1 == _u);
+	EXPECT_TRUE(v1 == _v);
+
+	// And from the pool, in parallel
+	std::fill(_y.begin(), _y.end(), 0);
+	std::fill(_u.begin(), _u.end(), 0);
+	std::fill(_v.begin(), _v.end(), 0);
+	ThreadPool pool(3);
+	yuv.process(_chunks, pool);
+	EXPECT_TRUE(y1 == _y);
+	EXPECT_TRUE(u1 == _u);
+	EXPECT_TRUE(v1 == _v);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllModes, Render2YUVP, ::testing::Values(0, 1, 2)); // plain, antialias, upscale
+
+TEST_F(Render2YUVP, OverlayARGB32) {
+	make_chunks(W, H, false);
+	Render2::YUV420P yuv(_planes, _linesize, W, H, false, -1, _palette);
+	CaptureRender rgb_render(W, H, _palette, false, false);
+	yuv.process(_chunks);
+	rgb_render.process(_chunks);
+
+	// Transparent changes nothing
+	std::vector<uint32_t> overlay(W*H, 0);
+	std::vector<unsigned char> y0(_y), u0(_u), v0(_v);
+	yuv.overlay_argb32((const unsigned char*)&overlay[0], W*4, 0, H);
+	EXPECT_TRUE(y0 == _y);
+	EXPECT_TRUE(u0 == _u);
+	EXPECT_TRUE(v0 == _v);
+
+	// The default implementation, on the RGB side, must agree with ours:
+	// opaque at the top, half-transparent in the left of the rest. (Blocks
+	// that are only partly covered are approximate, so keep to whole ones.)
+	for (unsigned y=0; y<H; y++)
+		for (unsigned x=0; x<W; x++)
+			if (y < 14)
+				overlay[y*W+x] = 0xff204080;
+			else if (x < W/2)
+				overlay[y*W+x] = 0x7ff0e0d0;
+	yuv.overlay_argb32((const unsigned char*)&overlay[0], W*4, 0, H);
+	rgb_render.overlay_argb32((const unsigned char*)&overlay[0], W*4, 0, H);
+	EXPECT_EQ(rgb(0x20,0x40,0x80), rgb_render.pix[0]);
+	check(rgb_render.pix, 2);
+
+	// pixel_get reads back (near enough) what's there
+	rgb p;
+	yuv.pixel_get(3, 2, p);
+	EXPECT_NEAR(0x20, p.r, 3);
+	EXPECT_NEAR(0x40, p.g, 3);
+	EXPECT_NEAR(0x80, p.b, 3);
+}
+
+TEST_F(Render2YUVP, OverlayBand) {
+	// A band that starts and ends half way through chroma blocks must do
+	// just what the whole image would, with the rest of it transparent.
+	make_chunks(W, H, false);
+	Render2::YUV420P yuv(_planes, _linesize, W, H, false, -1, _palette);
+	yuv.process(_chunks);
+	std::vector<unsigned char> y0(_y), u0(_u), v0(_v);
+
+	const unsigned TOP = 5, ROWS = 8;
+	std::vector<uint32_t> overlay(W*H, 0);
+	srand(11);
+	for (unsigned i=TOP*W; i<(TOP+ROWS)*W; i++)
+		overlay[i] = (rand() & 1) ? 0 : rand();
+	yuv.overlay_argb32((const unsigned char*)&overlay[0], W*4, 0, H);
+	std::vector<unsigned char> y1(_y), u1(_u), v1(_v);
+
+	_y = y0; _u = u0; _v = v0;
+	yuv.overlay_argb32((const unsigned char*)&overlay[TOP*W], W*4, TOP, ROWS);
+	EXPECT_TRUE(y1 == _y);
+	EXPECT_TRUE(u1 == _u);
+	EXPECT_TRUE(v1 == _v);
+}
+
+class Render2OverlayP: public ::testing::TestWithParam<int> {
+	/* overlay_argb32 must do what rgb::overlay() does, pixel by pixel. */
+protected:
+	static const unsigned W = 37, H = 20;
+	static const unsigned TOP = 6, ROWS = 9;
+	std::vector<rgb> expected;
+	std::vector<uint32_t> overlay;
+
+	// Random pixels, and an overlay for rows 6 to 14: transparent at the
+	// ends of the rows, with some opaque and some transparent in the
+	// middle. check() draws both on the target, and blends expected to match.
+	virtual void SetUp() {
+		expected.resize(W*H);
+		srand(5);
+		for (unsigned i=0; i<W*H; i++)
+			expected[i] = rgb(rand(), rand(), rand());
+		overlay.assign(W*ROWS, 0);
+		for (unsigned j=0; j<ROWS; j++) {
+			for (unsigned i=3; i<W-2; i++) {
+				const unsigned choice = rand() % 4;
+				const uint32_t alpha = choice == 0 ? 0 : choice == 1 ? 255 : rand() & 0xff;
+				overlay[j*W + i] = (alpha << 24) | (rand() & 0xffffff);
+			}
+		}
+	}
+
+	void check(Render2::Base& target) {
+		for (unsigned i=0; i<W*H; i++)
+			target.pixel_done(i % W, i / W, expected[i]);
+		for (unsigned j=0; j<ROWS; j++) {
+			for (unsigned i=0; i<W; i++) {
+				const uint32_t w = overlay[j*W + i];
+				expected[(TOP+j)*W + i].overlay(rgba(w >> 16, w >> 8, w, w >> 24));
+			}
+		}
+		target.overlay_argb32((const unsigned char*)&overlay[0], W*4, TOP, ROWS);
+
+		for (unsigned i=0; i<W*H; i++) {
+			rgb got;
+			target.pixel_get(i % W, i / W, got);
+			ASSERT_EQ(expected[i], got) << "pixel " << i;
+		}
+	}
+};
+
+TEST_P(Render2OverlayP, MatchesPixelOverlay) {
+	const int fmt = GetParam();
+	const unsigned step = (fmt == Render2::pixpack_format::PACKED_RGB_24) ? 3 : 4;
+	MockPalette pal;
+	std::vector<unsigned char> buf(W*H*step);
+	Render2::MemoryBuffer mem(&buf[0], W*step, W, H, false, -1, fmt, pal);
+	check(mem);
+}
+
+TEST_F(Render2OverlayP, PNGMatchesPixelOverlay) {
+	MockPalette pal;
+	Render2::PNG png(W, H, pal, -1);
+	check(png);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllFormats, Render2OverlayP,
+		::testing::Values(Render2::pixpack_format::PACKED_RGB_24, CAIRO_FORMAT_ARGB32, CAIRO_FORMAT_RGB24));
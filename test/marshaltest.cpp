@@ -17,6 +17,9 @@
 
 #include "gtest/gtest.h"
 #include "marshal.h"
+#include <float.h>
+#include <cmath>
+#include <limits>
 
 TEST(Marshal, RuntimeChecksPass) {
 	EXPECT_TRUE(b2marsh::runtime_type_check());
@@ -39,6 +42,70 @@ TEST(Marshal, LongDoublePairwise) {
 	}
 }
 
+// Values that need every bit of a long double, and the awkward ones
+Fractal::Value marshvectors_hard[] = {
+	1.2L, -1.0L/3.0L, M_PI + 1e-18L, nextafterl(1.0L, 2.0L), -0.0L,
+	LDBL_MAX, -LDBL_MAX, LDBL_MIN, LDBL_MIN / 1024, std::numeric_limits<long double>::denorm_min(),
+	INFINITY, -INFINITY, NAN
+};
+
+static void expect_round_trip(Fractal::Value tv, b2marsh::Encoding enc) {
+	b2msg::Float wire;
+	b2marsh::Value2Wire(tv, &wire, enc);
+	std::string marshalled;
+	wire.SerializeToString(&marshalled);
+	b2msg::Float wire2;
+	ASSERT_TRUE(wire2.ParseFromString(marshalled));
+	Fractal::Value result;
+	b2marsh::Wire2Value(wire2, result);
+	if (std::isnan(tv))
+		EXPECT_TRUE(std::isnan(result)) << "encoding " << (int)enc;
+	else
+		EXPECT_EQ(tv, result) << "encoding " << (int)enc;
+	EXPECT_EQ(std::signbit(tv), std::signbit(result)) << "encoding " << (int)enc;
+}
+
+TEST(Marshal, BinaryEncodingsAreExact) {
+	for (auto tv : marshvectors_ld) {
+		expect_round_trip(tv, b2marsh::Encoding::AUTO);
+		expect_round_trip(tv, b2marsh::Encoding::EXTENDED);
+		expect_round_trip(tv, b2marsh::Encoding::BIGFLOAT);
+	}
+	for (auto tv : marshvectors_hard) {
+		expect_round_trip(tv, b2marsh::Encoding::AUTO);
+		expect_round_trip(tv, b2marsh::Encoding::EXTENDED);
+		expect_round_trip(tv, b2marsh::Encoding::BIGFLOAT);
+	}
+	// Those that are the sum of two doubles
+	for (auto tv : { 0.0L, 1.0L, 1.2L, -1.0L/3.0L, (long double)M_PI + 1e-18L, nextafterl(1.0L, 2.0L) })
+		expect_round_trip(tv, b2marsh::Encoding::DOUBLEDOUBLE);
+}
+
+TEST(Marshal, AutoIsCompact) {
+	for (auto tv : marshvectors_hard) {
+		if (!std::isfinite(tv) || tv == 0)
+			continue; // their decimals are short enough
+		b2msg::Float bin, dec;
+		b2marsh::Value2Wire(tv, &bin);
+		b2marsh::Value2Wire(tv, &dec, b2marsh::Encoding::DECIMAL);
+		EXPECT_GT(dec.SerializeAsString().length(), bin.SerializeAsString().length()) << tv;
+		EXPECT_FALSE(bin.has_longdouble());
+	}
+	// A double needs no more than that
+	b2msg::Float wire;
+	b2marsh::Value2Wire(0.5, &wire);
+	EXPECT_TRUE(wire.has_dd());
+	EXPECT_FALSE(wire.dd().has_lo());
+}
+
+TEST(Marshal, ReadsDecimal) {
+	b2msg::Float wire;
+	wire.set_longdouble("0.25");
+	Fractal::Value result;
+	b2marsh::Wire2Value(wire, result);
+	EXPECT_EQ(0.25, result);
+}
+
 // Confirms that message marshalling is working
 TEST(Marshal, MessagePairwise) {
 	const Fractal::Point p1(1.2, 3.4);